@@ -0,0 +1,562 @@
+#include "aot.h"
+
+#include "chip8.h"
+#include "decoder.h"
+
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace chip8
+{
+    static std::vector<const aot_program*>& registry()
+    {
+        static std::vector<const aot_program*> programs;
+        return programs;
+    }
+
+    bool register_aot_program(const aot_program& program)
+    {
+        registry().push_back(&program);
+        return true;
+    }
+
+    const aot_program* find_aot_program(const unsigned char* rom, const std::size_t size, const quirk_profile quirks)
+    {
+        for(const auto* program : registry())
+        {
+            if(program->quirks == quirks && program->rom_size == size && std::memcmp(program->rom, rom, size) == 0)
+            {
+                return program;
+            }
+        }
+        return nullptr;
+    }
+
+    static bool recompilable(const op handler, const quirk_flags& quirks)
+    {
+        switch(handler)
+        {
+            case op::jump_if_equal:
+            case op::jump_if_not_equal:
+            case op::jump_if_registers_equal:
+            case op::jump_if_registers_not_equal:
+                // How far an XO-CHIP skip goes depends on the opcode after it, which is not part of the block
+                return quirks.mode != machine_mode::xochip;
+            case op::set_memory_address_to_big_sprite_address:
+                return quirks.mode != machine_mode::chip8;
+            case op::return_from_subroutine:
+            case op::jump_to:
+            case op::call_func:
+            case op::set_register_to_value:
+            case op::add_assign_register_to_value:
+            case op::assign_register:
+            case op::or_assign_register:
+            case op::and_assign_register:
+            case op::xor_assign_register:
+            case op::add_assign_register:
+            case op::subtract_assign_register:
+            case op::shift_right_assign_register:
+            case op::reverse_subtract_assign_register:
+            case op::shift_left_assign_register:
+            case op::assign_address_register:
+            case op::add_assign_address_register:
+            case op::set_memory_address_to_character_sprite_address:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    static bool ends_block(const op handler)
+    {
+        return handler == op::jump_to || handler == op::call_func || handler == op::return_from_subroutine ||
+               handler == op::jump_if_equal || handler == op::jump_if_not_equal ||
+               handler == op::jump_if_registers_equal || handler == op::jump_if_registers_not_equal;
+    }
+
+    // The ROM as loaded into memory, with what the control flow graph is built from
+    class rom_image
+    {
+    public:
+        rom_image(const unsigned char* rom, const std::size_t size, const quirk_flags& quirks)
+            : rom(rom)
+            , end(static_cast<unsigned>(PROGRAM_OFFSET + size))
+            , quirks(quirks)
+        {
+        }
+
+        // Whether a whole instruction starts at address
+        bool holds(const unsigned address) const
+        {
+            return address >= PROGRAM_OFFSET && address + 1 < end;
+        }
+
+        unsigned short opcode_at(const unsigned address) const
+        {
+            const auto offset = address - PROGRAM_OFFSET;
+            return static_cast<unsigned short>(rom[offset] << 8 | rom[offset + 1]);
+        }
+
+        decoded_instruction instruction_at(const unsigned address) const
+        {
+            return decode(opcode_at(address));
+        }
+
+        // Where control can go from the instruction at address, as far as the ROM tells
+        std::vector<unsigned> successors(const unsigned address) const
+        {
+            const auto instruction = instruction_at(address);
+            switch(instruction.handler)
+            {
+                case op::jump_to:
+                    return {instruction.nnn};
+                case op::call_func:
+                    return {instruction.nnn, address + 2};
+                case op::return_from_subroutine:
+                case op::jump_to_address:
+                case op::exit_interpreter:
+                case op::unsupported:
+                    return {};
+                case op::jump_if_equal:
+                case op::jump_if_not_equal:
+                case op::jump_if_registers_equal:
+                case op::jump_if_registers_not_equal:
+                case op::jump_if_key_pressed:
+                case op::jump_if_key_not_pressed:
+                {
+                    const auto next = address + 2;
+                    const bool is_long =
+                        quirks.mode == machine_mode::xochip && holds(next) && opcode_at(next) == 0xF000;
+                    return {next, next + (is_long ? 4 : 2)};
+                }
+                case op::assign_long_address_register:
+                    return {address + 4};
+                default:
+                    return {address + 2};
+            }
+        }
+
+        const unsigned char* rom;
+        unsigned end;
+        quirk_flags quirks;
+    };
+
+    static bool is_identifier(const std::string& name)
+    {
+        if(name.empty() || std::isdigit(static_cast<unsigned char>(name[0])) != 0)
+        {
+            return false;
+        }
+        for(const auto c : name)
+        {
+            if(std::isalnum(static_cast<unsigned char>(c)) == 0 && c != '_')
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // The statements one recompiled instruction runs, except for the control transfer of those that end a block
+    static void write_instruction(std::FILE* out, const decoded_instruction& instruction, const quirk_flags& quirks)
+    {
+        const auto x = instruction.x;
+        const auto y = instruction.y;
+        switch(instruction.handler)
+        {
+            case op::set_register_to_value:
+                std::fprintf(out, "                    v%X = 0x%02X;\n", x, instruction.nn);
+                break;
+            case op::add_assign_register_to_value:
+                std::fprintf(out, "                    v%X = static_cast<unsigned char>(v%X + 0x%02X);\n", x, x,
+                             instruction.nn);
+                break;
+            case op::assign_register:
+                if(x != y)
+                {
+                    std::fprintf(out, "                    v%X = v%X;\n", x, y);
+                }
+                break;
+            case op::or_assign_register:
+            case op::and_assign_register:
+            case op::xor_assign_register:
+            {
+                const char operation = instruction.handler == op::or_assign_register    ? '|'
+                                       : instruction.handler == op::and_assign_register ? '&'
+                                                                                        : '^';
+                std::fprintf(out, "                    v%X %c= v%X;\n", x, operation, y);
+                if(quirks.logic_resets_vf)
+                {
+                    std::fprintf(out, "                    vF = 0;\n");
+                }
+                break;
+            }
+            case op::add_assign_register:
+                std::fprintf(out, "                    sum = v%X + v%X;\n", x, y);
+                std::fprintf(out, "                    v%X = static_cast<unsigned char>(sum);\n", x);
+                std::fprintf(out, "                    vF = static_cast<unsigned char>(sum >> 8);\n");
+                break;
+            case op::subtract_assign_register:
+            case op::reverse_subtract_assign_register:
+            {
+                // VF is written last, so that it ends up holding the flag when it is also an operand
+                const auto minuend    = instruction.handler == op::subtract_assign_register ? x : y;
+                const auto subtrahend = instruction.handler == op::subtract_assign_register ? y : x;
+                // Compilers warn of a register compared with itself
+                if(minuend == subtrahend)
+                {
+                    std::fprintf(out, "                    flag = 1;\n");
+                }
+                else
+                {
+                    std::fprintf(out, "                    flag = v%X >= v%X;\n", minuend, subtrahend);
+                }
+                std::fprintf(out, "                    v%X = static_cast<unsigned char>(v%X - v%X);\n", x, minuend,
+                             subtrahend);
+                std::fprintf(out, "                    vF = flag;\n");
+                break;
+            }
+            case op::shift_right_assign_register:
+            case op::shift_left_assign_register:
+            {
+                const auto source = quirks.shift_reads_vy ? y : x;
+                std::fprintf(out, "                    source = v%X;\n", source);
+                if(instruction.handler == op::shift_right_assign_register)
+                {
+                    std::fprintf(out, "                    v%X = static_cast<unsigned char>(source >> 1);\n", x);
+                    std::fprintf(out, "                    vF = source & 1;\n");
+                }
+                else
+                {
+                    std::fprintf(out, "                    v%X = static_cast<unsigned char>(source << 1);\n", x);
+                    std::fprintf(out, "                    vF = static_cast<unsigned char>(source >> 7);\n");
+                }
+                break;
+            }
+            case op::assign_address_register:
+                std::fprintf(out, "                    i = 0x%03X;\n", instruction.nnn);
+                break;
+            case op::add_assign_address_register:
+                std::fprintf(out, "                    i = static_cast<unsigned short>(i + v%X);\n", x);
+                break;
+            case op::set_memory_address_to_character_sprite_address:
+                std::fprintf(out, "                    i = static_cast<unsigned short>((v%X & 0xF) * 5);\n", x);
+                break;
+            case op::set_memory_address_to_big_sprite_address:
+                std::fprintf(out, "                    i = static_cast<unsigned short>(%d + (v%X & 0xF) * 10);\n",
+                             FONTSET_SIZE, x);
+                break;
+            default:
+                break;
+        }
+    }
+
+    aot_summary write_aot_source(std::FILE* out, const unsigned char* rom, const std::size_t size,
+                                 const quirk_profile quirks, const std::string& name)
+    {
+        if(is_identifier(name) == false)
+        {
+            throw std::invalid_argument(name + " is not a C++ identifier");
+        }
+        if(size == 0)
+        {
+            throw std::invalid_argument("An empty ROM has nothing to recompile");
+        }
+
+        const auto flags       = flags_of(quirks);
+        const auto memory_size = memory_size_of(flags.mode);
+        if(size > memory_size - PROGRAM_OFFSET)
+        {
+            throw std::invalid_argument("ROM of " + std::to_string(size) + " bytes is larger than " +
+                                        std::to_string(memory_size - PROGRAM_OFFSET));
+        }
+        const rom_image image(rom, size, flags);
+
+        // Everything reachable from the entry point. A leader starts a block: it is jumped to, called, returned
+        // or skipped to, or follows an instruction the interpreter runs.
+        std::vector<bool> reachable(memory_size, false);
+        std::vector<bool> leader(memory_size, false);
+        std::vector<unsigned> pending;
+        if(image.holds(PROGRAM_OFFSET))
+        {
+            reachable[PROGRAM_OFFSET] = true;
+            leader[PROGRAM_OFFSET]    = true;
+            pending.push_back(PROGRAM_OFFSET);
+        }
+
+        aot_summary summary;
+        while(pending.empty() == false)
+        {
+            const auto address = pending.back();
+            pending.pop_back();
+            summary.instructions++;
+
+            const auto handler  = image.instruction_at(address).handler;
+            const bool straight = recompilable(handler, flags) && ends_block(handler) == false;
+            for(const auto next : image.successors(address))
+            {
+                if(image.holds(next) == false)
+                {
+                    continue;
+                }
+                if(straight == false || next != address + 2)
+                {
+                    leader[next] = true;
+                }
+                if(reachable[next] == false)
+                {
+                    reachable[next] = true;
+                    pending.push_back(next);
+                }
+            }
+        }
+
+        // Blocks run from a leader through straight-line recompilable code. A block that grows too long is cut
+        // and the address it stops at becomes a leader itself, which the scan reaches later.
+        struct block
+        {
+            unsigned start;
+            unsigned end;
+        };
+        std::vector<block> blocks;
+        std::vector<int> block_at(memory_size, -1);
+        for(unsigned start = PROGRAM_OFFSET; start < image.end; start++)
+        {
+            if(leader[start] == false || recompilable(image.instruction_at(start).handler, flags) == false)
+            {
+                continue;
+            }
+
+            auto address = start;
+            while(true)
+            {
+                const auto handler = image.instruction_at(address).handler;
+                if(recompilable(handler, flags) == false)
+                {
+                    break;
+                }
+                address += 2;
+                if(ends_block(handler) || image.holds(address) == false || leader[address])
+                {
+                    break;
+                }
+                if(address - start + 2 > MAX_AOT_BLOCK_SIZE)
+                {
+                    leader[address] = true;
+                    break;
+                }
+            }
+
+            block_at[start] = static_cast<int>(blocks.size());
+            blocks.push_back({start, address});
+            summary.recompiled += (address - start) / 2;
+        }
+        summary.blocks = blocks.size();
+
+        // Labels are only written for the blocks something jumps to, so the compiler has no unused ones to warn of
+        std::vector<bool> targeted(memory_size, false);
+        const auto mark_target = [&](const unsigned target) {
+            if(target < memory_size && block_at[target] >= 0)
+            {
+                targeted[target] = true;
+            }
+        };
+        for(const auto& b : blocks)
+        {
+            const auto last = image.instruction_at(b.end - 2);
+            switch(last.handler)
+            {
+                case op::jump_to:
+                case op::call_func:
+                    mark_target(last.nnn);
+                    break;
+                case op::return_from_subroutine:
+                    break;
+                case op::jump_if_equal:
+                case op::jump_if_not_equal:
+                    mark_target(b.end);
+                    mark_target(b.end + 2);
+                    break;
+                case op::jump_if_registers_equal:
+                case op::jump_if_registers_not_equal:
+                    if(last.x != last.y || last.handler == op::jump_if_registers_not_equal)
+                    {
+                        mark_target(b.end);
+                    }
+                    if(last.x != last.y || last.handler == op::jump_if_registers_equal)
+                    {
+                        mark_target(b.end + 2);
+                    }
+                    break;
+                default:
+                    mark_target(b.end);
+                    break;
+            }
+        }
+
+        // Moves to target, straight into its block when there is one and out to the interpreter otherwise
+        const auto write_transfer = [&](const unsigned target, const char* indent) {
+            std::fprintf(out, "%spc = 0x%03X;\n", indent, target);
+            if(target < memory_size && block_at[target] >= 0)
+            {
+                std::fprintf(out, "%sgoto block_%03X;\n", indent, target);
+            }
+            else
+            {
+                std::fprintf(out, "%sgoto done;\n", indent);
+            }
+        };
+
+        std::fprintf(out, "// Recompiled by chip8-aot for the %s quirks. Regenerate it instead of editing it.\n",
+                     quirk_profile_name(quirks));
+        std::fprintf(out, "#include \"aot.h\"\n\nnamespace\n{\n");
+
+        std::fprintf(out, "    const unsigned char rom[] = {");
+        for(std::size_t i = 0; i != size; i++)
+        {
+            std::fprintf(out, "%s0x%02X,", i % 16 == 0 ? "\n        " : " ", rom[i]);
+        }
+        std::fprintf(out, "\n    };\n\n");
+
+        std::fprintf(out, "    const chip8::aot_block blocks[] = {");
+        for(std::size_t i = 0; i != blocks.size(); i++)
+        {
+            std::fprintf(out, "%s{0x%03X, 0x%03X},", i % 6 == 0 ? "\n        " : " ", blocks[i].start, blocks[i].end);
+        }
+        // An array cannot be empty
+        std::fprintf(out, "%s\n    };\n\n", blocks.empty() ? "\n        {0, 0}," : "");
+
+        std::fprintf(out, "    std::uint64_t run(const chip8::aot_context& context, "
+                          "[[maybe_unused]] const std::uint64_t budget)\n");
+        std::fprintf(out, "    {\n");
+        for(unsigned v = 0; v != 16; v++)
+        {
+            std::fprintf(out, "        unsigned char v%X = context.V[%u];\n", v, v);
+        }
+        std::fprintf(out, "        unsigned short i  = *context.I;\n");
+        std::fprintf(out, "        unsigned short pc = *context.pc;\n");
+        std::fprintf(out, "        unsigned char sp  = *context.sp;\n\n");
+        std::fprintf(out, "        [[maybe_unused]] unsigned sum;\n");
+        std::fprintf(out, "        [[maybe_unused]] unsigned char flag;\n");
+        std::fprintf(out, "        [[maybe_unused]] unsigned char source;\n");
+        std::fprintf(out, "        std::uint64_t executed = 0;\n\n");
+        std::fprintf(out, "        while(true)\n        {\n            switch(pc)\n            {\n");
+
+        for(std::size_t k = 0; k != blocks.size(); k++)
+        {
+            const auto& b    = blocks[k];
+            const auto count = (b.end - b.start) / 2;
+
+            std::fprintf(out, "                case 0x%03X:\n", b.start);
+            if(targeted[b.start])
+            {
+                std::fprintf(out, "                block_%03X:\n", b.start);
+            }
+            std::fprintf(out, "                    if(context.stale[%zu] != 0 || budget - executed < %u)\n", k, count);
+            std::fprintf(out, "                    {\n                        goto done;\n                    }\n");
+            std::fprintf(out, "                    executed += %u;\n", count);
+
+            for(auto address = b.start; address != b.end; address += 2)
+            {
+                const auto instruction = image.instruction_at(address);
+                std::fprintf(out, "                    // %03X: %04X\n", address, image.opcode_at(address));
+                write_instruction(out, instruction, flags);
+
+                if(address + 2 != b.end)
+                {
+                    continue;
+                }
+
+                const auto x = instruction.x;
+                const auto y = instruction.y;
+                switch(instruction.handler)
+                {
+                    case op::jump_to:
+                        write_transfer(instruction.nnn, "                    ");
+                        break;
+                    case op::call_func:
+                        // A full stack is left for the interpreter to report, from the call
+                        std::fprintf(out, "                    if(sp >= %d)\n                    {\n", STACK_SIZE);
+                        std::fprintf(out, "                        executed--;\n");
+                        std::fprintf(out, "                        pc = 0x%03X;\n", address);
+                        std::fprintf(out, "                        goto done;\n                    }\n");
+                        std::fprintf(out, "                    context.stack[sp++] = 0x%03X;\n", address);
+                        write_transfer(instruction.nnn, "                    ");
+                        break;
+                    case op::return_from_subroutine:
+                        std::fprintf(out, "                    if(sp == 0)\n                    {\n");
+                        std::fprintf(out, "                        executed--;\n");
+                        std::fprintf(out, "                        pc = 0x%03X;\n", address);
+                        std::fprintf(out, "                        goto done;\n                    }\n");
+                        std::fprintf(out, "                    pc = static_cast<unsigned short>("
+                                          "context.stack[--sp] + 2);\n");
+                        std::fprintf(out, "                    continue;\n");
+                        break;
+                    case op::jump_if_equal:
+                    case op::jump_if_not_equal:
+                    case op::jump_if_registers_equal:
+                    case op::jump_if_registers_not_equal:
+                    {
+                        const bool equal = instruction.handler == op::jump_if_equal ||
+                                           instruction.handler == op::jump_if_registers_equal;
+                        const bool compares_registers = instruction.handler == op::jump_if_registers_equal ||
+                                                        instruction.handler == op::jump_if_registers_not_equal;
+                        if(compares_registers && x == y)
+                        {
+                            // A register always equals itself
+                            write_transfer(equal ? address + 4 : address + 2, "                    ");
+                            break;
+                        }
+                        if(compares_registers == false)
+                        {
+                            std::fprintf(out, "                    if(v%X %s 0x%02X)\n", x, equal ? "==" : "!=",
+                                         instruction.nn);
+                        }
+                        else
+                        {
+                            std::fprintf(out, "                    if(v%X %s v%X)\n", x, equal ? "==" : "!=", y);
+                        }
+                        std::fprintf(out, "                    {\n");
+                        write_transfer(address + 4, "                        ");
+                        std::fprintf(out, "                    }\n");
+                        write_transfer(address + 2, "                    ");
+                        break;
+                    }
+                    default:
+                        write_transfer(b.end, "                    ");
+                        break;
+                }
+            }
+        }
+
+        std::fprintf(out, "                default:\n                    goto done;\n");
+        std::fprintf(out, "            }\n        }\n\n    done:\n");
+        for(unsigned v = 0; v != 16; v++)
+        {
+            std::fprintf(out, "        context.V[%u] = v%X;\n", v, v);
+        }
+        std::fprintf(out, "        *context.I  = i;\n");
+        std::fprintf(out, "        *context.pc = pc;\n");
+        std::fprintf(out, "        *context.sp = sp;\n");
+        std::fprintf(out, "        return executed;\n    }\n} // namespace\n\n");
+
+        std::fprintf(out, "extern const chip8::aot_program %s = {\n", name.c_str());
+        std::fprintf(out, "    .name        = \"%s\",\n", name.c_str());
+        std::fprintf(out, "    .quirks      = chip8::quirk_profile::%s,\n", quirk_profile_name(quirks));
+        std::fprintf(out, "    .rom         = rom,\n");
+        std::fprintf(out, "    .rom_size    = sizeof rom,\n");
+        std::fprintf(out, "    .blocks      = blocks,\n");
+        std::fprintf(out, "    .block_count = %zu,\n", blocks.size());
+        std::fprintf(out, "    .run         = run,\n};\n\n");
+        std::fprintf(out, "[[maybe_unused]] static const bool registered = chip8::register_aot_program(%s);\n",
+                     name.c_str());
+
+        if(std::ferror(out) != 0)
+        {
+            throw std::runtime_error("Could not write the recompiled source");
+        }
+        return summary;
+    }
+} // namespace chip8
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "quirks.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace chip8
+{
+    // The machine state recompiled code runs on, pointing into the machine running it
+    struct aot_context
+    {
+        unsigned char* V;
+        unsigned short* I;
+        unsigned short* pc;
+        unsigned short* stack;
+        unsigned char* sp;
+        const unsigned char* stale; // One flag per block, set while memory does not hold the bytes it was made from
+    };
+
+    // Addresses of the instructions a block runs, from start up to end
+    struct aot_block
+    {
+        unsigned short start;
+        unsigned short end;
+    };
+
+    // A ROM recompiled ahead of time by write_aot_source() and built into a binary that links the core
+    struct aot_program
+    {
+        const char* name;
+        quirk_profile quirks;
+        const unsigned char* rom;
+        std::size_t rom_size;
+        const aot_block* blocks; // Sorted by start
+        std::size_t block_count;
+
+        // Runs blocks from *context.pc on for up to budget instructions and returns how many it ran. Stops in front
+        // of a block that does not fit the budget, is stale or is not there, which leaves the instruction at the pc
+        // to the interpreter.
+        std::uint64_t (*run)(const aot_context& context, const std::uint64_t budget);
+    };
+
+    // No block is longer, so a write can only reach blocks that start at most this far below it
+    static constexpr auto MAX_AOT_BLOCK_SIZE = 256;
+
+    // Programs are registered by the translation units write_aot_source() emits, from static initialisers, and
+    // found again by the ROM they were recompiled from and the quirks they were recompiled for. Null when none.
+    bool register_aot_program(const aot_program& program);
+    const aot_program* find_aot_program(const unsigned char* rom, const std::size_t size, const quirk_profile quirks);
+
+    struct aot_summary
+    {
+        std::size_t blocks       = 0;
+        std::size_t instructions = 0; // Reachable from 0x200 through jumps, calls, returns and skips
+        std::size_t recompiled   = 0; // Of instructions, the ones the blocks cover
+    };
+
+    // Recovers the control flow graph of rom from 0x200, following jumps, calls and skips, and writes a C++
+    // translation unit with every basic block as a labelled case of one dispatch switch over the pc. The V
+    // registers live in locals for as long as the code stays in recompiled blocks. Only instructions that touch no
+    // more than the registers, I and the stack are recompiled. Draws, keys, timers, memory accesses, CXNN, BNNN and
+    // XO-CHIP's skips are left to the interpreter, and so is any block whose bytes change at run time. The program is
+    // defined under name, which has to be a C++ identifier. Throws std::invalid_argument for a bad name or a ROM that
+    // is empty or too large for the quirks' mode and std::runtime_error when out cannot be written.
+    aot_summary write_aot_source(std::FILE* out, const unsigned char* rom, const std::size_t size,
+                                 const quirk_profile quirks, const std::string& name);
+} // namespace chip8
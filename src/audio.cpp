@@ -0,0 +1,197 @@
+#include "audio.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace chip8
+{
+    square_wave::square_wave(const unsigned sample_rate, const double cycles_per_second, const double frequency)
+        : samples_per_cycle(sample_rate / cycles_per_second)
+        , samples_per_second(sample_rate)
+        , phase_step(frequency / sample_rate)
+    {
+        // Room for every span a few frames can log, so that playback does not allocate
+        tones.reserve(256);
+    }
+
+    void square_wave::set_max_lead(const std::uint64_t samples)
+    {
+        max_lead = static_cast<std::int64_t>(samples);
+    }
+
+    void square_wave::add(const sound_span& span)
+    {
+        auto start = static_cast<std::int64_t>(sample_at(span.start)) + offset;
+        auto end   = static_cast<std::int64_t>(sample_at(span.end)) + offset;
+        if(start < rendered || start - rendered > max_lead)
+        {
+            const auto shift = rendered - start;
+            offset += shift;
+            start += shift;
+            end += shift;
+        }
+
+        while(tones.empty() == false && tones.back().start >= start)
+        {
+            tones.pop_back();
+        }
+        if(tones.empty() == false && tones.back().end > start)
+        {
+            tones.back().end = start;
+        }
+
+        if(end <= start)
+        {
+            return;
+        }
+
+        tone next = {.start = start, .end = end, .step = phase_step, .patterned = span.patterned, .pattern = {}};
+        if(span.patterned)
+        {
+            next.step = PATTERN_BIT_RATE * std::exp2((span.pitch - DEFAULT_PITCH) / 48.0) / samples_per_second;
+            std::memcpy(next.pattern, span.pattern, sizeof next.pattern);
+        }
+
+        // A span continuing the tone before it with the same sound extends it, without restarting the wave
+        if(tones.empty() == false && tones.back().end == start && tones.back().step == next.step &&
+           tones.back().patterned == next.patterned &&
+           std::memcmp(tones.back().pattern, next.pattern, sizeof next.pattern) == 0)
+        {
+            tones.back().end = end;
+            return;
+        }
+        tones.push_back(next);
+    }
+
+    void square_wave::render(std::int16_t* out, const std::size_t count)
+    {
+        std::size_t finished = 0;
+        for(std::size_t i = 0; i != count; i++)
+        {
+            const auto position = rendered + static_cast<std::int64_t>(i);
+            while(finished != tones.size() && tones[finished].end <= position)
+            {
+                finished++;
+            }
+
+            if(finished == tones.size() || tones[finished].start > position)
+            {
+                // Every beep starts on the same edge of the wave
+                out[i] = 0;
+                phase  = 0;
+                continue;
+            }
+
+            // A pattern's phase counts its 128 bits, a plain beep's the halves of the wave
+            const auto& current = tones[finished];
+            bool high;
+            if(current.patterned)
+            {
+                const auto bit = static_cast<unsigned>(phase) % (AUDIO_PATTERN_SIZE * 8);
+                high           = (current.pattern[bit / 8] >> (7 - bit % 8) & 1) != 0;
+                phase += current.step;
+                phase -= std::floor(phase / (AUDIO_PATTERN_SIZE * 8)) * (AUDIO_PATTERN_SIZE * 8);
+            }
+            else
+            {
+                high = phase < 0.5;
+                phase += current.step;
+                phase -= std::floor(phase);
+            }
+            out[i] = static_cast<std::int16_t>(high ? BEEP_AMPLITUDE : -BEEP_AMPLITUDE);
+        }
+
+        tones.erase(tones.begin(), tones.begin() + static_cast<std::ptrdiff_t>(finished));
+        rendered += static_cast<std::int64_t>(count);
+    }
+
+    std::uint64_t square_wave::samples_rendered() const
+    {
+        return static_cast<std::uint64_t>(rendered);
+    }
+
+    std::uint64_t square_wave::sample_at(const std::uint64_t cycles) const
+    {
+        return static_cast<std::uint64_t>(std::llround(static_cast<double>(cycles) * samples_per_cycle));
+    }
+
+    static void put_u16(unsigned char* out, const std::uint32_t value)
+    {
+        out[0] = static_cast<unsigned char>(value);
+        out[1] = static_cast<unsigned char>(value >> 8);
+    }
+
+    static void put_u32(unsigned char* out, const std::uint32_t value)
+    {
+        put_u16(out, value);
+        put_u16(out + 2, value >> 16);
+    }
+
+    // RIFF header of 16-bit mono PCM, little-endian throughout
+    static constexpr auto WAV_HEADER_SIZE = 44;
+
+    wav_writer::wav_writer(const char* path, const unsigned sample_rate)
+        : file(std::fopen(path, "wb"), &std::fclose)
+        , path(path)
+        , sample_rate(sample_rate)
+    {
+        if(file == nullptr)
+        {
+            throw std::runtime_error(std::string("Could not write ") + path);
+        }
+        write_header();
+    }
+
+    void wav_writer::write(const std::int16_t* samples, const std::size_t count)
+    {
+        unsigned char bytes[2 * 1024];
+        for(std::size_t done = 0; done != count;)
+        {
+            const auto chunk = std::min(count - done, sizeof(bytes) / 2);
+            for(std::size_t i = 0; i != chunk; i++)
+            {
+                put_u16(&bytes[i * 2], static_cast<std::uint16_t>(samples[done + i]));
+            }
+            std::fwrite(bytes, 2, chunk, file.get());
+            done += chunk;
+        }
+        samples_written += count;
+    }
+
+    void wav_writer::finish()
+    {
+        if(samples_written * 2 > 0xFFFFFFFF - WAV_HEADER_SIZE)
+        {
+            throw std::runtime_error(path + " would be larger than a WAV file can be");
+        }
+
+        std::fseek(file.get(), 0, SEEK_SET);
+        write_header();
+        if(std::fflush(file.get()) != 0 || std::ferror(file.get()) != 0)
+        {
+            throw std::runtime_error("Could not write " + path);
+        }
+    }
+
+    void wav_writer::write_header()
+    {
+        const auto data_size = static_cast<std::uint32_t>(samples_written * 2);
+
+        unsigned char header[WAV_HEADER_SIZE] = {};
+        std::memcpy(&header[0], "RIFF", 4);
+        put_u32(&header[4], WAV_HEADER_SIZE - 8 + data_size);
+        std::memcpy(&header[8], "WAVEfmt ", 8);
+        put_u32(&header[16], 16);              // fmt chunk size
+        put_u16(&header[20], 1);               // PCM
+        put_u16(&header[22], 1);               // Channels
+        put_u32(&header[24], sample_rate);     // Samples per second
+        put_u32(&header[28], sample_rate * 2); // Bytes per second
+        put_u16(&header[32], 2);               // Bytes per sample
+        put_u16(&header[34], 16);              // Bits per sample
+        std::memcpy(&header[36], "data", 4);
+        put_u32(&header[40], data_size);
+        std::fwrite(header, 1, sizeof(header), file.get());
+    }
+} // namespace chip8
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "chip8.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace chip8
+{
+    static constexpr auto AUDIO_SAMPLE_RATE = 48000;
+    static constexpr auto BEEP_FREQUENCY    = 440.0;
+    static constexpr auto BEEP_AMPLITUDE    = 6000; // Out of 32767, a square wave is loud
+
+    // Bits per second of an XO-CHIP audio pattern played at DEFAULT_PITCH, doubling every 48 steps of pitch
+    static constexpr auto PATTERN_BIT_RATE = 4000.0;
+
+    // Renders the sound spans a machine logs as a mono square wave, or as their audio pattern for the spans that have
+    // one. Cycles map to samples at cycles_per_second, so a beep starts and stops on the sample of the instruction
+    // that started it and of the frame it ran out in.
+    class square_wave
+    {
+    public:
+        square_wave(const unsigned sample_rate, const double cycles_per_second,
+                    const double frequency = BEEP_FREQUENCY);
+
+        // For playback on a clock of its own, such as an audio device. A span that would start among the samples
+        // already rendered starts on the next one instead, and one due more than max_lead samples ahead is brought
+        // forward to start on the next sample. Every later span moves with it.
+        void set_max_lead(const std::uint64_t samples);
+
+        // Spans are added in the order they were logged
+        void add(const sound_span& span);
+        void render(std::int16_t* out, const std::size_t count);
+
+        std::uint64_t samples_rendered() const;
+        // The sample a cycle count maps to, before any shift made to follow a clock
+        std::uint64_t sample_at(const std::uint64_t cycles) const;
+
+    private:
+        // Sample positions, start included and end excluded
+        struct tone
+        {
+            std::int64_t start;
+            std::int64_t end;
+            double step; // Of the phase per sample, a wave period or a pattern bit
+            bool patterned;
+            unsigned char pattern[AUDIO_PATTERN_SIZE];
+        };
+
+        double samples_per_cycle;
+        double samples_per_second;
+        double phase_step;
+        double phase = 0;
+
+        std::int64_t offset   = 0; // Added to the sample of every span, moved by late and early spans
+        std::int64_t rendered = 0;
+        std::int64_t max_lead = std::numeric_limits<std::int64_t>::max();
+
+        std::vector<tone> tones; // Ascending and not overlapping
+    };
+
+    // 16-bit mono PCM written to a WAV file as it is produced. The sizes in the header are filled in by finish().
+    class wav_writer
+    {
+    public:
+        // Throws std::runtime_error when the file cannot be created
+        wav_writer(const char* path, const unsigned sample_rate);
+
+        wav_writer(const wav_writer&)            = delete;
+        wav_writer& operator=(const wav_writer&) = delete;
+
+        void write(const std::int16_t* samples, const std::size_t count);
+        // Throws std::runtime_error when anything could not be written
+        void finish();
+
+    private:
+        void write_header();
+
+        std::unique_ptr<std::FILE, decltype(&std::fclose)> file;
+        std::string path;
+        unsigned sample_rate;
+        std::uint64_t samples_written = 0;
+    };
+} // namespace chip8
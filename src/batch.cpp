@@ -0,0 +1,136 @@
+#include "batch.h"
+
+#include "chip8.h"
+#include "rom_pack.h"
+#include "work_stealing_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <stdexcept>
+
+namespace chip8
+{
+    double batch_result::instructions_per_second() const
+    {
+        if(seconds <= 0)
+        {
+            return 0;
+        }
+        return static_cast<double>(instructions) / seconds;
+    }
+
+    double batch_result::idle_share() const
+    {
+        if(instructions == 0)
+        {
+            return 0;
+        }
+        return static_cast<double>(idle) / static_cast<double>(instructions);
+    }
+
+    struct rom_bytes
+    {
+        const unsigned char* data;
+        std::size_t size;
+    };
+
+    static std::vector<unsigned char> read_rom(const std::string& path)
+    {
+        std::ifstream is(path, std::ios::binary);
+        if(is.is_open() == false)
+        {
+            throw std::runtime_error("Could not open " + path);
+        }
+        return std::vector<unsigned char>(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+    }
+
+    batch_result run_batch(const std::vector<batch_job>& jobs, const unsigned thread_count, trace_drain* drain,
+                           const rom_pack* pack)
+    {
+        // Every ROM is read or looked up once no matter how many machines run it
+        std::map<std::string, std::vector<unsigned char>> files;
+        std::map<std::string, rom_bytes> roms;
+        for(const auto& job : jobs)
+        {
+            if(roms.contains(job.rom_path) == false)
+            {
+                rom_bytes rom;
+                if(pack != nullptr)
+                {
+                    const auto packed = pack->find_by_key(job.rom_path);
+                    if(packed == nullptr)
+                    {
+                        throw std::runtime_error("No ROM " + job.rom_path + " in the pack");
+                    }
+                    rom = {packed->data, packed->size};
+                }
+                else
+                {
+                    const auto& file = files.emplace(job.rom_path, read_rom(job.rom_path)).first->second;
+                    rom              = {file.data(), file.size()};
+                }
+                roms.emplace(job.rom_path, rom);
+            }
+
+            // How much fits depends on the mode the job runs in, so the same ROM is checked once per job
+            const auto max_size = memory_size_of(flags_of(job.quirks).mode) - PROGRAM_OFFSET;
+            if(roms.at(job.rom_path).size > max_size)
+            {
+                throw std::invalid_argument(job.rom_path + " is larger than " + std::to_string(max_size) + " bytes");
+            }
+        }
+
+        std::atomic<std::uint64_t> instructions = 0;
+        std::atomic<std::uint64_t> idle         = 0;
+        std::atomic<std::uint64_t> failed       = 0;
+
+        const auto start = std::chrono::steady_clock::now();
+        {
+            work_stealing_pool pool(thread_count);
+
+            for(const auto& job : jobs)
+            {
+                const auto& rom = roms.at(job.rom_path);
+
+                pool.submit([&rom, &job, &instructions, &idle, &failed, drain]() {
+                    auto vm = std::make_unique<machine>();
+                    vm->set_backend(job.engine);
+                    vm->set_quirks(job.quirks);
+                    vm->load(rom.data, rom.size);
+                    if(drain != nullptr)
+                    {
+                        vm->attach_trace(*drain);
+                    }
+
+                    try
+                    {
+                        vm->run_cycles(job.cycles);
+                    }
+                    catch(const std::exception&)
+                    {
+                        failed.fetch_add(1, std::memory_order_relaxed);
+                    }
+
+                    instructions.fetch_add(vm->instruction_count(), std::memory_order_relaxed);
+                    idle.fetch_add(vm->idle_cycle_count(), std::memory_order_relaxed);
+                });
+            }
+
+            pool.wait_idle();
+        }
+        const auto end = std::chrono::steady_clock::now();
+
+        batch_result result;
+        result.machines     = jobs.size();
+        result.failed       = failed.load();
+        result.instructions = instructions.load();
+        result.idle         = idle.load();
+        result.seconds      = std::chrono::duration<double>(end - start).count();
+        return result;
+    }
+} // namespace chip8
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "chip8.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace chip8
+{
+    class rom_pack;
+    class trace_drain;
+
+    struct batch_job
+    {
+        std::string rom_path; // Or a name or SHA-1 in the pack given to run_batch()
+        std::uint64_t cycles;
+        backend engine       = backend::blocks;
+        quirk_profile quirks = DEFAULT_QUIRKS;
+    };
+
+    struct batch_result
+    {
+        std::uint64_t machines     = 0;
+        std::uint64_t failed       = 0; // Machines that stopped early on an unsupported or invalid instruction
+        std::uint64_t instructions = 0;
+        std::uint64_t idle         = 0; // Of instructions, the cycles fast-forwarded through idle loops
+        double seconds             = 0;
+
+        double instructions_per_second() const;
+        // From 0 to 1
+        double idle_share() const;
+    };
+
+    // Runs every job on its own machine, spread over a work stealing pool. thread_count of 0 uses every core.
+    // When drain is set every machine streams its trace records to it. With a pack ROMs are looked up in it instead
+    // of being read from disk. Throws std::runtime_error for a ROM that cannot be found or read and
+    // std::invalid_argument for one too large to load, before any machine runs.
+    batch_result run_batch(const std::vector<batch_job>& jobs, const unsigned thread_count = 0,
+                           trace_drain* drain = nullptr, const rom_pack* pack = nullptr);
+} // namespace chip8
@@ -0,0 +1,184 @@
+#include "batch.h"
+#include "rom_pack.h"
+#include "trace.h"
+
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Usage: chip8-batch [--threads N] [--machines N] [--cycles N] [--backend interpreter|blocks|jit]
+//                    [--quirks vip|schip|modern|xochip] [--trace FILE] [--pack FILE] rom...
+// Runs --machines copies of every ROM for --cycles instructions each and reports the aggregate throughput, and how
+// much of it was fast-forwarded through idle loops.
+// --trace streams binary trace records from every machine to FILE (only in builds with CHIP8_TRACE_LEVEL > 0).
+// --pack maps a ROM pack written by chip8-pack and looks every rom up in it, by name or SHA-1. "all" then runs every
+// ROM in the pack.
+
+static bool parse_number(const char* text, auto& out)
+{
+    const auto end = text + std::strlen(text);
+    return std::from_chars(text, end, out).ptr == end;
+}
+
+static bool parse_backend(const std::string_view text, chip8::backend& out)
+{
+    if(text == "interpreter")
+    {
+        out = chip8::backend::interpreter;
+        return true;
+    }
+    if(text == "blocks")
+    {
+        out = chip8::backend::blocks;
+        return true;
+    }
+    if(text == "jit")
+    {
+        out = chip8::backend::jit;
+        return true;
+    }
+    return false;
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned threads       = 0;
+    unsigned long machines = 1000;
+    unsigned long cycles   = 100000;
+
+    const char* trace_path = nullptr;
+    const char* pack_path  = nullptr;
+    auto engine            = chip8::backend::blocks;
+    auto quirks            = chip8::DEFAULT_QUIRKS;
+
+    std::vector<chip8::batch_job> jobs;
+    std::vector<const char*> roms;
+
+    for(int i = 1; i < argc; i++)
+    {
+        const std::string_view arg = argv[i];
+
+        const bool has_value = i + 1 < argc;
+        if(arg == "--threads" && has_value && parse_number(argv[i + 1], threads))
+        {
+            i++;
+        }
+        else if(arg == "--machines" && has_value && parse_number(argv[i + 1], machines))
+        {
+            i++;
+        }
+        else if(arg == "--cycles" && has_value && parse_number(argv[i + 1], cycles))
+        {
+            i++;
+        }
+        else if(arg == "--backend" && has_value && parse_backend(argv[i + 1], engine))
+        {
+            i++;
+        }
+        else if(arg == "--quirks" && has_value && chip8::parse_quirk_profile(argv[i + 1], quirks))
+        {
+            i++;
+        }
+        else if(arg == "--trace" && has_value)
+        {
+            trace_path = argv[++i];
+        }
+        else if(arg == "--pack" && has_value)
+        {
+            pack_path = argv[++i];
+        }
+        else if(arg.starts_with("--"))
+        {
+            std::fprintf(stderr, "Unknown or incomplete option %s\n", argv[i]);
+            return 1;
+        }
+        else
+        {
+            roms.push_back(argv[i]);
+        }
+    }
+
+    if(roms.empty())
+    {
+        std::fprintf(stderr,
+                     "Usage: %s [--threads N] [--machines N] [--cycles N] [--backend interpreter|blocks|jit] "
+                     "[--quirks vip|schip|modern|xochip] [--trace FILE] [--pack FILE] rom...\n",
+                     argv[0]);
+        return 1;
+    }
+
+    std::unique_ptr<chip8::rom_pack> pack;
+    if(pack_path != nullptr)
+    {
+        try
+        {
+            pack = std::make_unique<chip8::rom_pack>(pack_path);
+        }
+        catch(const std::exception& e)
+        {
+            std::fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+    }
+
+    std::vector<std::string> names;
+    for(const auto rom : roms)
+    {
+        if(pack != nullptr && std::strcmp(rom, "all") == 0)
+        {
+            for(const auto& packed : pack->roms())
+            {
+                names.push_back(chip8::to_hex(packed.digest));
+            }
+            continue;
+        }
+        names.push_back(rom);
+    }
+
+    for(const auto& name : names)
+    {
+        for(unsigned long i = 0; i != machines; i++)
+        {
+            jobs.push_back({name, cycles, engine, quirks});
+        }
+    }
+
+    std::unique_ptr<std::FILE, decltype(&std::fclose)> trace_file(nullptr, &std::fclose);
+    std::unique_ptr<chip8::trace_drain> drain;
+    if(trace_path != nullptr)
+    {
+        trace_file.reset(std::fopen(trace_path, "wb"));
+        if(trace_file == nullptr)
+        {
+            std::fprintf(stderr, "Could not open %s\n", trace_path);
+            return 1;
+        }
+        drain = std::make_unique<chip8::trace_drain>(trace_file.get(), chip8::trace_drain::format::binary);
+    }
+
+    chip8::batch_result result;
+    try
+    {
+        result = chip8::run_batch(jobs, threads, drain.get(), pack.get());
+    }
+    catch(const std::exception& e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    drain.reset();
+
+    std::printf("machines:     %llu\n", static_cast<unsigned long long>(result.machines));
+    std::printf("failed:       %llu\n", static_cast<unsigned long long>(result.failed));
+    std::printf("instructions: %llu\n", static_cast<unsigned long long>(result.instructions));
+    std::printf("idle:         %.1f%%\n", result.idle_share() * 100);
+    std::printf("seconds:      %.3f\n", result.seconds);
+    std::printf("MIPS:         %.2f\n", result.instructions_per_second() / 1e6);
+
+    return result.failed == 0 ? 0 : 2;
+}
@@ -0,0 +1,767 @@
+#include "chip8.h"
+#include "lockstep.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Usage: chip8-bench [--quick] [--cycles-per-frame N] [--output FILE] [rom...]
+// Measures the cost of every handler family on each backend, end-to-end MIPS on the bundled synthetic ROMs and on
+// any ROM given, the cost of the framebuffer primitives and frame-time percentiles, and prints the results as one
+// JSON document, to FILE with --output. --quick runs shorter measurements, for smoke tests. Every ROM is also run on
+// 8, 16 and 32 lockstep lanes with different seeds, against as many machines run one after the other.
+// --cycles-per-frame sets the frame length used for the frame-time percentiles.
+
+using clock_type = std::chrono::steady_clock;
+
+static constexpr chip8::backend BACKENDS[] = {chip8::backend::interpreter, chip8::backend::blocks,
+                                              chip8::backend::jit};
+
+static constexpr auto PROGRAM_START = 0x200;
+
+// Where the call benchmark's subroutine lives, past every generated loop
+static constexpr auto SUBROUTINE = 0xE00;
+
+// Copies of the instruction under test per loop iteration, so the jump back costs little
+static constexpr auto OPCODE_SLOTS = 128;
+
+// Keeps measured results alive without the optimizer seeing through them
+static volatile std::uint64_t sink;
+
+struct settings
+{
+    std::uint64_t opcode_cycles = 1 << 21;
+    std::uint64_t rom_cycles    = 1 << 24;
+    unsigned draw_iterations    = 1 << 22;
+    unsigned frames             = 6000;
+    unsigned repeats            = 5;
+    unsigned frame_cycles       = chip8::DEFAULT_CYCLES_PER_FRAME;
+};
+
+static bool parse_number(const char* text, auto& out)
+{
+    const auto end = text + std::strlen(text);
+    return std::from_chars(text, end, out).ptr == end;
+}
+
+static const char* backend_name(const chip8::backend engine)
+{
+    switch(engine)
+    {
+        case chip8::backend::interpreter:
+            return "interpreter";
+        case chip8::backend::blocks:
+            return "blocks";
+        case chip8::backend::jit:
+            return "jit";
+    }
+    return "unknown";
+}
+
+static double seconds_since(const clock_type::time_point start)
+{
+    return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+using rom_image = std::vector<unsigned char>;
+
+static void emit(rom_image& rom, const chip8::opcode_t opcode)
+{
+    rom.push_back(static_cast<unsigned char>(opcode >> 8));
+    rom.push_back(static_cast<unsigned char>(opcode & 0xFF));
+}
+
+static rom_image assemble(std::initializer_list<chip8::opcode_t> opcodes)
+{
+    rom_image rom;
+    for(const auto opcode : opcodes)
+    {
+        emit(rom, opcode);
+    }
+    return rom;
+}
+
+// What the address bits of a benchmarked instruction point at
+enum class target
+{
+    none,
+    next_instruction,
+    subroutine
+};
+
+// One loop of OPCODE_SLOTS instructions of a single handler family, after setup has run once. When second is set
+// the slots alternate between the two, which is how fused pairs are measured.
+struct opcode_case
+{
+    const char* name;
+    std::vector<chip8::opcode_t> setup;
+    chip8::opcode_t first;
+    chip8::opcode_t second = 0;
+    target address         = target::none;
+};
+
+static const std::vector<opcode_case>& opcode_cases()
+{
+    // Registers stay zero unless setup says otherwise and I points at free memory past the code
+    static const std::vector<opcode_case> cases = {
+        {"00E0 clear", {}, 0x00E0},
+        {"1NNN jump", {}, 0x1000, 0, target::next_instruction},
+        {"2NNN+00EE call and return", {}, 0x2000, 0, target::subroutine},
+        {"3XNN skip taken", {}, 0x3000},
+        {"3XNN skip not taken", {}, 0x3001},
+        {"4XNN skip not taken", {}, 0x4000},
+        {"5XY0 skip taken", {}, 0x5010},
+        {"6XNN set", {}, 0x6042},
+        {"7XNN add", {}, 0x7001},
+        {"8XY0 assign", {}, 0x8010},
+        {"8XY1 or", {}, 0x8011},
+        {"8XY2 and", {}, 0x8012},
+        {"8XY3 xor", {}, 0x8013},
+        {"8XY4 add with carry", {0x6103}, 0x8014},
+        {"8XY5 subtract with borrow", {0x6103}, 0x8015},
+        {"9XY0 skip not taken", {0x6101}, 0x9010},
+        {"ANNN set I", {}, 0xA800},
+        {"BNNN jump plus V0", {}, 0xB000, 0, target::next_instruction},
+        {"CXNN random", {}, 0xC0FF},
+        {"DXYN draw 5 rows", {0xF029}, 0xD015},
+        {"DXYN draw 15 rows unaligned", {0x6003, 0x6105}, 0xD01F},
+        {"EX9E skip if key not taken", {}, 0xE09E},
+        {"FX07 read delay timer", {}, 0xF007},
+        {"FX15 set delay timer", {0x6010}, 0xF015},
+        {"FX18 set sound timer", {0x6010}, 0xF018},
+        {"FX29 font address", {}, 0xF029},
+        {"FX33 store BCD", {0x60FF, 0xA800}, 0xF033},
+        {"FX55 store V0-VF", {0xA800}, 0xFF55},
+        {"FX65 load V0-VF", {0xA800}, 0xFF65},
+        {"6XNN+DXYN set and draw", {0xF029}, 0x6005, 0xD015},
+        {"7XNN+3XNN add and skip", {}, 0x7001, 0x3000},
+    };
+    return cases;
+}
+
+static rom_image build_opcode_rom(const opcode_case& test)
+{
+    rom_image rom;
+    for(const auto opcode : test.setup)
+    {
+        emit(rom, opcode);
+    }
+
+    const auto loop = static_cast<chip8::opcode_t>(PROGRAM_START + rom.size());
+    for(auto slot = 0; slot != OPCODE_SLOTS; slot++)
+    {
+        const auto address = static_cast<chip8::opcode_t>(PROGRAM_START + rom.size());
+
+        auto opcode = slot % 2 != 0 && test.second != 0 ? test.second : test.first;
+        if(test.address == target::next_instruction)
+        {
+            opcode = static_cast<chip8::opcode_t>(opcode | (address + 2));
+        }
+        if(test.address == target::subroutine)
+        {
+            opcode = static_cast<chip8::opcode_t>(opcode | SUBROUTINE);
+        }
+        emit(rom, opcode);
+    }
+    // A second jump catches a skip taken by the last slot
+    emit(rom, static_cast<chip8::opcode_t>(0x1000 | loop));
+    emit(rom, static_cast<chip8::opcode_t>(0x1000 | loop));
+
+    rom.resize(SUBROUTINE - PROGRAM_START);
+    emit(rom, 0x00EE);
+    return rom;
+}
+
+struct named_rom
+{
+    std::string name;
+    rom_image image;
+};
+
+// Synthetic programs standing in for the kinds of load real ROMs put on the core
+static std::vector<named_rom> bundled_roms()
+{
+    return {
+        // Register arithmetic and skips only
+        {"synthetic/alu", assemble({
+                              0x6000, // 200: V0 = 0
+                              0x6101, // 202: V1 = 1
+                              0x7001, // 204: V0 += 1
+                              0x8014, // 206: V0 += V1
+                              0x8202, // 208: V2 &= V0
+                              0x8303, // 20A: V3 ^= V0
+                              0x8415, // 20C: V4 -= V1
+                              0x4000, // 20E: skip unless V0 == 0
+                              0x6000, // 210: V0 = 0
+                              0x1204, // 212: jump 204
+                          })},
+        // Font sprites walking over the screen, cleared every 256 draws
+        {"synthetic/sprites", assemble({
+                                  0x00E0, // 200: clear
+                                  0x6000, // 202: V0 = 0
+                                  0x6100, // 204: V1 = 0
+                                  0x6200, // 206: V2 = 0
+                                  0xF229, // 208: I = font(V2)
+                                  0xD015, // 20A: draw
+                                  0x7005, // 20C: V0 += 5
+                                  0x7103, // 20E: V1 += 3
+                                  0x7201, // 210: V2 += 1
+                                  0x7301, // 212: V3 += 1
+                                  0x3300, // 214: skip if V3 == 0
+                                  0x1208, // 216: jump 208
+                                  0x00E0, // 218: clear
+                                  0x1208, // 21A: jump 208
+                              })},
+        // Random sprites, a subroutine doing BCD and register stores, timers and a key check
+        {"synthetic/mixed", assemble({
+                                0x6A00, // 200: VA = 0
+                                0xC03F, // 202: V0 = random & 3F
+                                0xC11F, // 204: V1 = random & 1F
+                                0xF029, // 206: I = font(V0)
+                                0xD015, // 208: draw
+                                0x2220, // 20A: call 220
+                                0xF107, // 20C: V1 = delay
+                                0x3100, // 20E: skip if V1 == 0
+                                0x1202, // 210: jump 202
+                                0x6B04, // 212: VB = 4
+                                0xFB15, // 214: delay = VB
+                                0xE59E, // 216: skip if key 5 is down
+                                0x1202, // 218: jump 202
+                                0x00E0, // 21A: clear
+                                0x1202, // 21C: jump 202
+                                0x0000, // 21E
+                                0xA300, // 220: I = 300
+                                0xFA33, // 222: BCD of VA
+                                0xFA55, // 224: store V0-VA
+                                0xFA65, // 226: load V0-VA
+                                0x7A01, // 228: VA += 1
+                                0x00EE, // 22A: return
+                            })},
+    };
+}
+
+static std::unique_ptr<chip8::machine> make_machine(const rom_image& rom, const chip8::backend engine)
+{
+    // Idle loops are measured like any other code rather than fast-forwarded
+    auto vm = std::make_unique<chip8::machine>();
+    vm->set_backend(engine);
+    vm->set_idle_skip(false);
+    vm->load(rom.data(), rom.size());
+    return vm;
+}
+
+// Best of several timed runs, after a warm-up that fills the decode and block caches
+static double best_seconds(chip8::machine& vm, const std::uint64_t cycles, const unsigned repeats)
+{
+    vm.run_cycles(std::min<std::uint64_t>(cycles / 16, 65536));
+
+    auto best = HUGE_VAL;
+    for(unsigned i = 0; i != repeats; i++)
+    {
+        const auto start = clock_type::now();
+        vm.run_cycles(cycles);
+        best = std::min(best, seconds_since(start));
+    }
+    return best;
+}
+
+class json_writer
+{
+public:
+    explicit json_writer(std::FILE* out)
+        : out(out)
+    {
+    }
+
+    void begin_object(const char* key = nullptr)
+    {
+        open(key, '{');
+    }
+
+    void end_object()
+    {
+        close('}');
+    }
+
+    void begin_array(const char* key = nullptr)
+    {
+        open(key, '[');
+    }
+
+    void end_array()
+    {
+        close(']');
+    }
+
+    void value(const char* key, const std::string_view text)
+    {
+        separate(key);
+        std::fputc('"', out);
+        for(const auto c : text)
+        {
+            if(c == '"' || c == '\\')
+            {
+                std::fputc('\\', out);
+            }
+            if(static_cast<unsigned char>(c) < 0x20)
+            {
+                std::fprintf(out, "\\u%04x", c);
+                continue;
+            }
+            std::fputc(c, out);
+        }
+        std::fputc('"', out);
+    }
+
+    // Without this overload string literals would pick the bool one
+    void value(const char* key, const char* text)
+    {
+        value(key, std::string_view(text));
+    }
+
+    void value(const char* key, const double number)
+    {
+        separate(key);
+        std::fprintf(out, std::isfinite(number) ? "%.6g" : "null", number);
+    }
+
+    void value(const char* key, const std::uint64_t number)
+    {
+        separate(key);
+        std::fprintf(out, "%llu", static_cast<unsigned long long>(number));
+    }
+
+    void value(const char* key, const bool flag)
+    {
+        separate(key);
+        std::fputs(flag ? "true" : "false", out);
+    }
+
+private:
+    void separate(const char* key)
+    {
+        if(needs_comma)
+        {
+            std::fputc(',', out);
+        }
+        std::fputc('\n', out);
+        std::fprintf(out, "%*s", depth * 2, "");
+        if(key != nullptr)
+        {
+            std::fprintf(out, "\"%s\": ", key);
+        }
+        needs_comma = true;
+    }
+
+    void open(const char* key, const char bracket)
+    {
+        if(depth != 0)
+        {
+            separate(key);
+        }
+        std::fputc(bracket, out);
+        depth++;
+        needs_comma = false;
+    }
+
+    void close(const char bracket)
+    {
+        depth--;
+        std::fputc('\n', out);
+        std::fprintf(out, "%*s%c", depth * 2, "", bracket);
+        needs_comma = true;
+        if(depth == 0)
+        {
+            std::fputc('\n', out);
+        }
+    }
+
+    std::FILE* out;
+    int depth        = 0;
+    bool needs_comma = false;
+};
+
+static void bench_opcodes(json_writer& json, const settings& config)
+{
+    json.begin_array("opcodes");
+    for(const auto& test : opcode_cases())
+    {
+        const auto rom = build_opcode_rom(test);
+        for(const auto engine : BACKENDS)
+        {
+            auto vm            = make_machine(rom, engine);
+            const auto seconds = best_seconds(*vm, config.opcode_cycles, config.repeats);
+
+            json.begin_object();
+            json.value("name", test.name);
+            json.value("backend", backend_name(vm->current_backend()));
+            json.value("ns_per_instruction", seconds * 1e9 / static_cast<double>(config.opcode_cycles));
+            json.value("mips", static_cast<double>(config.opcode_cycles) / seconds / 1e6);
+            json.end_object();
+        }
+    }
+    json.end_array();
+}
+
+static void bench_roms(json_writer& json, const settings& config, const std::vector<named_rom>& roms)
+{
+    json.begin_array("roms");
+    for(const auto& rom : roms)
+    {
+        for(const auto engine : BACKENDS)
+        {
+            auto vm = make_machine(rom.image, engine);
+
+            std::string error;
+            double seconds = 0;
+            try
+            {
+                seconds = best_seconds(*vm, config.rom_cycles, config.repeats);
+            }
+            catch(const std::exception& e)
+            {
+                error = e.what();
+            }
+
+            json.begin_object();
+            json.value("name", rom.name);
+            json.value("backend", backend_name(vm->current_backend()));
+            if(error.empty())
+            {
+                json.value("instructions", config.rom_cycles);
+                json.value("seconds", seconds);
+                json.value("mips", static_cast<double>(config.rom_cycles) / seconds / 1e6);
+            }
+            else
+            {
+                json.value("error", error);
+            }
+            json.end_object();
+        }
+    }
+    json.end_array();
+}
+
+// Nanoseconds per call of work, best of the configured repeats
+template<typename Work>
+static double time_per_call(const settings& config, const unsigned calls, Work&& work)
+{
+    auto best = HUGE_VAL;
+    for(unsigned repeat = 0; repeat != config.repeats; repeat++)
+    {
+        const auto start = clock_type::now();
+        for(unsigned i = 0; i != calls; i++)
+        {
+            work(i);
+        }
+        best = std::min(best, seconds_since(start));
+    }
+    return best * 1e9 / calls;
+}
+
+static void bench_display(json_writer& json, const settings& config)
+{
+    static const unsigned char sprite[15] = {0xF0, 0x90, 0x90, 0x90, 0xF0, 0x3C, 0x42, 0x81,
+                                             0x81, 0x42, 0x3C, 0xFF, 0x00, 0xAA, 0x55};
+
+    chip8::display_rows rows = {};
+    chip8::row_mask changed  = 0;
+    std::uint64_t collisions = 0;
+
+    const auto draws = config.draw_iterations;
+
+    std::vector<std::pair<const char*, double>> results;
+    const auto time_draw = [&](const char* name, const unsigned step, const unsigned height,
+                               const chip8::sprite_edge edge) {
+        results.emplace_back(name, time_per_call(config, draws, [&](const unsigned i) {
+            collisions += chip8::draw_sprite_rows(rows, i * step, i * 3, sprite, height, edge, changed);
+        }));
+    };
+    time_draw("draw_sprite 8 rows aligned clip", 8, 8, chip8::sprite_edge::clip);
+    time_draw("draw_sprite 15 rows unaligned clip", 7, 15, chip8::sprite_edge::clip);
+    time_draw("draw_sprite 15 rows unaligned wrap", 7, 15, chip8::sprite_edge::wrap);
+
+    results.emplace_back("clear_rows", time_per_call(config, draws / 16, [&](const unsigned i) {
+        rows[i % chip8::DRAW_BUFFER_HEIGHT] = i;
+        changed |= chip8::clear_rows(rows);
+    }));
+    results.emplace_back("hash_rows", time_per_call(config, draws / 16, [&](const unsigned i) {
+        rows[i % chip8::DRAW_BUFFER_HEIGHT] ^= i;
+        collisions += chip8::hash_rows(rows);
+    }));
+
+    // The frontend's full-frame upload paths
+    chip8::draw_buffer bytes;
+    std::vector<std::uint32_t> pixels(chip8::DRAW_BUFFER_WIDTH * chip8::DRAW_BUFFER_HEIGHT);
+    results.emplace_back("expand_to_bytes", time_per_call(config, draws / 64, [&](const unsigned i) {
+        rows[i % chip8::DRAW_BUFFER_HEIGHT] ^= i;
+        chip8::expand_to_bytes(rows, bytes);
+        collisions += bytes[i % sizeof bytes];
+    }));
+    results.emplace_back("expand_to_rgba", time_per_call(config, draws / 64, [&](const unsigned i) {
+        rows[i % chip8::DRAW_BUFFER_HEIGHT] ^= i;
+        chip8::expand_to_rgba(rows, pixels.data(), 0xFFFFFF, 0);
+        collisions += pixels[i % pixels.size()];
+    }));
+    sink = collisions + changed;
+
+    json.begin_array("display");
+    for(const auto& [name, ns] : results)
+    {
+        json.begin_object();
+        json.value("name", name);
+        json.value("ns_per_call", ns);
+        json.end_object();
+    }
+    json.end_array();
+}
+
+static double percentile(const std::vector<double>& sorted, const double fraction)
+{
+    const auto rank = static_cast<std::size_t>(std::ceil(fraction * static_cast<double>(sorted.size())));
+    return sorted[std::clamp<std::size_t>(rank, 1, sorted.size()) - 1];
+}
+
+// Times what a frontend does every frame: run the frame, then expand the display when it changed
+static void bench_frames(json_writer& json, const settings& config, const std::vector<named_rom>& roms)
+{
+    std::vector<std::uint32_t> pixels(chip8::DRAW_BUFFER_WIDTH * chip8::DRAW_BUFFER_HEIGHT);
+    std::vector<double> frame_us(config.frames);
+
+    json.begin_array("frames");
+    for(const auto& rom : roms)
+    {
+        for(const auto engine : BACKENDS)
+        {
+            auto vm = make_machine(rom.image, engine);
+            vm->set_cycles_per_frame(config.frame_cycles);
+
+            std::string error;
+            try
+            {
+                for(auto& us : frame_us)
+                {
+                    const auto start = clock_type::now();
+                    vm->run_frame();
+                    if(vm->take_dirty_rows() != 0)
+                    {
+                        chip8::expand_to_rgba(vm->display(), pixels.data(), 0xFFFFFF, 0);
+                    }
+                    us = seconds_since(start) * 1e6;
+                }
+            }
+            catch(const std::exception& e)
+            {
+                error = e.what();
+            }
+
+            json.begin_object();
+            json.value("name", rom.name);
+            json.value("backend", backend_name(vm->current_backend()));
+            json.value("cycles_per_frame", std::uint64_t{config.frame_cycles});
+            if(error.empty())
+            {
+                std::ranges::sort(frame_us);
+                json.value("frames", std::uint64_t{config.frames});
+                json.value("p50_us", percentile(frame_us, 0.50));
+                json.value("p90_us", percentile(frame_us, 0.90));
+                json.value("p99_us", percentile(frame_us, 0.99));
+                json.value("max_us", frame_us.back());
+            }
+            else
+            {
+                json.value("error", error);
+            }
+            json.end_object();
+        }
+    }
+    json.end_array();
+}
+
+// Aggregate MIPS of lanes machines run one after the other on each backend against the same lanes in lockstep
+static void bench_lockstep(json_writer& json, const settings& config, const std::vector<named_rom>& roms)
+{
+    const auto cycles = config.rom_cycles / chip8::MAX_LOCKSTEP_LANES;
+
+    json.begin_array("lockstep");
+    for(const auto& rom : roms)
+    {
+        for(const unsigned lanes : {8u, 16u, 32u})
+        {
+            const auto instructions = static_cast<double>(cycles) * lanes;
+
+            json.begin_object();
+            json.value("name", rom.name);
+            json.value("lanes", std::uint64_t{lanes});
+
+            json.begin_array("machines");
+            for(const auto engine : BACKENDS)
+            {
+                std::vector<std::unique_ptr<chip8::machine>> machines;
+                for(unsigned lane = 0; lane != lanes; lane++)
+                {
+                    machines.push_back(make_machine(rom.image, engine));
+                    machines.back()->seed(lane);
+                }
+
+                std::string error;
+                const auto start = clock_type::now();
+                for(auto& vm : machines)
+                {
+                    try
+                    {
+                        vm->run_cycles(cycles);
+                    }
+                    catch(const std::exception& e)
+                    {
+                        error = e.what();
+                    }
+                }
+                const auto seconds = seconds_since(start);
+
+                json.begin_object();
+                json.value("backend", backend_name(machines.front()->current_backend()));
+                if(error.empty())
+                {
+                    json.value("mips", instructions / seconds / 1e6);
+                }
+                else
+                {
+                    json.value("error", error);
+                }
+                json.end_object();
+            }
+            json.end_array();
+
+            auto group = std::make_unique<chip8::lockstep_machines>(lanes);
+            group->load(rom.image.data(), rom.image.size());
+            for(unsigned lane = 0; lane != lanes; lane++)
+            {
+                group->seed(lane, lane);
+            }
+
+            const auto start = clock_type::now();
+            group->run_cycles(cycles);
+            const auto seconds = seconds_since(start);
+
+            json.value("instruction_set", chip8::lockstep_instruction_set());
+            if(group->faulted_lanes() == 0)
+            {
+                json.value("lockstep_mips", instructions / seconds / 1e6);
+                json.value("occupancy", group->stats().occupancy());
+            }
+            else
+            {
+                json.value("error", group->fault(static_cast<unsigned>(std::countr_zero(group->faulted_lanes()))));
+            }
+            json.end_object();
+        }
+    }
+    json.end_array();
+}
+
+static const char* compiler_name()
+{
+#if defined(__clang__)
+    return "clang " __clang_version__;
+#elif defined(__GNUC__)
+    return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+    return "msvc";
+#else
+    return "unknown";
+#endif
+}
+
+int main(int argc, char* argv[])
+{
+    settings config;
+    const char* output_path = nullptr;
+
+    auto roms = bundled_roms();
+
+    for(int i = 1; i < argc; i++)
+    {
+        const std::string_view arg = argv[i];
+
+        const bool has_value = i + 1 < argc;
+        if(arg == "--quick")
+        {
+            config.opcode_cycles   = 1 << 16;
+            config.rom_cycles      = 1 << 18;
+            config.draw_iterations = 1 << 16;
+            config.frames          = 600;
+            config.repeats         = 2;
+        }
+        else if(arg == "--cycles-per-frame" && has_value && parse_number(argv[i + 1], config.frame_cycles) &&
+                config.frame_cycles != 0)
+        {
+            i++;
+        }
+        else if(arg == "--output" && has_value)
+        {
+            output_path = argv[++i];
+        }
+        else if(arg.starts_with("--"))
+        {
+            std::fprintf(stderr, "Unknown or incomplete option %s\n", argv[i]);
+            std::fprintf(stderr, "Usage: %s [--quick] [--cycles-per-frame N] [--output FILE] [rom...]\n", argv[0]);
+            return 1;
+        }
+        else
+        {
+            std::ifstream is(argv[i], std::ios::binary);
+            if(is.is_open() == false)
+            {
+                std::fprintf(stderr, "Could not open %s\n", argv[i]);
+                return 1;
+            }
+            roms.push_back({argv[i], rom_image(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>())});
+        }
+    }
+
+    std::unique_ptr<std::FILE, decltype(&std::fclose)> file(nullptr, &std::fclose);
+    if(output_path != nullptr)
+    {
+        file.reset(std::fopen(output_path, "w"));
+        if(file == nullptr)
+        {
+            std::fprintf(stderr, "Could not write %s\n", output_path);
+            return 1;
+        }
+    }
+
+    json_writer json(file != nullptr ? file.get() : stdout);
+    json.begin_object();
+    json.value("version", std::uint64_t{1});
+    json.value("compiler", compiler_name());
+    json.value("jit", chip8::jit_cache::supported());
+    json.value("trace_level", static_cast<std::uint64_t>(chip8::TRACE_LEVEL));
+
+    std::fprintf(stderr, "Opcodes...\n");
+    bench_opcodes(json, config);
+    std::fprintf(stderr, "ROMs...\n");
+    bench_roms(json, config, roms);
+    std::fprintf(stderr, "Display...\n");
+    bench_display(json, config);
+    std::fprintf(stderr, "Frames...\n");
+    bench_frames(json, config, roms);
+    std::fprintf(stderr, "Lockstep...\n");
+    bench_lockstep(json, config, roms);
+
+    json.end_object();
+    return 0;
+}
@@ -0,0 +1,190 @@
+#include "block_cache.h"
+
+#include <algorithm>
+
+namespace chip8
+{
+    // Dead records are only reclaimed by dropping the whole cache once they dominate it
+    static constexpr auto MIN_OPS_BEFORE_COMPACTION = 4096;
+
+    static bool ends_block(const op handler)
+    {
+        switch(handler)
+        {
+            case op::unsupported:
+            case op::return_from_subroutine:
+            case op::jump_to:
+            case op::call_func:
+            case op::jump_if_equal:
+            case op::jump_if_not_equal:
+            case op::jump_if_registers_equal:
+            case op::jump_if_registers_not_equal:
+            case op::jump_to_address:
+            case op::jump_if_key_pressed:
+            case op::jump_if_key_not_pressed:
+            case op::wait_for_key_press:           // Runs again until a key goes down
+            case op::exit_interpreter:             // Runs again for good
+            case op::assign_long_address_register: // Its second half is not an instruction
+            case op::store_bcd:                    // Stores may overwrite the block that is running
+            case op::fill_memory_with_registers:   //
+            case op::save_register_range:          //
+            case op::add_and_jump_if_equal:
+            case op::add_and_jump_if_not_equal:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // The superinstruction replacing first followed by second, or op::undecoded if the pair does not fuse
+    static op fuse(const op first, const op second)
+    {
+        if(first == op::set_register_to_value && second == op::draw_sprite)
+        {
+            return op::set_register_and_draw;
+        }
+        if(first == op::add_assign_register_to_value && second == op::jump_if_equal)
+        {
+            return op::add_and_jump_if_equal;
+        }
+        if(first == op::add_assign_register_to_value && second == op::jump_if_not_equal)
+        {
+            return op::add_and_jump_if_not_equal;
+        }
+        return op::undecoded;
+    }
+
+    block_cache::block_cache(const std::size_t memory_size)
+        : memory_size(memory_size)
+        , block_at(memory_size, 0)
+        , page_has_code((memory_size + CODE_PAGE_SIZE - 1) / CODE_PAGE_SIZE, false)
+        , page_rewrites(page_has_code.size(), 0)
+    {
+    }
+
+    const translated_block& block_cache::lookup(const unsigned char* memory, const unsigned short pc)
+    {
+        if(const auto id = block_at[pc]; id != 0)
+        {
+            return blocks[id - 1];
+        }
+        return translate(memory, pc);
+    }
+
+    const decoded_instruction* block_cache::ops_of(const translated_block& block) const
+    {
+        return ops.data() + block.first_op;
+    }
+
+    const translated_block& block_cache::translate(const unsigned char* memory, const unsigned short pc)
+    {
+        translated_block block = {
+            .first_op          = static_cast<unsigned>(ops.size()),
+            .op_count          = 0,
+            .instruction_count = 0,
+            .start             = pc,
+            .first_page        = static_cast<unsigned>(pc) / CODE_PAGE_SIZE,
+            .last_page         = static_cast<unsigned>(pc) / CODE_PAGE_SIZE,
+            .alive             = true,
+        };
+
+        unsigned address             = pc;
+        bool previous_is_second_half = false;
+        while(block.instruction_count != MAX_BLOCK_INSTRUCTIONS && address + 1 < memory_size)
+        {
+            // Translating code that is about to be overwritten again costs more than interpreting it
+            if(page_rewrites[address / CODE_PAGE_SIZE] == SELF_MODIFYING_REWRITES)
+            {
+                break;
+            }
+
+            const auto instruction = decode(static_cast<unsigned short>(memory[address] << 8 | memory[address + 1]));
+
+            // A record that already completes a pair cannot start another one
+            const auto fused = block.op_count == 0 || previous_is_second_half
+                                   ? op::undecoded
+                                   : fuse(ops.back().handler, instruction.handler);
+            if(fused != op::undecoded)
+            {
+                ops.back().handler = fused;
+            }
+            previous_is_second_half = fused != op::undecoded;
+
+            ops.push_back(instruction);
+            block.op_count++;
+            block.instruction_count++;
+            address += 2;
+
+            if(ends_block(instruction.handler))
+            {
+                break;
+            }
+        }
+
+        if(address != pc)
+        {
+            block.last_page = (address - 1) / CODE_PAGE_SIZE;
+        }
+
+        // Blocks on self-modifying pages only tell the caller to interpret, which stays valid whatever gets written
+        if(page_rewrites[block.first_page] != SELF_MODIFYING_REWRITES)
+        {
+            for(auto page = block.first_page; page <= block.last_page; page++)
+            {
+                page_has_code[page] = true;
+            }
+        }
+
+        blocks.push_back(block);
+        block_at[pc] = static_cast<unsigned>(blocks.size());
+        return blocks.back();
+    }
+
+    void block_cache::invalidate(const unsigned address, const unsigned size)
+    {
+        if(size == 0)
+        {
+            return;
+        }
+
+        // An instruction starting on the previous page can reach one byte into the written range
+        const auto first_page = (address == 0 ? 0 : address - 1) / CODE_PAGE_SIZE;
+        const auto last_page  = (address + size - 1) / CODE_PAGE_SIZE;
+        for(auto page = first_page; page <= last_page && page < page_has_code.size(); page++)
+        {
+            if(page_has_code[page])
+            {
+                invalidate_page(page);
+            }
+        }
+
+        if(dead_ops > MIN_OPS_BEFORE_COMPACTION && dead_ops * 2 > ops.size())
+        {
+            clear();
+        }
+    }
+
+    void block_cache::invalidate_page(const unsigned page)
+    {
+        for(auto& block : blocks)
+        {
+            if(block.alive && block.first_page <= page && page <= block.last_page)
+            {
+                block.alive           = false;
+                block_at[block.start] = 0;
+                dead_ops += block.op_count;
+            }
+        }
+        page_has_code[page]  = false;
+        page_rewrites[page] += page_rewrites[page] < SELF_MODIFYING_REWRITES;
+    }
+
+    void block_cache::clear()
+    {
+        blocks.clear();
+        ops.clear();
+        std::fill(block_at.begin(), block_at.end(), 0);
+        std::fill(page_has_code.begin(), page_has_code.end(), false);
+        dead_ops = 0;
+    }
+} // namespace chip8
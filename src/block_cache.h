@@ -0,0 +1,59 @@
+#pragma once
+
+#include "decoder.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace chip8
+{
+    // Stores into a page that holds translated code drop every block touching that page
+    static constexpr auto CODE_PAGE_SIZE = 256;
+
+    // Longest straight-line run translated into a single block
+    static constexpr auto MAX_BLOCK_INSTRUCTIONS = 64;
+
+    // Code pages invalidated this many times are treated as self-modifying and left to the interpreter
+    static constexpr auto SELF_MODIFYING_REWRITES = 32;
+
+    struct translated_block
+    {
+        unsigned first_op;                // Index of the block's first record in the op pool
+        unsigned short op_count;          // Records, including the second halves of fused pairs
+        unsigned short instruction_count; // Guest instructions the block retires
+        unsigned start;
+        unsigned first_page;
+        unsigned last_page;
+        bool alive;
+    };
+
+    // Straight-line runs of decoded instructions keyed by start address. A block runs until the first branch,
+    // skip or store, and common instruction pairs are fused into superinstructions: the fused op replaces the
+    // first record and its handler consumes the record after it.
+    class block_cache
+    {
+    public:
+        explicit block_cache(const std::size_t memory_size);
+
+        // Returns the block starting at pc, translating it from memory on a miss
+        const translated_block& lookup(const unsigned char* memory, const unsigned short pc);
+
+        const decoded_instruction* ops_of(const translated_block& block) const;
+
+        void invalidate(const unsigned address, const unsigned size);
+        void clear();
+
+    private:
+        const translated_block& translate(const unsigned char* memory, const unsigned short pc);
+        void invalidate_page(const unsigned page);
+
+        std::size_t memory_size;
+
+        std::vector<translated_block> blocks;
+        std::vector<decoded_instruction> ops;
+        std::vector<unsigned> block_at; // Block id + 1 for every start address, 0 when none
+        std::vector<bool> page_has_code;
+        std::vector<unsigned char> page_rewrites;
+        std::size_t dead_ops = 0;
+    };
+} // namespace chip8
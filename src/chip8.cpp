@@ -1,47 +1,49 @@
 #include "chip8.h"
 
+#include "aot.h"
+#include "profile.h"
+#include "trace.h"
+
 #include <algorithm>
-#include <bitset>
+#include <bit>
+#include <cstring>
 #include <fstream>
-#include <functional>
 #include <ios>
-#include <iostream>
-#include <random>
-#include <sstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
 #include <utility>
 
+// Computed goto is a GCC/Clang extension, everything else falls back to a switch.
+// Define CHIP8_THREADED_DISPATCH=0 to force the switch.
+#ifndef CHIP8_THREADED_DISPATCH
+#if defined(__GNUC__) || defined(__clang__)
+#define CHIP8_THREADED_DISPATCH 1
+#else
+#define CHIP8_THREADED_DISPATCH 0
+#endif
+#endif
+
+// GCC merges the identical dispatch tails of the threaded handlers back into one shared indirect jump, which
+// undoes the point of threading them
+#if CHIP8_THREADED_DISPATCH && defined(__GNUC__) && !defined(__clang__)
+#define CHIP8_NO_TAIL_MERGING __attribute__((optimize("no-crossjumping", "no-gcse")))
+#else
+#define CHIP8_NO_TAIL_MERGING
+#endif
+
 namespace chip8
 {
     namespace ranges = std::ranges;
 
-    using opcode_t      = unsigned short;
-    using register_t    = unsigned char;
-    using stack_entry_t = unsigned short;
-
-    static unsigned char memory[4096];
-
-    static register_t V[16];
-
-    static register_t& flag_register = V[15];
-
-    static unsigned short I;
-    static unsigned short pc;
-
-    static draw_buffer gfx;
-
-    static unsigned char delay_timer;
-    static unsigned char sound_timer;
+    // How often a running machine checks whether it went idle, in cycles
+    static constexpr std::uint64_t IDLE_CHECK_INTERVAL = 1024;
 
-    static constexpr auto STACK_SIZE = 16;
+    // FX07, 3X00 and the jump back
+    static constexpr std::uint64_t DELAY_LOOP_LENGTH = 3;
 
-    static stack_entry_t stack[STACK_SIZE];
-    static stack_entry_t* sp = nullptr;
-
-    static bool key_state[16];
-
-    static bool draw_this_frame = false;
-
-    unsigned char chip8_fontset[80] = {
+    const unsigned char chip8_fontset[FONTSET_SIZE] = {
         0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
         0x20, 0x60, 0x20, 0x20, 0x70, // 1
         0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
@@ -60,7 +62,37 @@ namespace chip8
         0xF0, 0x80, 0xF0, 0x80, 0x80  // F
     };
 
-    static constexpr auto PROGRAM_OFFSET = 0x200;
+    const unsigned char big_fontset[BIG_FONTSET_SIZE] = {
+        0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+        0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+        0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+        0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+        0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+        0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+        0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+        0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+    };
+
+    // Compiles to nothing unless the build's CHIP8_TRACE_LEVEL is at least Level
+    template<trace_level Level>
+    static inline void trace(trace_ring* ring, const trace_record& record)
+    {
+        if constexpr(TRACE_LEVEL >= Level)
+        {
+            if(ring != nullptr && ring->try_push(record) == false)
+            {
+                ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
 
     static inline void clear_buffer(auto& buffer)
     {
@@ -73,245 +105,469 @@ namespace chip8
         return static_cast<unsigned char>(reg & 0xF);
     }
 
-    static bool paint_row_pixels_at(const int x, const int y, unsigned char memory_row)
+    // Instructions of a later mode than the profile's fail like any other unsupported opcode
+    template<typename Quirks, machine_mode Mode>
+    static void require_mode()
+    {
+        if constexpr(Quirks::flags.mode < Mode)
+        {
+            throw std::invalid_argument("Unsupported operation");
+        }
+    }
+
+    machine::machine()
+        : memory(base_memory)
+        , decoded(base_decoded)
+        , blocks(MEMORY_SIZE)
     {
-        static constexpr auto ROW_WIDTH = 8;
+        set_quirks(DEFAULT_QUIRKS);
+        init();
+    }
 
-        bool flipped = false;
+    machine::~machine()
+    {
+        detach_trace();
+    }
 
-        for(auto i = 0; i != ROW_WIDTH; i++)
+    void machine::attach_trace(trace_drain& drain)
+    {
+        if constexpr(TRACE_LEVEL != trace_level::off)
         {
-            static constexpr auto FIRST_PIXEL_POSITION = 0x80;
+            detach_trace();
+            trace_output      = std::make_unique<trace_ring>();
+            trace_destination = &drain;
+            drain.attach(*trace_output);
+        }
+    }
 
-            // Only entries with 1 require action
-            if((memory_row & (FIRST_PIXEL_POSITION >> i)) == 0)
-            {
-                continue;
-            }
+    void machine::detach_trace()
+    {
+        if(trace_destination != nullptr)
+        {
+            trace_destination->detach(*trace_output);
+        }
+        trace_destination = nullptr;
+        trace_output.reset();
+    }
 
-            const int index = y * 64 + x + i;
-            flipped |= gfx[index] == 1;
-            gfx[index] ^= 1;
+    void machine::enable_profile()
+    {
+        if constexpr(PROFILING)
+        {
+            profiler = std::make_unique<profile>();
         }
+    }
+
+    void machine::disable_profile()
+    {
+        profiler.reset();
+    }
+
+    const profile* machine::current_profile() const
+    {
+        return profiler.get();
+    }
+
+    register_t& machine::flag_register()
+    {
+        return state.V[15];
+    }
+
+    register_t& machine::get_first_register(const decoded_instruction& instruction)
+    {
+        const auto index = instruction.x;
+
+        trace<trace_level::verbose>(trace_output.get(), {instructions_executed, state.pc, 0, trace_event::register_read,
+                                                         index, state.V[index]});
+
+        return state.V[index];
+    }
+
+    register_t& machine::get_second_register(const decoded_instruction& instruction)
+    {
+        const auto index = instruction.y;
+
+        trace<trace_level::verbose>(trace_output.get(), {instructions_executed, state.pc, 0, trace_event::register_read,
+                                                         index, state.V[index]});
 
-        return flipped;
+        return state.V[index];
     }
 
-    static inline unsigned short get_memory_address_from_opcode(const opcode_t opcode)
+    void machine::next_instruction()
     {
-        return static_cast<unsigned short>(opcode & 0x0FFF);
+        state.pc += 2;
     }
 
-    static register_t& get_first_register_from_opcode(const opcode_t opcode)
+    void machine::jump_next_instruction()
     {
-        std::cout << __FUNCTION__ << std::endl;
+        state.pc += 4;
+    }
 
-        auto index = opcode & 0x0F00;
-        index >>= 8;
+    const decoded_instruction& machine::fetch()
+    {
+        if(state.pc + 1u >= memory_size)
+        {
+            throw std::out_of_range("Program counter outside of memory range");
+        }
 
-        std::cout << std::hex << "register " << index << " value " << static_cast<int>(V[index]) << std::endl;
+        auto& instruction = decoded[state.pc];
+        if(instruction.handler == op::undecoded)
+        {
+            auto first_half_opcode  = memory[state.pc];
+            auto second_half_opcode = memory[state.pc + 1];
 
-        return V[index];
+            instruction = decode(static_cast<opcode_t>(first_half_opcode << 8 | second_half_opcode));
+        }
+        return instruction;
     }
 
-    register_t& get_second_register_from_opcode(const opcode_t opcode)
+    void machine::invalidate_code(const unsigned address, const unsigned size)
     {
-        std::cout << __FUNCTION__ << std::endl;
+        blocks.invalidate(address, size);
+        if(compiled != nullptr)
+        {
+            compiled->invalidate(address, size);
+        }
+        if(native != nullptr)
+        {
+            check_native_blocks(address, size);
+        }
 
-        auto index = opcode & 0x00F0;
-        index >>= 4;
+        // An instruction starting one byte before the written range also contains a written byte
+        const auto begin = address == 0 ? 0u : address - 1;
+        const auto end   = std::min(address + size, memory_size);
+        for(auto i = begin; i < end; i++)
+        {
+            decoded[i].handler = op::undecoded;
+        }
+    }
 
-        std::cout << std::hex << "register " << index << " value " << static_cast<int>(V[index]) << std::endl;
+    opcode_t machine::opcode_at(const unsigned address) const
+    {
+        return address + 1 < memory_size ? static_cast<opcode_t>(memory[address] << 8 | memory[address + 1]) : 0;
+    }
 
-        return V[index];
+    std::uint64_t machine::current_frame() const
+    {
+        return frame_at(instructions_executed);
     }
 
-    register_t get_value_from_opcode_nn(const opcode_t opcode)
+    std::uint64_t machine::frame_at(const std::uint64_t cycle) const
     {
-        std::cout << __FUNCTION__ << std::endl;
-        register_t value = static_cast<register_t>(opcode & 0x00FF);
-        std::cout << "Value from opcode " << static_cast<int>(value) << std::endl;
-        return value;
+        return frame_base + (cycle - cycle_base) / frame_cycles;
     }
 
-    register_t get_value_from_opcode_n(const opcode_t opcode)
+    unsigned char machine::timer_value(const timer& countdown) const
     {
-        std::cout << __FUNCTION__ << std::endl;
-        register_t value = static_cast<register_t>(opcode & 0x000F);
-        std::cout << "Value from opcode " << static_cast<int>(value) << std::endl;
-        return value;
+        return timer_value_at(countdown, instructions_executed);
     }
 
-    unsigned short get_value_from_opcode_nnn(const opcode_t opcode)
+    unsigned char machine::timer_value_at(const timer& countdown, const std::uint64_t cycle) const
     {
-        std::cout << __FUNCTION__ << std::endl;
+        const auto elapsed = frame_at(cycle) - countdown.set_in_frame;
+        return static_cast<unsigned char>(elapsed >= countdown.value ? 0 : countdown.value - elapsed);
+    }
 
-        unsigned short value = static_cast<unsigned short>(opcode & 0x0FFF);
-        std::cout << "Value from opcode " << static_cast<int>(value) << std::endl;
-        return value;
+    std::uint64_t machine::frame_start_cycle(const std::uint64_t frame) const
+    {
+        return cycle_base + (frame - frame_base) * frame_cycles;
     }
 
-    void next_instruction()
+    void machine::log_sound()
     {
-        std::cout << __FUNCTION__ << std::endl;
+        if(sound_log == nullptr)
+        {
+            return;
+        }
+
+        // The timer reads 0 from the first cycle of the frame it runs out in
+        const auto silent_from = sound.set_in_frame + sound.value;
+        const auto end         = silent_from > current_frame() ? frame_start_cycle(silent_from) : instructions_executed;
 
-        pc += 2;
+        sound_span span = {.start = instructions_executed, .end = end};
+        if(flags_of(active_quirks).mode == machine_mode::xochip)
+        {
+            span.patterned = true;
+            span.pitch     = extended->pitch;
+            std::memcpy(span.pattern, extended->pattern, sizeof span.pattern);
+        }
+        sound_log->push_back(span);
     }
 
-    static void fill_registers_with_memory(const opcode_t opcode)
+    void machine::allocate_memory(const machine_mode mode)
     {
+        memory_size = memory_size_of(mode);
+        if(mode == machine_mode::xochip)
+        {
+            xo_memory  = std::make_unique<unsigned char[]>(XO_MEMORY_SIZE);
+            xo_decoded = std::make_unique<decoded_instruction[]>(XO_MEMORY_SIZE);
+            memory     = xo_memory.get();
+            decoded    = xo_decoded.get();
+        }
+        else
+        {
+            xo_memory.reset();
+            xo_decoded.reset();
+            memory  = base_memory;
+            decoded = base_decoded;
+        }
+        blocks = block_cache(memory_size);
 
-        register_t& end = get_first_register_from_opcode(opcode);
+        if(mode == machine_mode::chip8)
+        {
+            extended.reset();
+        }
+        else if(extended == nullptr)
+        {
+            extended = std::make_unique<extended_state>();
+        }
+    }
 
-        auto i = 0;
-        for(register_t* it = &V[0]; it <= &end; it++)
+    template<typename Quirks>
+    void machine::skip_instruction()
+    {
+        // F000 NNNN is the only instruction four bytes long
+        if constexpr(Quirks::flags.mode == machine_mode::xochip)
         {
-            *it = memory[I + i];
-            i++;
+            if(opcode_at(state.pc + 2u) == 0xF000)
+            {
+                state.pc += 6;
+                return;
+            }
         }
+        jump_next_instruction();
+    }
 
-        next_instruction();
+    template<typename Quirks>
+    void machine::unsupported(const decoded_instruction&)
+    {
+        throw std::invalid_argument("Unsupported operation");
+    }
+
+    template<typename Quirks>
+    void machine::undecoded(const decoded_instruction&)
+    {
+        // fetch() never hands out an undecoded slot
+        throw std::logic_error("Executing an undecoded instruction");
     }
 
-    static void fill_memory_with_registers(const opcode_t opcode)
+    template<typename Quirks>
+    void machine::fill_registers_with_memory(const decoded_instruction& instruction)
     {
+        if(state.I + instruction.x >= memory_size)
+        {
+            throw std::out_of_range("Pointing out of memory range");
+        }
+        for(auto i = 0; i <= instruction.x; i++)
+        {
+            state.V[i] = memory[state.I + i];
+        }
+        if constexpr(Quirks::flags.load_store_advances_i)
+        {
+            state.I = static_cast<unsigned short>(state.I + instruction.x + 1);
+        }
 
-        const register_t& end = get_first_register_from_opcode(opcode);
+        next_instruction();
+    }
 
-        auto i = 0;
-        for(register_t* it = &V[0]; it <= &end; it++)
+    template<typename Quirks>
+    void machine::fill_memory_with_registers(const decoded_instruction& instruction)
+    {
+        if(state.I + instruction.x >= memory_size)
+        {
+            throw std::out_of_range("Pointing out of memory range");
+        }
+        for(auto i = 0; i <= instruction.x; i++)
         {
-            memory[I + i] = *it;
-            i++;
+            memory[state.I + i] = state.V[i];
+        }
+        invalidate_code(state.I, instruction.x + 1u);
+        if constexpr(Quirks::flags.load_store_advances_i)
+        {
+            state.I = static_cast<unsigned short>(state.I + instruction.x + 1);
         }
 
         next_instruction();
     }
 
-    static inline void store_bcd(const opcode_t opcode)
+    template<typename Quirks>
+    void machine::store_bcd(const decoded_instruction& instruction)
     {
-        std::cout << __FUNCTION__ << std::endl;
+        const auto I = state.I;
+        if(I + 2u >= memory_size)
+        {
+            throw std::out_of_range("Pointing out of memory range");
+        }
 
-        const register_t reg = get_first_register_from_opcode(opcode);
+        const register_t reg = get_first_register(instruction);
         memory[I]            = static_cast<unsigned char>(reg / 100); // hundreds digit
-        memory[I + 1]        = static_cast<unsigned char>((reg - memory[I]) / 10);
-        memory[I + 2]        = static_cast<unsigned char>(reg - memory[I] - memory[I + 1]);
+        memory[I + 1]        = static_cast<unsigned char>((reg - memory[I] * 100) / 10);
+        memory[I + 2]        = static_cast<unsigned char>(reg % 10);
+        invalidate_code(I, 3);
 
         next_instruction();
     }
 
-    static inline void set_memory_address_to_character_sprite_address(const opcode_t opcode)
+    template<typename Quirks>
+    void machine::set_memory_address_to_character_sprite_address(const decoded_instruction& instruction)
     {
-        std::cout << __FUNCTION__ << std::endl;
-
-        const register_t reg = get_first_register_from_opcode(opcode);
+        const register_t reg = get_first_register(instruction);
 
         const unsigned char key = get_key_from_register(reg);
 
-        std::cout << "key " << std::hex << static_cast<int>(key) << " " << &memory[0] << " " << &memory[key * 5]
-                  << std::endl;
-
-        I = static_cast<unsigned short>(std::distance(&memory[0], &memory[key * 5]));
+        state.I = static_cast<unsigned short>(key * 5);
 
         next_instruction();
     }
 
-    void jump_next_instruction()
+    template<typename Quirks>
+    void machine::return_from_subroutine(const decoded_instruction&)
     {
-        std::cout << __FUNCTION__ << std::endl;
+        if(state.sp == 0)
+        {
+            throw std::out_of_range("Stack pointer decremented to outside the range of the stack");
+        }
+        state.sp--;                       // Go back in the stack to previous valid entry
+        state.pc = state.stack[state.sp]; // Point pc to saved memory address
 
-        pc += 4;
+        next_instruction();
     }
 
-    static void return_from_subroutine()
+    template<typename Quirks>
+    void machine::set_memory_address_to_big_sprite_address(const decoded_instruction& instruction)
     {
-        std::cout << __FUNCTION__ << std::endl;
+        require_mode<Quirks, machine_mode::schip>();
+
+        const unsigned char key = get_key_from_register(get_first_register(instruction));
+        state.I                 = static_cast<unsigned short>(FONTSET_SIZE + key * 10);
+
+        next_instruction();
+    }
 
-        sp--; // Go back in the stack to previous valid entry
-        if(sp < &stack[0])
+    template<typename Quirks>
+    void machine::clear_screen(const decoded_instruction&)
+    {
+        if constexpr(Quirks::flags.mode == machine_mode::chip8)
+        {
+            dirty_rows |= clear_rows(gfx);
+        }
+        else
         {
-            std::out_of_range("Stack pointer decremented to outside the range of the stack");
+            dirty_rows |= clear_planes(extended->screen, extended->planes);
         }
-        pc = *sp; // Point pc to saved memory address
+        next_instruction();
+    }
 
+    // Scrolls move by pixels of the current resolution, as Octo does
+
+    template<typename Quirks>
+    void machine::scroll_down(const decoded_instruction& instruction)
+    {
+        require_mode<Quirks, machine_mode::schip>();
+        dirty_rows |= scroll_planes(extended->screen, extended->planes, 0, instruction.nn & 0x0F);
         next_instruction();
     }
 
-    static void clear_screen_and_return(const opcode_t opcode)
+    template<typename Quirks>
+    void machine::scroll_up(const decoded_instruction& instruction)
     {
-        std::cout << __FUNCTION__ << std::endl;
+        require_mode<Quirks, machine_mode::xochip>();
+        dirty_rows |= scroll_planes(extended->screen, extended->planes, 0, -(instruction.nn & 0x0F));
+        next_instruction();
+    }
 
-        switch(opcode)
-        {
-            case 0xE0: // Clear screen
-                clear_buffer(gfx);
-                return;
-            case 0xEE: // Return from subroutine
-                return_from_subroutine();
-                return;
-        }
+    template<typename Quirks>
+    void machine::scroll_right(const decoded_instruction&)
+    {
+        require_mode<Quirks, machine_mode::schip>();
+        dirty_rows |= scroll_planes(extended->screen, extended->planes, 4, 0);
+        next_instruction();
+    }
+
+    template<typename Quirks>
+    void machine::scroll_left(const decoded_instruction&)
+    {
+        require_mode<Quirks, machine_mode::schip>();
+        dirty_rows |= scroll_planes(extended->screen, extended->planes, -4, 0);
+        next_instruction();
     }
 
-    static void jump_to(const opcode_t opcode)
+    template<typename Quirks>
+    void machine::exit_interpreter(const decoded_instruction&)
     {
-        std::cout << __FUNCTION__ << std::endl;
+        // Stays on the instruction for good, which idle() reports as halted
+        require_mode<Quirks, machine_mode::schip>();
+    }
 
-        pc = get_memory_address_from_opcode(opcode);
+    template<typename Quirks>
+    void machine::set_low_resolution(const decoded_instruction&)
+    {
+        require_mode<Quirks, machine_mode::schip>();
+        extended->screen = {};
+        dirty_rows       = ALL_ROWS;
+        next_instruction();
     }
 
-    static void call_func(const opcode_t opcode)
+    template<typename Quirks>
+    void machine::set_high_resolution(const decoded_instruction&)
     {
-        std::cout << __FUNCTION__ << std::endl;
+        require_mode<Quirks, machine_mode::schip>();
+        extended->screen = {.planes = {}, .hires = true};
+        dirty_rows       = ALL_ROWS;
+        next_instruction();
+    }
 
-        auto memory_address = get_memory_address_from_opcode(opcode); // Extract memory address from opcode
+    template<typename Quirks>
+    void machine::jump_to(const decoded_instruction& instruction)
+    {
+        state.pc = instruction.nnn;
+    }
 
-        *sp = pc; // Assign current sp to current pc address
-        sp++;     // Go up next available entry stack
-        if(sp > &stack[STACK_SIZE - 1])
+    template<typename Quirks>
+    void machine::call_func(const decoded_instruction& instruction)
+    {
+        if(state.sp >= STACK_SIZE)
         {
-            std::out_of_range("Stack pointer incremented to outside the range of the stack");
+            throw std::out_of_range("Stack pointer incremented to outside the range of the stack");
         }
-        pc = memory_address; // Have pc point to new memory address
+        state.stack[state.sp] = state.pc; // Assign current sp to current pc address
+        state.sp++;                       // Go up next available entry stack
+        state.pc = instruction.nnn;       // Have pc point to new memory address
     }
 
-    static void jump_if_equal(const opcode_t opcode)
+    template<typename Quirks>
+    void machine::jump_if_equal(const decoded_instruction& instruction)
     {
-        std::cout << __FUNCTION__ << std::endl;
+        const auto reg = get_first_register(instruction);
 
-        const auto reg   = get_first_register_from_opcode(opcode); // Extract register index
-        const auto value = get_value_from_opcode_nn(opcode);       // Extract value
-
-        if(reg != value)
+        if(reg != instruction.nn)
         {
             next_instruction();
             return;
         }
 
-        jump_next_instruction(); // Jump a whole instruction
+        skip_instruction<Quirks>(); // Jump a whole instruction
     }
 
-    static void jump_if_not_equal(const opcode_t opcode)
+    template<typename Quirks>
+    void machine::jump_if_not_equal(const decoded_instruction& instruction)
     {
-        std::cout << __FUNCTION__ << std::endl;
-
-        const auto reg   = get_first_register_from_opcode(opcode); // Extract register index
-        const auto value = get_value_from_opcode_nn(opcode);       // Extract value
+        const auto reg = get_first_register(instruction);
 
-        if(reg == value)
+        if(reg == instruction.nn)
         {
             next_instruction();
             return;
         }
 
-        jump_next_instruction(); // Jump a whole instruction
+        skip_instruction<Quirks>(); // Jump a whole instruction
     }
 
-    static void jump_if_registers_equal(const opcode_t opcode)
+    template<typename Quirks>
+    void machine::jump_if_registers_equal(const decoded_instruction& instruction)
     {
-        std::cout << __FUNCTION__ << std::endl;
-
-        const auto register_1 = get_first_register_from_opcode(opcode);  // Extract register index 1
-        const auto register_2 = get_second_register_from_opcode(opcode); // Extract register index 2
+        const auto register_1 = get_first_register(instruction);
+        const auto register_2 = get_second_register(instruction);
 
         if(register_1 != register_2)
         {
@@ -319,445 +575,1278 @@ namespace chip8
             return;
         }
 
-        jump_next_instruction(); // Jump a whole instruction
+        skip_instruction<Quirks>(); // Jump a whole instruction
     }
 
-    static void set_register_to_value(const opcode_t opcode)
+    template<typename Quirks>
+    void machine::save_register_range(const decoded_instruction& instruction)
     {
-        std::cout << __FUNCTION__ << std::endl;
-
-        register_t& reg      = get_first_register_from_opcode(opcode); // Extract register index
-        register_t new_value = get_value_from_opcode_nn(opcode);       // Extract value
+        require_mode<Quirks, machine_mode::xochip>();
 
-        reg = new_value;
+        // VX to VY in that order, which runs backwards when X is the larger
+        const int step   = instruction.x <= instruction.y ? 1 : -1;
+        const auto count = static_cast<unsigned>((instruction.y - instruction.x) * step + 1);
+        if(state.I + count > memory_size)
+        {
+            throw std::out_of_range("Pointing out of memory range");
+        }
+        for(unsigned i = 0; i != count; i++)
+        {
+            memory[state.I + i] = state.V[instruction.x + static_cast<int>(i) * step];
+        }
+        invalidate_code(state.I, count);
 
         next_instruction();
     }
 
-    static void add_assign_register_to_value(const opcode_t opcode)
+    template<typename Quirks>
+    void machine::load_register_range(const decoded_instruction& instruction)
     {
-        std::cout << __FUNCTION__ << std::endl;
+        require_mode<Quirks, machine_mode::xochip>();
 
-        auto& reg = get_first_register_from_opcode(opcode);
-
-        reg += get_value_from_opcode_nn(opcode);
+        const int step   = instruction.x <= instruction.y ? 1 : -1;
+        const auto count = static_cast<unsigned>((instruction.y - instruction.x) * step + 1);
+        if(state.I + count > memory_size)
+        {
+            throw std::out_of_range("Pointing out of memory range");
+        }
+        for(unsigned i = 0; i != count; i++)
+        {
+            state.V[instruction.x + static_cast<int>(i) * step] = memory[state.I + i];
+        }
 
         next_instruction();
     }
 
-    static void assign_to_register(const opcode_t opcode)
+    template<typename Quirks>
+    void machine::set_register_to_value(const decoded_instruction& instruction)
     {
-        std::cout << __FUNCTION__ << std::endl;
+        get_first_register(instruction) = instruction.nn;
 
-        switch(opcode & 0x000F)
-        {
-            case 0x0:
-            {
-                register_t& register_1      = get_first_register_from_opcode(opcode);
-                const register_t register_2 = get_second_register_from_opcode(opcode);
-                register_1                  = register_2;
-                break;
-            }
-            case 0x1:
-            {
-                register_t& register_1      = get_first_register_from_opcode(opcode);
-                const register_t register_2 = get_second_register_from_opcode(opcode);
-                register_1 |= register_2;
-                break;
-            }
-            case 0x2:
-            {
-                register_t& register_1      = get_first_register_from_opcode(opcode);
-                const register_t register_2 = get_second_register_from_opcode(opcode);
-                register_1 &= register_2;
-                break;
-            }
-            case 0x3:
-            {
-                register_t& register_1      = get_first_register_from_opcode(opcode);
-                const register_t register_2 = get_second_register_from_opcode(opcode);
-                register_1 ^= register_2;
-                break;
-            }
-            case 0x4:
-            {
-                register_t& register_1      = get_first_register_from_opcode(opcode);
-                const register_t register_2 = get_second_register_from_opcode(opcode);
-                int temp                    = register_1;
-                temp += register_2;
-                register_1 = static_cast<register_t>(temp);
-
-                // Check if digits passed char size were flipped
-                auto is_overflow = temp >> 8 != 0;
-                if(is_overflow)
-                {
-                    flag_register = 1;
-                }
-                else
-                {
-                    flag_register = 0;
-                }
-                break;
-            }
-            case 0x5:
-            {
-                register_t& register_1      = get_first_register_from_opcode(opcode);
-                const register_t register_2 = get_second_register_from_opcode(opcode);
-                auto is_underflow           = register_2 > register_1;
-                register_1 -= register_2;
+        next_instruction();
+    }
+
+    template<typename Quirks>
+    void machine::add_assign_register_to_value(const decoded_instruction& instruction)
+    {
+        get_first_register(instruction) += instruction.nn;
 
-                // Check if digits passed char size were flipped
-                if(is_underflow)
-                {
-                    flag_register = 0;
-                }
-                else
-                {
-                    flag_register = 1;
-                }
-                break;
-            }
-            case 0x6:
-            {
-                throw std::invalid_argument("Unsupported operation");
-            }
-            case 0x7:
-            {
-                throw std::invalid_argument("Unsupported operation");
-            }
-            case 0xE:
-            {
-                throw std::invalid_argument("Unsupported operation");
-            }
-        }
         next_instruction();
     }
 
-    static void jump_if_registers_not_equal(const opcode_t opcode)
+    template<typename Quirks>
+    void machine::assign_register(const decoded_instruction& instruction)
     {
-        std::cout << __FUNCTION__ << std::endl;
+        get_first_register(instruction) = get_second_register(instruction);
 
-        const auto register_1 = get_first_register_from_opcode(opcode);  // Extract register index 1
-        const auto register_2 = get_second_register_from_opcode(opcode); // Extract register index 2
+        next_instruction();
+    }
 
-        if(register_1 == register_2)
+    template<typename Quirks>
+    void machine::or_assign_register(const decoded_instruction& instruction)
+    {
+        get_first_register(instruction) |= get_second_register(instruction);
+        if constexpr(Quirks::flags.logic_resets_vf)
         {
-            next_instruction();
-            return;
+            flag_register() = 0;
         }
 
-        jump_next_instruction(); // Jump a whole instruction
+        next_instruction();
     }
 
-    static void assign_address_register(const opcode_t opcode)
+    template<typename Quirks>
+    void machine::and_assign_register(const decoded_instruction& instruction)
     {
-        std::cout << __FUNCTION__ << std::endl;
-        I = get_memory_address_from_opcode(opcode);
+        get_first_register(instruction) &= get_second_register(instruction);
+        if constexpr(Quirks::flags.logic_resets_vf)
+        {
+            flag_register() = 0;
+        }
+
         next_instruction();
     }
 
-    static void jump_to_address(const opcode_t opcode)
+    template<typename Quirks>
+    void machine::xor_assign_register(const decoded_instruction& instruction)
     {
-        const auto register_0 = static_cast<unsigned short>(V[0]);
-        const auto value      = get_value_from_opcode_nnn(opcode);
-        pc += register_0;
-        pc += value;
+        get_first_register(instruction) ^= get_second_register(instruction);
+        if constexpr(Quirks::flags.logic_resets_vf)
+        {
+            flag_register() = 0;
+        }
+
+        next_instruction();
     }
 
-    static void set_register_to_bitwise_and_of_random(const opcode_t opcode)
+    template<typename Quirks>
+    void machine::add_assign_register(const decoded_instruction& instruction)
     {
-        static std::random_device rd;
-        static std::uniform_int_distribution<int> dist(0, 255);
-
-        register_t& reg  = get_first_register_from_opcode(opcode);
-        register_t value = get_value_from_opcode_nn(opcode);
+        register_t& register_1      = get_first_register(instruction);
+        const register_t register_2 = get_second_register(instruction);
+        int temp                    = register_1;
+        temp += register_2;
+        register_1 = static_cast<register_t>(temp);
 
-        register_t rand = static_cast<register_t>(dist(rd));
-
-        reg = static_cast<register_t>(rand & value);
+        // Check if digits passed char size were flipped
+        flag_register() = temp >> 8 != 0;
 
         next_instruction();
     }
 
-    static void draw_sprite(const opcode_t opcode)
+    template<typename Quirks>
+    void machine::subtract_assign_register(const decoded_instruction& instruction)
     {
-        draw_this_frame = true;
-        std::cout << __FUNCTION__ << std::endl;
-        const int x      = get_first_register_from_opcode(opcode);
-        int y            = get_second_register_from_opcode(opcode);
-        const int height = get_value_from_opcode_n(opcode);
-        std::cout << std::dec << "x: " << x << " y: " << y << " h: " << height << std::endl;
-
-        bool pixel_flipped = false;
-        for(auto i = 0; i != height; i++)
-        {
-            const int index = I + i;
-            if(index >= static_cast<int>(sizeof memory))
-            {
-                std::out_of_range("Pointing out of memory range");
-            }
-            pixel_flipped |= paint_row_pixels_at(x, y, memory[index]);
-            y++;
-        }
+        register_t& register_1      = get_first_register(instruction);
+        const register_t register_2 = get_second_register(instruction);
+        auto is_underflow           = register_2 > register_1;
+        register_1 -= register_2;
 
-        flag_register = pixel_flipped;
-        // auto k        = 0;
-        // for(int i = 0; i != 32; i++)
-        // {
-        //     std::cout << 10000000 + k << "      ";
-        //     for(int j = 0; j != 64; j++)
-        //     {
-        //         // if(int(gfx[k]) == 1)
-        //         // {
-
-        //         std::cout << int(gfx[k]) << " ";
-        //         // }
-        //         // else
-        //         // {
-        //         //     std::cout << " " << " ";
-        //         // }
-        //         k++;
-        //     }
-        //     std::cout << std::endl;
-        // }
+        flag_register() = is_underflow == false;
 
         next_instruction();
     }
 
-    static bool key_is_pressed(unsigned char key)
+    template<typename Quirks>
+    void machine::shift_right_assign_register(const decoded_instruction& instruction)
     {
-        return key_state[key];
+        const register_t source =
+            Quirks::flags.shift_reads_vy ? get_second_register(instruction) : get_first_register(instruction);
+        get_first_register(instruction) = static_cast<register_t>(source >> 1);
+
+        // VF is written last, so a shift of VF itself leaves the bit shifted out
+        flag_register() = source & 1;
+
+        next_instruction();
     }
 
-    static void jump_if_key_pressed(const opcode_t opcode)
+    template<typename Quirks>
+    void machine::reverse_subtract_assign_register(const decoded_instruction& instruction)
     {
-        std::cout << __FUNCTION__ << std::endl;
+        register_t& register_1      = get_first_register(instruction);
+        const register_t register_2 = get_second_register(instruction);
+        auto is_underflow           = register_1 > register_2;
+        register_1                  = static_cast<register_t>(register_2 - register_1);
 
-        const register_t reg    = get_first_register_from_opcode(opcode);
-        const unsigned char key = get_key_from_register(reg);
+        flag_register() = is_underflow == false;
 
-        if(key_is_pressed(key))
-        {
-            jump_next_instruction();
-            return;
-        }
         next_instruction();
     }
 
-    static void jump_if_key_not_pressed(const opcode_t opcode)
+    template<typename Quirks>
+    void machine::shift_left_assign_register(const decoded_instruction& instruction)
     {
-        std::cout << __FUNCTION__ << std::endl;
+        const register_t source =
+            Quirks::flags.shift_reads_vy ? get_second_register(instruction) : get_first_register(instruction);
+        get_first_register(instruction) = static_cast<register_t>(source << 1);
 
-        const register_t reg    = get_first_register_from_opcode(opcode);
-        const unsigned char key = get_key_from_register(reg);
+        flag_register() = source >> 7;
 
-        if(key_is_pressed(key) == false)
-        {
-            jump_next_instruction();
-            return;
-        }
         next_instruction();
     }
 
-    static void jump_by_key(const opcode_t opcode)
+    template<typename Quirks>
+    void machine::jump_if_registers_not_equal(const decoded_instruction& instruction)
     {
-        switch(get_value_from_opcode_nn(opcode))
+        const auto register_1 = get_first_register(instruction);
+        const auto register_2 = get_second_register(instruction);
+
+        if(register_1 == register_2)
         {
-            case 0x9E:
-                jump_if_key_pressed(opcode);
-                break;
-            case 0xA1:
-                jump_if_key_not_pressed(opcode);
-                break;
-            default:
-                break;
+            next_instruction();
+            return;
         }
+
+        skip_instruction<Quirks>(); // Jump a whole instruction
     }
-    static inline void set_sound_timer_to_register(const opcode_t opcode)
+
+    template<typename Quirks>
+    void machine::assign_address_register(const decoded_instruction& instruction)
     {
-        sound_timer = get_first_register_from_opcode(opcode);
+        state.I = instruction.nnn;
         next_instruction();
     }
 
-    static inline void set_delay_timer_to_register(const opcode_t opcode)
+    template<typename Quirks>
+    void machine::jump_to_address(const decoded_instruction& instruction)
     {
-        delay_timer = get_first_register_from_opcode(opcode);
-        next_instruction();
+        // BXNN on the machines that read VX, where X is the top nibble of the address
+        const auto offset = state.V[Quirks::flags.jump_reads_vx ? instruction.x : 0];
+        state.pc          = static_cast<unsigned short>(offset + instruction.nnn);
     }
 
-    static inline void set_register_to_delay_timer(const opcode_t opcode)
+    template<typename Quirks>
+    void machine::set_register_to_bitwise_and_of_random(const decoded_instruction& instruction)
     {
-        register_t& reg = get_first_register_from_opcode(opcode);
-        reg             = delay_timer;
+        const auto rand = static_cast<register_t>(random.next() >> 56);
+
+        get_first_register(instruction) = static_cast<register_t>(rand & instruction.nn);
+
         next_instruction();
     }
 
-    static void misc(const opcode_t opcode)
+    template<typename Quirks>
+    void machine::draw_sprite(const decoded_instruction& instruction)
     {
-        switch(get_value_from_opcode_nn(opcode))
+        state.draw_this_frame = true;
+        const unsigned x      = get_first_register(instruction);
+        const unsigned y      = get_second_register(instruction);
+        const unsigned height = instruction.nn & 0x0F;
+        trace<trace_level::verbose>(trace_output.get(), {instructions_executed, state.pc, 0, trace_event::draw,
+                                                         static_cast<unsigned char>(x),
+                                                         static_cast<unsigned short>(y << 8 | height)});
+
+        if constexpr(Quirks::flags.mode == machine_mode::chip8)
         {
-            case 0x07:
+            if(state.I + height > memory_size)
             {
-                set_register_to_delay_timer(opcode);
-                return;
+                throw std::out_of_range("Pointing out of memory range");
             }
-            case 0x0A:
+            flag_register() = draw_sprite_rows(gfx, x, y, &memory[state.I], height, sprite_edges, dirty_rows);
+        }
+        else
+        {
+            // DXY0 draws 16x16 in either resolution, as Octo does. Every selected plane takes a sprite of its own.
+            const bool wide   = height == 0;
+            const auto rows   = wide ? 16u : height;
+            const auto planes = extended->planes;
+            const auto size   = rows * (wide ? 2u : 1u) * static_cast<unsigned>(std::popcount(planes));
+            if(state.I + size > memory_size)
             {
-                throw std::invalid_argument("Unsupported operation");
-                return;
+                throw std::out_of_range("Pointing out of memory range");
             }
-            case 0x15:
-            {
-                set_delay_timer_to_register(opcode);
-                return;
+            flag_register() = draw_sprite_planes(extended->screen, planes, x, y, &memory[state.I], rows, wide,
+                                                 sprite_edges, dirty_rows);
+        }
+
+        next_instruction();
+    }
+
+    bool machine::key_is_pressed(unsigned char key) const
+    {
+        return key_state[key];
+    }
+
+    template<typename Quirks>
+    void machine::jump_if_key_pressed(const decoded_instruction& instruction)
+    {
+        const register_t reg    = get_first_register(instruction);
+        const unsigned char key = get_key_from_register(reg);
+
+        if(key_is_pressed(key))
+        {
+            skip_instruction<Quirks>();
+            return;
+        }
+        next_instruction();
+    }
+
+    template<typename Quirks>
+    void machine::jump_if_key_not_pressed(const decoded_instruction& instruction)
+    {
+        const register_t reg    = get_first_register(instruction);
+        const unsigned char key = get_key_from_register(reg);
+
+        if(key_is_pressed(key) == false)
+        {
+            skip_instruction<Quirks>();
+            return;
+        }
+        next_instruction();
+    }
+
+    template<typename Quirks>
+    void machine::wait_for_key_press(const decoded_instruction& instruction)
+    {
+        // Runs again every cycle until a key goes down while it waits. A key already held when the wait started
+        // does not count, so holding a key does not run through one FX0A after another.
+        if(pending_key < 0)
+        {
+            return;
+        }
+        get_first_register(instruction) = static_cast<register_t>(pending_key);
+        pending_key                     = -1;
+        next_instruction();
+    }
+
+    template<typename Quirks>
+    void machine::set_sound_timer_to_register(const decoded_instruction& instruction)
+    {
+        sound = {get_first_register(instruction), current_frame()};
+        log_sound();
+        next_instruction();
+    }
+
+    template<typename Quirks>
+    void machine::add_assign_address_register(const decoded_instruction& instruction)
+    {
+        state.I = static_cast<unsigned short>(state.I + get_first_register(instruction));
+        next_instruction();
+    }
+
+    template<typename Quirks>
+    void machine::assign_long_address_register(const decoded_instruction&)
+    {
+        require_mode<Quirks, machine_mode::xochip>();
+        state.I = opcode_at(state.pc + 2u);
+        jump_next_instruction();
+    }
+
+    template<typename Quirks>
+    void machine::select_planes(const decoded_instruction& instruction)
+    {
+        require_mode<Quirks, machine_mode::xochip>();
+        extended->planes = instruction.x & ALL_PLANES;
+        next_instruction();
+    }
+
+    template<typename Quirks>
+    void machine::load_audio_pattern(const decoded_instruction&)
+    {
+        require_mode<Quirks, machine_mode::xochip>();
+        if(static_cast<unsigned>(state.I + AUDIO_PATTERN_SIZE) > memory_size)
+        {
+            throw std::out_of_range("Pointing out of memory range");
+        }
+        std::memcpy(extended->pattern, &memory[state.I], AUDIO_PATTERN_SIZE);
+
+        // A sound playing now changes its tone from here on
+        if(sound_playing())
+        {
+            log_sound();
+        }
+        next_instruction();
+    }
+
+    template<typename Quirks>
+    void machine::set_pitch_to_register(const decoded_instruction& instruction)
+    {
+        require_mode<Quirks, machine_mode::xochip>();
+        extended->pitch = get_first_register(instruction);
+        if(sound_playing())
+        {
+            log_sound();
+        }
+        next_instruction();
+    }
+
+    template<typename Quirks>
+    void machine::store_flags(const decoded_instruction& instruction)
+    {
+        require_mode<Quirks, machine_mode::schip>();
+        std::memcpy(extended->flags, state.V, instruction.x + 1u);
+        next_instruction();
+    }
+
+    template<typename Quirks>
+    void machine::load_flags(const decoded_instruction& instruction)
+    {
+        require_mode<Quirks, machine_mode::schip>();
+        std::memcpy(state.V, extended->flags, instruction.x + 1u);
+        next_instruction();
+    }
+
+    template<typename Quirks>
+    void machine::set_delay_timer_to_register(const decoded_instruction& instruction)
+    {
+        delay = {get_first_register(instruction), current_frame()};
+        next_instruction();
+    }
+
+    template<typename Quirks>
+    void machine::set_register_to_delay_timer(const decoded_instruction& instruction)
+    {
+        get_first_register(instruction) = timer_value(delay);
+        next_instruction();
+    }
+
+    void machine::init()
+    {
+        state.pc = PROGRAM_OFFSET; // Program counter starts at 0x200
+        state.I  = 0;              // Reset index register
+        state.sp = 0;              // Reset stack pointer
+
+        // Clear display
+        clear_buffer(gfx);
+        dirty_rows = ALL_ROWS;
+        // The RPL flags outlive a reset, as they outlived the interpreter on the HP 48
+        if(extended != nullptr)
+        {
+            extended->screen = {};
+            extended->planes = 1;
+            extended->pitch  = DEFAULT_PITCH;
+            clear_buffer(extended->pattern);
+        }
+        // Clear stack
+        clear_buffer(state.stack);
+        // Clear registers V0-VF
+        clear_buffer(state.V);
+        // Clear memory
+        std::fill_n(memory, memory_size, 0);
+        // Release all keys
+        clear_buffer(key_state);
+        pending_key = -1;
+
+        std::memcpy(memory, chip8_fontset, sizeof chip8_fontset);
+        if(extended != nullptr)
+        {
+            std::memcpy(&memory[FONTSET_SIZE], big_fontset, sizeof big_fontset);
+        }
+        invalidate_code(0, memory_size);
+
+        // Reset timers
+        delay = {};
+        sound = {};
+
+        state.draw_this_frame = false;
+        instructions_executed = 0;
+        frame_base            = 0;
+        cycle_base            = 0;
+        log_sound();
+    }
+
+    void machine::trace_instruction()
+    {
+        trace<trace_level::instructions>(
+            trace_output.get(), {instructions_executed, state.pc,
+                                 static_cast<opcode_t>(memory[state.pc] << 8 | memory[state.pc + 1]),
+                                 trace_event::instruction, 0, 0});
+    }
+
+    void machine::profile_instruction(const decoded_instruction& instruction)
+    {
+        if constexpr(PROFILING)
+        {
+            if(profiler != nullptr)
+            {
+                profiler->record(instruction.handler, state.pc);
+            }
+        }
+    }
+
+    void machine::retire()
+    {
+        trace<trace_level::verbose>(trace_output.get(), {instructions_executed, state.pc, 0, trace_event::state,
+                                                         flag_register(), state.I});
+        instructions_executed++;
+    }
+
+    // Fused handlers retire their first half before running the second and leave retiring the second to the
+    // caller, so a second half that throws is not counted, like on the interpreter
+
+    template<typename Quirks>
+    void machine::set_register_and_draw(const decoded_instruction& instruction)
+    {
+        set_register_to_value<Quirks>(instruction);
+        retire();
+        draw_sprite<Quirks>((&instruction)[1]);
+    }
+
+    template<typename Quirks>
+    void machine::add_and_jump_if_equal(const decoded_instruction& instruction)
+    {
+        add_assign_register_to_value<Quirks>(instruction);
+        retire();
+        jump_if_equal<Quirks>((&instruction)[1]);
+    }
+
+    template<typename Quirks>
+    void machine::add_and_jump_if_not_equal(const decoded_instruction& instruction)
+    {
+        add_assign_register_to_value<Quirks>(instruction);
+        retire();
+        jump_if_not_equal<Quirks>((&instruction)[1]);
+    }
+
+    machine::op_range machine::next_block(std::uint64_t& remaining)
+    {
+        if(remaining == 0)
+        {
+            return {nullptr, nullptr};
+        }
+
+        // The budget is charged for a whole block up front. Blocks that would overrun it are single-stepped.
+        const auto& block = blocks.lookup(memory, state.pc);
+        if(block.op_count != 0 && block.instruction_count <= remaining)
+        {
+            remaining -= block.instruction_count;
+
+            const auto first = blocks.ops_of(block);
+            return {first, first + block.op_count};
+        }
+
+        remaining--;
+
+        const auto& instruction = fetch();
+        return {&instruction, &instruction + 1};
+    }
+
+    template<typename Quirks, bool UseBlocks>
+    CHIP8_NO_TAIL_MERGING void machine::execute(const std::uint64_t instructions)
+    {
+        auto remaining = instructions;
+
+        const decoded_instruction* cursor    = nullptr;
+        const decoded_instruction* block_end = nullptr;
+        const decoded_instruction* instruction;
+
+        // The interpreter fetches and retires every instruction itself. The block backend walks the current block and
+        // only leaves the fast path to look up the next one. Retiring only traces and counts an instruction: the
+        // timers are worked out from that count when they are read.
+#if CHIP8_THREADED_DISPATCH
+        // Threaded code: every handler jumps straight to the next one instead of returning to a central loop,
+        // which gives the branch predictor one indirect jump per handler to learn from
+        static void* const labels[] = {
+#define CHIP8_OP_LABEL(name) &&execute_##name,
+            CHIP8_OPS(CHIP8_OP_LABEL) CHIP8_FUSED_OPS(CHIP8_OP_LABEL)
+#undef CHIP8_OP_LABEL
+        };
+
+        static_assert(std::size(labels) == static_cast<std::size_t>(op::count));
+
+#define CHIP8_DISPATCH()                                                                                              \
+    if(UseBlocks ? cursor != block_end : remaining != 0)                                                              \
+    {                                                                                                                 \
+        instruction = UseBlocks ? cursor++ : (remaining--, &fetch());                                                 \
+        trace_instruction();                                                                                          \
+        profile_instruction(*instruction);                                                                            \
+        goto* labels[static_cast<std::size_t>(instruction->handler)];                                                 \
+    }                                                                                                                 \
+    goto dispatch_next_block
+
+        CHIP8_DISPATCH();
+
+    dispatch_next_block:
+        if constexpr(UseBlocks)
+        {
+            const auto range = next_block(remaining);
+            if(range.begin != nullptr)
+            {
+                cursor    = range.begin;
+                block_end = range.end;
+                CHIP8_DISPATCH();
             }
-            case 0x18:
+        }
+        return;
+
+#define CHIP8_OP_BODY(name)                                                                                           \
+    execute_##name : name<Quirks>(*instruction);                                                                      \
+    retire();                                                                                                         \
+    CHIP8_DISPATCH();
+        CHIP8_OPS(CHIP8_OP_BODY)
+#undef CHIP8_OP_BODY
+
+        // Fused ops also step over the record of their second half
+#define CHIP8_FUSED_OP_BODY(name)                                                                                     \
+    execute_##name : name<Quirks>(*instruction);                                                                      \
+    cursor++;                                                                                                         \
+    retire();                                                                                                         \
+    CHIP8_DISPATCH();
+        CHIP8_FUSED_OPS(CHIP8_FUSED_OP_BODY)
+#undef CHIP8_FUSED_OP_BODY
+#undef CHIP8_DISPATCH
+#else
+        while(true)
+        {
+            if(UseBlocks ? cursor != block_end : remaining != 0)
             {
-                set_sound_timer_to_register(opcode);
-                return;
+                instruction = UseBlocks ? cursor++ : (remaining--, &fetch());
             }
-            case 0x1E:
+            else if constexpr(UseBlocks)
             {
-                throw std::invalid_argument("Unsupported operation");
-                return;
+                const auto range = next_block(remaining);
+                if(range.begin == nullptr)
+                {
+                    return;
+                }
+                cursor      = range.begin;
+                block_end   = range.end;
+                instruction = cursor++;
             }
-            case 0x29:
+            else
             {
-                set_memory_address_to_character_sprite_address(opcode);
                 return;
             }
-            case 0x33:
+
+            trace_instruction();
+            profile_instruction(*instruction);
+
+            switch(instruction->handler)
             {
-                store_bcd(opcode);
-                return;
+#define CHIP8_OP_CASE(name)                                                                                           \
+    case op::name:                                                                                                    \
+        name<Quirks>(*instruction);                                                                                   \
+        break;
+                CHIP8_OPS(CHIP8_OP_CASE)
+#undef CHIP8_OP_CASE
+#define CHIP8_FUSED_OP_CASE(name)                                                                                     \
+    case op::name:                                                                                                    \
+        name<Quirks>(*instruction);                                                                                   \
+        cursor++;                                                                                                     \
+        break;
+                CHIP8_FUSED_OPS(CHIP8_FUSED_OP_CASE)
+#undef CHIP8_FUSED_OP_CASE
+                case op::count:
+                    break;
             }
-            case 0x55:
+
+            retire();
+        }
+#endif
+    }
+
+    template<typename Quirks>
+    void machine::execute_compiled(const std::uint64_t instructions)
+    {
+        auto remaining = instructions;
+        while(remaining != 0)
+        {
+            const auto& block = compiled->lookup(memory, state.pc);
+            if(block.instruction_count != 0 && block.instruction_count <= remaining)
+            {
+                block.entry(&state);
+                remaining -= block.instruction_count;
+                instructions_executed += block.instruction_count;
+                continue;
+            }
+
+            // Whatever the generated code does not cover goes through the handlers one instruction at a time
+            execute<Quirks, false>(1);
+            remaining--;
+        }
+    }
+
+    template<typename Quirks>
+    void machine::execute_native(const std::uint64_t instructions)
+    {
+        static_assert(std::is_same_v<register_t, unsigned char> && std::is_same_v<stack_entry_t, unsigned short>,
+                      "aot_context must point at the machine's own types");
+        const aot_context context = {
+            .V     = state.V,
+            .I     = &state.I,
+            .pc    = &state.pc,
+            .stack = state.stack,
+            .sp    = &state.sp,
+            .stale = native_stale.data(),
+        };
+
+        auto remaining = instructions;
+        while(true)
+        {
+            const auto executed    = native->run(context, remaining);
+            instructions_executed += executed;
+            remaining             -= executed;
+            if(remaining == 0)
             {
-                fill_memory_with_registers(opcode);
                 return;
             }
-            case 0x65:
+
+            // Whatever the recompiled code does not cover goes through the handlers one instruction at a time
+            execute<Quirks, false>(1);
+            remaining--;
+        }
+    }
+
+    void machine::check_native_blocks(const unsigned address, const unsigned size)
+    {
+        // Blocks are sorted by start and never longer than MAX_AOT_BLOCK_SIZE, so only the ones starting at most
+        // that far below the write can overlap it
+        const auto first = address > MAX_AOT_BLOCK_SIZE ? address - MAX_AOT_BLOCK_SIZE : 0u;
+        const auto end   = address + size;
+
+        const auto starts_before = [](const aot_block& b, const unsigned start) {
+            return b.start < start;
+        };
+        const auto blocks_end = native->blocks + native->block_count;
+        auto block            = std::lower_bound(native->blocks, blocks_end, first, starts_before);
+        for(; block != blocks_end && block->start < end; block++)
+        {
+            if(block->end > address)
             {
-                fill_registers_with_memory(opcode);
+                native_stale[block - native->blocks] =
+                    std::memcmp(&memory[block->start], &native->rom[block->start - PROGRAM_OFFSET],
+                                block->end - block->start) != 0;
+            }
+        }
+    }
+
+    template<typename Quirks>
+    void machine::execute_on_backend(const std::uint64_t instructions)
+    {
+        // Recompiled code does not emit trace records or profile either
+        if(native != nullptr && trace_output == nullptr && (PROFILING && profiler != nullptr) == false)
+        {
+            execute_native<Quirks>(instructions);
+            return;
+        }
+
+        switch(active_backend)
+        {
+            case backend::interpreter:
+                execute<Quirks, false>(instructions);
                 return;
+            case backend::blocks:
+                execute<Quirks, true>(instructions);
+                return;
+            case backend::jit:
+                // Generated code does not emit trace records or profile, so those machines run the blocks instead
+                if(trace_output != nullptr || (PROFILING && profiler != nullptr))
+                {
+                    execute<Quirks, true>(instructions);
+                    return;
+                }
+                execute_compiled<Quirks>(instructions);
+                return;
+        }
+    }
+
+    void machine::execute_skipping_idle(std::uint64_t instructions)
+    {
+        // Traced and profiled machines account for every cycle they run
+        if(skip_idle_loops == false || trace_output != nullptr || (PROFILING && profiler != nullptr))
+        {
+            (this->*execute_with_quirks)(instructions);
+            return;
+        }
+
+        // A machine that goes idle partway through the budget runs at most one more interval before it is noticed
+        while(instructions != 0)
+        {
+            const auto skipped = skip_idle(instructions);
+            const auto chunk   = std::min<std::uint64_t>(instructions - skipped, IDLE_CHECK_INTERVAL);
+            skipped_cycles += skipped;
+            (this->*execute_with_quirks)(chunk);
+            instructions -= skipped + chunk;
+        }
+    }
+
+    std::uint64_t machine::skip_idle(const std::uint64_t budget)
+    {
+        switch(idle())
+        {
+            case idle_state::running:
+                return 0;
+            case idle_state::halted:
+            case idle_state::waiting_for_key:
+                instructions_executed += budget;
+                return budget;
+            case idle_state::waiting_for_delay:
+                break;
+        }
+
+        // Every pass reads the timer on its first instruction and the loop is left once a pass read 0. The passes
+        // that would still read a running timer are skipped whole, and the register keeps the last value read.
+        const auto expires = frame_start_cycle(delay.set_in_frame + delay.value);
+        const auto passes  = std::min((expires - instructions_executed + DELAY_LOOP_LENGTH - 1) / DELAY_LOOP_LENGTH,
+                                      budget / DELAY_LOOP_LENGTH);
+        if(passes == 0)
+        {
+            return 0;
+        }
+
+        instructions_executed += passes * DELAY_LOOP_LENGTH;
+        state.V[memory[state.pc] & 0x0F] = timer_value_at(delay, instructions_executed - DELAY_LOOP_LENGTH);
+        return passes * DELAY_LOOP_LENGTH;
+    }
+
+    idle_state machine::idle() const
+    {
+        const auto opcode = opcode_at(state.pc);
+        if(opcode == (0x1000 | state.pc) || (opcode == 0x00FD && extended != nullptr))
+        {
+            return idle_state::halted;
+        }
+        if((opcode & 0xF0FF) == 0xF00A && pending_key < 0)
+        {
+            return idle_state::waiting_for_key;
+        }
+        if((opcode & 0xF0FF) == 0xF007 && opcode_at(state.pc + 2) == (0x3000 | (opcode & 0x0F00)) &&
+           opcode_at(state.pc + 4) == (0x1000 | state.pc) && timer_value(delay) != 0)
+        {
+            return idle_state::waiting_for_delay;
+        }
+        return idle_state::running;
+    }
+
+    std::uint64_t machine::idle_cycle_count() const
+    {
+        return skipped_cycles;
+    }
+
+    void machine::set_idle_skip(const bool enabled)
+    {
+        skip_idle_loops = enabled;
+    }
+
+    unsigned machine::run_cycles(const std::uint64_t cycles)
+    {
+        state.draw_this_frame = false;
+
+        // Nothing happens at a vblank itself: timers work out their value from the cycle counter when read, so the
+        // backends run the whole budget in one go
+        const auto first_frame = current_frame();
+        const bool was_playing = sound_playing();
+
+        execute_skipping_idle(cycles);
+
+        if constexpr(PROFILING)
+        {
+            if(profiler != nullptr)
+            {
+                profiler->end();
             }
         }
+
+        if(was_playing && sound_playing() == false)
+        {
+            trace<trace_level::instructions>(trace_output.get(),
+                                             {instructions_executed, state.pc, 0, trace_event::beep, 0, 0});
+        }
+        return static_cast<unsigned>(current_frame() - first_frame);
     }
 
-    static std::function<void(const opcode_t)> funcs[] = {
-        clear_screen_and_return,               // 0
-        jump_to,                               // 1
-        call_func,                             // 2
-        jump_if_equal,                         // 3
-        jump_if_not_equal,                     // 4
-        jump_if_registers_equal,               // 5
-        set_register_to_value,                 // 6
-        add_assign_register_to_value,          // 7
-        assign_to_register,                    // 8
-        jump_if_registers_not_equal,           // 9
-        assign_address_register,               // A
-        jump_to_address,                       // B
-        set_register_to_bitwise_and_of_random, // C
-        draw_sprite,                           // D
-        jump_by_key,                           // E
-        misc                                   // F
-    };
+    void machine::run_frame()
+    {
+        run_cycles(frame_cycles - (instructions_executed - cycle_base) % frame_cycles);
+    }
 
-    void init()
+    void machine::set_cycles_per_frame(const unsigned cycles)
     {
-        pc = PROGRAM_OFFSET; // Program counter starts at 0x200
-        I  = 0;              // Reset index register
-        sp = &stack[0];      // Reset stack pointer
+        if(cycles == 0)
+        {
+            throw std::invalid_argument("A frame needs at least one cycle");
+        }
 
-        // Clear display
-        clear_buffer(gfx);
-        // Clear stack
-        clear_buffer(stack);
-        // Clear registers V0-VF
-        clear_buffer(V);
-        // Clear memory
-        clear_buffer(memory);
+        // The frame in progress restarts with the new length
+        frame_base   = current_frame();
+        cycle_base   = instructions_executed;
+        frame_cycles = cycles;
 
-        for(int i = 0; i < 80; i++)
+        // A sound playing now runs out on a different cycle
+        if(sound_playing())
         {
-            memory[i] = chip8_fontset[i];
+            log_sound();
+        }
+    }
+
+    unsigned machine::cycles_per_frame() const
+    {
+        return frame_cycles;
+    }
+
+    std::uint64_t machine::frame_count() const
+    {
+        return current_frame();
+    }
+
+    bool machine::sound_playing() const
+    {
+        return timer_value(sound) != 0;
+    }
 
-            std::memcpy(&memory, &chip8_fontset, sizeof chip8_fontset); // OK
+    void machine::set_backend(const backend b)
+    {
+        if(b == backend::jit && jit_cache::supported() == false)
+        {
+            active_backend = backend::blocks;
+            return;
         }
 
-        // Reset timers
-        delay_timer = 0;
-        sound_timer = 0;
+        if(b == backend::jit && compiled == nullptr)
+        {
+            const jit_layout layout = {
+                .V  = offsetof(hot_state, V),
+                .I  = offsetof(hot_state, I),
+                .pc = offsetof(hot_state, pc),
+            };
+            compiled = std::make_unique<jit_cache>(memory_size, layout, flags_of(active_quirks));
+        }
+        active_backend = b;
     }
 
-    void update()
+    backend machine::current_backend() const
     {
-        std::cout << "############## UPDATE ##############" << std::endl;
+        return active_backend;
+    }
 
-        draw_this_frame = false;
-        // Fetch Opcode
-        auto first_half_opcode  = memory[pc];
-        auto second_half_opcode = memory[pc + 1];
+    void machine::set_quirks(const quirk_profile profile)
+    {
+        const auto mode    = flags_of(profile).mode;
+        const bool resized = mode != flags_of(active_quirks).mode;
 
-        opcode_t opcode = static_cast<opcode_t>(first_half_opcode << 8 | second_half_opcode);
-        auto f_index    = first_half_opcode >> 4;
-        std::cout << "opcode: " << std::hex << opcode << std::endl;
-        if(f_index >= static_cast<int>(sizeof funcs))
+        switch(profile)
         {
-            throw std::invalid_argument("Unsupported operation");
+            case quirk_profile::vip:
+                execute_with_quirks = &machine::execute_on_backend<vip_quirks>;
+                break;
+            case quirk_profile::schip:
+                execute_with_quirks = &machine::execute_on_backend<schip_quirks>;
+                break;
+            case quirk_profile::modern:
+                execute_with_quirks = &machine::execute_on_backend<modern_quirks>;
+                break;
+            case quirk_profile::xochip:
+                execute_with_quirks = &machine::execute_on_backend<xochip_quirks>;
+                break;
+        }
+        active_quirks = profile;
+        sprite_edges  = flags_of(profile).edge;
+        if(native != nullptr && native->quirks != profile)
+        {
+            attach_program(nullptr);
+        }
+
+        if(resized)
+        {
+            allocate_memory(mode);
+            init();
+        }
+
+        // Generated code has the quirks it was compiled under built in
+        if(compiled != nullptr)
+        {
+            compiled.reset();
+            set_backend(active_backend);
+        }
+    }
+
+    void machine::attach_program(const aot_program* program)
+    {
+        if(program != nullptr && program->quirks != active_quirks)
+        {
+            throw std::invalid_argument(std::string(program->name) + " was recompiled for the " +
+                                        quirk_profile_name(program->quirks) + " quirks");
+        }
+
+        native = program;
+        native_stale.assign(program != nullptr ? program->block_count : 0, 1);
+        if(native != nullptr)
+        {
+            check_native_blocks(0, memory_size);
+        }
+    }
+
+    quirk_profile machine::current_quirks() const
+    {
+        return active_quirks;
+    }
+
+    void machine::update()
+    {
+        run_cycles(1);
+    }
+
+    void machine::load(const char* path)
+    {
+        std::ifstream is(path, std::ios::binary);
+        if(is.is_open() == false)
+        {
+            throw std::runtime_error(std::string("Could not open ") + path);
+        }
+
+        // One byte more than fits tells an oversized ROM apart from one that fills memory exactly
+        const auto max_size = memory_size - PROGRAM_OFFSET;
+        std::vector<unsigned char> rom(max_size + 1);
+        is.read(reinterpret_cast<char*>(rom.data()), static_cast<std::streamsize>(rom.size()));
+        if(is.bad())
+        {
+            throw std::runtime_error(std::string("Could not read ") + path);
+        }
+        if(static_cast<std::size_t>(is.gcount()) > max_size)
+        {
+            throw std::invalid_argument(std::string(path) + " is larger than " + std::to_string(max_size) + " bytes");
+        }
+        load(rom.data(), static_cast<std::size_t>(is.gcount()));
+    }
+
+    void machine::load(const unsigned char* data, const std::size_t size)
+    {
+        const auto max_size = memory_size - PROGRAM_OFFSET;
+        if(size > max_size)
+        {
+            throw std::invalid_argument("ROM of " + std::to_string(size) + " bytes is larger than " +
+                                        std::to_string(max_size));
+        }
+
+        std::memcpy(&memory[PROGRAM_OFFSET], data, size);
+        invalidate_code(PROGRAM_OFFSET, static_cast<unsigned>(size));
+    }
+
+    void machine::on_key_down(const int key_index)
+    {
+        if(pending_key < 0 && (opcode_at(state.pc) & 0xF0FF) == 0xF00A)
+        {
+            pending_key = key_index;
+        }
+        key_state[key_index] = true;
+        if(input_log != nullptr)
+        {
+            input_log->push_back({instructions_executed, key_index, true});
+        }
+    }
+
+    void machine::on_key_up(const int key_index)
+    {
+        key_state[key_index] = false;
+        if(input_log != nullptr)
+        {
+            input_log->push_back({instructions_executed, key_index, false});
+        }
+    }
+
+    bool machine::draw_triggered() const
+    {
+        return state.draw_this_frame;
+    }
+
+    const display_rows& machine::display() const
+    {
+        return gfx;
+    }
+
+    const framebuffer* machine::screen() const
+    {
+        return extended != nullptr ? &extended->screen : nullptr;
+    }
+
+    void machine::set_sprite_edge(const sprite_edge edge)
+    {
+        sprite_edges = edge;
+    }
+
+    row_mask machine::take_dirty_rows()
+    {
+        return std::exchange(dirty_rows, 0);
+    }
+
+    std::uint64_t machine::frame_hash() const
+    {
+        return extended != nullptr ? hash_framebuffer(extended->screen) : hash_rows(gfx);
+    }
+
+    std::uint64_t machine::register_hash() const
+    {
+        // The fold of hash_rows(), a word at a time: the registers eight at a time, then the rest of the state
+        const auto fold = [](std::uint64_t hash, const std::uint64_t word) {
+            hash = (hash ^ word) * 0xFF51AFD7ED558CCD;
+            return hash ^ hash >> 32;
+        };
+
+        std::uint64_t hash = 0x9E3779B97F4A7C15;
+        for(unsigned i = 0; i != REGISTER_COUNT; i += 8)
+        {
+            std::uint64_t word = 0;
+            for(unsigned j = 0; j != 8; j++)
+            {
+                word |= std::uint64_t{state.V[i + j]} << j * 8;
+            }
+            hash = fold(hash, word);
         }
-        funcs[f_index](opcode);
-        std::cout << "pc: " << pc << std::endl;
-        std::cout << "I: " << I << std::endl;
-        for(int i = 0; i != 15; i++)
+        hash = fold(hash, std::uint64_t{state.I} | std::uint64_t{state.pc} << 16 | std::uint64_t{state.sp} << 32 |
+                              std::uint64_t{timer_value(delay)} << 40 | std::uint64_t{timer_value(sound)} << 48);
+        for(unsigned i = 0; i != state.sp; i++)
         {
-            std::cout << "register " << i << ": " << static_cast<int>(V[i]) << std::endl;
+            hash = fold(hash, state.stack[i]);
         }
-        std::cout << "flag_register: " << static_cast<int>(flag_register) << std::endl;
-        std::cout << std::endl;
+        return hash;
+    }
 
-        if(delay_timer > 0)
+    std::uint64_t machine::instruction_count() const
+    {
+        return instructions_executed;
+    }
+
+    void machine::seed(const std::uint64_t value)
+    {
+        random.reseed(value);
+    }
+
+    void machine::record_input(std::vector<input_event>* log)
+    {
+        input_log = log;
+        if(input_log == nullptr)
         {
-            delay_timer--;
+            return;
         }
 
-        if(sound_timer > 0)
+        for(auto key = 0; key != KEY_COUNT; key++)
         {
-            if(sound_timer == 1)
+            if(key_state[key])
             {
-                std::cout << "Beep" << std::endl;
+                input_log->push_back({instructions_executed, key, true});
             }
-            sound_timer--;
         }
     }
 
+    void machine::record_sound(std::vector<sound_span>* log)
+    {
+        sound_log = log;
+        if(sound_playing())
+        {
+            log_sound();
+        }
+    }
+
+    void machine::save(machine_snapshot& out) const
+    {
+        if(extended != nullptr)
+        {
+            throw std::logic_error("Snapshots only hold CHIP-8 machines");
+        }
+        std::memset(&out, 0, sizeof out);
+
+        out.instructions_executed = instructions_executed;
+        out.frame_base            = frame_base;
+        out.cycle_base            = cycle_base;
+        out.delay_set_in_frame    = delay.set_in_frame;
+        out.sound_set_in_frame    = sound.set_in_frame;
+        out.frame_cycles          = frame_cycles;
+        out.I                     = state.I;
+        out.pc                    = state.pc;
+        out.sp                    = state.sp;
+        out.delay                 = delay.value;
+        out.sound                 = sound.value;
+        out.pending_key           = static_cast<unsigned char>(pending_key + 1);
+
+        std::memcpy(out.random_state, random.state, sizeof random.state);
+        std::memcpy(out.gfx, gfx, sizeof gfx);
+        std::memcpy(out.stack, state.stack, sizeof state.stack);
+        std::memcpy(out.V, state.V, sizeof state.V);
+        std::memcpy(out.memory, memory, sizeof out.memory);
+    }
+
+    void machine::restore(const machine_snapshot& in)
+    {
+        if(extended != nullptr)
+        {
+            throw std::logic_error("Snapshots only hold CHIP-8 machines");
+        }
+
+        instructions_executed = in.instructions_executed;
+        frame_base            = in.frame_base;
+        cycle_base            = in.cycle_base;
+        frame_cycles          = in.frame_cycles;
+        delay                 = {in.delay, in.delay_set_in_frame};
+        sound                 = {in.sound, in.sound_set_in_frame};
+        pending_key           = in.pending_key - 1;
+        state.I               = in.I;
+        state.pc              = in.pc;
+        state.sp              = in.sp;
+
+        std::memcpy(state.stack, in.stack, sizeof state.stack);
+        std::memcpy(state.V, in.V, sizeof state.V);
+        std::memcpy(random.state, in.random_state, sizeof random.state);
+
+        for(unsigned row = 0; row != DRAW_BUFFER_HEIGHT; row++)
+        {
+            dirty_rows |= static_cast<row_mask>(gfx[row] != in.gfx[row]) << row;
+        }
+        std::memcpy(gfx, in.gfx, sizeof gfx);
+        state.draw_this_frame = dirty_rows != 0;
+
+        // Rewinding mostly moves data around, so compiled code survives wherever the bytes did not change
+        for(unsigned page = 0; page != MEMORY_SIZE; page += CODE_PAGE_SIZE)
+        {
+            if(std::memcmp(&memory[page], &in.memory[page], CODE_PAGE_SIZE) != 0)
+            {
+                std::memcpy(&memory[page], &in.memory[page], CODE_PAGE_SIZE);
+                invalidate_code(page, CODE_PAGE_SIZE);
+            }
+        }
+
+        // Input recorded after the snapshot belongs to a timeline that no longer happens. The keys held right now
+        // carry over, so the log catches up with them.
+        if(input_log != nullptr)
+        {
+            std::erase_if(*input_log, [&](const input_event& event) {
+                return event.cycle > instructions_executed;
+            });
+
+            bool logged[KEY_COUNT] = {};
+            for(const auto& event : *input_log)
+            {
+                logged[event.key] = event.down;
+            }
+            for(auto key = 0; key != KEY_COUNT; key++)
+            {
+                if(logged[key] != key_state[key])
+                {
+                    input_log->push_back({instructions_executed, key, key_state[key]});
+                }
+            }
+        }
+
+        if(sound_log != nullptr)
+        {
+            std::erase_if(*sound_log, [&](const sound_span& span) {
+                return span.start > instructions_executed;
+            });
+            log_sound();
+        }
+    }
+
+    machine& default_machine()
+    {
+        static machine& instance = []() -> machine& {
+            // The drain is constructed before the machine so that it is destroyed after it
+            auto* drain = TRACE_LEVEL != trace_level::off ? &default_trace_drain() : nullptr;
+
+            static machine vm;
+            if(drain != nullptr)
+            {
+                vm.attach_trace(*drain);
+            }
+            return vm;
+        }();
+        return instance;
+    }
+
+    void init()
+    {
+        default_machine().init();
+    }
+
+    void update()
+    {
+        default_machine().update();
+    }
+
+    void run_frame()
+    {
+        default_machine().run_frame();
+    }
+
     void load(const char* path)
     {
-        // Load program into memory
-        std::ifstream is(path, std::ios::binary);
-        auto begin = &memory[0];
-        begin += PROGRAM_OFFSET;
-        std::streamsize max_count = sizeof(memory) - PROGRAM_OFFSET;
-        is.read(reinterpret_cast<char*>(begin), max_count);
+        default_machine().load(path);
     }
 
     void on_key_down(const int key_index)
     {
-        key_state[key_index] = true;
+        default_machine().on_key_down(key_index);
     }
 
     void on_key_up(const int key_index)
     {
-        key_state[key_index] = false;
+        default_machine().on_key_up(key_index);
     }
 
     bool draw_triggered()
     {
-        return draw_this_frame;
+        return default_machine().draw_triggered();
     }
 
-    const draw_buffer& gfx_buffer()
+    const display_rows& display()
     {
-        return gfx;
+        return default_machine().display();
+    }
+
+    row_mask take_dirty_rows()
+    {
+        return default_machine().take_dirty_rows();
+    }
+
+    std::uint64_t frame_hash()
+    {
+        return default_machine().frame_hash();
     }
 } // namespace chip8
\ No newline at end of file
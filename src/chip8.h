@@ -1,17 +1,377 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "block_cache.h"
+#include "decoder.h"
+#include "display.h"
+#include "jit.h"
+#include "quirks.h"
+#include "random.h"
+
 namespace chip8
 {
-    static constexpr auto DRAW_BUFFER_WIDTH  = 64;
-    static constexpr auto DRAW_BUFFER_HEIGHT = 32;
+    static constexpr auto MEMORY_SIZE    = 4096;
+    static constexpr auto XO_MEMORY_SIZE = 65536; // Only allocated by machines in the XO-CHIP mode
+    static constexpr auto REGISTER_COUNT = 16;
+    static constexpr auto STACK_SIZE     = 16;
+    static constexpr auto KEY_COUNT      = 16;
+
+    // Programs load at PROGRAM_OFFSET and may fill the rest of memory
+    static constexpr auto PROGRAM_OFFSET  = 0x200;
+    static constexpr auto MAX_ROM_SIZE    = MEMORY_SIZE - PROGRAM_OFFSET;
+    static constexpr auto MAX_XO_ROM_SIZE = XO_MEMORY_SIZE - PROGRAM_OFFSET;
+
+    // The hex digit sprites FX29 points at, five rows each, stored at address 0
+    static constexpr auto FONTSET_SIZE = 80;
+    extern const unsigned char chip8_fontset[FONTSET_SIZE];
+
+    // The ten-row digit sprites FX30 points at, stored right after the small ones in the SUPER-CHIP and XO-CHIP
+    // modes only
+    static constexpr auto BIG_FONTSET_SIZE = 160;
+    extern const unsigned char big_fontset[BIG_FONTSET_SIZE];
+
+    // SUPER-CHIP's RPL flags, as many as XO-CHIP has, and XO-CHIP's one-bit audio samples
+    static constexpr auto FLAG_REGISTER_COUNT = 16;
+    static constexpr auto AUDIO_PATTERN_SIZE  = 16;
+    static constexpr auto DEFAULT_PITCH       = 64; // Plays the pattern at 4000 bits per second
+
+    constexpr unsigned memory_size_of(const machine_mode mode)
+    {
+        return mode == machine_mode::xochip ? XO_MEMORY_SIZE : MEMORY_SIZE;
+    }
+
+    static constexpr auto CACHE_LINE_SIZE = 64;
+
+    // Emulated time: frames end at 60 Hz, and the timers tick once per frame
+    static constexpr auto FRAMES_PER_SECOND = 60;
+
+    // Instructions per 60 Hz frame unless configured otherwise, about 720 instructions per second
+    static constexpr auto DEFAULT_CYCLES_PER_FRAME = 12;
+
+    using opcode_t      = unsigned short;
+    using register_t    = unsigned char;
+    using stack_entry_t = unsigned short;
+
+    class trace_ring;
+    class trace_drain;
+    struct profile;
+    struct aot_program;
+
+    enum class backend
+    {
+        interpreter, // Fetch and dispatch one instruction at a time
+        blocks,      // Execute cached, fused basic blocks
+        jit          // Run basic blocks compiled to native code, where the build supports it
+    };
+
+    // What a machine's next instructions do when nothing from outside changes
+    enum class idle_state
+    {
+        running,
+        halted,            // Jumping to itself, which nothing ends
+        waiting_for_key,   // FX0A, until a key goes down
+        waiting_for_delay, // FX07, 3X00 and a jump back, until the delay timer runs out
+    };
+
+    // A key press or release that happened once cycle instructions had run
+    struct input_event
+    {
+        std::uint64_t cycle;
+        int key;
+        bool down;
+    };
+
+    // The sound timer sounds from cycle start until cycle end, replacing whatever was due to sound from start on.
+    // A span that ends where it starts silences the sound. XO-CHIP machines play their audio pattern instead of a
+    // plain beep.
+    struct sound_span
+    {
+        std::uint64_t start;
+        std::uint64_t end;
+        bool patterned                            = false;
+        unsigned char pitch                       = DEFAULT_PITCH;
+        unsigned char pattern[AUDIO_PATTERN_SIZE] = {};
+    };
+
+    // Everything needed to put a machine back to an earlier point, except its configuration and the keys held.
+    // The layout has no implicit padding so that two snapshots can be compared and delta-encoded byte by byte.
+    struct machine_snapshot
+    {
+        std::uint64_t random_state[4];
+        std::uint64_t instructions_executed;
+        std::uint64_t frame_base;
+        std::uint64_t cycle_base;
+        std::uint64_t delay_set_in_frame;
+        std::uint64_t sound_set_in_frame;
+        display_rows gfx;
+        std::uint32_t frame_cycles;
+        stack_entry_t stack[STACK_SIZE];
+        unsigned short I;
+        unsigned short pc;
+        register_t V[REGISTER_COUNT];
+        unsigned char sp;
+        unsigned char delay;
+        unsigned char sound;
+        unsigned char pending_key; // Key pressed during an FX0A wait plus one, 0 when none
+        unsigned char padding[4];
+        unsigned char memory[MEMORY_SIZE];
+    };
+
+    static_assert(sizeof(machine_snapshot) % 8 == 0 && offsetof(machine_snapshot, memory) == 392,
+                  "machine_snapshot must not have implicit padding");
+
+    // A self-contained CHIP-8 virtual machine. Any number of machines can live in one process.
+    class machine
+    {
+    public:
+        machine();
+        ~machine();
+
+        machine(const machine&)            = delete;
+        machine& operator=(const machine&) = delete;
+
+        void init();
+        void update();
+
+        // Runs instructions, one cycle each, and returns how many vblanks they crossed. A vblank ends a frame
+        // every cycles_per_frame() cycles and is when the 60 Hz timers tick.
+        unsigned run_cycles(const std::uint64_t cycles);
+        // Runs up to and including the next vblank
+        void run_frame();
+
+        void set_cycles_per_frame(const unsigned cycles);
+        unsigned cycles_per_frame() const;
+        std::uint64_t frame_count() const;
+        bool sound_playing() const;
+
+        // Selecting the JIT in a build without one (see CHIP8_JIT) selects the block backend instead
+        void set_backend(const backend b);
+        backend current_backend() const;
+        // Also sets the sprite edge to the profile's, which set_sprite_edge() can override afterwards. A profile of
+        // another machine_mode also resizes memory and the display and starts over with init(), so it goes before
+        // load().
+        void set_quirks(const quirk_profile profile);
+        quirk_profile current_quirks() const;
+        // Both throw std::invalid_argument for a ROM larger than memory holds past PROGRAM_OFFSET, load(path)
+        // std::runtime_error when the file cannot be read. Memory is left untouched when they throw.
+        void load(const char* path);
+        void load(const unsigned char* data, const std::size_t size);
+        void on_key_down(const int key_index);
+        void on_key_up(const int key_index);
+        bool draw_triggered() const;
+        // The CHIP-8 mode's display, left blank in the other modes
+        const display_rows& display() const;
+        // The display of the SUPER-CHIP and XO-CHIP modes, null in the CHIP-8 mode
+        const framebuffer* screen() const;
+        void set_sprite_edge(const sprite_edge edge);
+        // Rows changed since the previous call. Rows that were changed back to what they were still count. On a
+        // framebuffer a bit covers a 32nd of the screen.
+        row_mask take_dirty_rows();
+        std::uint64_t frame_hash() const;
+        // Folds the registers, I, pc, the stack and the timers, for telling runs apart beyond what they show
+        std::uint64_t register_hash() const;
+
+        std::uint64_t instruction_count() const;
+
+        idle_state idle() const;
+        // Of instruction_count(), the cycles fast-forwarded through instead of run
+        std::uint64_t idle_cycle_count() const;
+        // Idle states are fast-forwarded to the cycle they end on, or through the whole budget when only a key or
+        // nothing ends them. The result is the same as running every cycle. On by default, and traced or profiled
+        // machines always run every cycle.
+        void set_idle_skip(const bool enabled);
+
+        // Seeds the generator behind CXNN. Machines start out seeded with 0, so runs are reproducible by default.
+        void seed(const std::uint64_t value);
+
+        // Appends every key press and release from now on to log, or stops recording when log is null. Keys held
+        // when recording starts are logged as pressed on the current cycle. Restoring a snapshot rewrites the log
+        // to the timeline that continues from it.
+        void record_input(std::vector<input_event>* log);
+        // Appends a span to log every time the sound timer's future changes from now on: when it is set, when the
+        // frame length changes and when a snapshot is restored, or stops when log is null. A sound playing when
+        // recording starts is logged on the current cycle. Restoring a snapshot drops the spans logged after it.
+        void record_sound(std::vector<sound_span>* log);
+
+        // Snapshots only hold the CHIP-8 mode, both throw std::logic_error in the others
+        void save(machine_snapshot& out) const;
+        // Only the code pages whose bytes differ from the snapshot are invalidated
+        void restore(const machine_snapshot& in);
+
+        // Streams this machine's trace records to drain. Does nothing in builds with CHIP8_TRACE_LEVEL 0.
+        void attach_trace(trace_drain& drain);
+        void detach_trace();
+
+        // Starts collecting op counts, handler timings and pc hits from zero. Does nothing in builds without
+        // CHIP8_PROFILE. A profiled machine runs the blocks in place of the JIT, whose code is not instrumented.
+        void enable_profile();
+        void disable_profile();
+        // Null unless profiling
+        const profile* current_profile() const;
+
+        // Runs the blocks of a ROM recompiled by chip8-aot wherever memory holds the bytes they were recompiled
+        // from, and the interpreter everywhere else. Traced and profiled machines never run them. Null
+        // detaches, and so does selecting other quirks. Throws std::invalid_argument when the machine runs other
+        // quirks than the program was recompiled for.
+        void attach_program(const aot_program* program);
+
+    private:
+        // Everything touched by every instruction, packed into a single cache line
+        struct alignas(CACHE_LINE_SIZE) hot_state
+        {
+            stack_entry_t stack[STACK_SIZE];
+            register_t V[REGISTER_COUNT];
+            unsigned short I;
+            unsigned short pc;
+            unsigned char sp; // Index of the next free stack entry
+            bool draw_this_frame;
+        };
+
+        static_assert(sizeof(hot_state) == CACHE_LINE_SIZE, "hot_state must fit in one cache line");
+
+        // A 60 Hz countdown is never decremented, its value follows from the frames elapsed since it was set
+        struct timer
+        {
+            unsigned char value;
+            std::uint64_t set_in_frame;
+        };
+
+        register_t& flag_register();
+
+        register_t& get_first_register(const decoded_instruction& instruction);
+        register_t& get_second_register(const decoded_instruction& instruction);
+
+        bool key_is_pressed(unsigned char key) const;
+
+        void next_instruction();
+        void jump_next_instruction();
+
+        const decoded_instruction& fetch();
+        opcode_t opcode_at(const unsigned address) const;
+        void invalidate_code(const unsigned address, const unsigned size);
+        std::uint64_t current_frame() const;
+        std::uint64_t frame_at(const std::uint64_t cycle) const;
+        unsigned char timer_value(const timer& countdown) const;
+        unsigned char timer_value_at(const timer& countdown, const std::uint64_t cycle) const;
+        std::uint64_t frame_start_cycle(const std::uint64_t frame) const;
+        void allocate_memory(const machine_mode mode);
+        // Skips one instruction, or both halves of an XO-CHIP F000 NNNN
+        template<typename Quirks>
+        void skip_instruction();
+        void log_sound();
+        void trace_instruction();
+        void profile_instruction(const decoded_instruction& instruction);
+        void retire();
+
+        // Records to execute before the next lookup. Returned by value so the dispatch loop keeps it in registers.
+        struct op_range
+        {
+            const decoded_instruction* begin;
+            const decoded_instruction* end;
+        };
+
+        op_range next_block(std::uint64_t& remaining);
+        template<typename Quirks, bool UseBlocks>
+        void execute(const std::uint64_t instructions);
+        template<typename Quirks>
+        void execute_compiled(const std::uint64_t instructions);
+        template<typename Quirks>
+        void execute_native(const std::uint64_t instructions);
+        // Marks the recompiled blocks overlapping a write stale unless their bytes are what they were made from
+        void check_native_blocks(const unsigned address, const unsigned size);
+        template<typename Quirks>
+        void execute_on_backend(const std::uint64_t instructions);
+        void execute_skipping_idle(std::uint64_t instructions);
+        // Fast-forwards through up to budget cycles of an idle state and returns how many it skipped
+        std::uint64_t skip_idle(const std::uint64_t budget);
+
+        // One handler per op, named after it, and instantiated over every quirk policy
+#define CHIP8_HANDLER_DECLARATION(name)                                                                               \
+    template<typename Quirks>                                                                                         \
+    void name(const decoded_instruction& instruction);
+        CHIP8_OPS(CHIP8_HANDLER_DECLARATION) CHIP8_FUSED_OPS(CHIP8_HANDLER_DECLARATION)
+#undef CHIP8_HANDLER_DECLARATION
+
+        hot_state state;
+
+        std::uint64_t instructions_executed;
+
+        timer delay;
+        timer sound;
+
+        // Frames are counted from the cycle a frame length was last set on
+        unsigned frame_cycles    = DEFAULT_CYCLES_PER_FRAME;
+        std::uint64_t frame_base = 0;
+        std::uint64_t cycle_base = 0;
+
+        // Point at the arrays below, or at the heap in the XO-CHIP mode. decoded holds the decoded form of the
+        // instruction starting at every address, filled on first execution.
+        unsigned char* memory;
+        decoded_instruction* decoded;
+        unsigned memory_size = MEMORY_SIZE;
+
+        unsigned char base_memory[MEMORY_SIZE];
+        decoded_instruction base_decoded[MEMORY_SIZE];
+        std::unique_ptr<unsigned char[]> xo_memory;
+        std::unique_ptr<decoded_instruction[]> xo_decoded;
+
+        block_cache blocks;
+        std::unique_ptr<jit_cache> compiled; // Only created once the JIT is selected
+        const aot_program* native = nullptr;
+        std::vector<unsigned char> native_stale; // One flag per block of native
+        backend active_backend = backend::blocks;
+
+        // execute_on_backend() instantiated for the selected profile, picked once by set_quirks()
+        using executor = void (machine::*)(const std::uint64_t);
+        quirk_profile active_quirks = DEFAULT_QUIRKS;
+        executor execute_with_quirks;
+
+        // State only the SUPER-CHIP and XO-CHIP modes have
+        struct extended_state
+        {
+            framebuffer screen;
+            plane_mask planes = 1; // Drawn, cleared and scrolled by the instructions that touch the display
+            register_t flags[FLAG_REGISTER_COUNT];
+            unsigned char pattern[AUDIO_PATTERN_SIZE];
+            unsigned char pitch;
+        };
+
+        display_rows gfx;
+        std::unique_ptr<extended_state> extended;
+        row_mask dirty_rows      = ALL_ROWS;
+        sprite_edge sprite_edges = sprite_edge::clip;
+
+        bool key_state[KEY_COUNT];
+        int pending_key                     = -1; // Pressed while FX0A waited, taken by the FX0A
+        std::vector<input_event>* input_log = nullptr;
+        std::vector<sound_span>* sound_log  = nullptr;
+
+        xoshiro256 random;
+
+        bool skip_idle_loops         = true;
+        std::uint64_t skipped_cycles = 0;
+
+        std::unique_ptr<trace_ring> trace_output;
+        trace_drain* trace_destination = nullptr;
+
+        std::unique_ptr<profile> profiler;
+    };
 
-    using draw_buffer = unsigned char[DRAW_BUFFER_WIDTH * DRAW_BUFFER_HEIGHT];
+    // Thin wrappers around a process-wide default machine
+    machine& default_machine();
 
     void init();
     void update();
+    void run_frame();
     void load(const char* path);
     void on_key_down(const int key);
     void on_key_up(const int key_index);
     bool draw_triggered();
-    const draw_buffer& gfx_buffer();
-}; // namespace chip8
\ No newline at end of file
+    const display_rows& display();
+    row_mask take_dirty_rows();
+    std::uint64_t frame_hash();
+}; // namespace chip8
@@ -0,0 +1,458 @@
+#include "conformance.h"
+
+#include "aot.h"
+#include "lockstep.h"
+#include "replay.h"
+#include "work_stealing_pool.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cinttypes>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+namespace chip8
+{
+    static constexpr std::string_view GOLDEN_HEADER = "chip8-golden 1";
+
+    static bool parse_number(const std::string_view text, auto& out, const int base = 10)
+    {
+        const auto end = text.data() + text.size();
+        return text.empty() == false && std::from_chars(text.data(), end, out, base).ptr == end;
+    }
+
+    static std::string read_text(const std::filesystem::path& path)
+    {
+        std::ifstream is(path, std::ios::binary);
+        if(is.is_open() == false)
+        {
+            throw std::runtime_error("Could not open " + path.string());
+        }
+        return std::string(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+    }
+
+    // NAME=VALUE
+    static bool parse_option(const std::string_view text, const std::filesystem::path& directory,
+                             conformance_case& out)
+    {
+        const auto equals = text.find('=');
+        if(equals == std::string_view::npos)
+        {
+            return false;
+        }
+        const auto name  = text.substr(0, equals);
+        const auto value = text.substr(equals + 1);
+
+        if(name == "checkpoints")
+        {
+            return parse_number(value, out.checkpoints) && out.checkpoints != 0;
+        }
+        if(name == "quirks")
+        {
+            return parse_quirk_profile(value, out.quirks);
+        }
+        if(name == "seed")
+        {
+            return parse_number(value, out.seed);
+        }
+        if(name == "cycles-per-frame")
+        {
+            return parse_number(value, out.cycles_per_frame) && out.cycles_per_frame != 0;
+        }
+        if(name == "keys")
+        {
+            const auto script = value.starts_with('@') ? read_text(directory / value.substr(1)) : std::string(value);
+            try
+            {
+                out.events = parse_input_script(script);
+            }
+            catch(const std::invalid_argument&)
+            {
+                return false;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    std::vector<conformance_case> load_conformance_manifest(const char* path)
+    {
+        std::ifstream is(path);
+        if(is.is_open() == false)
+        {
+            throw std::runtime_error(std::string("Could not open ") + path);
+        }
+        const auto directory = std::filesystem::path(path).parent_path();
+
+        std::vector<conformance_case> cases;
+        std::set<std::string> names;
+        std::string line;
+        while(std::getline(is, line))
+        {
+            std::istringstream fields(line);
+            std::string name;
+            if((fields >> name).fail() || name.starts_with('#'))
+            {
+                continue;
+            }
+
+            conformance_case entry;
+            entry.name = name;
+
+            std::string rom;
+            std::string cycles;
+            bool valid = (fields >> rom >> cycles).fail() == false && parse_number(cycles, entry.cycles) &&
+                         entry.cycles != 0 && names.insert(name).second;
+            entry.rom_path = (directory / rom).string();
+
+            std::string option;
+            while(valid && (fields >> option))
+            {
+                valid = parse_option(option, directory, entry);
+            }
+            if(valid == false)
+            {
+                throw std::runtime_error(std::string(path) + ": bad line " + line);
+            }
+            entry.checkpoints = static_cast<unsigned>(std::min<std::uint64_t>(entry.checkpoints, entry.cycles));
+            cases.push_back(std::move(entry));
+        }
+        return cases;
+    }
+
+    const char* conformance_engine_name(const conformance_engine engine)
+    {
+        switch(engine)
+        {
+            case conformance_engine::reference:
+                return "reference";
+            case conformance_engine::interpreter:
+                return "interpreter";
+            case conformance_engine::blocks:
+                return "blocks";
+            case conformance_engine::jit:
+                return "jit";
+            case conformance_engine::native:
+                return "native";
+            case conformance_engine::lockstep:
+                break;
+        }
+        return "lockstep";
+    }
+
+    // native and reference run on the interpreter
+    static backend backend_of(const conformance_engine engine)
+    {
+        switch(engine)
+        {
+            case conformance_engine::blocks:
+                return backend::blocks;
+            case conformance_engine::jit:
+                return backend::jit;
+            default:
+                break;
+        }
+        return backend::interpreter;
+    }
+
+    static conformance_run run_case(const conformance_case& entry, const std::vector<unsigned char>& rom,
+                                    const conformance_engine engine)
+    {
+        conformance_run run;
+        const aot_program* program = nullptr;
+        if(engine == conformance_engine::native)
+        {
+            program = find_aot_program(rom.data(), rom.size(), entry.quirks);
+            if(program == nullptr)
+            {
+                run.skipped = true;
+                return run;
+            }
+        }
+
+        auto vm = std::make_unique<machine>();
+        vm->set_backend(backend_of(engine));
+        vm->set_idle_skip(engine != conformance_engine::reference);
+        vm->set_quirks(entry.quirks);
+        vm->set_cycles_per_frame(entry.cycles_per_frame);
+        vm->seed(entry.seed);
+        vm->load(rom.data(), rom.size());
+        vm->attach_program(program);
+
+        const auto checkpoint = [&vm]() {
+            return conformance_checkpoint{vm->instruction_count(), vm->frame_hash(), vm->register_hash()};
+        };
+
+        try
+        {
+            for(std::uint64_t i = 1; i <= entry.checkpoints; i++)
+            {
+                run_with_input(*vm, entry.events, entry.cycles * i / entry.checkpoints);
+                run.checkpoints.push_back(checkpoint());
+            }
+        }
+        catch(const std::exception& e)
+        {
+            run.checkpoints.push_back(checkpoint());
+            run.fault = e.what();
+        }
+        return run;
+    }
+
+    // Runs the cases of lane_cases, which share a ROM, quirks and frame length, as the lanes of one
+    // lockstep_machines. All of them run up to the next cycle any of them has a checkpoint or an event on, where
+    // each lane takes its checkpoint and then its keys, in the order run_with_input() would.
+    static void run_lanes(const std::vector<conformance_case>& cases, const std::vector<std::size_t>& lane_cases,
+                          const std::vector<unsigned char>& rom, std::vector<conformance_run>& runs)
+    {
+        const auto lane_count = static_cast<unsigned>(lane_cases.size());
+        const auto& shared    = cases[lane_cases.front()];
+
+        auto lanes = std::make_unique<lockstep_machines>(lane_count);
+        lanes->set_quirks(shared.quirks);
+        lanes->set_cycles_per_frame(shared.cycles_per_frame);
+        lanes->load(rom.data(), rom.size());
+
+        std::vector<std::uint64_t> stops;
+        for(unsigned lane = 0; lane != lane_count; lane++)
+        {
+            const auto& entry = cases[lane_cases[lane]];
+            lanes->seed(lane, entry.seed);
+            for(std::uint64_t i = 1; i <= entry.checkpoints; i++)
+            {
+                stops.push_back(entry.cycles * i / entry.checkpoints);
+            }
+            for(const auto& event : entry.events)
+            {
+                if(event.cycle < entry.cycles)
+                {
+                    stops.push_back(event.cycle);
+                }
+            }
+        }
+        std::ranges::sort(stops);
+        stops.erase(std::unique(stops.begin(), stops.end()), stops.end());
+
+        const auto checkpoint = [&lanes](const unsigned lane) {
+            return conformance_checkpoint{lanes->instruction_count(lane), lanes->frame_hash(lane),
+                                          lanes->register_hash(lane)};
+        };
+
+        // Lanes stay in running until they fault or reach their last checkpoint, and the ones that are done keep
+        // running with the others without being looked at again
+        std::vector<std::size_t> next_event(lane_count, 0);
+        std::vector<bool> running(lane_count, true);
+        std::uint64_t now = 0;
+        for(const auto stop : stops)
+        {
+            lanes->run_cycles(stop - now);
+            now = stop;
+
+            for(unsigned lane = 0; lane != lane_count; lane++)
+            {
+                const auto& entry = cases[lane_cases[lane]];
+                auto& run         = runs[lane_cases[lane]];
+                if(running[lane] == false)
+                {
+                    continue;
+                }
+                if(const auto fault = lanes->fault(lane); fault != nullptr)
+                {
+                    run.checkpoints.push_back(checkpoint(lane));
+                    run.fault     = fault;
+                    running[lane] = false;
+                    continue;
+                }
+
+                if(now == entry.cycles * (run.checkpoints.size() + 1) / entry.checkpoints)
+                {
+                    run.checkpoints.push_back(checkpoint(lane));
+                    if(run.checkpoints.size() == entry.checkpoints)
+                    {
+                        running[lane] = false;
+                        continue;
+                    }
+                }
+                for(auto& i = next_event[lane]; i != entry.events.size() && entry.events[i].cycle <= now; i++)
+                {
+                    const auto& event = entry.events[i];
+                    event.down ? lanes->on_key_down(lane, event.key) : lanes->on_key_up(lane, event.key);
+                }
+            }
+        }
+    }
+
+    std::vector<conformance_run> run_conformance(const std::vector<conformance_case>& cases,
+                                                 const conformance_engine engine, const unsigned thread_count)
+    {
+        // Every ROM is read once no matter how many cases run it
+        std::map<std::string, std::vector<unsigned char>> roms;
+        for(const auto& entry : cases)
+        {
+            auto found = roms.find(entry.rom_path);
+            if(found == roms.end())
+            {
+                const auto text = read_text(entry.rom_path);
+                std::vector<unsigned char> rom(text.begin(), text.end());
+                found = roms.emplace(entry.rom_path, std::move(rom)).first;
+            }
+
+            const auto max_size = memory_size_of(flags_of(entry.quirks).mode) - PROGRAM_OFFSET;
+            if(found->second.size() > max_size)
+            {
+                throw std::invalid_argument(entry.rom_path + " is larger than " + std::to_string(max_size) + " bytes");
+            }
+        }
+
+        std::vector<conformance_run> runs(cases.size());
+        {
+            work_stealing_pool pool(thread_count);
+
+            // Every task writes only its own slots, and wait_idle() orders the writes before the return
+            if(engine == conformance_engine::lockstep)
+            {
+                std::map<std::tuple<std::string, quirk_profile, unsigned>, std::vector<std::size_t>> groups;
+                for(std::size_t i = 0; i != cases.size(); i++)
+                {
+                    if(flags_of(cases[i].quirks).mode != machine_mode::chip8)
+                    {
+                        runs[i].skipped = true;
+                        continue;
+                    }
+                    groups[{cases[i].rom_path, cases[i].quirks, cases[i].cycles_per_frame}].push_back(i);
+                }
+
+                for(const auto& [key, members] : groups)
+                {
+                    for(std::size_t first = 0; first < members.size(); first += MAX_LOCKSTEP_LANES)
+                    {
+                        const auto last = std::min(first + MAX_LOCKSTEP_LANES, members.size());
+                        std::vector<std::size_t> lane_cases(members.begin() + first, members.begin() + last);
+                        pool.submit([&runs, &cases, &roms, lane_cases = std::move(lane_cases)]() {
+                            run_lanes(cases, lane_cases, roms.at(cases[lane_cases.front()].rom_path), runs);
+                        });
+                    }
+                }
+            }
+            else
+            {
+                for(std::size_t i = 0; i != cases.size(); i++)
+                {
+                    pool.submit([&runs, &cases, &roms, engine, i]() {
+                        runs[i] = run_case(cases[i], roms.at(cases[i].rom_path), engine);
+                    });
+                }
+            }
+
+            pool.wait_idle();
+        }
+        return runs;
+    }
+
+    void save_golden(const char* path, const conformance_run& run)
+    {
+        std::unique_ptr<std::FILE, decltype(&std::fclose)> file(std::fopen(path, "w"), &std::fclose);
+        if(file == nullptr)
+        {
+            throw std::runtime_error(std::string("Could not write ") + path);
+        }
+
+        std::fprintf(file.get(), "%.*s\n", static_cast<int>(GOLDEN_HEADER.size()), GOLDEN_HEADER.data());
+        for(const auto& checkpoint : run.checkpoints)
+        {
+            std::fprintf(file.get(), "%" PRIu64 " %016" PRIx64 " %016" PRIx64 "\n", checkpoint.cycle,
+                         checkpoint.frame_hash, checkpoint.register_hash);
+        }
+        if(run.fault.empty() == false)
+        {
+            std::fprintf(file.get(), "fault %s\n", run.fault.c_str());
+        }
+
+        if(std::ferror(file.get()) != 0)
+        {
+            throw std::runtime_error(std::string("Could not write ") + path);
+        }
+    }
+
+    conformance_run load_golden(const char* path)
+    {
+        std::ifstream is(path);
+        if(is.is_open() == false)
+        {
+            throw std::runtime_error(std::string("Could not open ") + path);
+        }
+
+        std::string line;
+        if(std::getline(is, line).fail() || line != GOLDEN_HEADER)
+        {
+            throw std::runtime_error(std::string(path) + " is not a golden file");
+        }
+
+        conformance_run run;
+        while(std::getline(is, line))
+        {
+            const std::string_view text = line;
+            if(text.starts_with("fault "))
+            {
+                run.fault = text.substr(6);
+                continue;
+            }
+
+            const auto first  = text.find(' ');
+            const auto second = first == std::string_view::npos ? first : text.find(' ', first + 1);
+
+            conformance_checkpoint checkpoint;
+            if(second == std::string_view::npos || parse_number(text.substr(0, first), checkpoint.cycle) == false ||
+               parse_number(text.substr(first + 1, second - first - 1), checkpoint.frame_hash, 16) == false ||
+               parse_number(text.substr(second + 1), checkpoint.register_hash, 16) == false)
+            {
+                throw std::runtime_error(std::string(path) + ": bad line " + line);
+            }
+            run.checkpoints.push_back(checkpoint);
+        }
+        return run;
+    }
+
+    std::string describe_mismatch(const conformance_run& golden, const conformance_run& run)
+    {
+        char text[160];
+        for(std::size_t i = 0; i != std::min(golden.checkpoints.size(), run.checkpoints.size()); i++)
+        {
+            const auto& expected = golden.checkpoints[i];
+            const auto& actual   = run.checkpoints[i];
+            if(expected.cycle != actual.cycle)
+            {
+                std::snprintf(text, sizeof text, "checkpoint %zu on cycle %" PRIu64 " instead of %" PRIu64, i + 1,
+                              actual.cycle, expected.cycle);
+                return text;
+            }
+            if(expected.frame_hash != actual.frame_hash || expected.register_hash != actual.register_hash)
+            {
+                std::snprintf(text, sizeof text, "%s differs on cycle %" PRIu64,
+                              expected.frame_hash != actual.frame_hash ? "frame" : "registers", actual.cycle);
+                return text;
+            }
+        }
+        if(golden.checkpoints.size() != run.checkpoints.size())
+        {
+            std::snprintf(text, sizeof text, "%zu checkpoints instead of %zu", run.checkpoints.size(),
+                          golden.checkpoints.size());
+            return text;
+        }
+        if(golden.fault != run.fault)
+        {
+            return "fault \"" + run.fault + "\" instead of \"" + golden.fault + "\"";
+        }
+        return {};
+    }
+} // namespace chip8
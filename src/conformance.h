@@ -0,0 +1,81 @@
+#pragma once
+
+#include "chip8.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace chip8
+{
+    // One ROM of a conformance suite, run from power-on with scripted input and checked at evenly spaced cycles
+    struct conformance_case
+    {
+        std::string name;     // Names the golden file, unique within a manifest
+        std::string rom_path;
+        std::uint64_t cycles;
+        unsigned checkpoints      = 1; // Spread evenly up to cycles, the last one on cycles
+        quirk_profile quirks      = DEFAULT_QUIRKS;
+        std::uint64_t seed        = 0;
+        unsigned cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+        std::vector<input_event> events;
+    };
+
+    // What runs the cases. reference is the interpreter running every cycle, idle states included, and writes the
+    // golden files. native runs the blocks chip8-aot recompiled into the binary and lockstep runs the cases that
+    // share a ROM, quirks and frame length as lanes of one lockstep_machines.
+    enum class conformance_engine
+    {
+        reference,
+        interpreter,
+        blocks,
+        jit,
+        native,
+        lockstep,
+    };
+
+    // "reference", "interpreter", "blocks", "jit", "native" or "lockstep"
+    const char* conformance_engine_name(const conformance_engine engine);
+
+    struct conformance_checkpoint
+    {
+        std::uint64_t cycle;
+        std::uint64_t frame_hash;
+        std::uint64_t register_hash;
+
+        bool operator==(const conformance_checkpoint&) const = default;
+    };
+
+    // What a case did: the checkpoints it reached and, when it stopped early, what the machine threw, after a last
+    // checkpoint on the cycle it stopped on. Skipped when the engine cannot run the case: native without code
+    // recompiled for its ROM and quirks, lockstep outside the CHIP-8 mode.
+    struct conformance_run
+    {
+        std::vector<conformance_checkpoint> checkpoints;
+        std::string fault;
+        bool skipped = false;
+
+        bool operator==(const conformance_run&) const = default;
+    };
+
+    // One case per line: NAME ROM CYCLES, then any of checkpoints=N, quirks=PROFILE, seed=N, cycles-per-frame=N and
+    // keys=SCRIPT, the script in the format of parse_input_script() with commas only. keys=@FILE reads the script
+    // from FILE. Blank lines and lines starting with # are skipped, and relative ROM and script paths are taken
+    // from the manifest's directory. Throws std::runtime_error when the manifest cannot be read or has a bad line.
+    std::vector<conformance_case> load_conformance_manifest(const char* path);
+
+    // Runs every case on its own machine, or its own lane, on engine, spread over a work stealing pool. thread_count
+    // of 0 uses every core. Results are in the order of cases. Throws std::runtime_error for a ROM that cannot be
+    // read and std::invalid_argument for one too large to load, before any machine runs.
+    std::vector<conformance_run> run_conformance(const std::vector<conformance_case>& cases,
+                                                 const conformance_engine engine, const unsigned thread_count = 0);
+
+    // Text format: a "chip8-golden 1" line, one "CYCLE FRAME-HASH REGISTER-HASH" line per checkpoint, hashes in
+    // hex, and a "fault MESSAGE" line for a run that stopped early. Both throw std::runtime_error when the file
+    // cannot be read or written or is not a golden file.
+    void save_golden(const char* path, const conformance_run& run);
+    conformance_run load_golden(const char* path);
+
+    // Describes the first difference between a run and its golden, empty when there is none
+    std::string describe_mismatch(const conformance_run& golden, const conformance_run& run);
+} // namespace chip8
@@ -0,0 +1,184 @@
+#include "conformance.h"
+
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Usage: chip8-conform [--threads N] [--backend ENGINE|all] [--golden DIR] [--update] manifest
+// Runs every case of manifest on every core, once per engine, and compares the framebuffer and register hashes at
+// each checkpoint with the golden file DIR/NAME.golden. DIR defaults to the golden directory next to the manifest.
+// See load_conformance_manifest() for the manifest format and conformance_engine for the engines: reference,
+// interpreter, blocks, jit, native and lockstep, all of them by default. Cases an engine cannot run are skipped.
+// --update first regenerates every golden file from the reference engine, which runs every cycle the others may
+// fast-forward, then checks as usual. Exits with 2 when any case differs from its golden file or has none.
+
+static bool parse_number(const char* text, auto& out)
+{
+    const auto end = text + std::strlen(text);
+    return std::from_chars(text, end, out).ptr == end;
+}
+
+static const std::vector<chip8::conformance_engine> ALL_ENGINES = {
+    chip8::conformance_engine::reference, chip8::conformance_engine::interpreter, chip8::conformance_engine::blocks,
+    chip8::conformance_engine::jit,       chip8::conformance_engine::native,      chip8::conformance_engine::lockstep};
+
+static bool parse_engines(const std::string_view text, std::vector<chip8::conformance_engine>& out)
+{
+    if(text == "all")
+    {
+        out = ALL_ENGINES;
+        return true;
+    }
+    for(const auto engine : ALL_ENGINES)
+    {
+        if(text == chip8::conformance_engine_name(engine))
+        {
+            out = {engine};
+            return true;
+        }
+    }
+    return false;
+}
+
+static int run(const char* manifest_path, std::filesystem::path golden_directory,
+               const std::vector<chip8::conformance_engine>& engines, const unsigned threads, const bool update)
+{
+    const auto cases = chip8::load_conformance_manifest(manifest_path);
+    if(golden_directory.empty())
+    {
+        golden_directory = std::filesystem::path(manifest_path).parent_path() / "golden";
+    }
+    const auto golden_path = [&golden_directory](const chip8::conformance_case& entry) {
+        return (golden_directory / (entry.name + ".golden")).string();
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+
+    if(update)
+    {
+        std::filesystem::create_directories(golden_directory);
+        const auto runs = chip8::run_conformance(cases, chip8::conformance_engine::reference, threads);
+        for(std::size_t i = 0; i != cases.size(); i++)
+        {
+            chip8::save_golden(golden_path(cases[i]).c_str(), runs[i]);
+        }
+        std::printf("updated:  %zu golden files in %s\n", cases.size(), golden_directory.string().c_str());
+    }
+
+    std::vector<chip8::conformance_run> goldens(cases.size());
+    std::vector<bool> missing(cases.size(), false);
+    for(std::size_t i = 0; i != cases.size(); i++)
+    {
+        const auto path = golden_path(cases[i]);
+        if(std::filesystem::exists(path) == false)
+        {
+            missing[i] = true;
+            continue;
+        }
+        goldens[i] = chip8::load_golden(path.c_str());
+    }
+
+    unsigned long failed  = 0;
+    unsigned long skipped = 0;
+    for(const auto engine : engines)
+    {
+        const auto name = chip8::conformance_engine_name(engine);
+        const auto runs = chip8::run_conformance(cases, engine, threads);
+        for(std::size_t i = 0; i != cases.size(); i++)
+        {
+            if(runs[i].skipped)
+            {
+                skipped++;
+                continue;
+            }
+            if(missing[i])
+            {
+                std::printf("FAIL %s on %s: no golden file\n", cases[i].name.c_str(), name);
+                failed++;
+                continue;
+            }
+            if(const auto mismatch = chip8::describe_mismatch(goldens[i], runs[i]); mismatch.empty() == false)
+            {
+                std::printf("FAIL %s on %s: %s\n", cases[i].name.c_str(), name, mismatch.c_str());
+                failed++;
+            }
+        }
+    }
+
+    const auto end = std::chrono::steady_clock::now();
+
+    std::printf("cases:    %zu\n", cases.size());
+    std::printf("engines:  %zu\n", engines.size());
+    std::printf("skipped:  %lu\n", skipped);
+    std::printf("failed:   %lu\n", failed);
+    std::printf("seconds:  %.3f\n", std::chrono::duration<double>(end - start).count());
+
+    return failed == 0 ? 0 : 2;
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned threads = 0;
+    bool update      = false;
+
+    const char* manifest_path = nullptr;
+    std::filesystem::path golden_directory;
+    std::vector<chip8::conformance_engine> engines = ALL_ENGINES;
+
+    for(int i = 1; i < argc; i++)
+    {
+        const std::string_view arg = argv[i];
+
+        const bool has_value = i + 1 < argc;
+        if(arg == "--threads" && has_value && parse_number(argv[i + 1], threads))
+        {
+            i++;
+        }
+        else if(arg == "--backend" && has_value && parse_engines(argv[i + 1], engines))
+        {
+            i++;
+        }
+        else if(arg == "--golden" && has_value)
+        {
+            golden_directory = argv[++i];
+        }
+        else if(arg == "--update")
+        {
+            update = true;
+        }
+        else if(arg.starts_with("--") || manifest_path != nullptr)
+        {
+            std::fprintf(stderr, "Unknown or incomplete option %s\n", argv[i]);
+            return 1;
+        }
+        else
+        {
+            manifest_path = argv[i];
+        }
+    }
+
+    if(manifest_path == nullptr)
+    {
+        std::fprintf(stderr,
+                     "Usage: %s [--threads N] [--backend reference|interpreter|blocks|jit|native|lockstep|all] "
+                     "[--golden DIR] [--update] manifest\n",
+                     argv[0]);
+        return 1;
+    }
+
+    try
+    {
+        return run(manifest_path, golden_directory, engines, threads, update);
+    }
+    catch(const std::exception& e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+}
@@ -0,0 +1,151 @@
+#include "decoder.h"
+
+namespace chip8
+{
+    static op decode_handler(const unsigned short opcode)
+    {
+        switch(opcode >> 12)
+        {
+            case 0x0:
+                switch(opcode)
+                {
+                    case 0x00E0:
+                        return op::clear_screen;
+                    case 0x00EE:
+                        return op::return_from_subroutine;
+                    case 0x00FB:
+                        return op::scroll_right;
+                    case 0x00FC:
+                        return op::scroll_left;
+                    case 0x00FD:
+                        return op::exit_interpreter;
+                    case 0x00FE:
+                        return op::set_low_resolution;
+                    case 0x00FF:
+                        return op::set_high_resolution;
+                }
+                switch(opcode & 0xFFF0)
+                {
+                    case 0x00C0:
+                        return op::scroll_down;
+                    case 0x00D0:
+                        return op::scroll_up;
+                }
+                return op::unsupported;
+            case 0x1:
+                return op::jump_to;
+            case 0x2:
+                return op::call_func;
+            case 0x3:
+                return op::jump_if_equal;
+            case 0x4:
+                return op::jump_if_not_equal;
+            case 0x5:
+                switch(opcode & 0x000F)
+                {
+                    case 0x0:
+                        return op::jump_if_registers_equal;
+                    case 0x2:
+                        return op::save_register_range;
+                    case 0x3:
+                        return op::load_register_range;
+                }
+                return op::unsupported;
+            case 0x6:
+                return op::set_register_to_value;
+            case 0x7:
+                return op::add_assign_register_to_value;
+            case 0x8:
+                switch(opcode & 0x000F)
+                {
+                    case 0x0:
+                        return op::assign_register;
+                    case 0x1:
+                        return op::or_assign_register;
+                    case 0x2:
+                        return op::and_assign_register;
+                    case 0x3:
+                        return op::xor_assign_register;
+                    case 0x4:
+                        return op::add_assign_register;
+                    case 0x5:
+                        return op::subtract_assign_register;
+                    case 0x6:
+                        return op::shift_right_assign_register;
+                    case 0x7:
+                        return op::reverse_subtract_assign_register;
+                    case 0xE:
+                        return op::shift_left_assign_register;
+                }
+                return op::unsupported;
+            case 0x9:
+                return (opcode & 0x000F) == 0 ? op::jump_if_registers_not_equal : op::unsupported;
+            case 0xA:
+                return op::assign_address_register;
+            case 0xB:
+                return op::jump_to_address;
+            case 0xC:
+                return op::set_register_to_bitwise_and_of_random;
+            case 0xD:
+                return op::draw_sprite;
+            case 0xE:
+                switch(opcode & 0x00FF)
+                {
+                    case 0x9E:
+                        return op::jump_if_key_pressed;
+                    case 0xA1:
+                        return op::jump_if_key_not_pressed;
+                }
+                return op::unsupported;
+            case 0xF:
+                switch(opcode & 0x00FF)
+                {
+                    case 0x00:
+                        return opcode == 0xF000 ? op::assign_long_address_register : op::unsupported;
+                    case 0x01:
+                        return op::select_planes;
+                    case 0x02:
+                        return opcode == 0xF002 ? op::load_audio_pattern : op::unsupported;
+                    case 0x07:
+                        return op::set_register_to_delay_timer;
+                    case 0x0A:
+                        return op::wait_for_key_press;
+                    case 0x15:
+                        return op::set_delay_timer_to_register;
+                    case 0x18:
+                        return op::set_sound_timer_to_register;
+                    case 0x1E:
+                        return op::add_assign_address_register;
+                    case 0x29:
+                        return op::set_memory_address_to_character_sprite_address;
+                    case 0x30:
+                        return op::set_memory_address_to_big_sprite_address;
+                    case 0x33:
+                        return op::store_bcd;
+                    case 0x3A:
+                        return op::set_pitch_to_register;
+                    case 0x55:
+                        return op::fill_memory_with_registers;
+                    case 0x65:
+                        return op::fill_registers_with_memory;
+                    case 0x75:
+                        return op::store_flags;
+                    case 0x85:
+                        return op::load_flags;
+                }
+                return op::unsupported;
+        }
+        return op::unsupported;
+    }
+
+    decoded_instruction decode(const unsigned short opcode)
+    {
+        return {
+            .handler = decode_handler(opcode),
+            .x       = static_cast<unsigned char>((opcode & 0x0F00) >> 8),
+            .y       = static_cast<unsigned char>((opcode & 0x00F0) >> 4),
+            .nn      = static_cast<unsigned char>(opcode & 0x00FF),
+            .nnn     = static_cast<unsigned short>(opcode & 0x0FFF),
+        };
+    }
+} // namespace chip8
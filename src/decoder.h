@@ -0,0 +1,89 @@
+#pragma once
+
+// Every operation the interpreter can execute. The list is expanded into the op enum, the threaded-code label
+// table and the portable dispatch switch, which all have to stay in the same order.
+#define CHIP8_OPS(X)                                                                                                  \
+    X(undecoded)                                      /* Decode cache slot not filled yet */                          \
+    X(unsupported)                                    /* Anything the core does not implement */                      \
+    X(scroll_down)                                    /* 00CN */                                                      \
+    X(scroll_up)                                      /* 00DN */                                                      \
+    X(clear_screen)                                   /* 00E0 */                                                      \
+    X(return_from_subroutine)                         /* 00EE */                                                      \
+    X(scroll_right)                                   /* 00FB */                                                      \
+    X(scroll_left)                                    /* 00FC */                                                      \
+    X(exit_interpreter)                               /* 00FD */                                                      \
+    X(set_low_resolution)                             /* 00FE */                                                      \
+    X(set_high_resolution)                            /* 00FF */                                                      \
+    X(jump_to)                                        /* 1NNN */                                                      \
+    X(call_func)                                      /* 2NNN */                                                      \
+    X(jump_if_equal)                                  /* 3XNN */                                                      \
+    X(jump_if_not_equal)                              /* 4XNN */                                                      \
+    X(jump_if_registers_equal)                        /* 5XY0 */                                                      \
+    X(save_register_range)                            /* 5XY2 */                                                      \
+    X(load_register_range)                            /* 5XY3 */                                                      \
+    X(set_register_to_value)                          /* 6XNN */                                                      \
+    X(add_assign_register_to_value)                   /* 7XNN */                                                      \
+    X(assign_register)                                /* 8XY0 */                                                      \
+    X(or_assign_register)                             /* 8XY1 */                                                      \
+    X(and_assign_register)                            /* 8XY2 */                                                      \
+    X(xor_assign_register)                            /* 8XY3 */                                                      \
+    X(add_assign_register)                            /* 8XY4 */                                                      \
+    X(subtract_assign_register)                       /* 8XY5 */                                                      \
+    X(shift_right_assign_register)                    /* 8XY6 */                                                      \
+    X(reverse_subtract_assign_register)               /* 8XY7 */                                                      \
+    X(shift_left_assign_register)                     /* 8XYE */                                                      \
+    X(jump_if_registers_not_equal)                    /* 9XY0 */                                                      \
+    X(assign_address_register)                        /* ANNN */                                                      \
+    X(jump_to_address)                                /* BNNN */                                                      \
+    X(set_register_to_bitwise_and_of_random)          /* CXNN */                                                      \
+    X(draw_sprite)                                    /* DXYN */                                                      \
+    X(jump_if_key_pressed)                            /* EX9E */                                                      \
+    X(jump_if_key_not_pressed)                        /* EXA1 */                                                      \
+    X(assign_long_address_register)                   /* F000 NNNN */                                                 \
+    X(select_planes)                                  /* FN01 */                                                      \
+    X(load_audio_pattern)                             /* F002 */                                                      \
+    X(set_register_to_delay_timer)                    /* FX07 */                                                      \
+    X(wait_for_key_press)                             /* FX0A */                                                      \
+    X(set_delay_timer_to_register)                    /* FX15 */                                                      \
+    X(set_sound_timer_to_register)                    /* FX18 */                                                      \
+    X(add_assign_address_register)                    /* FX1E */                                                      \
+    X(set_memory_address_to_character_sprite_address) /* FX29 */                                                      \
+    X(set_memory_address_to_big_sprite_address)       /* FX30 */                                                      \
+    X(store_bcd)                                      /* FX33 */                                                      \
+    X(set_pitch_to_register)                          /* FX3A */                                                      \
+    X(fill_memory_with_registers)                     /* FX55 */                                                      \
+    X(fill_registers_with_memory)                     /* FX65 */                                                      \
+    X(store_flags)                                    /* FX75 */                                                      \
+    X(load_flags)                                     /* FX85 */
+
+// Superinstructions formed by the block cache. decode() never produces them: the fused op replaces the first
+// record of a pair and its handler executes the record that follows it as well.
+#define CHIP8_FUSED_OPS(X)                                                                                            \
+    X(set_register_and_draw)     /* 6XNN, DXYN */                                                                     \
+    X(add_and_jump_if_equal)     /* 7XNN, 3XNN */                                                                     \
+    X(add_and_jump_if_not_equal) /* 7XNN, 4XNN */
+
+namespace chip8
+{
+    enum class op : unsigned char
+    {
+#define CHIP8_OP_ENUM(name) name,
+        CHIP8_OPS(CHIP8_OP_ENUM) CHIP8_FUSED_OPS(CHIP8_OP_ENUM)
+#undef CHIP8_OP_ENUM
+            count
+    };
+
+    // An opcode with its operation resolved and its operand nibbles already extracted
+    struct decoded_instruction
+    {
+        op handler;
+        unsigned char x;
+        unsigned char y;
+        unsigned char nn; // The low nibble doubles as N
+        unsigned short nnn;
+    };
+
+    static_assert(sizeof(decoded_instruction) == 6);
+
+    decoded_instruction decode(const unsigned short opcode);
+} // namespace chip8
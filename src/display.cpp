@@ -0,0 +1,311 @@
+#include "display.h"
+
+#include <array>
+#include <bit>
+#include <cstring>
+
+namespace chip8
+{
+    bool draw_sprite_rows(display_rows& rows, const unsigned x, const unsigned y, const unsigned char* sprite,
+                          const unsigned height, const sprite_edge edge, row_mask& changed)
+    {
+        const auto left = x % DRAW_BUFFER_WIDTH;
+        const auto top  = y % DRAW_BUFFER_HEIGHT;
+
+        std::uint64_t collisions = 0;
+        for(unsigned i = 0; i != height; i++)
+        {
+            auto row = top + i;
+            if(row >= DRAW_BUFFER_HEIGHT)
+            {
+                if(edge == sprite_edge::clip)
+                {
+                    break;
+                }
+                row -= DRAW_BUFFER_HEIGHT;
+            }
+
+            // Shifting drops the pixels past the right edge, rotating brings them back in on the left
+            const auto bits  = static_cast<std::uint64_t>(sprite[i]) << 56;
+            const auto shown = edge == sprite_edge::clip ? bits >> left : std::rotr(bits, static_cast<int>(left));
+
+            collisions |= rows[row] & shown;
+            rows[row] ^= shown;
+            changed |= static_cast<row_mask>(shown != 0) << row;
+        }
+        return collisions != 0;
+    }
+
+    row_mask clear_rows(display_rows& rows)
+    {
+        row_mask lit = 0;
+        for(unsigned row = 0; row != DRAW_BUFFER_HEIGHT; row++)
+        {
+            lit |= static_cast<row_mask>(rows[row] != 0) << row;
+            rows[row] = 0;
+        }
+        return lit;
+    }
+
+    std::uint64_t hash_rows(const display_rows& rows)
+    {
+        // Multiply and fold per row, the row index keeps swapped rows apart
+        std::uint64_t hash = 0x9E3779B97F4A7C15;
+        for(unsigned row = 0; row != DRAW_BUFFER_HEIGHT; row++)
+        {
+            hash = (hash ^ rows[row] ^ row) * 0xFF51AFD7ED558CCD;
+            hash ^= hash >> 32;
+        }
+        return hash;
+    }
+
+    static unsigned width_of(const framebuffer& screen)
+    {
+        return screen.hires ? HIRES_WIDTH : DRAW_BUFFER_WIDTH;
+    }
+
+    static unsigned height_of(const framebuffer& screen)
+    {
+        return screen.hires ? HIRES_HEIGHT : DRAW_BUFFER_HEIGHT;
+    }
+
+    static row_mask band_of(const framebuffer& screen, const unsigned row)
+    {
+        return row_mask{1} << (screen.hires ? row / 2 : row);
+    }
+
+    bool draw_sprite_planes(framebuffer& screen, const plane_mask planes, const unsigned x, const unsigned y,
+                            const unsigned char* sprite, const unsigned height, const bool wide,
+                            const sprite_edge edge, row_mask& changed)
+    {
+        const auto width  = width_of(screen);
+        const auto rows   = height_of(screen);
+        const auto left   = x % width;
+        const auto top    = y % rows;
+        const auto pixels = wide ? 16u : 8u;
+
+        std::uint64_t collisions = 0;
+        for(unsigned plane = 0; plane != MAX_PLANES; plane++)
+        {
+            if((planes >> plane & 1) == 0)
+            {
+                continue;
+            }
+
+            for(unsigned i = 0; i != height; i++, sprite += pixels / 8)
+            {
+                auto row = top + i;
+                if(row >= rows)
+                {
+                    if(edge == sprite_edge::clip)
+                    {
+                        continue;
+                    }
+                    row -= rows;
+                }
+
+                // The sprite row starts out in the top bits of the left word, at column 0
+                const auto bits = (wide ? static_cast<std::uint64_t>(sprite[0] << 8 | sprite[1])
+                                        : static_cast<std::uint64_t>(sprite[0]))
+                                  << (64 - pixels);
+
+                std::uint64_t shown[2] = {};
+                if(screen.hires == false)
+                {
+                    shown[0] = edge == sprite_edge::clip ? bits >> left : std::rotr(bits, static_cast<int>(left));
+                }
+                else if(left < 64)
+                {
+                    shown[0] = bits >> left;
+                    shown[1] = left == 0 ? 0 : bits << (64 - left);
+                }
+                else
+                {
+                    shown[1] = bits >> (left - 64);
+                    // Only a sprite starting in the right half can run past the right edge
+                    shown[0] = edge == sprite_edge::wrap && left != 64 ? bits << (128 - left) : 0;
+                }
+
+                auto& target = screen.planes[plane][row];
+                collisions |= (target[0] & shown[0]) | (target[1] & shown[1]);
+                target[0] ^= shown[0];
+                target[1] ^= shown[1];
+                changed |= (shown[0] | shown[1]) != 0 ? band_of(screen, row) : 0;
+            }
+        }
+        return collisions != 0;
+    }
+
+    row_mask clear_planes(framebuffer& screen, const plane_mask planes)
+    {
+        row_mask lit = 0;
+        for(unsigned plane = 0; plane != MAX_PLANES; plane++)
+        {
+            if((planes >> plane & 1) == 0)
+            {
+                continue;
+            }
+            for(unsigned row = 0; row != HIRES_HEIGHT; row++)
+            {
+                auto& words = screen.planes[plane][row];
+                lit |= (words[0] | words[1]) != 0 ? band_of(screen, row % height_of(screen)) : 0;
+                words[0] = 0;
+                words[1] = 0;
+            }
+        }
+        return lit;
+    }
+
+    row_mask scroll_planes(framebuffer& screen, const plane_mask planes, const int columns, const int rows)
+    {
+        const auto height = static_cast<int>(height_of(screen));
+        const auto right  = static_cast<unsigned>(columns > 0 ? columns : -columns);
+
+        for(unsigned plane = 0; plane != MAX_PLANES; plane++)
+        {
+            if((planes >> plane & 1) == 0)
+            {
+                continue;
+            }
+
+            // Rows move as whole words, walking away from the edge they move towards
+            auto& lines = screen.planes[plane];
+            for(auto i = 0; i != height; i++)
+            {
+                const auto row    = rows > 0 ? height - 1 - i : i;
+                const auto source = row - rows;
+                lines[row][0]     = source >= 0 && source < height ? lines[source][0] : 0;
+                lines[row][1]     = source >= 0 && source < height ? lines[source][1] : 0;
+            }
+
+            // Columns move by shifting both words of a row, carrying the bits that cross from one into the other
+            if(right == 0)
+            {
+                continue;
+            }
+            for(auto row = 0; row != height; row++)
+            {
+                auto& words = lines[row];
+                if(screen.hires == false)
+                {
+                    words[0] = right >= 64 ? 0 : columns > 0 ? words[0] >> right : words[0] << right;
+                }
+                else if(right >= 64)
+                {
+                    words[columns > 0] = right >= 128 ? 0 : columns > 0 ? words[0] >> (right - 64)
+                                                                        : words[1] << (right - 64);
+                    words[columns < 0] = 0;
+                }
+                else if(columns > 0)
+                {
+                    words[1] = words[1] >> right | words[0] << (64 - right);
+                    words[0] >>= right;
+                }
+                else
+                {
+                    words[0] = words[0] << right | words[1] >> (64 - right);
+                    words[1] <<= right;
+                }
+            }
+        }
+        return columns != 0 || rows != 0 ? ALL_ROWS : 0;
+    }
+
+    unsigned pixel_planes(const framebuffer& screen, const unsigned x, const unsigned y)
+    {
+        unsigned bits = 0;
+        for(unsigned plane = 0; plane != MAX_PLANES; plane++)
+        {
+            const auto word = screen.planes[plane][y][x / 64];
+            bits |= static_cast<unsigned>(word >> (63 - x % 64) & 1) << plane;
+        }
+        return bits;
+    }
+
+    std::uint64_t hash_framebuffer(const framebuffer& screen)
+    {
+        // The same fold as hash_rows(), over every word of both planes
+        std::uint64_t hash = 0x9E3779B97F4A7C15 ^ static_cast<std::uint64_t>(screen.hires);
+        const auto* words  = &screen.planes[0][0][0];
+        for(unsigned i = 0; i != MAX_PLANES * HIRES_HEIGHT * 2; i++)
+        {
+            hash = (hash ^ words[i] ^ i) * 0xFF51AFD7ED558CCD;
+            hash ^= hash >> 32;
+        }
+        return hash;
+    }
+
+    // Every byte value spread over eight bytes of 0 or 1, in screen order
+    static constexpr auto BYTE_EXPANSION = []() {
+        std::array<std::uint64_t, 256> table{};
+        for(unsigned value = 0; value != 256; value++)
+        {
+            for(unsigned bit = 0; bit != 8; bit++)
+            {
+                const std::uint64_t pixel = value >> (7 - bit) & 1;
+                if constexpr(std::endian::native == std::endian::little)
+                {
+                    table[value] |= pixel << (bit * 8);
+                }
+                else
+                {
+                    table[value] |= pixel << ((7 - bit) * 8);
+                }
+            }
+        }
+        return table;
+    }();
+
+    void expand_to_bytes(const display_rows& rows, draw_buffer& out)
+    {
+        auto* pixel = out;
+        for(const auto row : rows)
+        {
+            for(auto shift = 56; shift >= 0; shift -= 8)
+            {
+                std::memcpy(pixel, &BYTE_EXPANSION[row >> shift & 0xFF], 8);
+                pixel += 8;
+            }
+        }
+    }
+
+    void expand_to_rgba(const display_rows& rows, std::uint32_t* out, const std::uint32_t lit,
+                        const std::uint32_t unlit)
+    {
+        for(const auto row : rows)
+        {
+            expand_row_to_rgba(row, out, lit, unlit);
+            out += DRAW_BUFFER_WIDTH;
+        }
+    }
+
+    void expand_row_to_rgba(const std::uint64_t row, std::uint32_t* out, const std::uint32_t lit,
+                            const std::uint32_t unlit)
+    {
+        const auto difference = lit ^ unlit;
+        for(auto bit = 63; bit >= 0; bit--)
+        {
+            const auto on = static_cast<std::uint32_t>(row >> bit & 1);
+            *out++        = unlit ^ (difference & (0 - on));
+        }
+    }
+
+    void expand_framebuffer_to_rgba(const framebuffer& screen, std::uint32_t* out,
+                                    const std::uint32_t (&palette)[1 << MAX_PLANES])
+    {
+        for(unsigned y = 0; y != HIRES_HEIGHT; y++)
+        {
+            expand_framebuffer_row_to_rgba(screen, y, out + y * HIRES_WIDTH, palette);
+        }
+    }
+
+    void expand_framebuffer_row_to_rgba(const framebuffer& screen, const unsigned y, std::uint32_t* out,
+                                        const std::uint32_t (&palette)[1 << MAX_PLANES])
+    {
+        const auto scale = screen.hires ? 1u : 2u;
+        for(unsigned x = 0; x != HIRES_WIDTH; x++)
+        {
+            *out++ = palette[pixel_planes(screen, x / scale, y / scale)];
+        }
+    }
+} // namespace chip8
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+
+namespace chip8
+{
+    static constexpr auto DRAW_BUFFER_WIDTH  = 64;
+    static constexpr auto DRAW_BUFFER_HEIGHT = 32;
+
+    // The display packed one row per word. Bit 63 of a row is its leftmost pixel, so a sprite byte shifted to the
+    // top of a word lines up with the screen.
+    using display_rows = std::uint64_t[DRAW_BUFFER_HEIGHT];
+
+    static_assert(DRAW_BUFFER_WIDTH == 64, "A display row has to fill one 64-bit word exactly");
+
+    // One byte per pixel, 0 or 1, row by row
+    using draw_buffer = unsigned char[DRAW_BUFFER_WIDTH * DRAW_BUFFER_HEIGHT];
+
+    // One bit per display row, bit n for row n
+    using row_mask = std::uint32_t;
+
+    static_assert(DRAW_BUFFER_HEIGHT == 32, "Every display row needs a bit in row_mask");
+
+    static constexpr row_mask ALL_ROWS = 0xFFFFFFFF;
+
+    // The high resolution of the SUPER-CHIP and XO-CHIP modes
+    static constexpr auto HIRES_WIDTH  = 128;
+    static constexpr auto HIRES_HEIGHT = 64;
+
+    // XO-CHIP draws on two bitplanes, whose bits together pick one of four colours for a pixel
+    static constexpr auto MAX_PLANES = 2;
+
+    // One bit per plane, bit n for plane n
+    using plane_mask = unsigned;
+
+    static constexpr plane_mask ALL_PLANES = (1 << MAX_PLANES) - 1;
+
+    // The display of the SUPER-CHIP and XO-CHIP modes. Every plane row is 128 pixels in two words, the left half
+    // first, laid out like a row of display_rows. In low resolution only the left words of the first 32 rows are
+    // used, so that both resolutions scroll and draw with the same word-wide shifts.
+    struct framebuffer
+    {
+        std::uint64_t planes[MAX_PLANES][HIRES_HEIGHT][2];
+        bool hires;
+    };
+
+    // What happens to the parts of a sprite that run past the right or bottom edge. The sprite's position always
+    // wraps around the screen.
+    enum class sprite_edge
+    {
+        clip,
+        wrap
+    };
+
+    // XORs height rows of sprite onto the display at x, y and returns whether any lit pixel was turned off. Rows
+    // whose content changed are added to changed.
+    bool draw_sprite_rows(display_rows& rows, const unsigned x, const unsigned y, const unsigned char* sprite,
+                          const unsigned height, const sprite_edge edge, row_mask& changed);
+
+    // Clears the display and returns the rows that had anything lit
+    row_mask clear_rows(display_rows& rows);
+
+    // Like draw_sprite_rows(), on every plane in planes at the framebuffer's resolution. Each plane takes the next
+    // height rows of sprite, of two bytes each when wide. VF's collision covers all of them. changed gets a bit per
+    // 32nd of the screen's height: a row in low resolution, two in high.
+    bool draw_sprite_planes(framebuffer& screen, const plane_mask planes, const unsigned x, const unsigned y,
+                            const unsigned char* sprite, const unsigned height, const bool wide,
+                            const sprite_edge edge, row_mask& changed);
+
+    // Both return the bands that changed, in the units of draw_sprite_planes()
+    row_mask clear_planes(framebuffer& screen, const plane_mask planes);
+    // Moves planes by columns to the right and rows down, negative for left and up, in pixels of the current
+    // resolution. What moves off the screen is lost and what comes in is blank.
+    row_mask scroll_planes(framebuffer& screen, const plane_mask planes, const int columns, const int rows);
+
+    // The plane bits of the pixel at x, y of the current resolution, plane 0 in bit 0
+    unsigned pixel_planes(const framebuffer& screen, const unsigned x, const unsigned y);
+    std::uint64_t hash_framebuffer(const framebuffer& screen);
+
+    // Cheap content hash of the display, the same on every host
+    std::uint64_t hash_rows(const display_rows& rows);
+
+    // Views of the packed display for renderers that want a pixel per element
+    void expand_to_bytes(const display_rows& rows, draw_buffer& out);
+    void expand_to_rgba(const display_rows& rows, std::uint32_t* out, const std::uint32_t lit,
+                        const std::uint32_t unlit);
+    void expand_row_to_rgba(const std::uint64_t row, std::uint32_t* out, const std::uint32_t lit,
+                            const std::uint32_t unlit);
+    // Always HIRES_WIDTH x HIRES_HEIGHT, a low resolution pixel covering two by two. palette is indexed by
+    // pixel_planes().
+    void expand_framebuffer_to_rgba(const framebuffer& screen, std::uint32_t* out,
+                                    const std::uint32_t (&palette)[1 << MAX_PLANES]);
+    // Row y of expand_framebuffer_to_rgba()'s output, HIRES_WIDTH pixels. Band b of a row_mask covers rows 2b and
+    // 2b + 1 in both resolutions.
+    void expand_framebuffer_row_to_rgba(const framebuffer& screen, const unsigned y, std::uint32_t* out,
+                                        const std::uint32_t (&palette)[1 << MAX_PLANES]);
+} // namespace chip8
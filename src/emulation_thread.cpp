@@ -0,0 +1,224 @@
+#include "emulation_thread.h"
+
+#include "rewind.h"
+
+#include <algorithm>
+#include <exception>
+#include <iterator>
+
+namespace chip8
+{
+    // Sleeps overshoot by up to a scheduler tick, so the end of every wait is spent yielding instead
+    static constexpr auto SPIN_MARGIN = std::chrono::milliseconds(2);
+
+    emulation_thread::emulation_thread(machine& vm, rewind_buffer* history, const double frames_per_second)
+        : vm(vm)
+        , history(history)
+        , frame_duration(
+              std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1 / frames_per_second)))
+    {
+        sound_log.reserve(SOUND_SPAN_CAPACITY);
+        vm.record_sound(&sound_log);
+        worker = std::thread(&emulation_thread::run_loop, this);
+    }
+
+    emulation_thread::~emulation_thread()
+    {
+        stop();
+    }
+
+    bool emulation_thread::post(const emulation_event& event)
+    {
+        if(events.try_push(event) == false)
+        {
+            return false;
+        }
+        wakeups.fetch_add(1, std::memory_order_release);
+        wakeups.notify_one();
+        return true;
+    }
+
+    bool emulation_thread::take_frame()
+    {
+        return published.acquire();
+    }
+
+    const emulated_frame& emulation_thread::frame() const
+    {
+        return published.front();
+    }
+
+    std::size_t emulation_thread::take_sound(sound_span* out, const std::size_t max_count)
+    {
+        return sound.pop_bulk(out, max_count);
+    }
+
+    const char* emulation_thread::fault() const
+    {
+        return faulted.load(std::memory_order_acquire) ? fault_message.c_str() : nullptr;
+    }
+
+    void emulation_thread::stop()
+    {
+        stopping.store(true, std::memory_order_release);
+        wakeups.fetch_add(1, std::memory_order_release);
+        wakeups.notify_one();
+        if(worker.joinable())
+        {
+            worker.join();
+            vm.record_sound(nullptr);
+        }
+    }
+
+    void emulation_thread::run_loop()
+    {
+        auto next_frame = clock::now();
+        while(stopping.load(std::memory_order_acquire) == false)
+        {
+            const auto now = clock::now();
+            if(now < next_frame)
+            {
+                wait_until(next_frame);
+                continue;
+            }
+
+            try
+            {
+                for(auto i = 0; i != MAX_CATCH_UP_FRAMES && next_frame <= now; i++)
+                {
+                    apply_events();
+                    step_frame();
+                    next_frame += frame_duration;
+                }
+                if(next_frame <= now)
+                {
+                    next_frame = now + frame_duration; // Too far behind, drop the backlog
+                }
+                publish();
+
+                const auto state = vm.idle();
+                if(rewinding == false && (state == idle_state::halted || state == idle_state::waiting_for_key))
+                {
+                    park(next_frame);
+                }
+            }
+            catch(const std::exception& e)
+            {
+                fault_message = e.what();
+                faulted.store(true, std::memory_order_release);
+                return;
+            }
+        }
+    }
+
+    void emulation_thread::park(clock::time_point& next_frame)
+    {
+        // An event pushed after seen was read changes wakeups, so wait() cannot miss it
+        const auto seen = wakeups.load(std::memory_order_acquire);
+        if(events.empty() && stopping.load(std::memory_order_acquire) == false)
+        {
+            wakeups.wait(seen, std::memory_order_acquire);
+        }
+
+        // The frames that went by while parked all run at once and are recorded as a single step of history. The
+        // frame due now is left to the loop, after the events that woke the thread.
+        const auto missed = (clock::now() - next_frame) / frame_duration;
+        if(missed <= 0)
+        {
+            return;
+        }
+        vm.run_cycles(static_cast<std::uint64_t>(missed) * vm.cycles_per_frame());
+        if(history != nullptr)
+        {
+            history->push(vm);
+        }
+        frames += static_cast<std::uint64_t>(missed);
+        next_frame += missed * frame_duration;
+    }
+
+    void emulation_thread::apply_events()
+    {
+        emulation_event event;
+        while(events.try_pop(event))
+        {
+            switch(event.kind)
+            {
+                case emulation_event_kind::key_down:
+                    vm.on_key_down(event.key);
+                    break;
+                case emulation_event_kind::key_up:
+                    vm.on_key_up(event.key);
+                    break;
+                case emulation_event_kind::rewind_start:
+                case emulation_event_kind::rewind_stop:
+                    rewinding = event.kind == emulation_event_kind::rewind_start;
+                    break;
+            }
+        }
+    }
+
+    void emulation_thread::publish()
+    {
+        // A full queue means nobody is playing the sound, so the spans that do not fit are dropped
+        for(const auto& span : sound_log)
+        {
+            if(sound.try_push(span) == false)
+            {
+                break;
+            }
+        }
+        sound_log.clear();
+
+        const auto executed = static_cast<double>(vm.instruction_count());
+
+        auto& out = published.back();
+        if(const auto* screen = vm.screen(); screen != nullptr)
+        {
+            out.screen = *screen;
+        }
+        else
+        {
+            std::copy(std::begin(vm.display()), std::end(vm.display()), std::begin(out.rows));
+        }
+        out.extended      = vm.screen() != nullptr;
+        out.number        = frames;
+        out.sound_playing = vm.sound_playing();
+        out.idle          = executed != 0 ? static_cast<double>(vm.idle_cycle_count()) / executed : 0;
+
+        // The rows of a frame the consumer never acquired carry over to the next one. One it did acquire is what
+        // it shows, so only the rows changed since then carry on.
+        const auto changed = vm.take_dirty_rows();
+        out.dirty_rows     = unseen_rows | changed;
+        const auto dirty   = out.dirty_rows;
+        unseen_rows        = published.publish() ? dirty : changed;
+    }
+
+    void emulation_thread::step_frame()
+    {
+        if(rewinding && history != nullptr)
+        {
+            history->step_back(vm);
+        }
+        else
+        {
+            vm.run_frame();
+            if(history != nullptr)
+            {
+                history->push(vm);
+            }
+        }
+        frames++;
+    }
+
+    void emulation_thread::wait_until(const clock::time_point deadline) const
+    {
+        if(deadline - clock::now() > SPIN_MARGIN)
+        {
+            std::this_thread::sleep_until(deadline - SPIN_MARGIN);
+        }
+        while(clock::now() < deadline)
+        {
+            std::this_thread::yield();
+        }
+    }
+} // namespace chip8
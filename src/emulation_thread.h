@@ -0,0 +1,114 @@
+#pragma once
+
+#include "chip8.h"
+#include "spsc_ring.h"
+#include "triple_buffer.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace chip8
+{
+    class rewind_buffer;
+
+    // At most this many frames are caught up after the emulation thread was held up, the rest are dropped
+    static constexpr auto MAX_CATCH_UP_FRAMES = 4;
+
+    static constexpr auto EMULATION_EVENT_CAPACITY = 256;
+    static constexpr auto SOUND_SPAN_CAPACITY      = 256;
+
+    // What the emulation thread publishes after every batch of frames it runs
+    struct emulated_frame
+    {
+        display_rows rows;
+        framebuffer screen; // In place of rows for a machine in the SUPER-CHIP or XO-CHIP mode
+        bool extended        = false;
+        row_mask dirty_rows  = ALL_ROWS; // Rows changed since the frame the consumer acquired before this one
+        std::uint64_t number = 0; // Frames run or stepped back so far, so a consumer can tell how many it skipped
+        bool sound_playing   = false;
+        double idle          = 0; // Share of the machine's cycles fast-forwarded instead of run, from 0 to 1
+    };
+
+    enum class emulation_event_kind : unsigned char
+    {
+        key_down,
+        key_up,
+        rewind_start, // Step back one frame per frame instead of running, for as long as history has frames
+        rewind_stop
+    };
+
+    struct emulation_event
+    {
+        emulation_event_kind kind;
+        int key = 0; // Keypad index of key_down and key_up
+    };
+
+    // Runs a machine on a thread of its own at a fixed frame rate, so that a renderer waiting for vsync never holds
+    // up emulation and a slow frame never holds up presentation. Events go in through a lock-free queue and are
+    // applied at the start of the next frame, finished frames come out through a triple buffer and sound spans
+    // through a second queue, for an audio callback to render. Neither side ever blocks the other.
+    //
+    // A machine waiting for a key or jumping to itself parks the thread until the next event instead of waking it
+    // every frame. The frames that passed meanwhile are run on waking, which the machine fast-forwards through.
+    class emulation_thread
+    {
+    public:
+        // Starts running vm right away. vm, and history when given, belong to the thread until stop() returns.
+        emulation_thread(machine& vm, rewind_buffer* history, const double frames_per_second = FRAMES_PER_SECOND);
+        ~emulation_thread();
+
+        emulation_thread(const emulation_thread&)            = delete;
+        emulation_thread& operator=(const emulation_thread&) = delete;
+
+        // Called from a single thread. False when the queue is full, which only happens if emulation has stalled.
+        bool post(const emulation_event& event);
+
+        // Called from a single thread. Makes the newest published frame the one frame() returns, false when there
+        // has been none since the previous call.
+        bool take_frame();
+        const emulated_frame& frame() const;
+
+        // Called from a single thread, which need not be the one calling take_frame(). Pops up to max_count of the
+        // spans the machine logged, oldest first, and returns how many it popped.
+        std::size_t take_sound(sound_span* out, const std::size_t max_count);
+
+        // Null while running, what the machine threw once it faulted. The thread stops on a fault.
+        const char* fault() const;
+
+        // Stops after the current frame and waits for the thread to end
+        void stop();
+
+    private:
+        using clock = std::chrono::steady_clock;
+
+        void run_loop();
+        void apply_events();
+        // Hands the logged sound spans and the current frame to the consumers
+        void publish();
+        void park(clock::time_point& next_frame);
+        void step_frame();
+        void wait_until(const clock::time_point deadline) const;
+
+        machine& vm;
+        rewind_buffer* history;
+        clock::duration frame_duration;
+        bool rewinding       = false;
+        std::uint64_t frames = 0;
+        row_mask unseen_rows = 0; // Rows changed in published frames the consumer may not have acquired
+
+        spsc_ring<emulation_event, EMULATION_EVENT_CAPACITY> events;
+        triple_buffer<emulated_frame> published;
+        std::vector<sound_span> sound_log;
+        spsc_ring<sound_span, SOUND_SPAN_CAPACITY> sound;
+
+        std::string fault_message;
+        std::atomic<bool> faulted          = false;
+        std::atomic<bool> stopping         = false;
+        std::atomic<std::uint32_t> wakeups = 0; // Bumped by every event and by stop(), for park() to wait on
+        std::thread worker;
+    };
+} // namespace chip8
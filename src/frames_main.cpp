@@ -0,0 +1,225 @@
+#include "image_writer.h"
+#include "recording.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Usage: chip8-frames [--from N] [--to N] [--every N] [--scale N] [--palette RRGGBB,RRGGBB[,RRGGBB,RRGGBB]]
+//                     [--png PREFIX] [--gif FILE] recording
+// Prints how many frames recording, written by chip8-headless --record-frames, holds and exports them offline.
+// --png writes the frames from --from up to but not including --to, taking one in --every, to PREFIX followed by the
+// frame number and .png. --gif writes the same frames as one looping animation at their 60 Hz timing. GIF delays
+// count in hundredths of a second and players slow down anything shorter than two, so a frame shown for less gives
+// way to the next. Images are scaled up --scale times, from 64x32 for CHIP-8 recordings and from 128x64, with low
+// resolution doubled, for SUPER-CHIP and XO-CHIP ones. --palette takes the lit and unlit colours like the frontend,
+// then XO-CHIP's colours for the second plane and for both planes.
+
+static bool parse_number(const char* text, auto& out)
+{
+    const auto end = text + std::strlen(text);
+    return std::from_chars(text, end, out).ptr == end;
+}
+
+static bool parse_colour(const std::string_view text, std::uint32_t& out)
+{
+    const auto end = text.data() + text.size();
+    return text.size() == 6 && std::from_chars(text.data(), end, out, 16).ptr == end;
+}
+
+// In the order of the frontend's --palette, lit first
+static bool parse_palette(std::string_view text, chip8::image_palette& out)
+{
+    static constexpr unsigned order[] = {1, 0, 2, 3};
+
+    unsigned count = 0;
+    for(; count != std::size(order) && text.empty() == false; count++)
+    {
+        const auto comma = std::min(text.find(','), text.size());
+        if(parse_colour(text.substr(0, comma), out[order[count]]) == false)
+        {
+            return false;
+        }
+        text.remove_prefix(std::min(comma + 1, text.size()));
+    }
+    return text.empty() && (count == 2 || count == 4);
+}
+
+// Dimensions of every image of the recording, before scaling
+static int image_width(const chip8::quirk_profile quirks)
+{
+    return chip8::flags_of(quirks).mode == chip8::machine_mode::chip8 ? chip8::DRAW_BUFFER_WIDTH : chip8::HIRES_WIDTH;
+}
+
+static int image_height(const chip8::quirk_profile quirks)
+{
+    return chip8::flags_of(quirks).mode == chip8::machine_mode::chip8 ? chip8::DRAW_BUFFER_HEIGHT : chip8::HIRES_HEIGHT;
+}
+
+static void render(const chip8::recorded_frame& frame, const int width, const int height, unsigned char* out)
+{
+    for(auto y = 0; y != height; y++)
+    {
+        for(auto x = 0; x != width; x++)
+        {
+            out[y * width + x] = static_cast<unsigned char>(
+                frame.pixel(x * frame.width() / width, y * frame.height() / height));
+        }
+    }
+}
+
+// The shortest delay GIF players show as it is
+static constexpr unsigned MIN_GIF_DELAY = 2;
+
+// When frame, counted from the first one exported, starts in hundredths of a second
+static unsigned centiseconds_at(const std::uint64_t frame)
+{
+    return static_cast<unsigned>(frame * 100 / chip8::FRAMES_PER_SECOND);
+}
+
+int main(int argc, char* argv[])
+{
+    std::uint64_t from = 0;
+    std::uint64_t to   = UINT64_MAX;
+    unsigned every     = 1;
+    int scale          = 4;
+
+    chip8::image_palette palette = {0x000000, 0xFFFFFF, 0xFF6600, 0x662200};
+
+    const char* recording_path = nullptr;
+    const char* png_prefix     = nullptr;
+    const char* gif_path       = nullptr;
+
+    for(int i = 1; i < argc; i++)
+    {
+        const std::string_view arg = argv[i];
+
+        const bool has_value = i + 1 < argc;
+        if(arg == "--from" && has_value && parse_number(argv[i + 1], from))
+        {
+            i++;
+        }
+        else if(arg == "--to" && has_value && parse_number(argv[i + 1], to))
+        {
+            i++;
+        }
+        else if(arg == "--every" && has_value && parse_number(argv[i + 1], every) && every != 0)
+        {
+            i++;
+        }
+        else if(arg == "--scale" && has_value && parse_number(argv[i + 1], scale) && scale > 0 && scale <= 64)
+        {
+            i++;
+        }
+        else if(arg == "--palette" && has_value && parse_palette(argv[i + 1], palette))
+        {
+            i++;
+        }
+        else if(arg == "--png" && has_value)
+        {
+            png_prefix = argv[++i];
+        }
+        else if(arg == "--gif" && has_value)
+        {
+            gif_path = argv[++i];
+        }
+        else if(arg.starts_with("--") || recording_path != nullptr)
+        {
+            std::fprintf(stderr, "Unknown or incomplete option %s\n", argv[i]);
+            return 1;
+        }
+        else
+        {
+            recording_path = argv[i];
+        }
+    }
+
+    if(recording_path == nullptr)
+    {
+        std::fprintf(stderr,
+                     "Usage: %s [--from N] [--to N] [--every N] [--scale N] "
+                     "[--palette RRGGBB,RRGGBB[,RRGGBB,RRGGBB]] [--png PREFIX] [--gif FILE] recording\n",
+                     argv[0]);
+        return 1;
+    }
+
+    try
+    {
+        chip8::frame_reader reader(recording_path);
+        to = std::min(to, reader.frame_count());
+
+        std::printf("frames:    %llu\n", static_cast<unsigned long long>(reader.frame_count()));
+        std::printf("keyframes: %zu\n", reader.keyframe_count());
+        std::printf("quirks:    %s\n", chip8::quirk_profile_name(reader.quirks()));
+        std::printf("index:     %s\n", reader.indexed() ? "stored" : "rebuilt, the recording was not finished");
+
+        if(png_prefix == nullptr && gif_path == nullptr)
+        {
+            return 0;
+        }
+
+        const auto width  = image_width(reader.quirks()) * scale;
+        const auto height = image_height(reader.quirks()) * scale;
+        std::vector<unsigned char> pixels(static_cast<std::size_t>(width) * height);
+
+        std::unique_ptr<chip8::gif_writer> gif;
+        if(gif_path != nullptr)
+        {
+            gif = std::make_unique<chip8::gif_writer>(gif_path, width, height, palette);
+        }
+
+        // The GIF frame waiting for the next different one to know how long it shows
+        std::vector<unsigned char> pending;
+        unsigned pending_start = 0;
+
+        unsigned long long exported = 0;
+        for(auto frame = from; frame < to; frame += every)
+        {
+            render(reader.read(frame), width, height, pixels.data());
+            exported++;
+
+            if(png_prefix != nullptr)
+            {
+                const auto path = std::string(png_prefix) + std::to_string(frame) + ".png";
+                chip8::write_png(path.c_str(), pixels.data(), width, height, palette);
+            }
+
+            if(gif == nullptr || pixels == pending)
+            {
+                continue;
+            }
+            const auto start = centiseconds_at(frame - from);
+            if(pending.empty() == false && start - pending_start >= MIN_GIF_DELAY)
+            {
+                gif->add(pending.data(), start - pending_start);
+                pending_start = start;
+            }
+            pending = pixels;
+        }
+
+        if(gif != nullptr)
+        {
+            if(pending.empty() == false)
+            {
+                const auto end = std::max(centiseconds_at(to - from), pending_start + MIN_GIF_DELAY);
+                gif->add(pending.data(), end - pending_start);
+            }
+            gif->finish();
+        }
+
+        std::printf("exported:  %llu\n", exported);
+    }
+    catch(const std::exception& e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,581 @@
+#include "aot.h"
+#include "audio.h"
+#include "chip8.h"
+#include "profile.h"
+#include "recording.h"
+#include "replay.h"
+#include "rom_pack.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Usage: chip8-headless [--cycles N] [--cycles-per-frame N] [--backend interpreter|blocks|jit]
+//                       [--quirks vip|schip|modern|xochip] [--keys SCRIPT] [--seed N] [--record FILE]
+//                       [--replay FILE] [--profile FILE] [--pack FILE] [--frame FILE] [--wav FILE] [--ascii]
+//                       [--json] [--native] [--record-frames FILE] rom
+// Runs rom for --cycles instructions as fast as the host allows, without a display, then prints the final
+// framebuffer hash, the instruction count and the wall time. --cycles-per-frame sets how many instructions make up
+// one 60 Hz frame of emulated time. Idle loops, such as waiting for a key, are fast-forwarded, and idle reports the
+// share of instructions that were.
+// --quirks picks the interpreter whose behaviour the ambiguous instructions follow: the COSMAC VIP, SUPER-CHIP,
+// XO-CHIP or, by default, modern interpreters. SUPER-CHIP and XO-CHIP also bring their instructions, display and
+// memory.
+// --keys presses and releases keys at fixed instruction counts: CYCLE:+K presses hex key K once CYCLE instructions
+// have run and CYCLE:-K releases it, e.g. 5000:+5,5600:-5. --keys @FILE reads the script from FILE, where entries
+// may also be separated by whitespace.
+// --seed seeds the CXNN random generator. --record writes the run as a replay file. --replay reruns a recorded
+// session with its seed, frame length, quirks, cycle count and input, and fails with exit code 3 when the final frame
+// differs from the recorded one.
+// --profile writes op counts, handler timings and pc hits to FILE, as JSON when FILE ends in .json and as CSV
+// otherwise. It needs a build with CHIP8_PROFILE.
+// --pack takes rom from a ROM pack written by chip8-pack, by name or SHA-1, instead of from a file.
+// --frame writes the final framebuffer to FILE as a PBM image at its final resolution, --ascii prints it and --json
+// prints the results as a single JSON object.
+// --native runs the code chip8-aot recompiled rom into, in builds that have it in CHIP8_AOT_SOURCES, and the
+// interpreter wherever that code does not reach.
+// --wav renders the sound timer to FILE as a 48 kHz square wave, or XO-CHIP's audio pattern, with the instructions
+// run spread over emulated time at 60 frames per second.
+// --record-frames streams the display at the end of every frame to FILE as delta-encoded frames, for chip8-frames to
+// export as PNG images or a GIF.
+
+static bool parse_number(const char* text, auto& out)
+{
+    const auto end = text + std::strlen(text);
+    return std::from_chars(text, end, out).ptr == end;
+}
+
+static bool parse_backend(const std::string_view text, chip8::backend& out)
+{
+    if(text == "interpreter")
+    {
+        out = chip8::backend::interpreter;
+        return true;
+    }
+    if(text == "blocks")
+    {
+        out = chip8::backend::blocks;
+        return true;
+    }
+    if(text == "jit")
+    {
+        out = chip8::backend::jit;
+        return true;
+    }
+    return false;
+}
+
+static const char* backend_name(const chip8::backend engine)
+{
+    switch(engine)
+    {
+        case chip8::backend::interpreter:
+            return "interpreter";
+        case chip8::backend::blocks:
+            return "blocks";
+        case chip8::backend::jit:
+            return "jit";
+    }
+    return "unknown";
+}
+
+static bool read_file(const char* path, std::string& out)
+{
+    std::ifstream is(path, std::ios::binary);
+    if(is.is_open() == false)
+    {
+        return false;
+    }
+    out.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// The display at its current resolution, where a pixel lit on either XO-CHIP plane counts as lit
+static int frame_width(const chip8::machine& vm)
+{
+    return vm.screen() != nullptr && vm.screen()->hires ? chip8::HIRES_WIDTH : chip8::DRAW_BUFFER_WIDTH;
+}
+
+static int frame_height(const chip8::machine& vm)
+{
+    return vm.screen() != nullptr && vm.screen()->hires ? chip8::HIRES_HEIGHT : chip8::DRAW_BUFFER_HEIGHT;
+}
+
+static bool pixel_lit(const chip8::machine& vm, const int x, const int y)
+{
+    if(const auto* screen = vm.screen(); screen != nullptr)
+    {
+        return chip8::pixel_planes(*screen, x, y) != 0;
+    }
+    return (vm.display()[y] >> (chip8::DRAW_BUFFER_WIDTH - 1 - x) & 1) != 0;
+}
+
+static bool write_pbm(const char* path, const chip8::machine& vm)
+{
+    std::unique_ptr<std::FILE, decltype(&std::fclose)> file(std::fopen(path, "wb"), &std::fclose);
+    if(file == nullptr)
+    {
+        return false;
+    }
+
+    std::fprintf(file.get(), "P1\n%d %d\n", frame_width(vm), frame_height(vm));
+    for(auto y = 0; y != frame_height(vm); y++)
+    {
+        for(auto x = 0; x != frame_width(vm); x++)
+        {
+            std::fputc(pixel_lit(vm, x, y) ? '1' : '0', file.get());
+        }
+        std::fputc('\n', file.get());
+    }
+    return std::ferror(file.get()) == 0;
+}
+
+static void print_ascii(const chip8::machine& vm)
+{
+    for(auto y = 0; y != frame_height(vm); y++)
+    {
+        for(auto x = 0; x != frame_width(vm); x++)
+        {
+            std::putchar(pixel_lit(vm, x, y) ? '#' : '.');
+        }
+        std::putchar('\n');
+    }
+}
+
+// Runs like run_with_input(), recording the display each time a frame's worth of instructions has run
+static void run_recording_frames(chip8::machine& vm, const std::vector<chip8::input_event>& events,
+                                 const std::uint64_t cycles, chip8::frame_recorder& recorder)
+{
+    while(vm.instruction_count() < cycles)
+    {
+        const auto frame_end = (vm.instruction_count() / vm.cycles_per_frame() + 1) * vm.cycles_per_frame();
+        chip8::run_with_input(vm, events, std::min(frame_end, cycles));
+        recorder.push(vm);
+    }
+}
+
+static void print_json_string(const std::string_view text)
+{
+    std::putchar('"');
+    for(const auto c : text)
+    {
+        if(c == '"' || c == '\\')
+        {
+            std::putchar('\\');
+        }
+        if(static_cast<unsigned char>(c) < 0x20)
+        {
+            std::printf("\\u%04x", c);
+            continue;
+        }
+        std::putchar(c);
+    }
+    std::putchar('"');
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned long long cycles = 1000000;
+    unsigned frame_cycles     = chip8::DEFAULT_CYCLES_PER_FRAME;
+    auto engine               = chip8::backend::blocks;
+    auto quirks               = chip8::DEFAULT_QUIRKS;
+    std::uint64_t seed        = 0;
+
+    const char* rom_path     = nullptr;
+    const char* frame_path   = nullptr;
+    const char* record_path  = nullptr;
+    const char* replay_path  = nullptr;
+    const char* profile_path = nullptr;
+    const char* pack_path    = nullptr;
+    const char* wav_path     = nullptr;
+    const char* frames_path  = nullptr;
+    bool ascii               = false;
+    bool json                = false;
+    bool native              = false;
+
+    std::vector<chip8::input_event> events;
+
+    for(int i = 1; i < argc; i++)
+    {
+        const std::string_view arg = argv[i];
+
+        const bool has_value = i + 1 < argc;
+        if(arg == "--cycles" && has_value && parse_number(argv[i + 1], cycles))
+        {
+            i++;
+        }
+        else if(arg == "--cycles-per-frame" && has_value && parse_number(argv[i + 1], frame_cycles) &&
+                frame_cycles != 0)
+        {
+            i++;
+        }
+        else if(arg == "--backend" && has_value && parse_backend(argv[i + 1], engine))
+        {
+            i++;
+        }
+        else if(arg == "--quirks" && has_value && chip8::parse_quirk_profile(argv[i + 1], quirks))
+        {
+            i++;
+        }
+        else if(arg == "--keys" && has_value)
+        {
+            const std::string_view value = argv[++i];
+
+            std::string script(value);
+            if(value.starts_with('@') && read_file(argv[i] + 1, script) == false)
+            {
+                std::fprintf(stderr, "Could not read %s\n", argv[i] + 1);
+                return 1;
+            }
+            try
+            {
+                const auto parsed = chip8::parse_input_script(script);
+                events.insert(events.end(), parsed.begin(), parsed.end());
+            }
+            catch(const std::invalid_argument& e)
+            {
+                std::fprintf(stderr, "%s\n", e.what());
+                return 1;
+            }
+        }
+        else if(arg == "--seed" && has_value && parse_number(argv[i + 1], seed))
+        {
+            i++;
+        }
+        else if(arg == "--record" && has_value)
+        {
+            record_path = argv[++i];
+        }
+        else if(arg == "--replay" && has_value)
+        {
+            replay_path = argv[++i];
+        }
+        else if(arg == "--profile" && has_value)
+        {
+            if constexpr(chip8::PROFILING == false)
+            {
+                std::fprintf(stderr, "--profile needs a build with CHIP8_PROFILE\n");
+                return 1;
+            }
+            profile_path = argv[++i];
+        }
+        else if(arg == "--pack" && has_value)
+        {
+            pack_path = argv[++i];
+        }
+        else if(arg == "--frame" && has_value)
+        {
+            frame_path = argv[++i];
+        }
+        else if(arg == "--wav" && has_value)
+        {
+            wav_path = argv[++i];
+        }
+        else if(arg == "--record-frames" && has_value)
+        {
+            frames_path = argv[++i];
+        }
+        else if(arg == "--ascii")
+        {
+            ascii = true;
+        }
+        else if(arg == "--json")
+        {
+            json = true;
+        }
+        else if(arg == "--native")
+        {
+            native = true;
+        }
+        else if(arg.starts_with("--") || rom_path != nullptr)
+        {
+            std::fprintf(stderr, "Unknown or incomplete option %s\n", argv[i]);
+            return 1;
+        }
+        else
+        {
+            rom_path = argv[i];
+        }
+    }
+
+    if(rom_path == nullptr)
+    {
+        std::fprintf(stderr,
+                     "Usage: %s [--cycles N] [--cycles-per-frame N] [--backend interpreter|blocks|jit] "
+                     "[--quirks vip|schip|modern|xochip] [--keys SCRIPT] [--seed N] [--record FILE] "
+                     "[--replay FILE] [--profile FILE] [--pack FILE] [--frame FILE] [--wav FILE] [--ascii] [--json] "
+                     "[--native] [--record-frames FILE] rom\n",
+                     argv[0]);
+        return 1;
+    }
+
+    // A replay brings its own settings and input
+    chip8::replay recorded;
+    if(replay_path != nullptr)
+    {
+        try
+        {
+            recorded = chip8::load_replay(replay_path);
+        }
+        catch(const std::exception& e)
+        {
+            std::fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+        cycles       = recorded.cycles;
+        frame_cycles = recorded.cycles_per_frame;
+        quirks       = recorded.quirks;
+        seed         = recorded.seed;
+        events       = recorded.events;
+    }
+    std::ranges::stable_sort(events, {}, &chip8::input_event::cycle);
+
+    auto vm = std::make_unique<chip8::machine>();
+    vm->set_backend(engine);
+    vm->set_quirks(quirks);
+    vm->set_cycles_per_frame(frame_cycles);
+    vm->seed(seed);
+    const chip8::aot_program* program = nullptr;
+    try
+    {
+        if(pack_path != nullptr)
+        {
+            const chip8::rom_pack pack(pack_path);
+
+            const auto packed = pack.find_by_key(rom_path);
+            if(packed == nullptr)
+            {
+                std::fprintf(stderr, "No ROM %s in %s\n", rom_path, pack_path);
+                return 1;
+            }
+            vm->load(packed->data, packed->size);
+            program = chip8::find_aot_program(packed->data, packed->size, quirks);
+        }
+        else
+        {
+            vm->load(rom_path);
+
+            std::string rom;
+            if(native && read_file(rom_path, rom))
+            {
+                program = chip8::find_aot_program(reinterpret_cast<const unsigned char*>(rom.data()), rom.size(),
+                                                  quirks);
+            }
+        }
+    }
+    catch(const std::exception& e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    if(native)
+    {
+        if(program == nullptr)
+        {
+            std::fprintf(stderr, "This build has no recompiled code for %s with the %s quirks\n", rom_path,
+                         chip8::quirk_profile_name(quirks));
+            return 1;
+        }
+        vm->attach_program(program);
+    }
+
+    std::vector<chip8::input_event> input_log;
+    vm->record_input(&input_log);
+
+    if(profile_path != nullptr)
+    {
+        vm->enable_profile();
+    }
+
+    std::vector<chip8::sound_span> sound_log;
+    if(wav_path != nullptr)
+    {
+        vm->record_sound(&sound_log);
+    }
+
+    std::unique_ptr<chip8::frame_recorder> recorder;
+    if(frames_path != nullptr)
+    {
+        try
+        {
+            recorder = std::make_unique<chip8::frame_recorder>(frames_path, vm->current_quirks());
+        }
+        catch(const std::exception& e)
+        {
+            std::fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+    }
+
+    std::string error;
+    const auto start = std::chrono::steady_clock::now();
+    try
+    {
+        if(recorder != nullptr)
+        {
+            run_recording_frames(*vm, events, cycles, *recorder);
+        }
+        else
+        {
+            chip8::run_with_input(*vm, events, cycles);
+        }
+    }
+    catch(const std::exception& e)
+    {
+        error = e.what();
+    }
+    const auto end = std::chrono::steady_clock::now();
+
+    if(recorder != nullptr)
+    {
+        // A frame cut short by an error is recorded as it was left
+        try
+        {
+            if(error.empty() == false)
+            {
+                recorder->push(*vm);
+            }
+            recorder->finish();
+        }
+        catch(const std::exception& e)
+        {
+            std::fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+    }
+
+    const auto seconds      = std::chrono::duration<double>(end - start).count();
+    const auto instructions = vm->instruction_count();
+    const auto mips         = seconds > 0 ? static_cast<double>(instructions) / seconds / 1e6 : 0.0;
+    const auto hash         = vm->frame_hash();
+    const auto idle_cycles  = static_cast<double>(vm->idle_cycle_count());
+    const auto idle         = instructions != 0 ? idle_cycles / static_cast<double>(instructions) * 100 : 0.0;
+
+    const bool diverged = replay_path != nullptr && (hash != recorded.frame_hash || instructions != recorded.cycles);
+
+    if(record_path != nullptr)
+    {
+        try
+        {
+            chip8::save_replay(record_path, {seed, frame_cycles, quirks, instructions, hash, input_log});
+        }
+        catch(const std::exception& e)
+        {
+            std::fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+    }
+
+    if(profile_path != nullptr)
+    {
+        std::unique_ptr<std::FILE, decltype(&std::fclose)> file(std::fopen(profile_path, "w"), &std::fclose);
+        if(file == nullptr)
+        {
+            std::fprintf(stderr, "Could not write %s\n", profile_path);
+            return 1;
+        }
+        const auto& counters = *vm->current_profile();
+        if(std::string_view(profile_path).ends_with(".json"))
+        {
+            chip8::write_profile_json(counters, file.get());
+        }
+        else
+        {
+            chip8::write_profile_csv(counters, file.get());
+        }
+    }
+
+    if(wav_path != nullptr)
+    {
+        chip8::square_wave beep(chip8::AUDIO_SAMPLE_RATE, frame_cycles * double{chip8::FRAMES_PER_SECOND});
+        for(const auto& span : sound_log)
+        {
+            beep.add(span);
+        }
+
+        try
+        {
+            chip8::wav_writer wav(wav_path, chip8::AUDIO_SAMPLE_RATE);
+            std::int16_t samples[4096];
+            for(auto left = beep.sample_at(instructions); left != 0;)
+            {
+                const auto count = std::min<std::uint64_t>(left, std::size(samples));
+                beep.render(samples, count);
+                wav.write(samples, count);
+                left -= count;
+            }
+            wav.finish();
+        }
+        catch(const std::exception& e)
+        {
+            std::fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+    }
+
+    if(frame_path != nullptr && write_pbm(frame_path, *vm) == false)
+    {
+        std::fprintf(stderr, "Could not write %s\n", frame_path);
+        return 1;
+    }
+
+    if(ascii)
+    {
+        print_ascii(*vm);
+    }
+
+    if(json)
+    {
+        std::printf("{\"rom\":");
+        print_json_string(rom_path);
+        std::printf(",\"backend\":\"%s\",\"quirks\":\"%s\",\"instructions\":%llu,\"frames\":%llu,"
+                    "\"seconds\":%.6f,\"mips\":%.2f,\"idle\":%.2f,\"frame_hash\":\"%016llx\",\"seed\":%llu,",
+                    native ? "native" : backend_name(vm->current_backend()),
+                    chip8::quirk_profile_name(vm->current_quirks()), static_cast<unsigned long long>(instructions),
+                    static_cast<unsigned long long>(vm->frame_count()), seconds, mips, idle,
+                    static_cast<unsigned long long>(hash), static_cast<unsigned long long>(seed));
+        if(replay_path != nullptr)
+        {
+            std::printf("\"replay\":\"%s\",", diverged ? "diverged" : "match");
+        }
+        std::printf("\"error\":");
+        error.empty() ? static_cast<void>(std::printf("null")) : print_json_string(error);
+        std::printf("}\n");
+    }
+    else
+    {
+        std::printf("backend:      %s\n", native ? "native" : backend_name(vm->current_backend()));
+        std::printf("quirks:       %s\n", chip8::quirk_profile_name(vm->current_quirks()));
+        std::printf("instructions: %llu\n", static_cast<unsigned long long>(instructions));
+        std::printf("frames:       %llu\n", static_cast<unsigned long long>(vm->frame_count()));
+        std::printf("seconds:      %.6f\n", seconds);
+        std::printf("MIPS:         %.2f\n", mips);
+        std::printf("idle:         %.1f%%\n", idle);
+        std::printf("frame hash:   %016llx\n", static_cast<unsigned long long>(hash));
+        if(replay_path != nullptr)
+        {
+            std::printf("replay:       %s\n", diverged ? "diverged" : "match");
+        }
+        if(error.empty() == false)
+        {
+            std::printf("error:        %s\n", error.c_str());
+        }
+    }
+
+    if(error.empty() == false)
+    {
+        return 2;
+    }
+    return diverged ? 3 : 0;
+}
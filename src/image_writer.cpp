@@ -0,0 +1,427 @@
+#include "image_writer.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+namespace chip8
+{
+    static void append_u32_big_endian(std::vector<unsigned char>& out, const std::uint32_t value)
+    {
+        for(auto shift = 24; shift >= 0; shift -= 8)
+        {
+            out.push_back(static_cast<unsigned char>(value >> shift));
+        }
+    }
+
+    static void append_u16(std::vector<unsigned char>& out, const unsigned value)
+    {
+        out.push_back(static_cast<unsigned char>(value));
+        out.push_back(static_cast<unsigned char>(value >> 8));
+    }
+
+    static void append_rgb(std::vector<unsigned char>& out, const std::uint32_t colour)
+    {
+        out.push_back(static_cast<unsigned char>(colour >> 16));
+        out.push_back(static_cast<unsigned char>(colour >> 8));
+        out.push_back(static_cast<unsigned char>(colour));
+    }
+
+    static std::uint32_t crc32(const unsigned char* bytes, const std::size_t size)
+    {
+        static const auto table = []() {
+            std::array<std::uint32_t, 256> entries;
+            for(std::uint32_t i = 0; i != 256; i++)
+            {
+                auto c = i;
+                for(auto bit = 0; bit != 8; bit++)
+                {
+                    c = (c & 1) != 0 ? 0xEDB88320 ^ c >> 1 : c >> 1;
+                }
+                entries[i] = c;
+            }
+            return entries;
+        }();
+
+        std::uint32_t c = 0xFFFFFFFF;
+        for(std::size_t i = 0; i != size; i++)
+        {
+            c = table[(c ^ bytes[i]) & 0xFF] ^ c >> 8;
+        }
+        return c ^ 0xFFFFFFFF;
+    }
+
+    static std::uint32_t adler32(const std::vector<unsigned char>& bytes)
+    {
+        std::uint32_t a = 1;
+        std::uint32_t b = 0;
+        for(const auto byte : bytes)
+        {
+            a = (a + byte) % 65521;
+            b = (b + a) % 65521;
+        }
+        return b << 16 | a;
+    }
+
+    // Deflate's bits go out from the lowest bit of each byte up
+    class bit_writer
+    {
+    public:
+        explicit bit_writer(std::vector<unsigned char>& out)
+            : out(out)
+        {
+        }
+
+        void put(const std::uint32_t bits, const unsigned count)
+        {
+            buffer |= static_cast<std::uint64_t>(bits) << used;
+            used += count;
+            for(; used >= 8; used -= 8)
+            {
+                out.push_back(static_cast<unsigned char>(buffer));
+                buffer >>= 8;
+            }
+        }
+
+        // Huffman codes go out from their top bit down
+        void put_code(const std::uint32_t code, const unsigned length)
+        {
+            std::uint32_t reversed = 0;
+            for(unsigned i = 0; i != length; i++)
+            {
+                reversed |= (code >> i & 1) << (length - 1 - i);
+            }
+            put(reversed, length);
+        }
+
+        void flush()
+        {
+            if(used != 0)
+            {
+                out.push_back(static_cast<unsigned char>(buffer));
+            }
+            buffer = 0;
+            used   = 0;
+        }
+
+    private:
+        std::vector<unsigned char>& out;
+        std::uint64_t buffer = 0;
+        unsigned used        = 0;
+    };
+
+    // Deflate's length and distance symbols: the smallest value each stands for and how many extra bits follow it
+    static constexpr unsigned short LENGTH_BASES[29] = {3,  4,  5,  6,  7,  8,  9,   10,  11,  13,  15,  17,  19, 23,
+                                                        27, 31, 35, 43, 51, 59, 67,  83,  99,  115, 131, 163, 195, 227,
+                                                        258};
+    static constexpr unsigned char LENGTH_EXTRA_BITS[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                                            2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static constexpr unsigned short DISTANCE_BASES[30] = {1,    2,    3,    4,     5,     7,     9,    13,
+                                                          17,   25,   33,   49,    65,    97,    129,  193,
+                                                          257,  385,  513,  769,   1025,  1537,  2049, 3073,
+                                                          4097, 6145, 8193, 12289, 16385, 24577};
+    static constexpr unsigned char DISTANCE_EXTRA_BITS[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                                              6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+    static constexpr std::size_t MIN_MATCH    = 3;
+    static constexpr std::size_t MAX_MATCH    = 258;
+    static constexpr std::size_t MAX_DISTANCE = 32768;
+
+    // The fixed Huffman code of a literal byte or length symbol
+    static void put_literal(bit_writer& bits, const unsigned symbol)
+    {
+        if(symbol < 144)
+        {
+            bits.put_code(0x30 + symbol, 8);
+        }
+        else if(symbol < 256)
+        {
+            bits.put_code(0x190 + symbol - 144, 9);
+        }
+        else if(symbol < 280)
+        {
+            bits.put_code(symbol - 256, 7);
+        }
+        else
+        {
+            bits.put_code(0xC0 + symbol - 280, 8);
+        }
+    }
+
+    static void put_match(bit_writer& bits, const std::size_t length, const std::size_t distance)
+    {
+        const auto length_code = std::ranges::upper_bound(LENGTH_BASES, length) - std::begin(LENGTH_BASES) - 1;
+        put_literal(bits, static_cast<unsigned>(257 + length_code));
+        bits.put(static_cast<std::uint32_t>(length - LENGTH_BASES[length_code]), LENGTH_EXTRA_BITS[length_code]);
+
+        const auto distance_code = std::ranges::upper_bound(DISTANCE_BASES, distance) - std::begin(DISTANCE_BASES) - 1;
+        bits.put_code(static_cast<std::uint32_t>(distance_code), 5);
+        bits.put(static_cast<std::uint32_t>(distance - DISTANCE_BASES[distance_code]),
+                 DISTANCE_EXTRA_BITS[distance_code]);
+    }
+
+    // One block with the fixed Huffman codes. Matches are only looked for one byte and one row back.
+    static void deflate(const std::vector<unsigned char>& data, const std::size_t row_size,
+                        std::vector<unsigned char>& out)
+    {
+        bit_writer bits(out);
+        bits.put(1, 1); // Final block
+        bits.put(1, 2); // Fixed codes
+
+        const auto match_at = [&data](const std::size_t position, const std::size_t distance) {
+            std::size_t length = 0;
+            while(position + length != data.size() && length != MAX_MATCH &&
+                  data[position + length] == data[position + length - distance])
+            {
+                length++;
+            }
+            return length;
+        };
+
+        for(std::size_t i = 0; i != data.size();)
+        {
+            std::size_t length   = 0;
+            std::size_t distance = 0;
+            for(const auto candidate : {std::size_t{1}, row_size})
+            {
+                if(candidate <= i && candidate <= MAX_DISTANCE)
+                {
+                    if(const auto found = match_at(i, candidate); found > length)
+                    {
+                        length   = found;
+                        distance = candidate;
+                    }
+                }
+            }
+
+            if(length >= MIN_MATCH)
+            {
+                put_match(bits, length, distance);
+                i += length;
+                continue;
+            }
+            put_literal(bits, data[i++]);
+        }
+
+        put_literal(bits, 256); // End of block
+        bits.flush();
+    }
+
+    static void append_png_chunk(std::vector<unsigned char>& out, const char* type,
+                                 const std::vector<unsigned char>& data)
+    {
+        append_u32_big_endian(out, static_cast<std::uint32_t>(data.size()));
+        const auto start = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data.begin(), data.end());
+        append_u32_big_endian(out, crc32(&out[start], out.size() - start));
+    }
+
+    void write_png(const char* path, const unsigned char* pixels, const int width, const int height,
+                   const image_palette& palette)
+    {
+        // Two bits per pixel, every row behind a filter type byte of none
+        const auto row_size = static_cast<std::size_t>(width + 3) / 4 + 1;
+        std::vector<unsigned char> scanlines(row_size * height);
+        for(auto y = 0; y != height; y++)
+        {
+            auto* row = &scanlines[y * row_size + 1];
+            for(auto x = 0; x != width; x++)
+            {
+                row[x / 4] |= static_cast<unsigned char>((pixels[y * width + x] & 3) << (6 - 2 * (x % 4)));
+            }
+        }
+
+        std::vector<unsigned char> header;
+        append_u32_big_endian(header, width);
+        append_u32_big_endian(header, height);
+        header.insert(header.end(), {2, 3, 0, 0, 0}); // Bit depth, indexed colour, deflate, no filter, no interlace
+
+        std::vector<unsigned char> colours;
+        for(const auto colour : palette)
+        {
+            append_rgb(colours, colour);
+        }
+
+        std::vector<unsigned char> compressed = {0x78, 0x01};
+        deflate(scanlines, row_size, compressed);
+        append_u32_big_endian(compressed, adler32(scanlines));
+
+        std::vector<unsigned char> file = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        append_png_chunk(file, "IHDR", header);
+        append_png_chunk(file, "PLTE", colours);
+        append_png_chunk(file, "IDAT", compressed);
+        append_png_chunk(file, "IEND", {});
+
+        std::unique_ptr<std::FILE, decltype(&std::fclose)> output(std::fopen(path, "wb"), &std::fclose);
+        if(output == nullptr || std::fwrite(file.data(), 1, file.size(), output.get()) != file.size() ||
+           std::fflush(output.get()) != 0)
+        {
+            throw std::runtime_error(std::string("Could not write ") + path);
+        }
+    }
+
+    static constexpr unsigned MAX_GIF_DELAY = 0xFFFF;
+
+    // Two bits per pixel, the smallest code size GIF allows
+    static constexpr unsigned LZW_MIN_CODE_SIZE = 2;
+    static constexpr unsigned LZW_CLEAR         = 1 << LZW_MIN_CODE_SIZE;
+    static constexpr unsigned LZW_END           = LZW_CLEAR + 1;
+    static constexpr unsigned LZW_MAX_CODES     = 4096;
+
+    // LZW codes go out from the lowest bit of each byte up, in sub-blocks of up to 255 bytes
+    static void append_lzw(std::vector<unsigned char>& out, const std::vector<unsigned char>& indices)
+    {
+        std::vector<unsigned char> packed;
+        bit_writer bits(packed);
+
+        // The code that follows a code with each of the four pixel values, 0 for none
+        std::vector<unsigned short> next(LZW_MAX_CODES << LZW_MIN_CODE_SIZE);
+        unsigned next_code = LZW_END + 1;
+        unsigned code_size = LZW_MIN_CODE_SIZE + 1;
+
+        bits.put(LZW_CLEAR, code_size);
+        unsigned prefix = indices[0];
+        for(std::size_t i = 1; i != indices.size(); i++)
+        {
+            const unsigned pixel = indices[i];
+            if(const auto found = next[prefix << LZW_MIN_CODE_SIZE | pixel]; found != 0)
+            {
+                prefix = found;
+                continue;
+            }
+
+            bits.put(prefix, code_size);
+            next[prefix << LZW_MIN_CODE_SIZE | pixel] = static_cast<unsigned short>(next_code++);
+            // The decoder adds its entries one code later, so it widens its codes one code later too
+            if(next_code > 1u << code_size && code_size != 12)
+            {
+                code_size++;
+            }
+            if(next_code == LZW_MAX_CODES)
+            {
+                bits.put(LZW_CLEAR, code_size);
+                std::ranges::fill(next, 0);
+                next_code = LZW_END + 1;
+                code_size = LZW_MIN_CODE_SIZE + 1;
+            }
+            prefix = pixel;
+        }
+        bits.put(prefix, code_size);
+        bits.put(LZW_END, code_size);
+        bits.flush();
+
+        out.push_back(LZW_MIN_CODE_SIZE);
+        for(std::size_t i = 0; i < packed.size(); i += 255)
+        {
+            const auto size = std::min<std::size_t>(255, packed.size() - i);
+            out.push_back(static_cast<unsigned char>(size));
+            out.insert(out.end(), packed.begin() + i, packed.begin() + i + size);
+        }
+        out.push_back(0);
+    }
+
+    gif_writer::gif_writer(const char* path, const int width, const int height, const image_palette& palette)
+        : file(std::fopen(path, "wb"), &std::fclose)
+        , path(path)
+        , width(width)
+        , height(height)
+        , shown(static_cast<std::size_t>(width) * height)
+    {
+        if(file == nullptr)
+        {
+            throw std::runtime_error(std::string("Could not write ") + path);
+        }
+
+        std::vector<unsigned char> header = {'G', 'I', 'F', '8', '9', 'a'};
+        append_u16(header, width);
+        append_u16(header, height);
+        header.insert(header.end(), {0x91, 0, 0}); // A global table of four colours, background 0, square pixels
+        for(const auto colour : palette)
+        {
+            append_rgb(header, colour);
+        }
+        // Loops forever
+        header.insert(header.end(), {0x21, 0xFF, 11, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0', 3, 1, 0,
+                                     0, 0});
+        std::fwrite(header.data(), 1, header.size(), file.get());
+    }
+
+    void gif_writer::add(const unsigned char* pixels, const unsigned delay)
+    {
+        auto left   = width;
+        auto top    = height;
+        auto right  = 0;
+        auto bottom = 0;
+        for(auto y = 0; y != height; y++)
+        {
+            for(auto x = 0; x != width; x++)
+            {
+                if(empty || pixels[y * width + x] != shown[y * width + x])
+                {
+                    left   = std::min(left, x);
+                    top    = std::min(top, y);
+                    right  = std::max(right, x + 1);
+                    bottom = std::max(bottom, y + 1);
+                }
+            }
+        }
+
+        // A frame where nothing changed still needs an image to carry its delay
+        if(right == 0)
+        {
+            left   = 0;
+            top    = 0;
+            right  = 1;
+            bottom = 1;
+        }
+
+        // Delays longer than a GIF delay can hold go on over unchanged images
+        write_image(pixels, left, top, right, bottom, std::min(delay, MAX_GIF_DELAY));
+        for(auto remaining = delay - std::min(delay, MAX_GIF_DELAY); remaining != 0;)
+        {
+            const auto part = std::min(remaining, MAX_GIF_DELAY);
+            write_image(pixels, 0, 0, 1, 1, part);
+            remaining -= part;
+        }
+        std::memcpy(shown.data(), pixels, shown.size());
+        empty = false;
+    }
+
+    void gif_writer::write_image(const unsigned char* pixels, const int left, const int top, const int right,
+                                 const int bottom, const unsigned delay)
+    {
+        // Graphic control extension: left in place for the next frame to draw over, shown for delay
+        std::vector<unsigned char> image = {0x21, 0xF9, 4, 0x04};
+        append_u16(image, delay);
+        image.insert(image.end(), {0, 0});
+
+        image.push_back(0x2C);
+        append_u16(image, left);
+        append_u16(image, top);
+        append_u16(image, right - left);
+        append_u16(image, bottom - top);
+        image.push_back(0);
+
+        std::vector<unsigned char> indices;
+        indices.reserve(static_cast<std::size_t>(right - left) * (bottom - top));
+        for(auto y = top; y != bottom; y++)
+        {
+            indices.insert(indices.end(), &pixels[y * width + left], &pixels[y * width + right]);
+        }
+        append_lzw(image, indices);
+
+        std::fwrite(image.data(), 1, image.size(), file.get());
+    }
+
+    void gif_writer::finish()
+    {
+        std::fputc(0x3B, file.get());
+        if(std::fflush(file.get()) != 0 || std::ferror(file.get()) != 0)
+        {
+            throw std::runtime_error("Could not write " + path);
+        }
+    }
+} // namespace chip8
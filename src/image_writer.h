@@ -0,0 +1,49 @@
+#pragma once
+
+#include "display.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace chip8
+{
+    // 0xRRGGBB per colour, indexed by the plane bits of a pixel as pixel_planes() returns them
+    using image_palette = std::uint32_t[1 << MAX_PLANES];
+
+    // Writes width x height pixels, each an index into palette, as an indexed PNG. Runs of equal bytes and rows that
+    // repeat the one above are deflated, which is what a scaled-up frame mostly is. Throws std::runtime_error when
+    // path cannot be written.
+    void write_png(const char* path, const unsigned char* pixels, const int width, const int height,
+                   const image_palette& palette);
+
+    // Writes an animated GIF that loops forever. Each frame only stores the rectangle that changed since the frame
+    // before.
+    class gif_writer
+    {
+    public:
+        // Throws std::runtime_error when the file cannot be created
+        gif_writer(const char* path, const int width, const int height, const image_palette& palette);
+
+        gif_writer(const gif_writer&)            = delete;
+        gif_writer& operator=(const gif_writer&) = delete;
+
+        // Adds width x height pixels, each an index into the palette, shown for delay hundredths of a second
+        void add(const unsigned char* pixels, const unsigned delay);
+        // Throws std::runtime_error when anything could not be written
+        void finish();
+
+    private:
+        void write_image(const unsigned char* pixels, const int left, const int top, const int right,
+                         const int bottom, const unsigned delay);
+
+        std::unique_ptr<std::FILE, decltype(&std::fclose)> file;
+        std::string path;
+        int width;
+        int height;
+        std::vector<unsigned char> shown; // What the frames so far leave on the screen
+        bool empty = true;
+    };
+} // namespace chip8
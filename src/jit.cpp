@@ -0,0 +1,722 @@
+#include "jit.h"
+
+#include "block_cache.h"
+#include "decoder.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#if CHIP8_JIT
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+namespace chip8
+{
+    static constexpr std::size_t ARENA_SIZE = 256 * 1024;
+
+    // Upper bound of the code emitted for a single block, checked before compiling one
+    static constexpr std::size_t MAX_BLOCK_CODE_SIZE = 2048;
+
+    // Dead entries are only reclaimed by dropping the whole cache once they dominate it
+    static constexpr auto MIN_BLOCKS_BEFORE_COMPACTION = 4096;
+
+    static compiled_block interpreted_block(const unsigned pc)
+    {
+        return {
+            .entry             = nullptr,
+            .instruction_count = 0,
+            .start             = pc,
+            .first_page        = pc / CODE_PAGE_SIZE,
+            .last_page         = pc / CODE_PAGE_SIZE,
+            .alive             = true,
+        };
+    }
+
+#if CHIP8_JIT
+    namespace
+    {
+        enum host_register : unsigned char
+        {
+            rax,
+            rcx,
+            rdx,
+            rbx,
+            rsp,
+            rbp,
+            rsi,
+            rdi,
+            r8,
+            r9,
+            r10,
+            r11,
+            r12,
+            r13,
+            r14,
+            r15
+        };
+
+        // rbx holds the state pointer and rax is scratch, every other general purpose register can pin a V register
+        static constexpr host_register PINNABLE[] = {rcx, rdx, rsi, rdi, rbp, r8, r9, r10, r11, r12, r13, r14, r15};
+
+        static constexpr host_register STATE = rbx;
+
+#if defined(_WIN32)
+        static constexpr host_register FIRST_ARGUMENT = rcx;
+
+        static bool callee_saved(const host_register reg)
+        {
+            return reg == rbx || reg == rbp || reg == rsi || reg == rdi || reg >= r12;
+        }
+#else
+        static constexpr host_register FIRST_ARGUMENT = rdi;
+
+        static bool callee_saved(const host_register reg)
+        {
+            return reg == rbx || reg == rbp || reg >= r12;
+        }
+#endif
+
+        // Just the handful of instruction forms the code generator needs. Byte-sized forms always carry a REX
+        // prefix so that sil, dil and bpl are addressable.
+        class emitter
+        {
+        public:
+            explicit emitter(unsigned char* out)
+                : out(out)
+            {
+            }
+
+            std::size_t size(const unsigned char* begin) const
+            {
+                return static_cast<std::size_t>(out - begin);
+            }
+
+            void push(const host_register reg)
+            {
+                if(reg >= r8)
+                {
+                    byte(0x41);
+                }
+                byte(0x50 + (reg & 7));
+            }
+
+            void pop(const host_register reg)
+            {
+                if(reg >= r8)
+                {
+                    byte(0x41);
+                }
+                byte(0x58 + (reg & 7));
+            }
+
+            void ret()
+            {
+                byte(0xC3);
+            }
+
+            // mov rbx, reg
+            void move_state_pointer(const host_register from)
+            {
+                byte(0x48 | (from >> 3) << 2);
+                byte(0x89);
+                byte(0xC0 | (from & 7) << 3 | STATE);
+            }
+
+            // movzx reg32, byte [rbx + offset]
+            void load_byte(const host_register to, const unsigned offset)
+            {
+                if(to >= r8)
+                {
+                    byte(0x44);
+                }
+                byte(0x0F);
+                byte(0xB6);
+                state_operand(to, offset);
+            }
+
+            // mov byte [rbx + offset], reg8
+            void store_byte(const unsigned offset, const host_register from)
+            {
+                byte(0x40 | (from >> 3) << 2);
+                byte(0x88);
+                state_operand(from, offset);
+            }
+
+            // mov word [rbx + offset], imm16
+            void store_word(const unsigned offset, const unsigned short value)
+            {
+                byte(0x66);
+                byte(0xC7);
+                state_operand(rax, offset);
+                byte(value & 0xFF);
+                byte(value >> 8);
+            }
+
+            // mov word [rbx + offset], ax
+            void store_ax(const unsigned offset)
+            {
+                byte(0x66);
+                byte(0x89);
+                state_operand(rax, offset);
+            }
+
+            // mov reg8, imm8
+            void move_immediate(const host_register to, const unsigned char value)
+            {
+                byte(0x40 | to >> 3);
+                byte(0xB0 + (to & 7));
+                byte(value);
+            }
+
+            // add / cmp reg8, imm8
+            void add_immediate(const host_register to, const unsigned char value)
+            {
+                group1_immediate(0, to, value);
+            }
+
+            void compare_immediate(const host_register to, const unsigned char value)
+            {
+                group1_immediate(7, to, value);
+            }
+
+            // <op> reg8, reg8 where op is the one byte r/m8, r8 opcode (mov 88, add 00, or 08, and 20, sub 28,
+            // xor 30, cmp 38)
+            void byte_op(const unsigned char opcode, const host_register to, const host_register from)
+            {
+                byte(0x40 | (from >> 3) << 2 | to >> 3);
+                byte(opcode);
+                byte(0xC0 | (from & 7) << 3 | (to & 7));
+            }
+
+            // set<cc> reg8 where cc is the low nibble of the 0F 9x opcode
+            void set_condition(const unsigned char condition, const host_register to)
+            {
+                byte(0x40 | to >> 3);
+                byte(0x0F);
+                byte(0x90 | condition);
+                byte(0xC0 | (to & 7));
+            }
+
+            // movzx eax, reg8
+            void zero_extend_to_eax(const host_register from)
+            {
+                byte(0x40 | from >> 3);
+                byte(0x0F);
+                byte(0xB6);
+                byte(0xC0 | (from & 7));
+            }
+
+            // lea eax, [rax + rax * 4]
+            void eax_times_five()
+            {
+                byte(0x8D);
+                byte(0x04);
+                byte(0x80);
+            }
+
+            // lea eax, [rax + rax + base]
+            void eax_twice_plus(const unsigned base)
+            {
+                byte(0x8D);
+                byte(0x84);
+                byte(0x00);
+                dword(base);
+            }
+
+            // and eax, imm8
+            void and_eax(const unsigned char value)
+            {
+                byte(0x83);
+                byte(0xE0);
+                byte(value);
+            }
+
+        private:
+            void byte(const unsigned value)
+            {
+                *out++ = static_cast<unsigned char>(value);
+            }
+
+            void dword(const unsigned value)
+            {
+                std::memcpy(out, &value, sizeof value);
+                out += sizeof value;
+            }
+
+            // ModRM for [rbx + disp8] with reg in the reg field
+            void state_operand(const host_register reg, const unsigned offset)
+            {
+                byte(0x40 | (reg & 7) << 3 | STATE);
+                byte(offset);
+            }
+
+            void group1_immediate(const unsigned char extension, const host_register to, const unsigned char value)
+            {
+                byte(0x40 | to >> 3);
+                byte(0x80);
+                byte(0xC0 | extension << 3 | (to & 7));
+                byte(value);
+            }
+
+            unsigned char* out;
+        };
+
+        enum condition : unsigned char
+        {
+            below       = 0x2, // Carry set
+            above_equal = 0x3, // Carry clear
+            equal       = 0x4,
+            not_equal   = 0x5
+        };
+
+        static bool compilable(const op handler, const quirk_flags& quirks)
+        {
+            switch(handler)
+            {
+                case op::or_assign_register:
+                case op::and_assign_register:
+                case op::xor_assign_register:
+                    // Clearing VF after them is left to the interpreter
+                    return quirks.logic_resets_vf == false;
+                case op::jump_if_equal:
+                case op::jump_if_not_equal:
+                case op::jump_if_registers_equal:
+                case op::jump_if_registers_not_equal:
+                    // Skipping over F000 NNNN, four bytes long, is left to the interpreter
+                    return quirks.mode != machine_mode::xochip;
+                case op::jump_to:
+                case op::set_register_to_value:
+                case op::add_assign_register_to_value:
+                case op::assign_register:
+                case op::add_assign_register:
+                case op::subtract_assign_register:
+                case op::assign_address_register:
+                case op::set_memory_address_to_character_sprite_address:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        static bool ends_block(const op handler)
+        {
+            return handler == op::jump_to || handler == op::jump_if_equal || handler == op::jump_if_not_equal ||
+                   handler == op::jump_if_registers_equal || handler == op::jump_if_registers_not_equal;
+        }
+
+        // ANNN and 1NNN only hold part of NNN in the X nibble
+        static bool uses_first_register(const op handler)
+        {
+            return handler != op::assign_address_register && handler != op::jump_to;
+        }
+
+        static bool reads_second_register(const op handler)
+        {
+            switch(handler)
+            {
+                case op::jump_if_registers_equal:
+                case op::assign_register:
+                case op::or_assign_register:
+                case op::and_assign_register:
+                case op::xor_assign_register:
+                case op::add_assign_register:
+                case op::subtract_assign_register:
+                case op::jump_if_registers_not_equal:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        static bool writes_first_register(const op handler)
+        {
+            switch(handler)
+            {
+                case op::set_register_to_value:
+                case op::add_assign_register_to_value:
+                case op::assign_register:
+                case op::or_assign_register:
+                case op::and_assign_register:
+                case op::xor_assign_register:
+                case op::add_assign_register:
+                case op::subtract_assign_register:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        static bool writes_flag(const op handler)
+        {
+            return handler == op::add_assign_register || handler == op::subtract_assign_register;
+        }
+
+        static constexpr auto NOT_PINNED = 0xFF;
+
+        // Guest register to host register assignment for one block
+        struct register_map
+        {
+            unsigned char host_of[16];
+            bool written[16];
+            unsigned pinned = 0;
+
+            register_map()
+            {
+                std::fill(std::begin(host_of), std::end(host_of), NOT_PINNED);
+                std::fill(std::begin(written), std::end(written), false);
+            }
+
+            host_register operator[](const unsigned guest) const
+            {
+                return PINNABLE[host_of[guest]];
+            }
+
+            // Pins every register instruction touches, or nothing when the host runs out of registers
+            bool pin(const decoded_instruction& instruction)
+            {
+                unsigned char needed[3];
+                unsigned needed_count = 0;
+
+                if(uses_first_register(instruction.handler))
+                {
+                    needed[needed_count++] = instruction.x;
+                }
+                if(reads_second_register(instruction.handler))
+                {
+                    needed[needed_count++] = instruction.y;
+                }
+                if(writes_flag(instruction.handler))
+                {
+                    needed[needed_count++] = 0xF;
+                }
+
+                unsigned missing = 0;
+                for(unsigned i = 0; i != needed_count; i++)
+                {
+                    const bool counted = std::find(needed, needed + i, needed[i]) != needed + i;
+                    missing += host_of[needed[i]] == NOT_PINNED && counted == false;
+                }
+                if(pinned + missing > std::size(PINNABLE))
+                {
+                    return false;
+                }
+
+                for(unsigned i = 0; i != needed_count; i++)
+                {
+                    if(host_of[needed[i]] == NOT_PINNED)
+                    {
+                        host_of[needed[i]] = static_cast<unsigned char>(pinned++);
+                    }
+                }
+
+                written[instruction.x] |= writes_first_register(instruction.handler);
+                written[0xF] |= writes_flag(instruction.handler);
+                return true;
+            }
+        };
+    } // namespace
+#endif
+
+    jit_cache::jit_cache(const std::size_t memory_size, const jit_layout layout, const quirk_flags& quirks)
+        : memory_size(memory_size)
+        , layout(layout)
+        , quirks(quirks)
+        , block_at(memory_size, 0)
+        , page_has_code((memory_size + CODE_PAGE_SIZE - 1) / CODE_PAGE_SIZE, false)
+        , page_rewrites(page_has_code.size(), 0)
+    {
+        if(layout.V + 16 > 0x80 || layout.I + 2 > 0x80 || layout.pc + 2 > 0x80)
+        {
+            throw std::invalid_argument("Registers must be addressable with an 8-bit displacement");
+        }
+
+#if CHIP8_JIT
+        // The arena is only writable while a block is being emitted into it
+#if defined(_WIN32)
+        arena = static_cast<unsigned char*>(
+            VirtualAlloc(nullptr, ARENA_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READ));
+#else
+        void* mapping = mmap(nullptr, ARENA_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        arena         = mapping == MAP_FAILED ? nullptr : static_cast<unsigned char*>(mapping);
+#endif
+        if(arena == nullptr)
+        {
+            throw std::runtime_error("Could not allocate executable memory");
+        }
+        arena_size = ARENA_SIZE;
+#endif
+    }
+
+    jit_cache::~jit_cache()
+    {
+#if CHIP8_JIT
+#if defined(_WIN32)
+        VirtualFree(arena, 0, MEM_RELEASE);
+#else
+        munmap(arena, arena_size);
+#endif
+#endif
+    }
+
+    bool jit_cache::supported()
+    {
+        return CHIP8_JIT != 0;
+    }
+
+    const compiled_block& jit_cache::lookup(const unsigned char* memory, const unsigned short pc)
+    {
+        if(pc + 1u >= memory_size)
+        {
+            // Left to the interpreter, which reports the bad program counter
+            static const compiled_block out_of_range = interpreted_block(0);
+            return out_of_range;
+        }
+        if(const auto id = block_at[pc]; id != 0)
+        {
+            return blocks[id - 1];
+        }
+        return compile(memory, pc);
+    }
+
+    const compiled_block& jit_cache::compile([[maybe_unused]] const unsigned char* memory, const unsigned short pc)
+    {
+        auto block = interpreted_block(pc);
+
+#if CHIP8_JIT
+        register_map registers;
+        decoded_instruction body[MAX_BLOCK_INSTRUCTIONS];
+        unsigned count   = 0;
+        unsigned address = pc;
+        while(count != MAX_BLOCK_INSTRUCTIONS && address + 1 < memory_size &&
+              page_rewrites[address / CODE_PAGE_SIZE] != SELF_MODIFYING_REWRITES)
+        {
+            const auto instruction = decode(static_cast<unsigned short>(memory[address] << 8 | memory[address + 1]));
+            if(compilable(instruction.handler, quirks) == false || registers.pin(instruction) == false)
+            {
+                break;
+            }
+
+            body[count++] = instruction;
+            address += 2;
+
+            if(ends_block(instruction.handler))
+            {
+                break;
+            }
+        }
+
+        if(count != 0)
+        {
+            if(arena_size - arena_used < MAX_BLOCK_CODE_SIZE)
+            {
+                clear();
+            }
+
+#if defined(_WIN32)
+            DWORD previous_protection;
+            VirtualProtect(arena, arena_size, PAGE_READWRITE, &previous_protection);
+#else
+            mprotect(arena, arena_size, PROT_READ | PROT_WRITE);
+#endif
+
+            const auto begin = arena + arena_used;
+            emitter code(begin);
+
+            // Prologue: save what the ABI asks for, take the state pointer and load every pinned V register
+            code.push(STATE);
+            for(unsigned i = 0; i != registers.pinned; i++)
+            {
+                if(callee_saved(PINNABLE[i]))
+                {
+                    code.push(PINNABLE[i]);
+                }
+            }
+            code.move_state_pointer(FIRST_ARGUMENT);
+            for(unsigned guest = 0; guest != 16; guest++)
+            {
+                if(registers.host_of[guest] != NOT_PINNED)
+                {
+                    code.load_byte(registers[guest], layout.V + guest);
+                }
+            }
+
+            // Body. Each operation mirrors its handler in chip8.cpp. A skip leaves its outcome in al.
+            unsigned next_pc = address;
+            bool skips       = false;
+            for(unsigned i = 0; i != count; i++)
+            {
+                const auto& instruction = body[i];
+                const auto x            = uses_first_register(instruction.handler) ? registers[instruction.x] : rax;
+                const auto y            = reads_second_register(instruction.handler) ? registers[instruction.y] : rax;
+                switch(instruction.handler)
+                {
+                    case op::set_register_to_value:
+                        code.move_immediate(x, instruction.nn);
+                        break;
+                    case op::add_assign_register_to_value:
+                        code.add_immediate(x, instruction.nn);
+                        break;
+                    case op::assign_register:
+                        code.byte_op(0x88, x, y);
+                        break;
+                    case op::or_assign_register:
+                        code.byte_op(0x08, x, y);
+                        break;
+                    case op::and_assign_register:
+                        code.byte_op(0x20, x, y);
+                        break;
+                    case op::xor_assign_register:
+                        code.byte_op(0x30, x, y);
+                        break;
+                    case op::add_assign_register:
+                        code.byte_op(0x00, x, y);
+                        code.set_condition(below, registers[0xF]);
+                        break;
+                    case op::subtract_assign_register:
+                        code.byte_op(0x28, x, y);
+                        code.set_condition(above_equal, registers[0xF]);
+                        break;
+                    case op::assign_address_register:
+                        code.store_word(layout.I, instruction.nnn);
+                        break;
+                    case op::set_memory_address_to_character_sprite_address:
+                        code.zero_extend_to_eax(x);
+                        code.and_eax(0xF);
+                        code.eax_times_five();
+                        code.store_ax(layout.I);
+                        break;
+                    case op::jump_to:
+                        next_pc = instruction.nnn;
+                        break;
+                    case op::jump_if_equal:
+                    case op::jump_if_not_equal:
+                        code.compare_immediate(x, instruction.nn);
+                        code.set_condition(instruction.handler == op::jump_if_equal ? equal : not_equal, rax);
+                        skips = true;
+                        break;
+                    case op::jump_if_registers_equal:
+                    case op::jump_if_registers_not_equal:
+                        code.byte_op(0x38, x, y);
+                        code.set_condition(instruction.handler == op::jump_if_registers_equal ? equal : not_equal,
+                                           rax);
+                        skips = true;
+                        break;
+                    default:
+                        break;
+                }
+            }
+
+            // Epilogue: write back what the block changed, then the pc it continues at
+            for(unsigned guest = 0; guest != 16; guest++)
+            {
+                if(registers.written[guest])
+                {
+                    code.store_byte(layout.V + guest, registers[guest]);
+                }
+            }
+            if(skips)
+            {
+                code.zero_extend_to_eax(rax);
+                code.eax_twice_plus(next_pc);
+                code.store_ax(layout.pc);
+            }
+            else
+            {
+                code.store_word(layout.pc, static_cast<unsigned short>(next_pc));
+            }
+            for(unsigned i = registers.pinned; i-- != 0;)
+            {
+                if(callee_saved(PINNABLE[i]))
+                {
+                    code.pop(PINNABLE[i]);
+                }
+            }
+            code.pop(STATE);
+            code.ret();
+
+#if defined(_WIN32)
+            VirtualProtect(arena, arena_size, PAGE_EXECUTE_READ, &previous_protection);
+#else
+            mprotect(arena, arena_size, PROT_READ | PROT_EXEC);
+#endif
+
+            arena_used += code.size(begin);
+            // Keep entry points 16-byte aligned
+            arena_used = (arena_used + 15) & ~std::size_t{15};
+
+            block.entry             = reinterpret_cast<void (*)(void*)>(begin);
+            block.instruction_count = static_cast<unsigned short>(count);
+            block.last_page         = (address - 1) / CODE_PAGE_SIZE;
+        }
+#endif
+
+        // Blocks on self-modifying pages only tell the caller to interpret, which stays valid whatever gets written
+        if(page_rewrites[block.first_page] != SELF_MODIFYING_REWRITES)
+        {
+            for(auto page = block.first_page; page <= block.last_page; page++)
+            {
+                page_has_code[page] = true;
+            }
+        }
+
+        blocks.push_back(block);
+        block_at[pc] = static_cast<unsigned>(blocks.size());
+        return blocks.back();
+    }
+
+    void jit_cache::invalidate(const unsigned address, const unsigned size)
+    {
+        if(size == 0)
+        {
+            return;
+        }
+
+        // An instruction starting on the previous page can reach one byte into the written range
+        const auto first_page = (address == 0 ? 0 : address - 1) / CODE_PAGE_SIZE;
+        const auto last_page  = (address + size - 1) / CODE_PAGE_SIZE;
+        for(auto page = first_page; page <= last_page && page < page_has_code.size(); page++)
+        {
+            if(page_has_code[page])
+            {
+                invalidate_page(page);
+            }
+        }
+
+        if(dead_blocks > MIN_BLOCKS_BEFORE_COMPACTION && dead_blocks * 2 > blocks.size())
+        {
+            clear();
+        }
+    }
+
+    void jit_cache::invalidate_page(const unsigned page)
+    {
+        // The code of dead blocks stays in the arena until it fills up and is dropped as a whole
+        for(auto& block : blocks)
+        {
+            if(block.alive && block.first_page <= page && page <= block.last_page)
+            {
+                block.alive           = false;
+                block_at[block.start] = 0;
+                dead_blocks++;
+            }
+        }
+        page_has_code[page]  = false;
+        page_rewrites[page] += page_rewrites[page] < SELF_MODIFYING_REWRITES;
+    }
+
+    void jit_cache::clear()
+    {
+        blocks.clear();
+        arena_used  = 0;
+        dead_blocks = 0;
+        std::fill(block_at.begin(), block_at.end(), 0);
+        std::fill(page_has_code.begin(), page_has_code.end(), false);
+    }
+} // namespace chip8
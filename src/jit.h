@@ -0,0 +1,78 @@
+#pragma once
+
+#include "quirks.h"
+
+#include <cstddef>
+#include <vector>
+
+// Native code generation only targets x86-64. Define CHIP8_JIT=0 to compile it out everywhere.
+#ifndef CHIP8_JIT
+#if defined(__x86_64__) || defined(_M_X64)
+#define CHIP8_JIT 1
+#else
+#define CHIP8_JIT 0
+#endif
+#endif
+
+namespace chip8
+{
+    // Byte offsets of the guest registers inside the state handed to generated code
+    struct jit_layout
+    {
+        unsigned V;
+        unsigned I;
+        unsigned pc;
+    };
+
+    struct compiled_block
+    {
+        void (*entry)(void* state);
+        unsigned short instruction_count; // 0 when the instruction at start has to go through the interpreter
+        unsigned start;
+        unsigned first_page;
+        unsigned last_page;
+        bool alive;
+    };
+
+    // Basic blocks compiled to x86-64 in an executable arena, keyed by start address. The V registers a block
+    // touches are pinned to host registers for its whole body and written back once on exit. Draws, key and timer
+    // instructions, stores and calls are never compiled: a block stops in front of them and leaves them to the
+    // interpreter. So are the ops whose quirk in the given profile the generator does not implement. Invalidation
+    // works on the same code pages as the block cache.
+    class jit_cache
+    {
+    public:
+        jit_cache(const std::size_t memory_size, const jit_layout layout, const quirk_flags& quirks);
+        ~jit_cache();
+
+        jit_cache(const jit_cache&)            = delete;
+        jit_cache& operator=(const jit_cache&) = delete;
+
+        // False in builds without a code generator for the host
+        static bool supported();
+
+        // Returns the block starting at pc, compiling it from memory on a miss
+        const compiled_block& lookup(const unsigned char* memory, const unsigned short pc);
+
+        void invalidate(const unsigned address, const unsigned size);
+        void clear();
+
+    private:
+        const compiled_block& compile(const unsigned char* memory, const unsigned short pc);
+        void invalidate_page(const unsigned page);
+
+        std::size_t memory_size;
+        jit_layout layout;
+        quirk_flags quirks;
+
+        unsigned char* arena   = nullptr;
+        std::size_t arena_size = 0;
+        std::size_t arena_used = 0;
+
+        std::vector<compiled_block> blocks;
+        std::vector<unsigned> block_at; // Block id + 1 for every start address, 0 when none
+        std::vector<bool> page_has_code;
+        std::vector<unsigned char> page_rewrites;
+        std::size_t dead_blocks = 0;
+    };
+} // namespace chip8
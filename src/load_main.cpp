@@ -0,0 +1,470 @@
+#include "random.h"
+#include "session_protocol.h"
+#include "xor_delta.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Usage: chip8-load [--socket PATH] [--clients N] [--seconds N] [--quirks vip|schip|modern|xochip]
+//                   [--keys-per-second N] rom
+// Load generator for chip8-server. Opens --clients sessions of rom, 100 by default, on the server's socket, each
+// pressing and releasing random keys --keys-per-second times a second for --seconds, then prints how many frames
+// arrived and how late: the time from when the server's tick was due to when the frame was read, at the median, the
+// 99th percentile and the worst. Every frame is decoded and checked against the one before it, so a broken delta
+// counts as an error. Exits with 2 when any session ended in an error.
+
+static bool parse_number(const char* text, auto& out)
+{
+    const auto end = text + std::strlen(text);
+    return std::from_chars(text, end, out).ptr == end;
+}
+
+static bool read_file(const char* path, std::vector<unsigned char>& out)
+{
+    std::ifstream is(path, std::ios::binary);
+    if(is.is_open() == false)
+    {
+        return false;
+    }
+    out.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+    return true;
+}
+
+static std::uint64_t steady_nanoseconds()
+{
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                          std::chrono::steady_clock::now().time_since_epoch())
+                                          .count());
+}
+
+static int connect_to(const std::string& path)
+{
+    sockaddr_un address = {};
+    address.sun_family  = AF_UNIX;
+    if(path.size() >= sizeof(address.sun_path))
+    {
+        throw std::runtime_error("Socket path " + path + " is too long");
+    }
+    path.copy(address.sun_path, path.size());
+
+    const auto fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0 || connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+       fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0)
+    {
+        const std::string reason = std::strerror(errno);
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+        throw std::runtime_error("Could not connect to " + path + ": " + reason);
+    }
+    return fd;
+}
+
+struct client
+{
+    int fd = -1;
+    std::vector<unsigned char> input;
+    std::vector<unsigned char> output;
+    std::size_t output_sent     = 0;
+    bool waiting_for_writable   = false;
+    bool has_frame              = false; // Set by the first keyframe, which every delta after it builds on
+    std::uint64_t frame_number  = 0;
+    chip8::recorded_frame frame = {};
+    int held_key                = -1;
+    std::uint64_t next_key      = 0; // Steady clock nanoseconds
+};
+
+struct load_stats
+{
+    std::uint64_t frames    = 0;
+    std::uint64_t keyframes = 0;
+    std::uint64_t skipped   = 0; // Frame numbers the server skipped for a client behind
+    std::uint64_t bytes     = 0;
+    std::uint64_t errors    = 0;
+    std::vector<std::uint64_t> latencies; // Nanoseconds
+};
+
+class load_generator
+{
+public:
+    load_generator() : epoll_fd(epoll_create1(EPOLL_CLOEXEC))
+    {
+        if(epoll_fd < 0)
+        {
+            throw std::runtime_error(std::string("Could not create an epoll instance: ") + std::strerror(errno));
+        }
+    }
+
+    ~load_generator()
+    {
+        for(const auto& c : clients)
+        {
+            if(c.fd >= 0)
+            {
+                close(c.fd);
+            }
+        }
+        close(epoll_fd);
+    }
+
+    load_generator(const load_generator&)            = delete;
+    load_generator& operator=(const load_generator&) = delete;
+
+    void connect_clients(const std::string& path, const unsigned count, const chip8::open_request& request)
+    {
+        clients.resize(count);
+        for(std::size_t i = 0; i != clients.size(); i++)
+        {
+            auto& c = clients[i];
+            c.fd    = connect_to(path);
+
+            epoll_event event = {};
+            event.events      = EPOLLIN;
+            event.data.u64    = i;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c.fd, &event);
+
+            open_clients++;
+            chip8::append_open_message(c.output, request);
+            flush(i);
+        }
+    }
+
+    // Presses and releases keys until the time is up or every session has ended
+    void run(const double seconds, const double keys_per_second)
+    {
+        const auto start    = steady_nanoseconds();
+        const auto end      = start + static_cast<std::uint64_t>(seconds * 1e9);
+        const auto interval = keys_per_second > 0 ? static_cast<std::uint64_t>(1e9 / keys_per_second) : 0;
+
+        // Spread over the first interval so the clients do not all press at once
+        for(auto& c : clients)
+        {
+            c.next_key = start + (interval != 0 ? random.next() % interval : 0);
+        }
+
+        epoll_event events[256];
+        for(auto now = start; now < end && open_clients != 0; now = steady_nanoseconds())
+        {
+            const auto count = epoll_wait(epoll_fd, events, static_cast<int>(std::size(events)), 1);
+            for(auto i = 0; i < count; i++)
+            {
+                const auto index = static_cast<std::size_t>(events[i].data.u64);
+                if((events[i].events & EPOLLOUT) != 0)
+                {
+                    flush(index);
+                }
+                if((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0)
+                {
+                    receive(index);
+                }
+            }
+
+            if(interval == 0)
+            {
+                continue;
+            }
+            now = steady_nanoseconds();
+            for(std::size_t i = 0; i != clients.size(); i++)
+            {
+                auto& c = clients[i];
+                if(c.fd < 0 || c.next_key > now)
+                {
+                    continue;
+                }
+                if(c.held_key < 0)
+                {
+                    c.held_key = static_cast<int>(random.next() % chip8::KEY_COUNT);
+                    chip8::append_key_message(c.output, c.held_key, true);
+                }
+                else
+                {
+                    chip8::append_key_message(c.output, c.held_key, false);
+                    c.held_key = -1;
+                }
+                c.next_key += interval;
+                flush(i);
+            }
+        }
+    }
+
+    const load_stats& stats() const
+    {
+        return totals;
+    }
+
+private:
+    void flush(const std::size_t index)
+    {
+        auto& c = clients[index];
+        while(c.fd >= 0 && c.output_sent != c.output.size())
+        {
+            const auto size =
+                send(c.fd, c.output.data() + c.output_sent, c.output.size() - c.output_sent, MSG_NOSIGNAL);
+            if(size > 0)
+            {
+                c.output_sent += static_cast<std::size_t>(size);
+            }
+            else if(size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                watch_writable(index, true);
+                return;
+            }
+            else if(size < 0 && errno != EINTR)
+            {
+                fail(index, std::string("Send failed: ") + std::strerror(errno));
+                return;
+            }
+        }
+        c.output.clear();
+        c.output_sent = 0;
+        watch_writable(index, false);
+    }
+
+    void watch_writable(const std::size_t index, const bool enabled)
+    {
+        auto& c = clients[index];
+        if(c.fd >= 0 && c.waiting_for_writable != enabled)
+        {
+            epoll_event event = {};
+            event.events      = enabled ? EPOLLIN | EPOLLOUT : EPOLLIN;
+            event.data.u64    = index;
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c.fd, &event);
+            c.waiting_for_writable = enabled;
+        }
+    }
+
+    void receive(const std::size_t index)
+    {
+        auto& c = clients[index];
+        unsigned char buffer[64 * 1024];
+        while(c.fd >= 0)
+        {
+            const auto size = read(c.fd, buffer, sizeof(buffer));
+            if(size > 0)
+            {
+                c.input.insert(c.input.end(), buffer, buffer + size);
+                handle_messages(index, steady_nanoseconds());
+            }
+            else if(size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                return;
+            }
+            else if(size == 0 || errno != EINTR)
+            {
+                fail(index, "The server closed the connection");
+                return;
+            }
+        }
+    }
+
+    void handle_messages(const std::size_t index, const std::uint64_t now)
+    {
+        auto& c              = clients[index];
+        std::size_t consumed = 0;
+        try
+        {
+            chip8::message m;
+            while(const auto size = chip8::peek_message(c.input.data() + consumed, c.input.size() - consumed, m))
+            {
+                consumed += size;
+                if(m.type == chip8::message_type::error)
+                {
+                    fail(index, "Server error: " + std::string(reinterpret_cast<const char*>(m.payload), m.size));
+                    return;
+                }
+
+                chip8::frame_header header;
+                const unsigned char* delta = nullptr;
+                std::size_t delta_size     = 0;
+                if(chip8::parse_frame(m, header, delta, delta_size) == false)
+                {
+                    fail(index, "Unexpected message from the server");
+                    return;
+                }
+                if(check_frame(c, header, delta, delta_size) == false)
+                {
+                    fail(index, "Frame " + std::to_string(header.number) + " does not decode");
+                    return;
+                }
+
+                totals.frames++;
+                totals.keyframes += header.keyframe ? 1 : 0;
+                totals.bytes += size;
+                totals.latencies.push_back(now > header.due ? now - header.due : 0);
+            }
+        }
+        catch(const std::exception& e)
+        {
+            fail(index, e.what());
+            return;
+        }
+        c.input.erase(c.input.begin(), c.input.begin() + static_cast<std::ptrdiff_t>(consumed));
+    }
+
+    // Applies the frame's delta on top of the one before it. A delta only decodes after the frame right before it.
+    bool check_frame(client& c, const chip8::frame_header& header, const unsigned char* delta,
+                     const std::size_t delta_size)
+    {
+        if(header.keyframe)
+        {
+            c.frame = {};
+        }
+        else if(c.has_frame == false || header.number != c.frame_number + 1)
+        {
+            return false;
+        }
+        if(c.has_frame && header.number > c.frame_number + 1)
+        {
+            totals.skipped += header.number - c.frame_number - 1;
+        }
+
+        c.has_frame    = true;
+        c.frame_number = header.number;
+        return chip8::apply_xor_delta(delta, delta_size, c.frame.bytes, sizeof(c.frame.bytes));
+    }
+
+    void fail(const std::size_t index, const std::string& reason)
+    {
+        auto& c = clients[index];
+        if(totals.errors++ == 0)
+        {
+            std::fprintf(stderr, "client %zu: %s\n", index, reason.c_str());
+        }
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c.fd, nullptr);
+        close(c.fd);
+        c.fd = -1;
+        open_clients--;
+    }
+
+    int epoll_fd;
+    std::vector<client> clients;
+    std::size_t open_clients = 0;
+    chip8::xoshiro256 random{1};
+    load_stats totals;
+};
+
+// In milliseconds, from the sorted latencies
+static double percentile(const std::vector<std::uint64_t>& sorted, const double fraction)
+{
+    if(sorted.empty())
+    {
+        return 0;
+    }
+    const auto index = std::min(sorted.size() - 1, static_cast<std::size_t>(sorted.size() * fraction));
+    return sorted[index] / 1e6;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string socket_path = "chip8.sock";
+    unsigned clients        = 100;
+    double seconds          = 10;
+    double keys_per_second  = 4;
+
+    chip8::open_request request;
+    const char* rom_path = nullptr;
+
+    for(int i = 1; i < argc; i++)
+    {
+        const std::string_view arg = argv[i];
+
+        const bool has_value = i + 1 < argc;
+        if(arg == "--socket" && has_value)
+        {
+            socket_path = argv[++i];
+        }
+        else if(arg == "--clients" && has_value && parse_number(argv[i + 1], clients) && clients != 0)
+        {
+            i++;
+        }
+        else if(arg == "--seconds" && has_value && parse_number(argv[i + 1], seconds) && seconds > 0)
+        {
+            i++;
+        }
+        else if(arg == "--quirks" && has_value && chip8::parse_quirk_profile(argv[i + 1], request.quirks))
+        {
+            i++;
+        }
+        else if(arg == "--keys-per-second" && has_value && parse_number(argv[i + 1], keys_per_second) &&
+                keys_per_second >= 0)
+        {
+            i++;
+        }
+        else if(arg.starts_with("--") || rom_path != nullptr)
+        {
+            std::fprintf(stderr, "Unknown or incomplete option %s\n", argv[i]);
+            return 1;
+        }
+        else
+        {
+            rom_path = argv[i];
+        }
+    }
+
+    if(rom_path == nullptr)
+    {
+        std::fprintf(stderr,
+                     "Usage: %s [--socket PATH] [--clients N] [--seconds N] [--quirks vip|schip|modern|xochip] "
+                     "[--keys-per-second N] rom\n",
+                     argv[0]);
+        return 1;
+    }
+
+    std::vector<unsigned char> rom;
+    if(read_file(rom_path, rom) == false)
+    {
+        std::fprintf(stderr, "Could not read %s\n", rom_path);
+        return 1;
+    }
+    request.rom      = rom.data();
+    request.rom_size = rom.size();
+
+    try
+    {
+        load_generator generator;
+        generator.connect_clients(socket_path, clients, request);
+
+        const auto start = std::chrono::steady_clock::now();
+        generator.run(seconds, keys_per_second);
+        const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        auto stats = generator.stats();
+        std::sort(stats.latencies.begin(), stats.latencies.end());
+
+        std::printf("clients:     %u\n", clients);
+        std::printf("frames:      %llu (%.0f per second)\n", static_cast<unsigned long long>(stats.frames),
+                    stats.frames / elapsed);
+        std::printf("keyframes:   %llu\n", static_cast<unsigned long long>(stats.keyframes));
+        std::printf("skipped:     %llu\n", static_cast<unsigned long long>(stats.skipped));
+        std::printf("bytes/frame: %.1f\n", stats.frames != 0 ? static_cast<double>(stats.bytes) / stats.frames : 0);
+        std::printf("errors:      %llu\n", static_cast<unsigned long long>(stats.errors));
+        std::printf("latency p50: %.3f ms\n", percentile(stats.latencies, 0.5));
+        std::printf("latency p99: %.3f ms\n", percentile(stats.latencies, 0.99));
+        std::printf("latency max: %.3f ms\n", stats.latencies.empty() ? 0 : stats.latencies.back() / 1e6);
+        return stats.errors != 0 ? 2 : 0;
+    }
+    catch(const std::exception& e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+}
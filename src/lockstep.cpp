@@ -0,0 +1,1032 @@
+#include "lockstep.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+// Lane vectors: 2 for AVX2, 1 for SSE2 and 0 for plain loops. Defaults to the widest the build targets.
+#ifndef CHIP8_LOCKSTEP_SIMD
+#if defined(__AVX2__)
+#define CHIP8_LOCKSTEP_SIMD 2
+#elif defined(__SSE2__) || defined(_M_X64)
+#define CHIP8_LOCKSTEP_SIMD 1
+#else
+#define CHIP8_LOCKSTEP_SIMD 0
+#endif
+#endif
+
+#if CHIP8_LOCKSTEP_SIMD == 2
+#include <immintrin.h>
+#elif CHIP8_LOCKSTEP_SIMD == 1
+#include <emmintrin.h>
+#endif
+
+namespace chip8
+{
+    static_assert(MAX_LOCKSTEP_LANES == 32, "The lane vectors below hold exactly 32 lanes");
+
+    namespace
+    {
+        // A byte per lane for all 32 lanes, one V register across every machine. Comparisons return lane masks.
+#if CHIP8_LOCKSTEP_SIMD == 2
+        struct byte_lanes
+        {
+            __m256i v;
+        };
+
+        byte_lanes load_lanes(const unsigned char* lanes)
+        {
+            return {_mm256_load_si256(reinterpret_cast<const __m256i*>(lanes))};
+        }
+
+        void store_lanes(unsigned char* lanes, const byte_lanes value)
+        {
+            _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), value.v);
+        }
+
+        byte_lanes splat(const unsigned char value)
+        {
+            return {_mm256_set1_epi8(static_cast<char>(value))};
+        }
+
+        byte_lanes operator+(const byte_lanes a, const byte_lanes b)
+        {
+            return {_mm256_add_epi8(a.v, b.v)};
+        }
+
+        byte_lanes operator-(const byte_lanes a, const byte_lanes b)
+        {
+            return {_mm256_sub_epi8(a.v, b.v)};
+        }
+
+        byte_lanes operator|(const byte_lanes a, const byte_lanes b)
+        {
+            return {_mm256_or_si256(a.v, b.v)};
+        }
+
+        byte_lanes operator&(const byte_lanes a, const byte_lanes b)
+        {
+            return {_mm256_and_si256(a.v, b.v)};
+        }
+
+        byte_lanes operator^(const byte_lanes a, const byte_lanes b)
+        {
+            return {_mm256_xor_si256(a.v, b.v)};
+        }
+
+        byte_lanes min(const byte_lanes a, const byte_lanes b)
+        {
+            return {_mm256_min_epu8(a.v, b.v)};
+        }
+
+        lane_mask equal(const byte_lanes a, const byte_lanes b)
+        {
+            return static_cast<lane_mask>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a.v, b.v)));
+        }
+
+        // Lane n takes a where bit n of mask is set and b elsewhere
+        byte_lanes select(const lane_mask mask, const byte_lanes a, const byte_lanes b)
+        {
+            // Each byte picks the mask byte holding its bit, then tests that bit
+            const auto spread = _mm256_shuffle_epi8(
+                _mm256_set1_epi32(static_cast<int>(mask)),
+                _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3,
+                                 3, 3, 3));
+            const auto bits = _mm256_set1_epi64x(static_cast<long long>(0x8040201008040201));
+            return {_mm256_blendv_epi8(b.v, a.v, _mm256_cmpeq_epi8(_mm256_and_si256(spread, bits), bits))};
+        }
+
+        // Every lane whose bit is set in mask, of 32 unsigned shorts, is set to value
+        void fill_masked(unsigned short* lanes, const lane_mask mask, const unsigned short value)
+        {
+            const auto bits = _mm256_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384,
+                                                std::numeric_limits<short>::min());
+            const auto filled = _mm256_set1_epi16(static_cast<short>(value));
+            for(auto half = 0; half != 2; half++)
+            {
+                const auto target = reinterpret_cast<__m256i*>(lanes) + half;
+                const auto spread = _mm256_set1_epi16(static_cast<short>(mask >> (half * 16)));
+                const auto chosen = _mm256_cmpeq_epi16(_mm256_and_si256(spread, bits), bits);
+                _mm256_store_si256(target, _mm256_blendv_epi8(_mm256_load_si256(target), filled, chosen));
+            }
+        }
+
+        lane_mask equal(const unsigned short* lanes, const unsigned short value)
+        {
+            const auto wanted = _mm256_set1_epi16(static_cast<short>(value));
+            const auto low    = _mm256_cmpeq_epi16(_mm256_load_si256(reinterpret_cast<const __m256i*>(lanes)), wanted);
+            const auto high =
+                _mm256_cmpeq_epi16(_mm256_load_si256(reinterpret_cast<const __m256i*>(lanes) + 1), wanted);
+            // Packing interleaves the 128-bit halves, the permute puts the lanes back in order
+            const auto packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(low, high), 0xD8);
+            return static_cast<lane_mask>(_mm256_movemask_epi8(packed));
+        }
+#elif CHIP8_LOCKSTEP_SIMD == 1
+        struct byte_lanes
+        {
+            __m128i low;
+            __m128i high;
+        };
+
+        byte_lanes load_lanes(const unsigned char* lanes)
+        {
+            return {_mm_load_si128(reinterpret_cast<const __m128i*>(lanes)),
+                    _mm_load_si128(reinterpret_cast<const __m128i*>(lanes) + 1)};
+        }
+
+        void store_lanes(unsigned char* lanes, const byte_lanes value)
+        {
+            _mm_store_si128(reinterpret_cast<__m128i*>(lanes), value.low);
+            _mm_store_si128(reinterpret_cast<__m128i*>(lanes) + 1, value.high);
+        }
+
+        byte_lanes splat(const unsigned char value)
+        {
+            const auto v = _mm_set1_epi8(static_cast<char>(value));
+            return {v, v};
+        }
+
+        byte_lanes operator+(const byte_lanes a, const byte_lanes b)
+        {
+            return {_mm_add_epi8(a.low, b.low), _mm_add_epi8(a.high, b.high)};
+        }
+
+        byte_lanes operator-(const byte_lanes a, const byte_lanes b)
+        {
+            return {_mm_sub_epi8(a.low, b.low), _mm_sub_epi8(a.high, b.high)};
+        }
+
+        byte_lanes operator|(const byte_lanes a, const byte_lanes b)
+        {
+            return {_mm_or_si128(a.low, b.low), _mm_or_si128(a.high, b.high)};
+        }
+
+        byte_lanes operator&(const byte_lanes a, const byte_lanes b)
+        {
+            return {_mm_and_si128(a.low, b.low), _mm_and_si128(a.high, b.high)};
+        }
+
+        byte_lanes operator^(const byte_lanes a, const byte_lanes b)
+        {
+            return {_mm_xor_si128(a.low, b.low), _mm_xor_si128(a.high, b.high)};
+        }
+
+        byte_lanes min(const byte_lanes a, const byte_lanes b)
+        {
+            return {_mm_min_epu8(a.low, b.low), _mm_min_epu8(a.high, b.high)};
+        }
+
+        lane_mask equal(const byte_lanes a, const byte_lanes b)
+        {
+            const auto low  = static_cast<lane_mask>(_mm_movemask_epi8(_mm_cmpeq_epi8(a.low, b.low)));
+            const auto high = static_cast<lane_mask>(_mm_movemask_epi8(_mm_cmpeq_epi8(a.high, b.high)));
+            return low | high << 16;
+        }
+
+        static constexpr std::uint64_t BYTE_ONES = 0x0101010101010101;
+
+        // 16 bits of mask spread over 16 bytes of all ones or zeros
+        __m128i spread_bytes(const lane_mask mask)
+        {
+            const auto bits   = _mm_set1_epi64x(static_cast<long long>(0x8040201008040201));
+            const auto spread = _mm_set_epi64x(static_cast<long long>(BYTE_ONES * (mask >> 8 & 0xFF)),
+                                               static_cast<long long>(BYTE_ONES * (mask & 0xFF)));
+            return _mm_cmpeq_epi8(_mm_and_si128(spread, bits), bits);
+        }
+
+        __m128i blend(const __m128i chosen, const __m128i a, const __m128i b)
+        {
+            return _mm_or_si128(_mm_and_si128(chosen, a), _mm_andnot_si128(chosen, b));
+        }
+
+        // Lane n takes a where bit n of mask is set and b elsewhere
+        byte_lanes select(const lane_mask mask, const byte_lanes a, const byte_lanes b)
+        {
+            return {blend(spread_bytes(mask), a.low, b.low), blend(spread_bytes(mask >> 16), a.high, b.high)};
+        }
+
+        // Every lane whose bit is set in mask, of 32 unsigned shorts, is set to value
+        void fill_masked(unsigned short* lanes, const lane_mask mask, const unsigned short value)
+        {
+            const auto bits   = _mm_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128);
+            const auto filled = _mm_set1_epi16(static_cast<short>(value));
+            for(auto quarter = 0; quarter != 4; quarter++)
+            {
+                const auto target = reinterpret_cast<__m128i*>(lanes) + quarter;
+                const auto spread = _mm_set1_epi16(static_cast<short>(mask >> (quarter * 8) & 0xFF));
+                const auto chosen = _mm_cmpeq_epi16(_mm_and_si128(spread, bits), bits);
+                _mm_store_si128(target, blend(chosen, filled, _mm_load_si128(target)));
+            }
+        }
+
+        lane_mask equal(const unsigned short* lanes, const unsigned short value)
+        {
+            const auto wanted = _mm_set1_epi16(static_cast<short>(value));
+            const auto words  = reinterpret_cast<const __m128i*>(lanes);
+
+            lane_mask mask = 0;
+            for(auto half = 0; half != 2; half++)
+            {
+                const auto low  = _mm_cmpeq_epi16(_mm_load_si128(words + half * 2), wanted);
+                const auto high = _mm_cmpeq_epi16(_mm_load_si128(words + half * 2 + 1), wanted);
+                mask |= static_cast<lane_mask>(_mm_movemask_epi8(_mm_packs_epi16(low, high))) << (half * 16);
+            }
+            return mask;
+        }
+#else
+        struct byte_lanes
+        {
+            unsigned char v[MAX_LOCKSTEP_LANES];
+        };
+
+        byte_lanes load_lanes(const unsigned char* lanes)
+        {
+            byte_lanes result;
+            std::memcpy(result.v, lanes, sizeof(result.v));
+            return result;
+        }
+
+        void store_lanes(unsigned char* lanes, const byte_lanes value)
+        {
+            std::memcpy(lanes, value.v, sizeof(value.v));
+        }
+
+        byte_lanes splat(const unsigned char value)
+        {
+            byte_lanes result;
+            std::memset(result.v, value, sizeof(result.v));
+            return result;
+        }
+
+        byte_lanes combine(const byte_lanes a, const byte_lanes b, const auto& f)
+        {
+            byte_lanes result;
+            for(auto lane = 0; lane != MAX_LOCKSTEP_LANES; lane++)
+            {
+                result.v[lane] = static_cast<unsigned char>(f(a.v[lane], b.v[lane]));
+            }
+            return result;
+        }
+
+        byte_lanes operator+(const byte_lanes a, const byte_lanes b)
+        {
+            return combine(a, b, [](const unsigned char x, const unsigned char y) {
+                return x + y;
+            });
+        }
+
+        byte_lanes operator-(const byte_lanes a, const byte_lanes b)
+        {
+            return combine(a, b, [](const unsigned char x, const unsigned char y) {
+                return x - y;
+            });
+        }
+
+        byte_lanes operator|(const byte_lanes a, const byte_lanes b)
+        {
+            return combine(a, b, [](const unsigned char x, const unsigned char y) {
+                return x | y;
+            });
+        }
+
+        byte_lanes operator&(const byte_lanes a, const byte_lanes b)
+        {
+            return combine(a, b, [](const unsigned char x, const unsigned char y) {
+                return x & y;
+            });
+        }
+
+        byte_lanes operator^(const byte_lanes a, const byte_lanes b)
+        {
+            return combine(a, b, [](const unsigned char x, const unsigned char y) {
+                return x ^ y;
+            });
+        }
+
+        byte_lanes min(const byte_lanes a, const byte_lanes b)
+        {
+            return combine(a, b, [](const unsigned char x, const unsigned char y) {
+                return std::min(x, y);
+            });
+        }
+
+        lane_mask equal(const byte_lanes a, const byte_lanes b)
+        {
+            lane_mask mask = 0;
+            for(auto lane = 0; lane != MAX_LOCKSTEP_LANES; lane++)
+            {
+                mask |= static_cast<lane_mask>(a.v[lane] == b.v[lane]) << lane;
+            }
+            return mask;
+        }
+
+        // Lane n takes a where bit n of mask is set and b elsewhere
+        byte_lanes select(const lane_mask mask, const byte_lanes a, const byte_lanes b)
+        {
+            byte_lanes result;
+            for(auto lane = 0; lane != MAX_LOCKSTEP_LANES; lane++)
+            {
+                result.v[lane] = (mask >> lane & 1) != 0 ? a.v[lane] : b.v[lane];
+            }
+            return result;
+        }
+
+        // Every lane whose bit is set in mask, of 32 unsigned shorts, is set to value
+        void fill_masked(unsigned short* lanes, const lane_mask mask, const unsigned short value)
+        {
+            for(auto lane = 0; lane != MAX_LOCKSTEP_LANES; lane++)
+            {
+                lanes[lane] = (mask >> lane & 1) != 0 ? value : lanes[lane];
+            }
+        }
+
+        lane_mask equal(const unsigned short* lanes, const unsigned short value)
+        {
+            lane_mask mask = 0;
+            for(auto lane = 0; lane != MAX_LOCKSTEP_LANES; lane++)
+            {
+                mask |= static_cast<lane_mask>(lanes[lane] == value) << lane;
+            }
+            return mask;
+        }
+#endif
+
+        static constexpr lane_mask ALL_LANES = ~lane_mask{0};
+
+        // A lane group that covers every lane stores without blending, which is the common converged case
+        void store_lanes(unsigned char* lanes, const lane_mask mask, const byte_lanes value)
+        {
+            store_lanes(lanes, mask == ALL_LANES ? value : select(mask, value, load_lanes(lanes)));
+        }
+
+        void fill(unsigned short* lanes, const lane_mask mask, const unsigned short value)
+        {
+            if(mask == ALL_LANES)
+            {
+                std::fill_n(lanes, MAX_LOCKSTEP_LANES, value);
+            }
+            else if(mask != 0)
+            {
+                fill_masked(lanes, mask, value);
+            }
+        }
+
+        // Calls f with the index of every lane in mask, lowest first
+        void for_each_lane(lane_mask mask, const auto& f)
+        {
+            for(; mask != 0; mask &= mask - 1)
+            {
+                f(static_cast<unsigned>(std::countr_zero(mask)));
+            }
+        }
+    } // namespace
+
+    const char* lockstep_instruction_set()
+    {
+#if CHIP8_LOCKSTEP_SIMD == 2
+        return "avx2";
+#elif CHIP8_LOCKSTEP_SIMD == 1
+        return "sse2";
+#else
+        return "scalar";
+#endif
+    }
+
+    double lockstep_stats::occupancy() const
+    {
+        if(steps == 0)
+        {
+            return 0;
+        }
+        return static_cast<double>(instructions) / static_cast<double>(steps);
+    }
+
+    lockstep_machines::lockstep_machines(const unsigned lane_count)
+        : lanes(lane_count)
+    {
+        if(lane_count == 0 || lane_count > MAX_LOCKSTEP_LANES)
+        {
+            throw std::invalid_argument("Lockstep runs between 1 and " + std::to_string(MAX_LOCKSTEP_LANES) +
+                                        " lanes");
+        }
+        used_lanes = lane_count == MAX_LOCKSTEP_LANES ? ~lane_mask{0} : (lane_mask{1} << lane_count) - 1;
+
+        // Every lane starts out the way machine::init() leaves a machine
+        std::memset(V, 0, sizeof(V));
+        std::memset(I, 0, sizeof(I));
+        std::fill(std::begin(pc), std::end(pc), static_cast<unsigned short>(PROGRAM_OFFSET));
+        std::memset(sp, 0, sizeof(sp));
+        std::memset(stack, 0, sizeof(stack));
+        std::memset(executed, 0, sizeof(executed));
+        std::memset(keys, 0, sizeof(keys));
+        std::fill(std::begin(pending_key), std::end(pending_key), -1);
+        std::fill(std::begin(delay), std::end(delay), timer{});
+        std::fill(std::begin(sound), std::end(sound), timer{});
+        std::fill(std::begin(faults), std::end(faults), nullptr);
+        std::memset(frame_base, 0, sizeof(frame_base));
+        std::memset(cycle_base, 0, sizeof(cycle_base));
+        std::memset(gfx, 0, sizeof(gfx));
+        for(auto& lane_memory : memory)
+        {
+            std::memset(lane_memory, 0, sizeof(lane_memory));
+            std::memcpy(lane_memory, chip8_fontset, sizeof(chip8_fontset));
+        }
+        std::fill(std::begin(decoded), std::end(decoded), decoded_instruction{op::undecoded, 0, 0, 0, 0});
+        std::memset(stored_to, 0, sizeof(stored_to));
+    }
+
+    unsigned lockstep_machines::lane_count() const
+    {
+        return lanes;
+    }
+
+    void lockstep_machines::load(const unsigned char* data, const std::size_t size)
+    {
+        if(size > MAX_ROM_SIZE)
+        {
+            throw std::invalid_argument("ROM of " + std::to_string(size) + " bytes is larger than " +
+                                        std::to_string(MAX_ROM_SIZE));
+        }
+
+        for(auto& lane_memory : memory)
+        {
+            std::memcpy(&lane_memory[PROGRAM_OFFSET], data, size);
+        }
+
+        // Every lane holds the same bytes there again
+        std::fill_n(&stored_to[PROGRAM_OFFSET], size, false);
+        for(auto address = PROGRAM_OFFSET - 1; address < PROGRAM_OFFSET + static_cast<int>(size); address++)
+        {
+            decoded[address].handler = op::undecoded;
+        }
+    }
+
+    void lockstep_machines::seed(const unsigned lane, const std::uint64_t value)
+    {
+        random[lane].reseed(value);
+    }
+
+    void lockstep_machines::set_cycles_per_frame(const unsigned cycles)
+    {
+        if(cycles == 0)
+        {
+            throw std::invalid_argument("A frame needs at least one cycle");
+        }
+
+        for(unsigned lane = 0; lane != lanes; lane++)
+        {
+            frame_base[lane] = current_frame(lane, executed[lane]);
+            cycle_base[lane] = executed[lane];
+        }
+        frame_cycles = cycles;
+    }
+
+    void lockstep_machines::set_quirks(const quirk_profile profile)
+    {
+        if(flags_of(profile).mode != machine_mode::chip8)
+        {
+            throw std::invalid_argument(std::string("Lanes cannot run the ") + quirk_profile_name(profile) +
+                                        " profile");
+        }
+        quirks       = flags_of(profile);
+        sprite_edges = quirks.edge;
+    }
+
+    void lockstep_machines::set_sprite_edge(const sprite_edge edge)
+    {
+        sprite_edges = edge;
+    }
+
+    void lockstep_machines::on_key_down(const unsigned lane, const int key_index)
+    {
+        const auto at = pc[lane];
+        if(pending_key[lane] < 0 && at + 1 < MEMORY_SIZE && (memory[lane][at] & 0xF0) == 0xF0 &&
+           memory[lane][at + 1] == 0x0A)
+        {
+            pending_key[lane] = static_cast<signed char>(key_index);
+        }
+        keys[lane] |= static_cast<std::uint16_t>(1 << key_index);
+    }
+
+    void lockstep_machines::on_key_up(const unsigned lane, const int key_index)
+    {
+        keys[lane] &= static_cast<std::uint16_t>(~(1 << key_index));
+    }
+
+    std::uint64_t lockstep_machines::instruction_count(const unsigned lane) const
+    {
+        return executed[lane];
+    }
+
+    const display_rows& lockstep_machines::display(const unsigned lane) const
+    {
+        return gfx[lane];
+    }
+
+    std::uint64_t lockstep_machines::frame_hash(const unsigned lane) const
+    {
+        return hash_rows(gfx[lane]);
+    }
+
+    std::uint64_t lockstep_machines::register_hash(const unsigned lane) const
+    {
+        const auto fold = [](std::uint64_t hash, const std::uint64_t word) {
+            hash = (hash ^ word) * 0xFF51AFD7ED558CCD;
+            return hash ^ hash >> 32;
+        };
+
+        std::uint64_t hash = 0x9E3779B97F4A7C15;
+        for(unsigned i = 0; i != REGISTER_COUNT; i += 8)
+        {
+            std::uint64_t word = 0;
+            for(unsigned j = 0; j != 8; j++)
+            {
+                word |= std::uint64_t{V[i + j][lane]} << j * 8;
+            }
+            hash = fold(hash, word);
+        }
+        hash = fold(hash, std::uint64_t{I[lane]} | std::uint64_t{pc[lane]} << 16 | std::uint64_t{sp[lane]} << 32 |
+                              std::uint64_t{timer_value(lane, delay[lane], executed[lane])} << 40 |
+                              std::uint64_t{timer_value(lane, sound[lane], executed[lane])} << 48);
+        for(unsigned i = 0; i != sp[lane]; i++)
+        {
+            hash = fold(hash, stack[lane][i]);
+        }
+        return hash;
+    }
+
+    const char* lockstep_machines::fault(const unsigned lane) const
+    {
+        return faults[lane];
+    }
+
+    lane_mask lockstep_machines::faulted_lanes() const
+    {
+        return faulted;
+    }
+
+    const lockstep_stats& lockstep_machines::stats() const
+    {
+        return counters;
+    }
+
+    std::uint64_t lockstep_machines::current_frame(const unsigned lane, const std::uint64_t count) const
+    {
+        return frame_base[lane] + (count - cycle_base[lane]) / frame_cycles;
+    }
+
+    unsigned char lockstep_machines::timer_value(const unsigned lane, const timer& countdown,
+                                                 const std::uint64_t count) const
+    {
+        const auto elapsed = current_frame(lane, count) - countdown.set_in_frame;
+        return static_cast<unsigned char>(elapsed >= countdown.value ? 0 : countdown.value - elapsed);
+    }
+
+    lane_mask lockstep_machines::fail(const lane_mask failing, const char* message)
+    {
+        for_each_lane(failing, [this, message](const unsigned lane) {
+            faults[lane] = message;
+        });
+        faulted |= failing;
+        return failing;
+    }
+
+    void lockstep_machines::store_byte(const unsigned lane, const unsigned address, const unsigned char value)
+    {
+        memory[lane][address] = value;
+        stored_to[address]    = true;
+    }
+
+    lane_mask lockstep_machines::lanes_at(const lane_mask candidates, const unsigned at,
+                                          const decoded_instruction*& instruction)
+    {
+        const auto group = equal(pc, static_cast<unsigned short>(at)) & candidates;
+        if(at + 1 >= MEMORY_SIZE)
+        {
+            instruction = nullptr;
+            return group;
+        }
+
+        if(stored_to[at] == false && stored_to[at + 1] == false)
+        {
+            auto& shared = decoded[at];
+            if(shared.handler == op::undecoded)
+            {
+                const auto& bytes = memory[std::countr_zero(group)];
+                shared            = decode(static_cast<opcode_t>(bytes[at] << 8 | bytes[at + 1]));
+            }
+            instruction = &shared;
+            return group;
+        }
+
+        // Lanes may have stored different code here. Only those holding the first lane's opcode go together.
+        const auto first  = static_cast<unsigned>(std::countr_zero(group));
+        const auto opcode = memory[first][at] << 8 | memory[first][at + 1];
+
+        lane_mask same = 0;
+        for_each_lane(group, [this, at, opcode, &same](const unsigned lane) {
+            same |= static_cast<lane_mask>((memory[lane][at] << 8 | memory[lane][at + 1]) == opcode) << lane;
+        });
+        stored_instruction = decode(static_cast<opcode_t>(opcode));
+        instruction        = &stored_instruction;
+        return same;
+    }
+
+    void lockstep_machines::run_cycles(const std::uint64_t cycles)
+    {
+        std::uint64_t target[MAX_LOCKSTEP_LANES];
+        for(unsigned lane = 0; lane != lanes; lane++)
+        {
+            target[lane] = executed[lane] + cycles;
+        }
+
+        auto active = cycles == 0 ? 0 : used_lanes & ~faulted;
+        while(active != 0)
+        {
+            const decoded_instruction* instruction;
+
+            // Converged: every active lane sits at the same pc and they run together until one finishes, faults or
+            // branches away. Their instruction counts are brought up to date once the run ends.
+            const auto first = static_cast<unsigned>(std::countr_zero(active));
+            if(lanes_at(active, pc[first], instruction) == active)
+            {
+                auto budget = std::numeric_limits<std::uint64_t>::max();
+                for_each_lane(active, [&budget, &target, this](const unsigned lane) {
+                    budget = std::min(budget, target[lane] - executed[lane]);
+                });
+
+                std::uint64_t done = 0;
+                lane_mask failed   = 0;
+                while(done != budget && lanes_at(active, pc[first], instruction) == active)
+                {
+                    if(instruction == nullptr)
+                    {
+                        failed = fail(active, "Program counter outside of memory range");
+                        break;
+                    }
+
+                    failed = execute(active, pc[first], *instruction, done);
+                    counters.steps++;
+                    counters.instructions += std::popcount(active & ~failed);
+                    if(failed != 0)
+                    {
+                        break;
+                    }
+                    done++;
+                }
+
+                for_each_lane(active, [this, done, failed](const unsigned lane) {
+                    executed[lane] += done + ((failed >> lane & 1) == 0 && failed != 0 ? 1 : 0);
+                });
+                active &= ~failed;
+            }
+            else
+            {
+                // Diverged: the lane furthest behind goes next, the lowest pc among equals, so that a lane that
+                // skipped ahead waits for the others to catch up with it
+                auto leader = first;
+                for_each_lane(active, [&leader, this](const unsigned lane) {
+                    if(executed[lane] < executed[leader] ||
+                       (executed[lane] == executed[leader] && pc[lane] < pc[leader]))
+                    {
+                        leader = lane;
+                    }
+                });
+
+                const auto at    = pc[leader];
+                const auto group = lanes_at(active, at, instruction);
+                const auto failed =
+                    instruction == nullptr ? fail(group, "Program counter outside of memory range")
+                                           : execute(group, at, *instruction, 0);
+                counters.steps++;
+                counters.instructions += std::popcount(group & ~failed);
+
+                for_each_lane(group & ~failed, [this](const unsigned lane) {
+                    executed[lane]++;
+                });
+                active &= ~failed;
+            }
+
+            for_each_lane(active, [&active, &target, this](const unsigned lane) {
+                if(executed[lane] == target[lane])
+                {
+                    active &= ~(lane_mask{1} << lane);
+                }
+            });
+        }
+    }
+
+    lane_mask lockstep_machines::execute(const lane_mask group, const unsigned at,
+                                         const decoded_instruction& instruction, const std::uint64_t uncounted)
+    {
+        const auto x  = instruction.x;
+        const auto y  = instruction.y;
+        const auto nn = instruction.nn;
+
+        const auto next = static_cast<unsigned short>(at + 2);
+        const auto skip = static_cast<unsigned short>(at + 4);
+
+        // Ops that only touch registers may write every lane once group holds all the lanes in use, which skips the
+        // blend. The lanes beyond lane_count() are never read, and a group of every lane in use has no faulted lane.
+        const auto wide = group == used_lanes ? ALL_LANES : group;
+
+        // Skips move the lanes that take them two instructions on and the rest one
+        const auto branch = [this, wide, next, skip](const lane_mask taken) {
+            fill(pc, wide & ~taken, next);
+            fill(pc, wide & taken, skip);
+        };
+
+        lane_mask failed = 0;
+        switch(instruction.handler)
+        {
+            case op::clear_screen:
+                for_each_lane(group, [this](const unsigned lane) {
+                    clear_rows(gfx[lane]);
+                });
+                fill(pc, group, next);
+                break;
+            case op::return_from_subroutine:
+                for_each_lane(group, [this, &failed](const unsigned lane) {
+                    if(sp[lane] == 0)
+                    {
+                        failed |= fail(lane_mask{1} << lane,
+                                       "Stack pointer decremented to outside the range of the stack");
+                        return;
+                    }
+                    sp[lane]--;
+                    pc[lane] = static_cast<unsigned short>(stack[lane][sp[lane]] + 2);
+                });
+                break;
+            case op::jump_to:
+                fill(pc, group, instruction.nnn);
+                break;
+            case op::call_func:
+                for_each_lane(group, [this, at, &failed](const unsigned lane) {
+                    if(sp[lane] >= STACK_SIZE)
+                    {
+                        failed |= fail(lane_mask{1} << lane,
+                                       "Stack pointer incremented to outside the range of the stack");
+                        return;
+                    }
+                    stack[lane][sp[lane]++] = static_cast<stack_entry_t>(at);
+                });
+                fill(pc, group & ~failed, instruction.nnn);
+                break;
+            case op::jump_if_equal:
+                branch(equal(load_lanes(V[x]), splat(nn)));
+                break;
+            case op::jump_if_not_equal:
+                branch(~equal(load_lanes(V[x]), splat(nn)));
+                break;
+            case op::jump_if_registers_equal:
+                branch(equal(load_lanes(V[x]), load_lanes(V[y])));
+                break;
+            case op::jump_if_registers_not_equal:
+                branch(~equal(load_lanes(V[x]), load_lanes(V[y])));
+                break;
+            case op::set_register_to_value:
+                store_lanes(V[x], wide, splat(nn));
+                fill(pc, wide, next);
+                break;
+            case op::add_assign_register_to_value:
+                store_lanes(V[x], wide, load_lanes(V[x]) + splat(nn));
+                fill(pc, wide, next);
+                break;
+            case op::assign_register:
+                store_lanes(V[x], wide, load_lanes(V[y]));
+                fill(pc, wide, next);
+                break;
+            case op::or_assign_register:
+                store_lanes(V[x], wide, load_lanes(V[x]) | load_lanes(V[y]));
+                if(quirks.logic_resets_vf)
+                {
+                    store_lanes(V[15], wide, splat(0));
+                }
+                fill(pc, wide, next);
+                break;
+            case op::and_assign_register:
+                store_lanes(V[x], wide, load_lanes(V[x]) & load_lanes(V[y]));
+                if(quirks.logic_resets_vf)
+                {
+                    store_lanes(V[15], wide, splat(0));
+                }
+                fill(pc, wide, next);
+                break;
+            case op::xor_assign_register:
+                store_lanes(V[x], wide, load_lanes(V[x]) ^ load_lanes(V[y]));
+                if(quirks.logic_resets_vf)
+                {
+                    store_lanes(V[15], wide, splat(0));
+                }
+                fill(pc, wide, next);
+                break;
+            case op::add_assign_register:
+            {
+                // The sum wrapped where it came out below the first operand. VF is written last, as in machine.
+                const auto a   = load_lanes(V[x]);
+                const auto sum = a + load_lanes(V[y]);
+                store_lanes(V[x], wide, sum);
+                store_lanes(V[15], wide, select(equal(min(sum, a), a), splat(0), splat(1)));
+                fill(pc, wide, next);
+                break;
+            }
+            case op::subtract_assign_register:
+            {
+                const auto a = load_lanes(V[x]);
+                const auto b = load_lanes(V[y]);
+                store_lanes(V[x], wide, a - b);
+                store_lanes(V[15], wide, select(equal(min(a, b), b), splat(1), splat(0)));
+                fill(pc, wide, next);
+                break;
+            }
+            case op::shift_right_assign_register:
+            case op::shift_left_assign_register:
+            {
+                const auto source = quirks.shift_reads_vy ? y : x;
+                const bool right  = instruction.handler == op::shift_right_assign_register;
+                for_each_lane(group, [this, x, source, right](const unsigned lane) {
+                    const auto value = V[source][lane];
+                    V[x][lane]       = static_cast<register_t>(right ? value >> 1 : value << 1);
+                    V[15][lane]      = static_cast<register_t>(right ? value & 1 : value >> 7);
+                });
+                fill(pc, group, next);
+                break;
+            }
+            case op::reverse_subtract_assign_register:
+            {
+                const auto a = load_lanes(V[x]);
+                const auto b = load_lanes(V[y]);
+                store_lanes(V[x], wide, b - a);
+                store_lanes(V[15], wide, select(equal(min(a, b), a), splat(1), splat(0)));
+                fill(pc, wide, next);
+                break;
+            }
+            case op::assign_address_register:
+                fill(I, wide, instruction.nnn);
+                fill(pc, wide, next);
+                break;
+            case op::jump_to_address:
+            {
+                const auto offset = quirks.jump_reads_vx ? x : 0;
+                for_each_lane(group, [this, offset, &instruction](const unsigned lane) {
+                    pc[lane] = static_cast<unsigned short>(V[offset][lane] + instruction.nnn);
+                });
+                break;
+            }
+            case op::set_register_to_bitwise_and_of_random:
+                for_each_lane(group, [this, x, nn](const unsigned lane) {
+                    V[x][lane] = static_cast<register_t>(static_cast<register_t>(random[lane].next() >> 56) & nn);
+                });
+                fill(pc, group, next);
+                break;
+            case op::draw_sprite:
+                for_each_lane(group, [this, x, y, nn, &failed](const unsigned lane) {
+                    const unsigned height = nn & 0x0F;
+                    if(I[lane] + height > MEMORY_SIZE)
+                    {
+                        failed |= fail(lane_mask{1} << lane, "Pointing out of memory range");
+                        return;
+                    }
+
+                    row_mask changed = 0;
+                    V[15][lane]      = draw_sprite_rows(gfx[lane], V[x][lane], V[y][lane], &memory[lane][I[lane]],
+                                                        height, sprite_edges, changed);
+                });
+                fill(pc, group & ~failed, next);
+                break;
+            case op::jump_if_key_pressed:
+            case op::jump_if_key_not_pressed:
+            {
+                lane_mask pressed = 0;
+                for_each_lane(group, [this, x, &pressed](const unsigned lane) {
+                    pressed |= static_cast<lane_mask>(keys[lane] >> (V[x][lane] & 0xF) & 1) << lane;
+                });
+                branch(instruction.handler == op::jump_if_key_pressed ? pressed : ~pressed);
+                break;
+            }
+            case op::wait_for_key_press:
+                // Lanes without a key pressed during the wait stay where they are
+                for_each_lane(group, [this, x, next](const unsigned lane) {
+                    if(pending_key[lane] >= 0)
+                    {
+                        V[x][lane]        = static_cast<register_t>(pending_key[lane]);
+                        pending_key[lane] = -1;
+                        pc[lane]          = next;
+                    }
+                });
+                break;
+            case op::set_register_to_delay_timer:
+                for_each_lane(group, [this, x, uncounted](const unsigned lane) {
+                    V[x][lane] = timer_value(lane, delay[lane], executed[lane] + uncounted);
+                });
+                fill(pc, group, next);
+                break;
+            case op::set_delay_timer_to_register:
+            case op::set_sound_timer_to_register:
+            {
+                auto& countdowns = instruction.handler == op::set_delay_timer_to_register ? delay : sound;
+                for_each_lane(group, [this, x, uncounted, &countdowns](const unsigned lane) {
+                    countdowns[lane] = {V[x][lane], current_frame(lane, executed[lane] + uncounted)};
+                });
+                fill(pc, group, next);
+                break;
+            }
+            case op::add_assign_address_register:
+                for_each_lane(group, [this, x](const unsigned lane) {
+                    I[lane] = static_cast<unsigned short>(I[lane] + V[x][lane]);
+                });
+                fill(pc, group, next);
+                break;
+            case op::set_memory_address_to_character_sprite_address:
+                for_each_lane(group, [this, x](const unsigned lane) {
+                    I[lane] = static_cast<unsigned short>((V[x][lane] & 0xF) * 5);
+                });
+                fill(pc, group, next);
+                break;
+            case op::store_bcd:
+                for_each_lane(group, [this, x, &failed](const unsigned lane) {
+                    const unsigned address = I[lane];
+                    if(address + 2 >= MEMORY_SIZE)
+                    {
+                        failed |= fail(lane_mask{1} << lane, "Pointing out of memory range");
+                        return;
+                    }
+
+                    const auto value = V[x][lane];
+                    store_byte(lane, address, static_cast<unsigned char>(value / 100));
+                    store_byte(lane, address + 1, static_cast<unsigned char>(value / 10 % 10));
+                    store_byte(lane, address + 2, static_cast<unsigned char>(value % 10));
+                });
+                fill(pc, group & ~failed, next);
+                break;
+            case op::fill_memory_with_registers:
+                for_each_lane(group, [this, x, &failed](const unsigned lane) {
+                    const unsigned address = I[lane];
+                    if(address + x >= MEMORY_SIZE)
+                    {
+                        failed |= fail(lane_mask{1} << lane, "Pointing out of memory range");
+                        return;
+                    }
+                    for(unsigned i = 0; i <= x; i++)
+                    {
+                        store_byte(lane, address + i, V[i][lane]);
+                    }
+                    if(quirks.load_store_advances_i)
+                    {
+                        I[lane] = static_cast<unsigned short>(address + x + 1);
+                    }
+                });
+                fill(pc, group & ~failed, next);
+                break;
+            case op::fill_registers_with_memory:
+                for_each_lane(group, [this, x, &failed](const unsigned lane) {
+                    const unsigned address = I[lane];
+                    if(address + x >= MEMORY_SIZE)
+                    {
+                        failed |= fail(lane_mask{1} << lane, "Pointing out of memory range");
+                        return;
+                    }
+                    for(unsigned i = 0; i <= x; i++)
+                    {
+                        V[i][lane] = memory[lane][address + i];
+                    }
+                    if(quirks.load_store_advances_i)
+                    {
+                        I[lane] = static_cast<unsigned short>(address + x + 1);
+                    }
+                });
+                fill(pc, group & ~failed, next);
+                break;
+            // Lanes only run in the CHIP-8 mode, where the instructions of the others are unsupported
+            case op::scroll_down:
+            case op::scroll_up:
+            case op::scroll_right:
+            case op::scroll_left:
+            case op::exit_interpreter:
+            case op::set_low_resolution:
+            case op::set_high_resolution:
+            case op::save_register_range:
+            case op::load_register_range:
+            case op::assign_long_address_register:
+            case op::select_planes:
+            case op::load_audio_pattern:
+            case op::set_memory_address_to_big_sprite_address:
+            case op::set_pitch_to_register:
+            case op::store_flags:
+            case op::load_flags:
+            case op::undecoded:
+            case op::unsupported:
+            case op::set_register_and_draw:
+            case op::add_and_jump_if_equal:
+            case op::add_and_jump_if_not_equal:
+            case op::count:
+                // decode() never produces the fused ops, they only come out of the block cache
+                failed = fail(group, "Unsupported operation");
+                break;
+        }
+        return failed;
+    }
+} // namespace chip8
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "chip8.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace chip8
+{
+    static constexpr auto MAX_LOCKSTEP_LANES = 32;
+
+    // One bit per lane, bit n for lane n
+    using lane_mask = std::uint32_t;
+
+    struct lockstep_stats
+    {
+        std::uint64_t steps        = 0; // Instructions issued, each to every lane whose pc agreed
+        std::uint64_t instructions = 0; // Instructions retired, summed over the lanes
+
+        // Lanes served per step on average, the lane count for lanes that never diverge
+        double occupancy() const;
+    };
+
+    // "avx2", "sse2" or "scalar": what the build executes lanes with
+    const char* lockstep_instruction_set();
+
+    // Up to MAX_LOCKSTEP_LANES machines running the same ROM side by side, for searches and fuzzing that run one
+    // program under many seeds or inputs. Registers, I and pc are stored lane by lane so that one decoded instruction
+    // executes at once on every lane whose pc agrees, in vector registers where the build has them: AVX2 with
+    // CHIP8_AVX2, SSE2 on any other x86-64 and plain loops elsewhere. Lanes that diverge are masked off and run in
+    // steps of their own until their pcs meet again.
+    //
+    // Every lane computes exactly what a machine with the same seed and keys would. A lane that faults stops with
+    // the message the machine would have thrown, and the other lanes carry on.
+    class lockstep_machines
+    {
+    public:
+        explicit lockstep_machines(const unsigned lane_count);
+
+        lockstep_machines(const lockstep_machines&)            = delete;
+        lockstep_machines& operator=(const lockstep_machines&) = delete;
+
+        unsigned lane_count() const;
+
+        // Loads the same ROM into every lane. Throws std::invalid_argument for one larger than MAX_ROM_SIZE.
+        void load(const unsigned char* data, const std::size_t size);
+        void seed(const unsigned lane, const std::uint64_t value);
+        void set_cycles_per_frame(const unsigned cycles);
+        // Like machine::set_quirks(), for every lane. Lanes only have the CHIP-8 mode, the profiles of the others
+        // throw std::invalid_argument.
+        void set_quirks(const quirk_profile profile);
+        void set_sprite_edge(const sprite_edge edge);
+        void on_key_down(const unsigned lane, const int key_index);
+        void on_key_up(const unsigned lane, const int key_index);
+
+        // Runs every lane that has not faulted for cycles more instructions
+        void run_cycles(const std::uint64_t cycles);
+
+        std::uint64_t instruction_count(const unsigned lane) const;
+        const display_rows& display(const unsigned lane) const;
+        std::uint64_t frame_hash(const unsigned lane) const;
+        // What machine::register_hash() gives for a machine in the lane's state
+        std::uint64_t register_hash(const unsigned lane) const;
+        // Null while the lane runs, what a machine would have thrown once it faulted
+        const char* fault(const unsigned lane) const;
+        lane_mask faulted_lanes() const;
+        const lockstep_stats& stats() const;
+
+    private:
+        struct timer
+        {
+            unsigned char value;
+            std::uint64_t set_in_frame;
+        };
+
+        // Executes instruction, which starts at pc, on every lane of group and returns the lanes that faulted.
+        // uncounted is how many instructions the lanes of group have retired that executed does not hold yet.
+        lane_mask execute(const lane_mask group, const unsigned pc, const decoded_instruction& instruction,
+                          const std::uint64_t uncounted);
+        // The lanes of candidates whose pc is pc and whose opcode there is the one decoded for them
+        lane_mask lanes_at(const lane_mask candidates, const unsigned pc, const decoded_instruction*& instruction);
+        lane_mask fail(const lane_mask lanes, const char* message);
+        void store_byte(const unsigned lane, const unsigned address, const unsigned char value);
+        std::uint64_t current_frame(const unsigned lane, const std::uint64_t executed) const;
+        unsigned char timer_value(const unsigned lane, const timer& countdown, const std::uint64_t executed) const;
+
+        alignas(CACHE_LINE_SIZE) register_t V[REGISTER_COUNT][MAX_LOCKSTEP_LANES];
+        alignas(CACHE_LINE_SIZE) unsigned short I[MAX_LOCKSTEP_LANES];
+        alignas(CACHE_LINE_SIZE) unsigned short pc[MAX_LOCKSTEP_LANES];
+
+        unsigned lanes;
+        lane_mask used_lanes;
+        lane_mask faulted = 0;
+        lockstep_stats counters;
+
+        unsigned char sp[MAX_LOCKSTEP_LANES];
+        stack_entry_t stack[MAX_LOCKSTEP_LANES][STACK_SIZE];
+        std::uint64_t executed[MAX_LOCKSTEP_LANES];
+        std::uint16_t keys[MAX_LOCKSTEP_LANES];      // Bit k while key k is held
+        signed char pending_key[MAX_LOCKSTEP_LANES]; // Pressed while FX0A waited, -1 when none
+        timer delay[MAX_LOCKSTEP_LANES];
+        timer sound[MAX_LOCKSTEP_LANES];
+        xoshiro256 random[MAX_LOCKSTEP_LANES];
+        const char* faults[MAX_LOCKSTEP_LANES];
+
+        unsigned frame_cycles = DEFAULT_CYCLES_PER_FRAME;
+        std::uint64_t frame_base[MAX_LOCKSTEP_LANES];
+        std::uint64_t cycle_base[MAX_LOCKSTEP_LANES];
+
+        // Looked up per instruction, which every lane of a group shares
+        quirk_flags quirks       = flags_of(DEFAULT_QUIRKS);
+        sprite_edge sprite_edges = sprite_edge::clip;
+        display_rows gfx[MAX_LOCKSTEP_LANES];
+
+        unsigned char memory[MAX_LOCKSTEP_LANES][MEMORY_SIZE];
+        // Decoded once for all lanes. Addresses a lane has stored to since they were loaded may differ between
+        // lanes and are decoded per step instead.
+        decoded_instruction decoded[MEMORY_SIZE];
+        bool stored_to[MEMORY_SIZE];
+        decoded_instruction stored_instruction;
+    };
+} // namespace chip8
@@ -1,21 +1,68 @@
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_init.h>
 #include <SDL3/SDL_main.h>
+#include <algorithm>
+#include <bit>
+#include <charconv>
 #include <cmath>
+#include <cstring>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <string_view>
+#include <vector>
 
+#include "audio.h"
 #include "chip8.h"
+#include "emulation_thread.h"
+#include "profile.h"
+#include "replay.h"
+#include "rewind.h"
 
 constexpr uint32_t windowStartWidth  = 1280;
 constexpr uint32_t windowStartHeight = 640;
 
+// Holding backspace rewinds up to five minutes of play, one frame per frame
+constexpr size_t rewindArenaSize = 16 * 1024 * 1024;
+constexpr size_t rewindMaxFrames = 5 * 60 * 60;
+
+// Small device buffers keep a beep within a few milliseconds of its instruction. Spans due further ahead than two
+// frames mean the device clock fell behind emulated time, and they are pulled forward.
+constexpr const char* audioBufferFrames = "256";
+constexpr Uint64 audioMaxLead           = chip8::AUDIO_SAMPLE_RATE / chip8::FRAMES_PER_SECOND * 2;
+
 bool show_demo_window    = true;
 bool show_another_window = false;
 
+// XRGB8888 colours of lit and unlit pixels, overridden with --palette RRGGBB,RRGGBB. XO-CHIP adds colours for a
+// pixel lit on the second plane only and on both.
+struct Palette
+{
+    Uint32 lit    = 0xFFFFFF;
+    Uint32 unlit  = 0x000000;
+    Uint32 second = 0xFF6600;
+    Uint32 both   = 0x662200;
+};
+
 struct AppContext
 {
     SDL_Window* window;
     SDL_Renderer* renderer;
-    SDL_AppResult app_quit = SDL_APP_CONTINUE;
+    SDL_Texture* screen; // The whole display at one texel per pixel, scaled up by SDL
+    Palette palette;
+    SDL_AppResult app_quit   = SDL_APP_CONTINUE;
+    chip8::row_mask stale    = chip8::ALL_ROWS; // Rows of the texture never written since it was created
+    bool needs_present       = true;            // The window lost its contents, present even if nothing changed
+    Uint64 seed              = 0;
+    const char* record_path  = nullptr;         // Where the session's replay goes on quit
+    const char* profile_path = nullptr;         // Where the profile goes on quit, in builds with CHIP8_PROFILE
+    std::vector<chip8::input_event> input_log{};
+    chip8::rewind_buffer history{rewindArenaSize, rewindMaxFrames};
+    // Runs the default machine at 60 Hz and owns it and history until stopped
+    std::unique_ptr<chip8::emulation_thread> emulation{};
+    // Plays the sound timer, null when there is no audio device
+    SDL_AudioStream* audio = nullptr;
+    std::unique_ptr<chip8::square_wave> beep{};
 };
 
 SDL_AppResult SDL_Fail()
@@ -24,8 +71,117 @@ SDL_AppResult SDL_Fail()
     return SDL_APP_FAILURE;
 }
 
+// Runs on SDL's audio thread whenever the device wants more samples
+static void SDLCALL FeedAudio(void* appstate, SDL_AudioStream* stream, int additional_amount, int)
+{
+    auto* app = static_cast<AppContext*>(appstate);
+
+    chip8::sound_span spans[64];
+    while(const auto count = app->emulation->take_sound(spans, std::size(spans)))
+    {
+        for(size_t i = 0; i != count; i++)
+        {
+            app->beep->add(spans[i]);
+        }
+    }
+
+    Sint16 samples[1024];
+    for(auto left = static_cast<size_t>(additional_amount) / sizeof(Sint16); left != 0;)
+    {
+        const auto count = std::min(left, std::size(samples));
+        app->beep->render(samples, count);
+        SDL_PutAudioStreamData(stream, samples, static_cast<int>(count * sizeof(Sint16)));
+        left -= count;
+    }
+}
+
+static bool ParseColour(const std::string_view text, Uint32& out)
+{
+    const auto end = text.data() + text.size();
+    return text.size() == 6 && std::from_chars(text.data(), end, out, 16).ptr == end;
+}
+
+// The usual layout: the left four columns of the keyboard stand in for the 4x4 keypad
+//   1 2 3 4      1 2 3 C
+//   Q W E R  ->  4 5 6 D
+//   A S D F      7 8 9 E
+//   Z X C V      A 0 B F
+static constexpr SDL_Scancode keypadLayout[chip8::KEY_COUNT] = {
+    SDL_SCANCODE_X, SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3, // 0 1 2 3
+    SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_A, // 4 5 6 7
+    SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_Z, SDL_SCANCODE_C, // 8 9 A B
+    SDL_SCANCODE_4, SDL_SCANCODE_R, SDL_SCANCODE_F, SDL_SCANCODE_V  // C D E F
+};
+
+static int KeypadIndex(const SDL_Scancode code)
+{
+    for(int key = 0; key != chip8::KEY_COUNT; key++)
+    {
+        if(keypadLayout[key] == code)
+        {
+            return key;
+        }
+    }
+    return -1;
+}
+
+static bool ParsePalette(const std::string_view text, Palette& out)
+{
+    const auto comma = text.find(',');
+    return comma != std::string_view::npos && ParseColour(text.substr(0, comma), out.lit) &&
+           ParseColour(text.substr(comma + 1), out.unlit);
+}
+
 SDL_AppResult SDL_AppInit(void** appstate, int argc, char* argv[])
 {
+    // Usage: chip8 [--palette RRGGBB,RRGGBB] [--seed N] [--quirks vip|schip|modern|xochip] [--record FILE]
+    //              [--profile FILE] [rom]
+    // --record writes the session to FILE on quit, for chip8-headless --replay. --profile writes a CSV profile.
+    const char* rom_path     = "C:/Users/tiago.ferreira/Downloads/Pong.ch8";
+    const char* record_path  = nullptr;
+    const char* profile_path = nullptr;
+    Palette palette;
+    Uint64 seed = SDL_GetPerformanceCounter();
+    auto quirks = chip8::DEFAULT_QUIRKS;
+    for(int i = 1; i < argc; i++)
+    {
+        if(std::strcmp(argv[i], "--palette") == 0 && i + 1 < argc && ParsePalette(argv[i + 1], palette))
+        {
+            i++;
+            continue;
+        }
+        if(std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+        {
+            const std::string_view value = argv[i + 1];
+            if(std::from_chars(value.data(), value.data() + value.size(), seed).ptr == value.data() + value.size())
+            {
+                i++;
+                continue;
+            }
+        }
+        if(std::strcmp(argv[i], "--quirks") == 0 && i + 1 < argc && chip8::parse_quirk_profile(argv[i + 1], quirks))
+        {
+            i++;
+            continue;
+        }
+        if(std::strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+        {
+            record_path = argv[++i];
+            continue;
+        }
+        if(std::strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+        {
+            profile_path = argv[++i];
+            continue;
+        }
+        if(argv[i][0] == '-')
+        {
+            SDL_LogError(SDL_LOG_CATEGORY_CUSTOM, "Unknown or incomplete option %s", argv[i]);
+            return SDL_APP_FAILURE;
+        }
+        rom_path = argv[i];
+    }
+
     // create a window
     SDL_Window* window =
         SDL_CreateWindow("SDL Minimal Sample", windowStartWidth, windowStartHeight, SDL_WINDOW_HIGH_PIXEL_DENSITY);
@@ -41,6 +197,20 @@ SDL_AppResult SDL_AppInit(void** appstate, int argc, char* argv[])
         return SDL_Fail();
     }
 
+    // One streaming texture holds the display. SDL stretches it over the window in a single draw, keeping the
+    // aspect ratio and hard pixel edges. The SUPER-CHIP and XO-CHIP modes always get the high resolution.
+    const bool extended = chip8::flags_of(quirks).mode != chip8::machine_mode::chip8;
+    const int width     = extended ? chip8::HIRES_WIDTH : chip8::DRAW_BUFFER_WIDTH;
+    const int height    = extended ? chip8::HIRES_HEIGHT : chip8::DRAW_BUFFER_HEIGHT;
+    SDL_Texture* screen =
+        SDL_CreateTexture(renderer, SDL_PIXELFORMAT_XRGB8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+    if(screen == nullptr)
+    {
+        return SDL_Fail();
+    }
+    SDL_SetTextureScaleMode(screen, SDL_SCALEMODE_NEAREST);
+    SDL_SetRenderLogicalPresentation(renderer, width, height, SDL_LOGICAL_PRESENTATION_LETTERBOX);
+
     // print some information about the window
     SDL_ShowWindow(window);
     {
@@ -57,16 +227,62 @@ SDL_AppResult SDL_AppInit(void** appstate, int argc, char* argv[])
 
     // set up the application data
     *appstate = new AppContext{
-        .window   = window,
-        .renderer = renderer,
+        .window       = window,
+        .renderer     = renderer,
+        .screen       = screen,
+        .palette      = palette,
+        .seed         = seed,
+        .record_path  = record_path,
+        .profile_path = profile_path,
     };
 
     SDL_SetRenderVSync(renderer, -1); // enable vysnc
 
     SDL_Log("Application started successfully!");
 
+    auto* app = static_cast<AppContext*>(*appstate);
     chip8::init();
-    chip8::load("C:/Users/tiago.ferreira/Downloads/Pong.ch8");
+    chip8::default_machine().seed(app->seed);
+    chip8::default_machine().set_quirks(quirks);
+    try
+    {
+        chip8::load(rom_path);
+    }
+    catch(const std::exception& e)
+    {
+        SDL_LogError(SDL_LOG_CATEGORY_CUSTOM, "%s", e.what());
+        return SDL_APP_FAILURE;
+    }
+    if(app->record_path != nullptr)
+    {
+        chip8::default_machine().record_input(&app->input_log);
+    }
+    if(app->profile_path != nullptr)
+    {
+        chip8::default_machine().enable_profile();
+    }
+    const auto cycles_per_second = chip8::default_machine().cycles_per_frame() * double{chip8::FRAMES_PER_SECOND};
+    // Snapshots only hold CHIP-8 machines, so the other modes run without rewind
+    auto* history  = chip8::default_machine().screen() == nullptr ? &app->history : nullptr;
+    app->emulation = std::make_unique<chip8::emulation_thread>(chip8::default_machine(), history);
+
+    // Sound is optional, without an audio device the emulator runs silent
+    app->beep = std::make_unique<chip8::square_wave>(chip8::AUDIO_SAMPLE_RATE, cycles_per_second);
+    app->beep->set_max_lead(audioMaxLead);
+    SDL_SetHint(SDL_HINT_AUDIO_DEVICE_SAMPLE_FRAMES, audioBufferFrames);
+    const SDL_AudioSpec spec = {SDL_AUDIO_S16, 1, chip8::AUDIO_SAMPLE_RATE};
+    if(SDL_InitSubSystem(SDL_INIT_AUDIO))
+    {
+        app->audio = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &spec, FeedAudio, app);
+    }
+    if(app->audio == nullptr)
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_CUSTOM, "No sound: %s", SDL_GetError());
+    }
+    else
+    {
+        SDL_ResumeAudioStreamDevice(app->audio);
+    }
     return SDL_APP_CONTINUE;
 }
 
@@ -84,50 +300,133 @@ SDL_AppResult SDL_AppEvent(void* appstate, SDL_Event* event)
         case SDL_EVENT_QUIT:
             app->app_quit = SDL_APP_SUCCESS;
             return SDL_APP_CONTINUE;
-        case SDL_EVENT_KEY_DOWN:
+        case SDL_EVENT_WINDOW_EXPOSED:
+        case SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED:
+            app->needs_present = true;
             return SDL_APP_CONTINUE;
+        case SDL_EVENT_KEY_DOWN:
         case SDL_EVENT_KEY_UP:
+        {
+            // Events only queue up here, the emulation thread applies them before its next frame
+            using chip8::emulation_event_kind;
+            const bool down = event->type == SDL_EVENT_KEY_DOWN;
+            if(event->key.key == SDLK_BACKSPACE && event->key.repeat == false)
+            {
+                app->emulation->post({down ? emulation_event_kind::rewind_start : emulation_event_kind::rewind_stop});
+            }
+            if(const auto key = KeypadIndex(event->key.scancode); key >= 0 && event->key.repeat == false)
+            {
+                app->emulation->post({down ? emulation_event_kind::key_down : emulation_event_kind::key_up, key});
+            }
             return SDL_APP_CONTINUE;
+        }
         default:
             return SDL_APP_CONTINUE;
     }
 }
 
-SDL_AppResult SDL_AppIterate(void* appstate)
+// The SUPER-CHIP and XO-CHIP modes mark bands of two texture rows, one row of the display in low resolution and two
+// in high. Each run of dirty bands is uploaded with one lock, and only the rows of those bands are expanded.
+static SDL_AppResult PresentFramebuffer(AppContext* app, const bool fresh)
 {
-    chip8::update();
+    const auto& screen    = app->emulation->frame().screen;
+    chip8::row_mask dirty = app->stale | (fresh ? app->emulation->frame().dirty_rows : 0);
+    if(app->needs_present == false && dirty == 0)
+    {
+        return app->app_quit;
+    }
+
+    const Uint32 colours[1 << chip8::MAX_PLANES] = {app->palette.unlit, app->palette.lit, app->palette.second,
+                                                   app->palette.both};
+    while(dirty != 0)
+    {
+        const int first = std::countr_zero(dirty);
+        const int bands = std::countr_one(dirty >> first);
+        dirty &= ~(chip8::ALL_ROWS >> (32 - bands) << first);
+
+        const SDL_Rect span = {0, first * 2, chip8::HIRES_WIDTH, bands * 2};
+        void* pixels;
+        int pitch;
+        if(SDL_LockTexture(app->screen, &span, &pixels, &pitch) == false)
+        {
+            return SDL_Fail();
+        }
+
+        for(auto row = 0; row != bands * 2; row++)
+        {
+            auto* out = reinterpret_cast<Uint32*>(static_cast<Uint8*>(pixels) + row * pitch);
+            chip8::expand_framebuffer_row_to_rgba(screen, first * 2 + row, out, colours);
+        }
+        SDL_UnlockTexture(app->screen);
+    }
 
+    SDL_SetRenderDrawColor(app->renderer, 0, 0, 0, 255);
+    SDL_RenderClear(app->renderer);
+    SDL_RenderTexture(app->renderer, app->screen, nullptr, nullptr);
+    SDL_RenderPresent(app->renderer);
+
+    app->stale         = 0;
+    app->needs_present = false;
+    return app->app_quit;
+}
+
+SDL_AppResult SDL_AppIterate(void* appstate)
+{
     auto* app = reinterpret_cast<AppContext*>(appstate);
 
-    if(chip8::draw_triggered() == false)
+    if(const auto fault = app->emulation->fault(); fault != nullptr)
     {
-        return app->app_quit;
+        SDL_LogError(SDL_LOG_CATEGORY_CUSTOM, "%s", fault);
+        return SDL_APP_FAILURE;
     }
 
-    auto renderer = app->renderer;
-
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-    SDL_RenderClear(renderer);
+    // The emulation thread may have published several frames since the last iteration, or none. Only the rows the
+    // machine drew to, cleared or scrolled since the frame on screen are uploaded, across every frame skipped on
+    // the way, and a frame that touched none is not presented at all.
+    const bool fresh = app->emulation->take_frame();
+    if(app->emulation->frame().extended)
+    {
+        return PresentFramebuffer(app, fresh);
+    }
 
-    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    const auto& display   = app->emulation->frame().rows;
+    chip8::row_mask dirty = app->stale | (fresh ? app->emulation->frame().dirty_rows : 0);
+    if(app->needs_present == false && dirty == 0)
+    {
+        return app->app_quit;
+    }
 
-    auto _draw_buffer = chip8::gfx_buffer();
-    for(auto i = 0; i != chip8::DRAW_BUFFER_HEIGHT; i++)
+    // Upload the span of rows that changed. A locked area has to be written in full.
+    if(dirty != 0)
     {
-        for(auto j = 0; j != chip8::DRAW_BUFFER_WIDTH; j++)
+        const int first = std::countr_zero(dirty);
+        const int last  = chip8::DRAW_BUFFER_HEIGHT - 1 - std::countl_zero(dirty);
+
+        const SDL_Rect span = {0, first, chip8::DRAW_BUFFER_WIDTH, last - first + 1};
+        void* pixels;
+        int pitch;
+        if(SDL_LockTexture(app->screen, &span, &pixels, &pitch) == false)
         {
-            if(_draw_buffer[i * chip8::DRAW_BUFFER_WIDTH + j])
-            {
-                SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+            return SDL_Fail();
+        }
 
-                SDL_FRect pixel = {static_cast<float>(j * 20), static_cast<float>(i * 20), 20, 20};
-                SDL_RenderFillRect(renderer, &pixel);
-            }
+        for(auto row = first; row <= last; row++)
+        {
+            auto* out = reinterpret_cast<Uint32*>(static_cast<Uint8*>(pixels) + (row - first) * pitch);
+            chip8::expand_row_to_rgba(display[row], out, app->palette.lit, app->palette.unlit);
         }
+        SDL_UnlockTexture(app->screen);
     }
 
+    SDL_SetRenderDrawColor(app->renderer, 0, 0, 0, 255);
+    SDL_RenderClear(app->renderer);
+    SDL_RenderTexture(app->renderer, app->screen, nullptr, nullptr);
+
     SDL_RenderPresent(app->renderer);
 
+    app->stale         = 0;
+    app->needs_present = false;
+
     return app->app_quit;
 }
 
@@ -135,6 +434,47 @@ void SDL_AppQuit(void* appstate, SDL_AppResult result)
 {
     if(auto* app = reinterpret_cast<AppContext*>(appstate))
     {
+        // The audio callback reads from the emulation thread, and the machine is only safe to read once that has
+        // stopped
+        if(app->audio != nullptr)
+        {
+            SDL_DestroyAudioStream(app->audio);
+        }
+        if(app->emulation != nullptr)
+        {
+            app->emulation->stop();
+        }
+        auto& vm = chip8::default_machine();
+        if(vm.instruction_count() != 0)
+        {
+            SDL_Log("Idle for %.1f%% of the emulated cycles",
+                    100.0 * static_cast<double>(vm.idle_cycle_count()) / static_cast<double>(vm.instruction_count()));
+        }
+        if(app->record_path != nullptr)
+        {
+            vm.record_input(nullptr);
+            try
+            {
+                chip8::save_replay(app->record_path, {app->seed, vm.cycles_per_frame(), vm.current_quirks(),
+                                                      vm.instruction_count(), vm.frame_hash(), app->input_log});
+                SDL_Log("Replay written to %s", app->record_path);
+            }
+            catch(const std::exception& e)
+            {
+                SDL_LogError(SDL_LOG_CATEGORY_CUSTOM, "%s", e.what());
+            }
+        }
+
+        if(const auto* counters = vm.current_profile(); counters != nullptr && app->profile_path != nullptr)
+        {
+            if(auto* file = std::fopen(app->profile_path, "w"))
+            {
+                chip8::write_profile_csv(*counters, file);
+                std::fclose(file);
+            }
+        }
+
+        SDL_DestroyTexture(app->screen);
         SDL_DestroyRenderer(app->renderer);
         SDL_DestroyWindow(app->window);
 
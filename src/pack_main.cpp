@@ -0,0 +1,95 @@
+#include "rom_pack.h"
+
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Usage: chip8-pack OUTPUT rom...
+//        chip8-pack --list PACK
+// Writes every rom into the ROM pack OUTPUT under its file name, for chip8-batch --pack and chip8-headless --pack.
+// NAME=PATH stores PATH under NAME instead. --list prints the SHA-1, size and name of every ROM in PACK.
+
+static int list(const char* path)
+{
+    const chip8::rom_pack pack(path);
+    for(const auto& rom : pack.roms())
+    {
+        std::printf("%s %5zu %.*s\n", chip8::to_hex(rom.digest).c_str(), rom.size, static_cast<int>(rom.name.size()),
+                    rom.name.data());
+    }
+    return 0;
+}
+
+static int write(const char* path, const std::vector<const char*>& roms)
+{
+    std::vector<chip8::rom_pack_input> inputs;
+    for(const std::string_view rom : roms)
+    {
+        const auto equals = rom.find('=');
+
+        chip8::rom_pack_input input;
+        std::string file;
+        if(equals != std::string_view::npos)
+        {
+            input.name = rom.substr(0, equals);
+            file       = rom.substr(equals + 1);
+        }
+        else
+        {
+            input.name = std::filesystem::path(rom).filename().string();
+            file       = rom;
+        }
+
+        std::ifstream is(file, std::ios::binary);
+        if(is.is_open() == false)
+        {
+            std::fprintf(stderr, "Could not open %s\n", file.c_str());
+            return 1;
+        }
+        input.data.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+        inputs.push_back(std::move(input));
+    }
+
+    chip8::write_rom_pack(path, inputs);
+    std::printf("%zu ROMs written to %s\n", inputs.size(), path);
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc == 3 && std::strcmp(argv[1], "--list") == 0)
+    {
+        try
+        {
+            return list(argv[2]);
+        }
+        catch(const std::exception& e)
+        {
+            std::fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+    }
+
+    if(argc < 3 || argv[1][0] == '-')
+    {
+        std::fprintf(stderr, "Usage: %s OUTPUT rom...\n       %s --list PACK\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    try
+    {
+        return write(argv[1], std::vector<const char*>(argv + 2, argv + argc));
+    }
+    catch(const std::exception& e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+}
@@ -0,0 +1,88 @@
+#include "profile.h"
+
+namespace chip8
+{
+    static const char* const OP_NAMES[] = {
+#define CHIP8_OP_NAME(name) #name,
+        CHIP8_OPS(CHIP8_OP_NAME) CHIP8_FUSED_OPS(CHIP8_OP_NAME)
+#undef CHIP8_OP_NAME
+    };
+
+    static_assert(std::size(OP_NAMES) == PROFILED_OP_COUNT);
+
+    const char* op_name(const op handler)
+    {
+        const auto index = static_cast<std::size_t>(handler);
+        return index < PROFILED_OP_COUNT ? OP_NAMES[index] : "unknown";
+    }
+
+    void write_profile_csv(const profile& counters, std::FILE* output)
+    {
+        std::fprintf(output, "kind,key,count,samples,ticks,histogram\n");
+        for(std::size_t i = 0; i != PROFILED_OP_COUNT; i++)
+        {
+            if(counters.op_counts[i] == 0)
+            {
+                continue;
+            }
+
+            std::fprintf(output, "op,%s,%llu,%llu,%llu,", OP_NAMES[i],
+                         static_cast<unsigned long long>(counters.op_counts[i]),
+                         static_cast<unsigned long long>(counters.op_samples[i]),
+                         static_cast<unsigned long long>(counters.op_ticks[i]));
+            for(auto bucket = 0; bucket != PROFILE_HISTOGRAM_BUCKETS; bucket++)
+            {
+                std::fprintf(output, bucket == 0 ? "%llu" : " %llu",
+                             static_cast<unsigned long long>(counters.op_histogram[i][bucket]));
+            }
+            std::fputc('\n', output);
+        }
+
+        for(auto pc = 0; pc != MEMORY_SIZE; pc++)
+        {
+            if(counters.pc_hits[pc] != 0)
+            {
+                std::fprintf(output, "pc,0x%03X,%llu,,,\n", pc, static_cast<unsigned long long>(counters.pc_hits[pc]));
+            }
+        }
+    }
+
+    void write_profile_json(const profile& counters, std::FILE* output)
+    {
+        std::fprintf(output, "{\"ops\":[");
+        bool first = true;
+        for(std::size_t i = 0; i != PROFILED_OP_COUNT; i++)
+        {
+            if(counters.op_counts[i] == 0)
+            {
+                continue;
+            }
+
+            std::fprintf(output, "%s\n{\"name\":\"%s\",\"count\":%llu,\"samples\":%llu,\"ticks\":%llu,\"histogram\":[",
+                         first ? "" : ",", OP_NAMES[i], static_cast<unsigned long long>(counters.op_counts[i]),
+                         static_cast<unsigned long long>(counters.op_samples[i]),
+                         static_cast<unsigned long long>(counters.op_ticks[i]));
+            for(auto bucket = 0; bucket != PROFILE_HISTOGRAM_BUCKETS; bucket++)
+            {
+                std::fprintf(output, bucket == 0 ? "%llu" : ",%llu",
+                             static_cast<unsigned long long>(counters.op_histogram[i][bucket]));
+            }
+            std::fprintf(output, "]}");
+            first = false;
+        }
+
+        // Only the addresses that were hit, as pc and count pairs
+        std::fprintf(output, "],\n\"pc_hits\":[");
+        first = true;
+        for(auto pc = 0; pc != MEMORY_SIZE; pc++)
+        {
+            if(counters.pc_hits[pc] != 0)
+            {
+                std::fprintf(output, "%s[%d,%llu]", first ? "" : ",", pc,
+                             static_cast<unsigned long long>(counters.pc_hits[pc]));
+                first = false;
+            }
+        }
+        std::fprintf(output, "]}\n");
+    }
+} // namespace chip8
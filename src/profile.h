@@ -0,0 +1,114 @@
+#pragma once
+
+#include "chip8.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+// 1 compiles the profiler into the dispatch loop. With 0 every profiling hook is discarded at compile time and the
+// machine runs the same code as it would without a profiler. Off unless enabled in CMakeLists.txt.
+#ifndef CHIP8_PROFILE
+#define CHIP8_PROFILE 0
+#endif
+
+namespace chip8
+{
+    static constexpr bool PROFILING = CHIP8_PROFILE != 0;
+
+    // Bucket n counts handlers that took fewer than 2^n timestamp ticks, the last one everything longer
+    static constexpr auto PROFILE_HISTOGRAM_BUCKETS = 32;
+
+    static constexpr auto PROFILED_OP_COUNT = static_cast<std::size_t>(op::count);
+
+    // Time stamp counter where the host has one, nanoseconds otherwise
+    inline std::uint64_t read_timestamp()
+    {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+    }
+
+    // Every this many dispatches on average one handler is timed. The gaps are jittered so that a loop whose length
+    // divides the interval is not sampled at the same op every time.
+    static constexpr auto PROFILE_SAMPLE_INTERVAL = 16;
+
+    // Per-machine counters, written only by the thread running the machine. Every dispatched op is counted and its
+    // pc hit. Sampled dispatches are timed up to the next one, so a sample covers the handler and the dispatch that
+    // follows it. A fused pair counts once, under its fused op at the pc of its first half.
+    struct profile
+    {
+        std::uint64_t op_counts[PROFILED_OP_COUNT]                               = {};
+        std::uint64_t op_samples[PROFILED_OP_COUNT]                              = {};
+        std::uint64_t op_ticks[PROFILED_OP_COUNT]                                = {}; // Sum over the samples
+        std::uint64_t op_histogram[PROFILED_OP_COUNT][PROFILE_HISTOGRAM_BUCKETS] = {};
+        std::uint64_t pc_hits[MEMORY_SIZE]                                       = {};
+
+        void record(const op handler, const unsigned pc)
+        {
+            op_counts[static_cast<std::size_t>(handler)]++;
+            // Only the first 4 KB of an XO-CHIP machine's memory have counters
+            if(pc < MEMORY_SIZE)
+            {
+                pc_hits[pc]++;
+            }
+
+            if(sampled != op::count)
+            {
+                charge(read_timestamp());
+            }
+            if(--countdown == 0)
+            {
+                jitter    = jitter * 6364136223846793005 + 1442695040888963407;
+                countdown = 1 + static_cast<unsigned>(jitter >> 59);
+                sampled   = handler;
+                started   = read_timestamp();
+            }
+        }
+
+        // Ends a run, so that time spent outside the machine is never charged to an op
+        void end()
+        {
+            if(sampled != op::count)
+            {
+                charge(read_timestamp());
+            }
+        }
+
+    private:
+        void charge(const std::uint64_t now)
+        {
+            const auto index  = static_cast<std::size_t>(sampled);
+            const auto ticks  = now - started;
+            const auto bucket = std::min<std::size_t>(std::bit_width(ticks), PROFILE_HISTOGRAM_BUCKETS - 1);
+
+            op_samples[index]++;
+            op_ticks[index] += ticks;
+            op_histogram[index][bucket]++;
+            sampled = op::count;
+        }
+
+        op sampled            = op::count;
+        std::uint64_t started = 0;
+        unsigned countdown    = PROFILE_SAMPLE_INTERVAL;
+        std::uint64_t jitter  = 0;
+    };
+
+    const char* op_name(const op handler);
+
+    // One row per op that ran ("op,name,count,samples,ticks,h0 h1 ...") followed by one row per pc that was hit
+    // ("pc,0x200,hits,,,")
+    void write_profile_csv(const profile& counters, std::FILE* output);
+    void write_profile_json(const profile& counters, std::FILE* output);
+} // namespace chip8
@@ -0,0 +1,34 @@
+#include "quirks.h"
+
+namespace chip8
+{
+    const char* quirk_profile_name(const quirk_profile profile)
+    {
+        switch(profile)
+        {
+            case quirk_profile::vip:
+                return "vip";
+            case quirk_profile::schip:
+                return "schip";
+            case quirk_profile::xochip:
+                return "xochip";
+            case quirk_profile::modern:
+                break;
+        }
+        return "modern";
+    }
+
+    bool parse_quirk_profile(const std::string_view text, quirk_profile& out)
+    {
+        for(const auto profile : {quirk_profile::vip, quirk_profile::schip, quirk_profile::modern,
+                                   quirk_profile::xochip})
+        {
+            if(text == quirk_profile_name(profile))
+            {
+                out = profile;
+                return true;
+            }
+        }
+        return false;
+    }
+} // namespace chip8
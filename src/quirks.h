@@ -0,0 +1,108 @@
+#pragma once
+
+#include "display.h"
+
+#include <string_view>
+
+namespace chip8
+{
+    // The interpreters ROMs were written for disagree on a handful of instructions. A profile fixes all of them.
+    enum class quirk_profile
+    {
+        vip,    // The original COSMAC VIP interpreter
+        schip,  // SUPER-CHIP 1.1 on the HP 48
+        modern, // What most interpreters written since do, and the default
+        xochip, // XO-CHIP as Octo runs it
+    };
+
+    static constexpr auto DEFAULT_QUIRKS = quirk_profile::modern;
+
+    // The instruction set, display and memory a profile runs with
+    enum class machine_mode
+    {
+        chip8,  // 64x32, one plane and 4 KB
+        schip,  // Adds 128x64, scrolling, 16x16 sprites, the big font and the RPL flags
+        xochip, // Adds to SUPER-CHIP a second plane, 64 KB, the audio pattern and the long I load
+    };
+
+    struct quirk_flags
+    {
+        bool shift_reads_vy;        // 8XY6 and 8XYE shift VY into VX, instead of VX in place
+        bool load_store_advances_i; // FX55 and FX65 leave I past the last register they moved
+        bool jump_reads_vx;         // BXNN jumps to XNN plus VX, instead of BNNN to NNN plus V0
+        bool logic_resets_vf;       // 8XY1, 8XY2 and 8XY3 clear VF
+        sprite_edge edge;           // What selecting the profile sets the sprite edge to
+        machine_mode mode;
+    };
+
+    // Policy types the interpreter core is instantiated over, one instantiation per profile, so that a quirk costs
+    // nothing where it does not apply
+    struct vip_quirks
+    {
+        static constexpr quirk_flags flags = {
+            .shift_reads_vy        = true,
+            .load_store_advances_i = true,
+            .jump_reads_vx         = false,
+            .logic_resets_vf       = true,
+            .edge                  = sprite_edge::clip,
+            .mode                  = machine_mode::chip8,
+        };
+    };
+
+    struct schip_quirks
+    {
+        static constexpr quirk_flags flags = {
+            .shift_reads_vy        = false,
+            .load_store_advances_i = false,
+            .jump_reads_vx         = true,
+            .logic_resets_vf       = false,
+            .edge                  = sprite_edge::clip,
+            .mode                  = machine_mode::schip,
+        };
+    };
+
+    struct modern_quirks
+    {
+        static constexpr quirk_flags flags = {
+            .shift_reads_vy        = false,
+            .load_store_advances_i = false,
+            .jump_reads_vx         = false,
+            .logic_resets_vf       = false,
+            .edge                  = sprite_edge::clip,
+            .mode                  = machine_mode::chip8,
+        };
+    };
+
+    struct xochip_quirks
+    {
+        static constexpr quirk_flags flags = {
+            .shift_reads_vy        = true,
+            .load_store_advances_i = true,
+            .jump_reads_vx         = false,
+            .logic_resets_vf       = false,
+            .edge                  = sprite_edge::wrap,
+            .mode                  = machine_mode::xochip,
+        };
+    };
+
+    // For the code that looks quirks up as it runs rather than being instantiated per profile
+    constexpr quirk_flags flags_of(const quirk_profile profile)
+    {
+        switch(profile)
+        {
+            case quirk_profile::vip:
+                return vip_quirks::flags;
+            case quirk_profile::schip:
+                return schip_quirks::flags;
+            case quirk_profile::xochip:
+                return xochip_quirks::flags;
+            case quirk_profile::modern:
+                break;
+        }
+        return modern_quirks::flags;
+    }
+
+    // "vip", "schip", "modern" or "xochip"
+    const char* quirk_profile_name(const quirk_profile profile);
+    bool parse_quirk_profile(const std::string_view text, quirk_profile& out);
+} // namespace chip8
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+
+namespace chip8
+{
+    // xoshiro256**: four words of state, a handful of shifts and multiplies per number and the same sequence on
+    // every host for a given seed
+    class xoshiro256
+    {
+    public:
+        explicit xoshiro256(const std::uint64_t seed = 0)
+        {
+            reseed(seed);
+        }
+
+        // Spreads seed over the state with splitmix64, which never leaves it all zero
+        void reseed(std::uint64_t seed)
+        {
+            for(auto& word : state)
+            {
+                seed += 0x9E3779B97F4A7C15;
+                auto z = seed;
+                z      = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+                z      = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+                word   = z ^ (z >> 31);
+            }
+        }
+
+        std::uint64_t next()
+        {
+            const auto result = std::rotl(state[1] * 5, 7) * 9;
+            const auto t      = state[1] << 17;
+
+            state[2] ^= state[0];
+            state[3] ^= state[1];
+            state[1] ^= state[2];
+            state[0] ^= state[3];
+            state[2] ^= t;
+            state[3] = std::rotl(state[3], 45);
+
+            return result;
+        }
+
+        std::uint64_t state[4];
+    };
+} // namespace chip8
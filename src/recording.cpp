@@ -0,0 +1,490 @@
+#include "recording.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <system_error>
+
+namespace chip8
+{
+    // Little-endian throughout:
+    //   header   magic, u32 version, u32 RECORDED_FRAME_SIZE, u32 quirk profile, u32 keyframe interval
+    //   frames   per frame: u16 delta size, u8 flags, the delta against the frame before or, for a keyframe, a blank
+    //            frame
+    //   index    per keyframe: u64 frame, u64 offset of its record, in frame order
+    //   trailer  u64 frame count, u64 index offset, index magic
+    // A recording that was never finished ends after its last frame.
+    static constexpr char RECORDING_MAGIC[8]            = {'C', 'H', 'I', 'P', '8', 'R', 'E', 'C'};
+    static constexpr char INDEX_MAGIC[8]                = {'C', 'H', 'I', 'P', '8', 'I', 'D', 'X'};
+    static constexpr std::uint32_t RECORDING_VERSION    = 1;
+    static constexpr std::size_t RECORDING_HEADER_SIZE  = 24;
+    static constexpr std::size_t RECORD_HEADER_SIZE     = 3;
+    static constexpr std::size_t INDEX_ENTRY_SIZE       = 16;
+    static constexpr std::size_t RECORDING_TRAILER_SIZE = 24;
+    static constexpr unsigned char KEYFRAME             = 1;
+    static constexpr std::size_t MAX_RECORD_SIZE        = max_xor_delta_size(RECORDED_FRAME_SIZE);
+
+    static_assert(MAX_RECORD_SIZE <= 0xFFFF, "A record's size has to fit its u16");
+    static_assert(RECORD_HEADER_SIZE + MAX_RECORD_SIZE <= RECORDER_CHUNK_SIZE, "A chunk has to hold a record");
+
+    static const recorded_frame blank_frame = {};
+
+    static void put_u16(unsigned char* out, const std::uint32_t value)
+    {
+        out[0] = static_cast<unsigned char>(value);
+        out[1] = static_cast<unsigned char>(value >> 8);
+    }
+
+    static void put_u32(unsigned char* out, const std::uint32_t value)
+    {
+        put_u16(out, value);
+        put_u16(out + 2, value >> 16);
+    }
+
+    static void put_u64(unsigned char* out, const std::uint64_t value)
+    {
+        put_u32(out, static_cast<std::uint32_t>(value));
+        put_u32(out + 4, static_cast<std::uint32_t>(value >> 32));
+    }
+
+    static std::uint32_t read_u16(const unsigned char* bytes)
+    {
+        return static_cast<std::uint32_t>(bytes[0]) | static_cast<std::uint32_t>(bytes[1]) << 8;
+    }
+
+    static std::uint32_t read_u32(const unsigned char* bytes)
+    {
+        return read_u16(bytes) | read_u16(bytes + 2) << 16;
+    }
+
+    static std::uint64_t read_u64(const unsigned char* bytes)
+    {
+        return read_u32(bytes) | static_cast<std::uint64_t>(read_u32(bytes + 4)) << 32;
+    }
+
+    // Leftmost pixel first, whatever the host's byte order
+    static void put_row(unsigned char* out, const std::uint64_t row)
+    {
+        for(auto i = 0; i != 8; i++)
+        {
+            out[i] = static_cast<unsigned char>(row >> (56 - 8 * i));
+        }
+    }
+
+    bool recorded_frame::hires() const
+    {
+        return bytes[RECORDED_FRAME_SIZE - 1] != 0;
+    }
+
+    int recorded_frame::width() const
+    {
+        return hires() ? HIRES_WIDTH : DRAW_BUFFER_WIDTH;
+    }
+
+    int recorded_frame::height() const
+    {
+        return hires() ? HIRES_HEIGHT : DRAW_BUFFER_HEIGHT;
+    }
+
+    unsigned recorded_frame::pixel(const int x, const int y) const
+    {
+        unsigned planes = 0;
+        for(auto plane = 0; plane != MAX_PLANES; plane++)
+        {
+            const auto byte = bytes[(plane * HIRES_HEIGHT + y) * RECORDED_ROW_SIZE + x / 8];
+            planes |= (byte >> (7 - x % 8) & 1u) << plane;
+        }
+        return planes;
+    }
+
+    void capture_frame(const machine& vm, recorded_frame& out)
+    {
+        const auto* screen = vm.screen();
+        if(screen == nullptr)
+        {
+            std::memset(out.bytes, 0, sizeof out.bytes);
+            for(auto y = 0; y != DRAW_BUFFER_HEIGHT; y++)
+            {
+                put_row(&out.bytes[y * RECORDED_ROW_SIZE], vm.display()[y]);
+            }
+            return;
+        }
+
+        for(auto plane = 0; plane != MAX_PLANES; plane++)
+        {
+            for(auto y = 0; y != HIRES_HEIGHT; y++)
+            {
+                auto* row = &out.bytes[(plane * HIRES_HEIGHT + y) * RECORDED_ROW_SIZE];
+                put_row(row, screen->planes[plane][y][0]);
+                put_row(row + 8, screen->planes[plane][y][1]);
+            }
+        }
+        out.bytes[RECORDED_FRAME_SIZE - 1] = screen->hires ? 1 : 0;
+    }
+
+    frame_recorder::frame_recorder(const char* path, const quirk_profile quirks, const unsigned keyframe_interval)
+        : file(std::fopen(path, "wb"), &std::fclose)
+        , path(path)
+        , keyframe_interval(keyframe_interval)
+    {
+        if(keyframe_interval == 0)
+        {
+            throw std::invalid_argument("Frame recording needs a keyframe interval");
+        }
+        if(file == nullptr)
+        {
+            throw std::runtime_error(std::string("Could not write ") + path);
+        }
+
+        unsigned char header[RECORDING_HEADER_SIZE];
+        std::memcpy(header, RECORDING_MAGIC, sizeof(RECORDING_MAGIC));
+        put_u32(&header[8], RECORDING_VERSION);
+        put_u32(&header[12], RECORDED_FRAME_SIZE);
+        put_u32(&header[16], static_cast<std::uint32_t>(quirks));
+        put_u32(&header[20], keyframe_interval);
+        if(std::fwrite(header, 1, sizeof(header), file.get()) != sizeof(header))
+        {
+            throw std::runtime_error(std::string("Could not write ") + path);
+        }
+
+        for(unsigned char i = 0; i != RECORDER_CHUNK_COUNT; i++)
+        {
+            chunks[i].data = std::make_unique<unsigned char[]>(RECORDER_CHUNK_SIZE);
+            if(i != filling)
+            {
+                empty_chunks.try_push(i);
+            }
+        }
+        frames = std::make_unique<recorded_frame[]>(2);
+
+        writer = std::thread(&frame_recorder::write_loop, this);
+    }
+
+    frame_recorder::~frame_recorder()
+    {
+        try
+        {
+            finish();
+        }
+        catch(const std::runtime_error&)
+        {
+        }
+    }
+
+    void frame_recorder::push(const machine& vm)
+    {
+        auto& now = frames[previous ^ 1];
+        capture_frame(vm, now);
+
+        const bool keyframe = frames_pushed % keyframe_interval == 0;
+        const auto& before  = keyframe ? blank_frame : frames[previous];
+
+        if(chunks[filling].size + RECORD_HEADER_SIZE + MAX_RECORD_SIZE > RECORDER_CHUNK_SIZE)
+        {
+            hand_off();
+        }
+
+        auto& target    = chunks[filling];
+        auto* record    = &target.data[target.size];
+        const auto size = encode_xor_delta(now.bytes, before.bytes, RECORDED_FRAME_SIZE, record + RECORD_HEADER_SIZE);
+        put_u16(record, static_cast<std::uint32_t>(size));
+        record[2] = keyframe ? KEYFRAME : 0;
+
+        if(keyframe)
+        {
+            keyframes.push_back({frames_pushed, RECORDING_HEADER_SIZE + encoded});
+        }
+        target.size += RECORD_HEADER_SIZE + size;
+        encoded += RECORD_HEADER_SIZE + size;
+        frames_pushed++;
+        previous ^= 1;
+    }
+
+    void frame_recorder::hand_off()
+    {
+        // Never fails, the ring has room for every chunk
+        full_chunks.try_push(filling);
+
+        // Only waits when the writer is a whole ring of chunks behind
+        while(empty_chunks.try_pop(filling) == false)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+
+    void frame_recorder::write_loop()
+    {
+        while(true)
+        {
+            unsigned char index;
+            if(full_chunks.try_pop(index))
+            {
+                auto& written = chunks[index];
+                if(std::fwrite(written.data.get(), 1, written.size, file.get()) != written.size)
+                {
+                    write_failed.store(true, std::memory_order_relaxed);
+                }
+                written.size = 0;
+                empty_chunks.try_push(index);
+                continue;
+            }
+
+            // Chunks handed off before stopping was set are seen by the check after it
+            if(stopping.load(std::memory_order_acquire))
+            {
+                if(full_chunks.empty())
+                {
+                    return;
+                }
+                continue;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    void frame_recorder::finish()
+    {
+        if(finished)
+        {
+            return;
+        }
+        finished = true;
+
+        if(chunks[filling].size != 0)
+        {
+            full_chunks.try_push(filling);
+        }
+        stopping.store(true, std::memory_order_release);
+        writer.join();
+
+        // The writer is gone, the rest is written from this thread
+        std::vector<unsigned char> index(keyframes.size() * INDEX_ENTRY_SIZE + RECORDING_TRAILER_SIZE);
+        for(std::size_t i = 0; i != keyframes.size(); i++)
+        {
+            put_u64(&index[i * INDEX_ENTRY_SIZE], keyframes[i].frame);
+            put_u64(&index[i * INDEX_ENTRY_SIZE + 8], keyframes[i].offset);
+        }
+        auto* trailer = &index[keyframes.size() * INDEX_ENTRY_SIZE];
+        put_u64(trailer, frames_pushed);
+        put_u64(trailer + 8, RECORDING_HEADER_SIZE + encoded);
+        std::memcpy(trailer + 16, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+
+        std::fwrite(index.data(), 1, index.size(), file.get());
+        if(write_failed.load(std::memory_order_relaxed) || std::fflush(file.get()) != 0 || std::ferror(file.get()) != 0)
+        {
+            throw std::runtime_error("Could not write " + path);
+        }
+    }
+
+    std::uint64_t frame_recorder::frame_count() const
+    {
+        return frames_pushed;
+    }
+
+    std::uint64_t frame_recorder::bytes_encoded() const
+    {
+        return encoded;
+    }
+
+    frame_reader::frame_reader(const char* path)
+        : file(std::fopen(path, "rb"), &std::fclose)
+        , path(path)
+    {
+        if(file == nullptr)
+        {
+            throw std::runtime_error(std::string("Could not open ") + path);
+        }
+
+        unsigned char header[RECORDING_HEADER_SIZE];
+        if(std::fread(header, 1, sizeof(header), file.get()) != sizeof(header) ||
+           std::memcmp(header, RECORDING_MAGIC, sizeof(RECORDING_MAGIC)) != 0 ||
+           read_u32(&header[8]) != RECORDING_VERSION || read_u32(&header[12]) != RECORDED_FRAME_SIZE ||
+           read_u32(&header[16]) > static_cast<std::uint32_t>(quirk_profile::xochip))
+        {
+            throw std::runtime_error(std::string(path) + " is not a frame recording");
+        }
+        recorded_quirks = static_cast<quirk_profile>(read_u32(&header[16]));
+
+        std::error_code error;
+        const auto file_size = std::filesystem::file_size(path, error);
+        if(error)
+        {
+            throw std::runtime_error(std::string("Could not open ") + path);
+        }
+
+        has_index = load_index(file_size);
+        if(has_index == false)
+        {
+            rebuild_index(file_size);
+        }
+
+        record = std::make_unique<unsigned char[]>(MAX_RECORD_SIZE);
+    }
+
+    bool frame_reader::load_index(const std::uint64_t file_size)
+    {
+        if(file_size < RECORDING_HEADER_SIZE + RECORDING_TRAILER_SIZE)
+        {
+            return false;
+        }
+
+        unsigned char trailer[RECORDING_TRAILER_SIZE];
+        if(std::fseek(file.get(), static_cast<long>(file_size - RECORDING_TRAILER_SIZE), SEEK_SET) != 0 ||
+           std::fread(trailer, 1, sizeof(trailer), file.get()) != sizeof(trailer) ||
+           std::memcmp(&trailer[16], INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0)
+        {
+            return false;
+        }
+
+        const auto frame_total  = read_u64(&trailer[0]);
+        const auto index_offset = read_u64(&trailer[8]);
+        if(index_offset < RECORDING_HEADER_SIZE || index_offset > file_size - RECORDING_TRAILER_SIZE ||
+           (file_size - RECORDING_TRAILER_SIZE - index_offset) % INDEX_ENTRY_SIZE != 0)
+        {
+            return false;
+        }
+
+        std::vector<unsigned char> index(file_size - RECORDING_TRAILER_SIZE - index_offset);
+        if(std::fseek(file.get(), static_cast<long>(index_offset), SEEK_SET) != 0 ||
+           std::fread(index.data(), 1, index.size(), file.get()) != index.size())
+        {
+            return false;
+        }
+
+        std::vector<keyframe_entry> entries;
+        for(std::size_t i = 0; i != index.size(); i += INDEX_ENTRY_SIZE)
+        {
+            const keyframe_entry entry = {read_u64(&index[i]), read_u64(&index[i + 8])};
+
+            // In frame and file order, inside the frames, and starting with the first frame
+            const bool in_order = entries.empty() ? entry.frame == 0 && entry.offset == RECORDING_HEADER_SIZE
+                                                  : entry.frame > entries.back().frame &&
+                                                        entry.offset > entries.back().offset;
+            if(in_order == false || entry.frame >= frame_total || entry.offset >= index_offset)
+            {
+                return false;
+            }
+            entries.push_back(entry);
+        }
+        if(entries.empty() != (frame_total == 0))
+        {
+            return false;
+        }
+
+        keyframes = std::move(entries);
+        frames    = frame_total;
+        return true;
+    }
+
+    void frame_reader::rebuild_index(const std::uint64_t file_size)
+    {
+        keyframes.clear();
+        frames = 0;
+
+        std::uint64_t offset = RECORDING_HEADER_SIZE;
+        unsigned char header[RECORD_HEADER_SIZE];
+        while(std::fseek(file.get(), static_cast<long>(offset), SEEK_SET) == 0 &&
+              std::fread(header, 1, sizeof(header), file.get()) == sizeof(header))
+        {
+            const auto size  = read_u16(header);
+            const auto flags = header[2];
+
+            // A record cut short or what is not a record ends the frames
+            if(flags > KEYFRAME || size > MAX_RECORD_SIZE || file_size - offset < RECORD_HEADER_SIZE + size ||
+               (frames == 0 && flags != KEYFRAME))
+            {
+                break;
+            }
+
+            if(flags == KEYFRAME)
+            {
+                keyframes.push_back({frames, offset});
+            }
+            frames++;
+            offset += RECORD_HEADER_SIZE + size;
+        }
+    }
+
+    std::uint64_t frame_reader::frame_count() const
+    {
+        return frames;
+    }
+
+    std::size_t frame_reader::keyframe_count() const
+    {
+        return keyframes.size();
+    }
+
+    quirk_profile frame_reader::quirks() const
+    {
+        return recorded_quirks;
+    }
+
+    bool frame_reader::indexed() const
+    {
+        return has_index;
+    }
+
+    const recorded_frame& frame_reader::read(const std::uint64_t n)
+    {
+        if(n >= frames)
+        {
+            throw std::out_of_range(path + " has no frame " + std::to_string(n));
+        }
+        if(n + 1 == next_frame)
+        {
+            return current;
+        }
+
+        // Decoding on from the current frame beats going back to a keyframe unless one lies in between
+        const auto keyframe = std::prev(std::ranges::upper_bound(keyframes, n, {}, &keyframe_entry::frame));
+        if(n < next_frame || keyframe->frame >= next_frame)
+        {
+            if(std::fseek(file.get(), static_cast<long>(keyframe->offset), SEEK_SET) != 0)
+            {
+                throw std::runtime_error("Could not read " + path);
+            }
+            next_frame = keyframe->frame;
+        }
+
+        while(next_frame <= n)
+        {
+            decode_next();
+        }
+        return current;
+    }
+
+    void frame_reader::decode_next()
+    {
+        // The next read has to start over from a keyframe
+        const auto damaged = [this]() {
+            const auto frame = next_frame;
+            next_frame       = frames + 1;
+            return std::runtime_error(path + " is damaged at frame " + std::to_string(frame));
+        };
+
+        unsigned char header[RECORD_HEADER_SIZE];
+        if(std::fread(header, 1, sizeof(header), file.get()) != sizeof(header))
+        {
+            throw damaged();
+        }
+
+        const auto size = read_u16(header);
+        if(size > MAX_RECORD_SIZE || std::fread(record.get(), 1, size, file.get()) != size)
+        {
+            throw damaged();
+        }
+
+        if(header[2] == KEYFRAME)
+        {
+            current = blank_frame;
+        }
+        if(apply_xor_delta(record.get(), size, current.bytes, RECORDED_FRAME_SIZE) == false)
+        {
+            throw damaged();
+        }
+        next_frame++;
+    }
+} // namespace chip8
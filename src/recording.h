@@ -0,0 +1,154 @@
+#pragma once
+
+#include "chip8.h"
+#include "spsc_ring.h"
+#include "xor_delta.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace chip8
+{
+    // A keyframe every five seconds of 60 Hz frames bounds a seek to that many deltas
+    static constexpr auto RECORDING_KEYFRAME_INTERVAL = 300;
+
+    static constexpr auto RECORDED_ROW_SIZE   = HIRES_WIDTH / 8;
+    static constexpr auto RECORDED_FRAME_SIZE = MAX_PLANES * HIRES_HEIGHT * RECORDED_ROW_SIZE + 1;
+
+    // The display as a recording holds it, the same in every mode and on every host: each plane's rows laid out like
+    // a framebuffer's, a bit per pixel with the leftmost pixel in the top bit of a row's first byte, then a byte that
+    // is 1 in high resolution. The CHIP-8 mode's display fills the low resolution part of plane 0.
+    struct recorded_frame
+    {
+        unsigned char bytes[RECORDED_FRAME_SIZE];
+
+        bool hires() const;
+        int width() const;
+        int height() const;
+        // The plane bits of the pixel at x, y of the frame's resolution, plane 0 in bit 0
+        unsigned pixel(const int x, const int y) const;
+    };
+
+    void capture_frame(const machine& vm, recorded_frame& out);
+
+    // Chunks of encoded frames in flight between the VM and the writer thread
+    static constexpr auto RECORDER_CHUNK_COUNT = 8;
+    static constexpr auto RECORDER_CHUNK_SIZE  = 64 * 1024;
+
+    // Streams the frames of a machine to a file, each one the XOR against the frame before, run-length encoded the
+    // way rewind_buffer encodes snapshots, so that a frame where nothing moved costs a few bytes. Every
+    // keyframe_interval frames one is encoded against a blank frame instead. push() encodes straight into a chunk,
+    // which goes to a background thread to be written once full, so the VM never waits for the disk unless every
+    // chunk is still queued. finish() appends an index of the keyframes that frame_reader seeks with.
+    class frame_recorder
+    {
+    public:
+        // Throws std::runtime_error when path cannot be created
+        frame_recorder(const char* path, const quirk_profile quirks,
+                       const unsigned keyframe_interval = RECORDING_KEYFRAME_INTERVAL);
+        // Finishes the recording if finish() was not called, ignoring errors
+        ~frame_recorder();
+
+        frame_recorder(const frame_recorder&)            = delete;
+        frame_recorder& operator=(const frame_recorder&) = delete;
+
+        // Records vm's display as the next frame
+        void push(const machine& vm);
+        // Writes what is still queued and the index. Throws std::runtime_error when anything could not be written.
+        void finish();
+
+        std::uint64_t frame_count() const;
+        // Encoded so far, without the header and the index
+        std::uint64_t bytes_encoded() const;
+
+    private:
+        struct keyframe_entry
+        {
+            std::uint64_t frame;
+            std::uint64_t offset;
+        };
+
+        struct chunk
+        {
+            std::unique_ptr<unsigned char[]> data;
+            std::size_t size = 0;
+        };
+
+        // Hands the chunk being filled to the writer and takes an empty one
+        void hand_off();
+        void write_loop();
+
+        std::unique_ptr<std::FILE, decltype(&std::fclose)> file;
+        std::string path;
+        unsigned keyframe_interval;
+
+        chunk chunks[RECORDER_CHUNK_COUNT];
+        unsigned char filling = 0;
+        spsc_ring<unsigned char, RECORDER_CHUNK_COUNT> full_chunks;
+        spsc_ring<unsigned char, RECORDER_CHUNK_COUNT> empty_chunks;
+
+        // The frame before and the one being encoded, swapped after every push
+        std::unique_ptr<recorded_frame[]> frames;
+        unsigned char previous = 0;
+
+        std::vector<keyframe_entry> keyframes;
+        std::uint64_t frames_pushed = 0;
+        std::uint64_t encoded       = 0;
+        bool finished               = false;
+
+        std::atomic<bool> stopping     = false;
+        std::atomic<bool> write_failed = false;
+        std::thread writer;
+    };
+
+    // Reads back what frame_recorder wrote. A recording that was never finished has no index, which is then rebuilt
+    // by walking the frames, up to the last one that was written completely.
+    class frame_reader
+    {
+    public:
+        // Throws std::runtime_error when path cannot be opened or is not a recording
+        explicit frame_reader(const char* path);
+
+        frame_reader(const frame_reader&)            = delete;
+        frame_reader& operator=(const frame_reader&) = delete;
+
+        std::uint64_t frame_count() const;
+        std::size_t keyframe_count() const;
+        quirk_profile quirks() const;
+        // False when the index had to be rebuilt
+        bool indexed() const;
+
+        // Decodes frame n, the one after the previous read cheaply and any other from the keyframe before it. Throws
+        // std::out_of_range for n past the last frame and std::runtime_error when the file is damaged.
+        const recorded_frame& read(const std::uint64_t n);
+
+    private:
+        struct keyframe_entry
+        {
+            std::uint64_t frame;
+            std::uint64_t offset;
+        };
+
+        bool load_index(const std::uint64_t file_size);
+        void rebuild_index(const std::uint64_t file_size);
+        void decode_next();
+
+        std::unique_ptr<std::FILE, decltype(&std::fclose)> file;
+        std::string path;
+        quirk_profile recorded_quirks;
+        bool has_index = false;
+
+        std::vector<keyframe_entry> keyframes;
+        std::uint64_t frames = 0;
+
+        recorded_frame current   = {};
+        std::uint64_t next_frame = 0; // The frame decode_next() decodes, with the file positioned at its record
+        std::unique_ptr<unsigned char[]> record;
+    };
+} // namespace chip8
@@ -0,0 +1,191 @@
+#include "replay.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+namespace chip8
+{
+    static constexpr std::string_view REPLAY_HEADER = "chip8-replay 1";
+
+    static bool parse_number(const std::string_view text, auto& out, const int base = 10)
+    {
+        const auto end = text.data() + text.size();
+        return text.empty() == false && std::from_chars(text.data(), end, out, base).ptr == end;
+    }
+
+    // CYCLE:+K or CYCLE:-K
+    static bool parse_input_event(const std::string_view text, input_event& out)
+    {
+        const auto colon = text.find(':');
+        if(colon == std::string_view::npos || colon + 2 >= text.size())
+        {
+            return false;
+        }
+        if(text[colon + 1] != '+' && text[colon + 1] != '-')
+        {
+            return false;
+        }
+        if(parse_number(text.substr(0, colon), out.cycle) == false ||
+           parse_number(text.substr(colon + 2), out.key, 16) == false)
+        {
+            return false;
+        }
+
+        out.down = text[colon + 1] == '+';
+        return out.key >= 0 && out.key < KEY_COUNT;
+    }
+
+    std::vector<input_event> parse_input_script(const std::string_view script)
+    {
+        std::vector<input_event> events;
+
+        std::size_t begin = 0;
+        while(begin < script.size())
+        {
+            auto end = begin;
+            while(end < script.size() && script[end] != ',' &&
+                  std::isspace(static_cast<unsigned char>(script[end])) == 0)
+            {
+                end++;
+            }
+
+            if(end != begin)
+            {
+                const auto entry = script.substr(begin, end - begin);
+
+                input_event event;
+                if(parse_input_event(entry, event) == false)
+                {
+                    throw std::invalid_argument("Bad key event " + std::string(entry));
+                }
+                events.push_back(event);
+            }
+            begin = end + 1;
+        }
+
+        std::ranges::stable_sort(events, {}, &input_event::cycle);
+        return events;
+    }
+
+    void save_replay(const char* path, const replay& session)
+    {
+        std::unique_ptr<std::FILE, decltype(&std::fclose)> file(std::fopen(path, "w"), &std::fclose);
+        if(file == nullptr)
+        {
+            throw std::runtime_error(std::string("Could not write ") + path);
+        }
+
+        std::fprintf(file.get(), "%.*s\n", static_cast<int>(REPLAY_HEADER.size()), REPLAY_HEADER.data());
+        std::fprintf(file.get(), "seed %" PRIu64 "\n", session.seed);
+        std::fprintf(file.get(), "cycles-per-frame %u\n", session.cycles_per_frame);
+        std::fprintf(file.get(), "quirks %s\n", quirk_profile_name(session.quirks));
+        std::fprintf(file.get(), "cycles %" PRIu64 "\n", session.cycles);
+        std::fprintf(file.get(), "frame-hash %016" PRIx64 "\n", session.frame_hash);
+        for(const auto& event : session.events)
+        {
+            std::fprintf(file.get(), "%" PRIu64 ":%c%X\n", event.cycle, event.down ? '+' : '-', event.key);
+        }
+
+        if(std::ferror(file.get()) != 0)
+        {
+            throw std::runtime_error(std::string("Could not write ") + path);
+        }
+    }
+
+    replay load_replay(const char* path)
+    {
+        std::ifstream is(path);
+        if(is.is_open() == false)
+        {
+            throw std::runtime_error(std::string("Could not open ") + path);
+        }
+
+        std::string line;
+        if(std::getline(is, line).fail() || line != REPLAY_HEADER)
+        {
+            throw std::runtime_error(std::string(path) + " is not a replay");
+        }
+
+        replay session;
+        std::string events;
+        while(std::getline(is, line))
+        {
+            const std::string_view text = line;
+            if(text.empty() || std::isdigit(static_cast<unsigned char>(text[0])) != 0)
+            {
+                events.append(text).push_back('\n');
+                continue;
+            }
+
+            const auto space = text.find(' ');
+            const auto name  = text.substr(0, space);
+            const auto value = space == std::string_view::npos ? std::string_view() : text.substr(space + 1);
+
+            bool valid = false;
+            if(name == "seed")
+            {
+                valid = parse_number(value, session.seed);
+            }
+            else if(name == "cycles-per-frame")
+            {
+                valid = parse_number(value, session.cycles_per_frame) && session.cycles_per_frame != 0;
+            }
+            else if(name == "quirks")
+            {
+                valid = parse_quirk_profile(value, session.quirks);
+            }
+            else if(name == "cycles")
+            {
+                valid = parse_number(value, session.cycles);
+            }
+            else if(name == "frame-hash")
+            {
+                valid = parse_number(value, session.frame_hash, 16);
+            }
+
+            if(valid == false)
+            {
+                throw std::runtime_error(std::string(path) + ": bad line " + line);
+            }
+        }
+
+        try
+        {
+            session.events = parse_input_script(events);
+        }
+        catch(const std::invalid_argument& e)
+        {
+            throw std::runtime_error(std::string(path) + ": " + e.what());
+        }
+        return session;
+    }
+
+    void run_with_input(machine& vm, const std::vector<input_event>& events, const std::uint64_t cycles)
+    {
+        // The machine runs flat out between events. An event applies right before the instruction at its cycle, so
+        // the ones before the current count belong to whatever ran the machine that far.
+        auto next_event = std::ranges::lower_bound(events, vm.instruction_count(), {}, &input_event::cycle);
+        while(true)
+        {
+            const auto executed = vm.instruction_count();
+            if(executed >= cycles)
+            {
+                return;
+            }
+            for(; next_event != events.end() && next_event->cycle <= executed; next_event++)
+            {
+                next_event->down ? vm.on_key_down(next_event->key) : vm.on_key_up(next_event->key);
+            }
+
+            const auto until = next_event != events.end() ? std::min(next_event->cycle, cycles) : cycles;
+            vm.run_cycles(until - executed);
+        }
+    }
+} // namespace chip8
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "chip8.h"
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace chip8
+{
+    // A recorded session: everything needed to run it again bit for bit, on any backend, given the same ROM
+    struct replay
+    {
+        std::uint64_t seed        = 0;
+        unsigned cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+        quirk_profile quirks      = DEFAULT_QUIRKS;
+        std::uint64_t cycles      = 0; // Instructions run by the end of the recording
+        std::uint64_t frame_hash  = 0; // frame_hash() at the end, what a playback has to arrive at
+        std::vector<input_event> events;
+    };
+
+    // Parses CYCLE:+K and CYCLE:-K entries, K a hex key, separated by commas or whitespace. Entries for the same
+    // cycle keep their order. Throws std::invalid_argument on a malformed entry.
+    std::vector<input_event> parse_input_script(const std::string_view script);
+
+    // Text format: a "chip8-replay 1" line, "name value" settings and one CYCLE:+K or CYCLE:-K event per line.
+    // Both throw std::runtime_error when the file cannot be read or written or is not a replay.
+    void save_replay(const char* path, const replay& session);
+    replay load_replay(const char* path);
+
+    // Runs vm until it has executed cycles instructions in total, pressing and releasing keys as the events come
+    // due. Events whose cycle has already passed are skipped and one due at cycles is left for the next call, so
+    // calls that run the same machine on in steps can pass the whole list every time.
+    void run_with_input(machine& vm, const std::vector<input_event>& events, const std::uint64_t cycles);
+} // namespace chip8
@@ -0,0 +1,208 @@
+#include "rewind.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace chip8
+{
+    static const machine_snapshot empty_snapshot = {};
+
+    static std::size_t encode_xor(const unsigned char* now, const unsigned char* before, unsigned char* out)
+    {
+        return encode_xor_delta(now, before, sizeof(machine_snapshot), out);
+    }
+
+    static void apply_xor(const unsigned char* in, const std::size_t size, unsigned char* state)
+    {
+        apply_xor_delta(in, size, state, sizeof(machine_snapshot));
+    }
+
+    rewind_buffer::rewind_buffer(const std::size_t arena_size, const std::size_t max_frames,
+                                 const unsigned keyframe_interval)
+        : arena_size(arena_size), keyframe_interval(keyframe_interval)
+    {
+        if(arena_size < MAX_REWIND_RECORD_SIZE)
+        {
+            throw std::invalid_argument("Rewind arena cannot hold a single keyframe");
+        }
+        if(max_frames == 0 || keyframe_interval == 0)
+        {
+            throw std::invalid_argument("Rewind buffer needs room for a frame and a keyframe interval");
+        }
+
+        arena   = std::make_unique<unsigned char[]>(arena_size);
+        encoded = std::make_unique<unsigned char[]>(MAX_REWIND_RECORD_SIZE);
+        records.resize(max_frames);
+    }
+
+    rewind_buffer::record& rewind_buffer::at(const std::uint64_t sequence)
+    {
+        return records[sequence % records.size()];
+    }
+
+    void rewind_buffer::push(const machine& vm)
+    {
+        vm.save(next_state);
+
+        // Whatever came after the current frame is replaced by the new history
+        if(end != oldest)
+        {
+            for(auto sequence = current + 1; sequence != end; sequence++)
+            {
+                arena_used -= at(sequence).size;
+            }
+            end = current + 1;
+        }
+
+        unsigned since_keyframe = 0;
+        if(end != oldest)
+        {
+            for(auto sequence = current; at(sequence).keyframe == false; sequence--)
+            {
+                since_keyframe++;
+            }
+        }
+
+        auto keyframe    = end == oldest || since_keyframe + 1 >= keyframe_interval;
+        const auto* base = reinterpret_cast<const unsigned char*>(keyframe ? &empty_snapshot : &current_state);
+        auto size        = encode_xor(reinterpret_cast<const unsigned char*>(&next_state), base, encoded.get());
+        auto offset      = make_room(size);
+
+        // Making room dropped the keyframe this delta depended on
+        if(keyframe == false && end == oldest)
+        {
+            keyframe = true;
+            size     = encode_xor(reinterpret_cast<const unsigned char*>(&next_state),
+                                  reinterpret_cast<const unsigned char*>(&empty_snapshot), encoded.get());
+            offset   = make_room(size);
+        }
+
+        std::memcpy(&arena[offset], encoded.get(), size);
+        at(end) = {offset, static_cast<std::uint32_t>(size), keyframe};
+        current = end++;
+        arena_used += size;
+
+        std::memcpy(&current_state, &next_state, sizeof current_state);
+    }
+
+    std::size_t rewind_buffer::make_room(const std::size_t size)
+    {
+        while(true)
+        {
+            if(end == oldest)
+            {
+                return 0;
+            }
+
+            if(end - oldest != records.size())
+            {
+                const auto& newest = at(end - 1);
+                const auto head    = newest.offset + newest.size;
+                const auto tail    = at(oldest).offset;
+
+                // Records fill the arena from the oldest one onwards and wrap around once they reach its end
+                const auto wrapped = tail > head || (tail == head && arena_used != 0);
+                if(wrapped && tail - head >= size)
+                {
+                    return head;
+                }
+                if(wrapped == false && arena_size - head >= size)
+                {
+                    return head;
+                }
+                if(wrapped == false && tail >= size)
+                {
+                    return 0;
+                }
+            }
+
+            drop_oldest_group();
+        }
+    }
+
+    void rewind_buffer::drop_oldest_group()
+    {
+        do
+        {
+            arena_used -= at(oldest).size;
+            oldest++;
+        } while(oldest != end && at(oldest).keyframe == false);
+    }
+
+    void rewind_buffer::seek(const std::uint64_t sequence)
+    {
+        // Deltas are XORs, so applying the current frame's delta again steps back over it
+        if(sequence + 1 == current && at(current).keyframe == false)
+        {
+            const auto& delta = at(current);
+            apply_xor(&arena[delta.offset], delta.size, reinterpret_cast<unsigned char*>(&current_state));
+            current = sequence;
+            return;
+        }
+
+        auto keyframe = sequence;
+        while(at(keyframe).keyframe == false)
+        {
+            keyframe--;
+        }
+
+        std::memcpy(&current_state, &empty_snapshot, sizeof current_state);
+        for(auto frame = keyframe; frame <= sequence; frame++)
+        {
+            const auto& entry = at(frame);
+            apply_xor(&arena[entry.offset], entry.size, reinterpret_cast<unsigned char*>(&current_state));
+        }
+        current = sequence;
+    }
+
+    bool rewind_buffer::step_back(machine& vm)
+    {
+        if(end == oldest || current == oldest)
+        {
+            return false;
+        }
+
+        seek(current - 1);
+        vm.restore(current_state);
+        return true;
+    }
+
+    bool rewind_buffer::restore(machine& vm, const std::size_t frames_back)
+    {
+        if(frames_back >= frame_count())
+        {
+            return false;
+        }
+
+        const auto sequence = end - 1 - frames_back;
+        if(sequence != current)
+        {
+            seek(sequence);
+        }
+        vm.restore(current_state);
+        return true;
+    }
+
+    void rewind_buffer::clear()
+    {
+        oldest     = 0;
+        end        = 0;
+        current    = 0;
+        arena_used = 0;
+    }
+
+    std::size_t rewind_buffer::frame_count() const
+    {
+        return end - oldest;
+    }
+
+    std::size_t rewind_buffer::frames_behind() const
+    {
+        return end == oldest ? 0 : end - 1 - current;
+    }
+
+    std::size_t rewind_buffer::bytes_used() const
+    {
+        return arena_used;
+    }
+} // namespace chip8
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "chip8.h"
+#include "xor_delta.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace chip8
+{
+    // A keyframe every second of 60 Hz frames bounds a seek to that many deltas
+    static constexpr auto DEFAULT_KEYFRAME_INTERVAL = 60;
+
+    // Upper bound of one encoded record
+    static constexpr auto MAX_REWIND_RECORD_SIZE = max_xor_delta_size(sizeof(machine_snapshot));
+
+    // Rewind history of one machine, one record per pushed frame. Every keyframe_interval frames a record holds the
+    // whole snapshot, the records between hold the XOR against the frame before, run-length encoded so that
+    // unchanged bytes cost next to nothing. All storage is allocated up front: when either the arena or the frame
+    // limit runs out the oldest keyframe is dropped together with its deltas.
+    class rewind_buffer
+    {
+    public:
+        rewind_buffer(const std::size_t arena_size, const std::size_t max_frames,
+                      const unsigned keyframe_interval = DEFAULT_KEYFRAME_INTERVAL);
+
+        rewind_buffer(const rewind_buffer&)            = delete;
+        rewind_buffer& operator=(const rewind_buffer&) = delete;
+
+        // Records vm as the newest frame. Frames stepped back over are forgotten.
+        void push(const machine& vm);
+        // Puts vm back to the frame recorded before the current one. False when there is none left.
+        bool step_back(machine& vm);
+        // Puts vm back to frames_back frames before the newest. False when that frame is no longer held.
+        bool restore(machine& vm, const std::size_t frames_back);
+        void clear();
+
+        // Frames held, including the current one
+        std::size_t frame_count() const;
+        // How far the current frame is behind the newest
+        std::size_t frames_behind() const;
+        std::size_t bytes_used() const;
+
+    private:
+        struct record
+        {
+            std::size_t offset;
+            std::uint32_t size;
+            bool keyframe;
+        };
+
+        record& at(const std::uint64_t sequence);
+        // Decodes the frame with the given sequence number into current_state
+        void seek(const std::uint64_t sequence);
+        // Drops the oldest frames until size bytes fit and returns where they go
+        std::size_t make_room(const std::size_t size);
+        void drop_oldest_group();
+
+        std::unique_ptr<unsigned char[]> arena;
+        std::size_t arena_size;
+        std::size_t arena_used = 0;
+
+        // Records are addressed by a sequence number that only grows, their slot is the number modulo the capacity
+        std::vector<record> records;
+        std::uint64_t oldest  = 0;
+        std::uint64_t end     = 0;
+        std::uint64_t current = 0;
+
+        unsigned keyframe_interval;
+
+        machine_snapshot current_state;
+        machine_snapshot next_state;
+        std::unique_ptr<unsigned char[]> encoded;
+    };
+} // namespace chip8
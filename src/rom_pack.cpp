@@ -0,0 +1,344 @@
+#include "rom_pack.h"
+
+#include "chip8.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace chip8
+{
+    // Little-endian throughout:
+    //   header      magic, u32 version, u32 ROM count
+    //   entries     per ROM: SHA-1, u32 size, u32 name size, u32 name offset, u64 data offset, sorted by SHA-1
+    //   name order  u32 entry index per ROM, sorted by name
+    //   names, data
+    static constexpr char PACK_MAGIC[8]           = {'C', 'H', 'I', 'P', '8', 'P', 'A', 'K'};
+    static constexpr std::uint32_t PACK_VERSION   = 1;
+    static constexpr std::size_t PACK_HEADER_SIZE = 16;
+    static constexpr std::size_t PACK_ENTRY_SIZE  = 40;
+
+    static std::uint32_t read_u32(const unsigned char* bytes)
+    {
+        return static_cast<std::uint32_t>(bytes[0]) | static_cast<std::uint32_t>(bytes[1]) << 8 |
+               static_cast<std::uint32_t>(bytes[2]) << 16 | static_cast<std::uint32_t>(bytes[3]) << 24;
+    }
+
+    static std::uint64_t read_u64(const unsigned char* bytes)
+    {
+        return read_u32(bytes) | static_cast<std::uint64_t>(read_u32(bytes + 4)) << 32;
+    }
+
+    static void append_u32(std::vector<unsigned char>& out, const std::uint32_t value)
+    {
+        for(auto shift = 0; shift != 32; shift += 8)
+        {
+            out.push_back(static_cast<unsigned char>(value >> shift));
+        }
+    }
+
+    static void append_u64(std::vector<unsigned char>& out, const std::uint64_t value)
+    {
+        append_u32(out, static_cast<std::uint32_t>(value));
+        append_u32(out, static_cast<std::uint32_t>(value >> 32));
+    }
+
+    rom_pack::rom_pack(const char* path)
+    {
+        const auto fail = [path](const char* reason) {
+            return std::runtime_error(std::string(path) + ": " + reason);
+        };
+
+#if defined(_WIN32)
+        file_handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                                  nullptr);
+        if(file_handle == INVALID_HANDLE_VALUE)
+        {
+            file_handle = nullptr;
+            throw fail("could not open");
+        }
+
+        LARGE_INTEGER file_size;
+        if(GetFileSizeEx(file_handle, &file_size) == 0 || file_size.QuadPart < static_cast<LONGLONG>(PACK_HEADER_SIZE))
+        {
+            unmap();
+            throw fail("not a ROM pack");
+        }
+
+        mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        const auto view =
+            mapping_handle != nullptr ? MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if(view == nullptr)
+        {
+            unmap();
+            throw fail("could not map");
+        }
+        mapping      = static_cast<const unsigned char*>(view);
+        mapping_size = static_cast<std::size_t>(file_size.QuadPart);
+#else
+        const auto fd = open(path, O_RDONLY);
+        if(fd < 0)
+        {
+            throw fail("could not open");
+        }
+
+        struct stat status;
+        if(fstat(fd, &status) != 0 || status.st_size < static_cast<off_t>(PACK_HEADER_SIZE))
+        {
+            close(fd);
+            throw fail("not a ROM pack");
+        }
+
+        // The mapping stays valid after the descriptor is closed
+        const auto size = static_cast<std::size_t>(status.st_size);
+        void* view      = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(view == MAP_FAILED)
+        {
+            throw fail("could not map");
+        }
+        mapping      = static_cast<const unsigned char*>(view);
+        mapping_size = size;
+#endif
+
+        try
+        {
+            if(std::memcmp(mapping, PACK_MAGIC, sizeof(PACK_MAGIC)) != 0 || read_u32(mapping + 8) != PACK_VERSION)
+            {
+                throw fail("not a ROM pack");
+            }
+
+            const auto count = read_u32(mapping + 12);
+            if((mapping_size - PACK_HEADER_SIZE) / (PACK_ENTRY_SIZE + sizeof(std::uint32_t)) < count)
+            {
+                throw fail("truncated index");
+            }
+
+            const auto in_file = [this](const std::uint64_t offset, const std::uint64_t size) {
+                return offset <= mapping_size && size <= mapping_size - offset;
+            };
+
+            entries.reserve(count);
+            for(std::uint32_t i = 0; i != count; i++)
+            {
+                const auto entry       = mapping + PACK_HEADER_SIZE + i * PACK_ENTRY_SIZE;
+                const auto size        = read_u32(entry + 20);
+                const auto name_size   = read_u32(entry + 24);
+                const auto name_offset = read_u32(entry + 28);
+                const auto data_offset = read_u64(entry + 32);
+                if(size > MAX_XO_ROM_SIZE || in_file(name_offset, name_size) == false ||
+                   in_file(data_offset, size) == false)
+                {
+                    throw fail("entry out of range");
+                }
+
+                packed_rom rom{
+                    .name   = {reinterpret_cast<const char*>(mapping + name_offset), name_size},
+                    .digest = {},
+                    .data   = mapping + data_offset,
+                    .size   = size,
+                };
+                std::memcpy(rom.digest.data(), entry, rom.digest.size());
+                if(entries.empty() == false && rom.digest < entries.back().digest)
+                {
+                    throw fail("index not sorted by SHA-1");
+                }
+                entries.push_back(rom);
+            }
+
+            // Strictly ascending names also rule out duplicates and indices used twice
+            const auto order = mapping + PACK_HEADER_SIZE + count * PACK_ENTRY_SIZE;
+            name_order.reserve(count);
+            for(std::uint32_t i = 0; i != count; i++)
+            {
+                const auto index = read_u32(order + i * sizeof(std::uint32_t));
+                if(index >= count ||
+                   (name_order.empty() == false && entries[name_order.back()].name >= entries[index].name))
+                {
+                    throw fail("index not sorted by name");
+                }
+                name_order.push_back(index);
+            }
+        }
+        catch(...)
+        {
+            unmap();
+            throw;
+        }
+    }
+
+    rom_pack::~rom_pack()
+    {
+        unmap();
+    }
+
+    void rom_pack::unmap()
+    {
+#if defined(_WIN32)
+        if(mapping != nullptr)
+        {
+            UnmapViewOfFile(mapping);
+        }
+        if(mapping_handle != nullptr)
+        {
+            CloseHandle(mapping_handle);
+        }
+        if(file_handle != nullptr)
+        {
+            CloseHandle(file_handle);
+        }
+        mapping_handle = nullptr;
+        file_handle    = nullptr;
+#else
+        if(mapping != nullptr)
+        {
+            munmap(const_cast<unsigned char*>(mapping), mapping_size);
+        }
+#endif
+        mapping      = nullptr;
+        mapping_size = 0;
+    }
+
+    std::size_t rom_pack::size() const
+    {
+        return entries.size();
+    }
+
+    const packed_rom& rom_pack::operator[](const std::size_t index) const
+    {
+        return entries[index];
+    }
+
+    const std::vector<packed_rom>& rom_pack::roms() const
+    {
+        return entries;
+    }
+
+    const packed_rom* rom_pack::find(const std::string_view name) const
+    {
+        const auto found = std::ranges::lower_bound(name_order, name, {}, [this](const std::uint32_t index) {
+            return entries[index].name;
+        });
+        return found != name_order.end() && entries[*found].name == name ? &entries[*found] : nullptr;
+    }
+
+    const packed_rom* rom_pack::find(const sha1_digest& digest) const
+    {
+        const auto found = std::ranges::lower_bound(entries, digest, {}, &packed_rom::digest);
+        return found != entries.end() && found->digest == digest ? &*found : nullptr;
+    }
+
+    const packed_rom* rom_pack::find_by_key(const std::string_view key) const
+    {
+        if(const auto rom = find(key); rom != nullptr)
+        {
+            return rom;
+        }
+
+        sha1_digest digest;
+        return parse_sha1(key, digest) ? find(digest) : nullptr;
+    }
+
+    void write_rom_pack(const char* path, const std::vector<rom_pack_input>& roms)
+    {
+        struct pending
+        {
+            const rom_pack_input* input;
+            sha1_digest digest;
+        };
+
+        std::vector<pending> sorted;
+        for(const auto& rom : roms)
+        {
+            if(rom.name.empty())
+            {
+                throw std::invalid_argument("ROM names cannot be empty");
+            }
+            if(rom.data.size() > MAX_XO_ROM_SIZE)
+            {
+                throw std::invalid_argument(rom.name + " is larger than " + std::to_string(MAX_XO_ROM_SIZE) +
+                                            " bytes");
+            }
+            sorted.push_back({&rom, sha1(rom.data.data(), rom.data.size())});
+        }
+        std::ranges::sort(sorted, {}, &pending::digest);
+
+        std::vector<std::uint32_t> order(sorted.size());
+        for(std::uint32_t i = 0; i != order.size(); i++)
+        {
+            order[i] = i;
+        }
+        std::ranges::sort(order, {}, [&sorted](const std::uint32_t index) -> const std::string& {
+            return sorted[index].input->name;
+        });
+        for(std::size_t i = 1; i < order.size(); i++)
+        {
+            if(sorted[order[i - 1]].input->name == sorted[order[i]].input->name)
+            {
+                throw std::invalid_argument("Duplicate ROM name " + sorted[order[i]].input->name);
+            }
+        }
+
+        const auto index_size  = PACK_HEADER_SIZE + sorted.size() * (PACK_ENTRY_SIZE + sizeof(std::uint32_t));
+        std::size_t names_size = 0;
+        for(const auto& rom : sorted)
+        {
+            names_size += rom.input->name.size();
+        }
+
+        // Identical ROMs are stored once
+        std::map<sha1_digest, std::uint64_t> data_offsets;
+        std::vector<unsigned char> data;
+        std::vector<unsigned char> file;
+        file.insert(file.end(), std::begin(PACK_MAGIC), std::end(PACK_MAGIC));
+        append_u32(file, PACK_VERSION);
+        append_u32(file, static_cast<std::uint32_t>(sorted.size()));
+
+        auto name_offset = index_size;
+        for(const auto& rom : sorted)
+        {
+            auto [stored, added] = data_offsets.try_emplace(rom.digest, index_size + names_size + data.size());
+            if(added)
+            {
+                data.insert(data.end(), rom.input->data.begin(), rom.input->data.end());
+            }
+
+            file.insert(file.end(), rom.digest.begin(), rom.digest.end());
+            append_u32(file, static_cast<std::uint32_t>(rom.input->data.size()));
+            append_u32(file, static_cast<std::uint32_t>(rom.input->name.size()));
+            append_u32(file, static_cast<std::uint32_t>(name_offset));
+            append_u64(file, stored->second);
+            name_offset += rom.input->name.size();
+        }
+        for(const auto index : order)
+        {
+            append_u32(file, index);
+        }
+        for(const auto& rom : sorted)
+        {
+            file.insert(file.end(), rom.input->name.begin(), rom.input->name.end());
+        }
+        file.insert(file.end(), data.begin(), data.end());
+
+        std::unique_ptr<std::FILE, decltype(&std::fclose)> output(std::fopen(path, "wb"), &std::fclose);
+        if(output == nullptr || std::fwrite(file.data(), 1, file.size(), output.get()) != file.size() ||
+           std::fflush(output.get()) != 0)
+        {
+            throw std::runtime_error(std::string("Could not write ") + path);
+        }
+    }
+} // namespace chip8
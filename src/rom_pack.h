@@ -0,0 +1,71 @@
+#pragma once
+
+#include "sha1.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace chip8
+{
+    // One ROM inside a mapped pack. name and data point into the mapping and live as long as the pack.
+    struct packed_rom
+    {
+        std::string_view name;
+        sha1_digest digest;
+        const unsigned char* data;
+        std::size_t size;
+    };
+
+    // What write_rom_pack() stores under each name
+    struct rom_pack_input
+    {
+        std::string name;
+        std::vector<unsigned char> data;
+    };
+
+    // A library of ROMs in one file, mapped read-only once so that machines can be loaded from it without any
+    // further file I/O. The file holds a header, one entry per ROM sorted by SHA-1, the entry indices sorted by name,
+    // the names and the ROM data, where identical ROMs share their bytes. Every offset is checked when the pack is
+    // opened, so a lookup never reads outside the mapping.
+    class rom_pack
+    {
+    public:
+        // Throws std::runtime_error when the file cannot be mapped or is not a valid pack
+        explicit rom_pack(const char* path);
+        ~rom_pack();
+
+        rom_pack(const rom_pack&)            = delete;
+        rom_pack& operator=(const rom_pack&) = delete;
+
+        std::size_t size() const;
+        // In SHA-1 order
+        const packed_rom& operator[](const std::size_t index) const;
+        const std::vector<packed_rom>& roms() const;
+
+        // nullptr when the pack has no such ROM. A digest stored under several names finds any one of them.
+        const packed_rom* find(const std::string_view name) const;
+        const packed_rom* find(const sha1_digest& digest) const;
+        // key is either a name or 40 hex digits of a SHA-1
+        const packed_rom* find_by_key(const std::string_view key) const;
+
+    private:
+        void unmap();
+
+        const unsigned char* mapping = nullptr;
+        std::size_t mapping_size     = 0;
+#if defined(_WIN32)
+        void* file_handle    = nullptr;
+        void* mapping_handle = nullptr;
+#endif
+
+        std::vector<packed_rom> entries;
+        std::vector<std::uint32_t> name_order; // Entry indices sorted by name
+    };
+
+    // Writes roms as a pack. Throws std::invalid_argument for a duplicate name or a ROM larger than MAX_XO_ROM_SIZE
+    // and std::runtime_error when the file cannot be written.
+    void write_rom_pack(const char* path, const std::vector<rom_pack_input>& roms);
+} // namespace chip8
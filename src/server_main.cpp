@@ -0,0 +1,99 @@
+#include "session_server.h"
+
+#include <charconv>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <string_view>
+
+// Usage: chip8-server [--socket PATH] [--threads N] [--batch N] [--max-sessions N] [--backlog BYTES]
+// Serves a machine per client of the Unix domain socket PATH, chip8.sock by default, until SIGINT or SIGTERM, then
+// prints what it served. See session_protocol.h for the messages and chip8-load for a client. --threads sizes the
+// pool the sessions run on, --batch is how many sessions one pool task runs a frame of and --backlog how many unsent
+// bytes a client may fall behind by before its frames are skipped.
+
+static bool parse_number(const char* text, auto& out)
+{
+    const auto end = text + std::strlen(text);
+    return std::from_chars(text, end, out).ptr == end;
+}
+
+static chip8::session_server* running_server = nullptr;
+
+static void stop_server(int)
+{
+    running_server->stop();
+}
+
+int main(int argc, char* argv[])
+{
+    chip8::server_options options;
+    options.socket_path = "chip8.sock";
+
+    for(int i = 1; i < argc; i++)
+    {
+        const std::string_view arg = argv[i];
+
+        const bool has_value = i + 1 < argc;
+        if(arg == "--socket" && has_value)
+        {
+            options.socket_path = argv[++i];
+        }
+        else if(arg == "--threads" && has_value && parse_number(argv[i + 1], options.threads))
+        {
+            i++;
+        }
+        else if(arg == "--batch" && has_value && parse_number(argv[i + 1], options.batch_size) &&
+                options.batch_size != 0)
+        {
+            i++;
+        }
+        else if(arg == "--max-sessions" && has_value && parse_number(argv[i + 1], options.max_sessions))
+        {
+            i++;
+        }
+        else if(arg == "--backlog" && has_value && parse_number(argv[i + 1], options.max_backlog))
+        {
+            i++;
+        }
+        else
+        {
+            std::fprintf(stderr, "Unknown or incomplete option %s\n", argv[i]);
+            std::fprintf(stderr,
+                         "Usage: %s [--socket PATH] [--threads N] [--batch N] [--max-sessions N] [--backlog BYTES]\n",
+                         argv[0]);
+            return 1;
+        }
+    }
+
+    try
+    {
+        chip8::session_server server(options);
+        running_server = &server;
+        std::signal(SIGINT, stop_server);
+        std::signal(SIGTERM, stop_server);
+
+        std::printf("listening on %s\n", options.socket_path.c_str());
+        std::fflush(stdout);
+        server.run();
+
+        std::signal(SIGINT, SIG_DFL);
+        std::signal(SIGTERM, SIG_DFL);
+        running_server = nullptr;
+
+        const auto stats = server.stats();
+        std::printf("accepted:       %llu\n", static_cast<unsigned long long>(stats.accepted));
+        std::printf("still open:     %llu\n", static_cast<unsigned long long>(stats.sessions));
+        std::printf("frames sent:    %llu\n", static_cast<unsigned long long>(stats.frames_sent));
+        std::printf("frames skipped: %llu\n", static_cast<unsigned long long>(stats.frames_skipped));
+        std::printf("late ticks:     %llu\n", static_cast<unsigned long long>(stats.late_ticks));
+        std::printf("faults:         %llu\n", static_cast<unsigned long long>(stats.faults));
+    }
+    catch(const std::exception& e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
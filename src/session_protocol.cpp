@@ -0,0 +1,161 @@
+#include "session_protocol.h"
+
+#include "xor_delta.h"
+
+#include <stdexcept>
+#include <string>
+
+namespace chip8
+{
+    static const recorded_frame blank_frame = {};
+
+    static void append_u32(std::vector<unsigned char>& out, const std::uint32_t value)
+    {
+        for(auto shift = 0; shift != 32; shift += 8)
+        {
+            out.push_back(static_cast<unsigned char>(value >> shift));
+        }
+    }
+
+    static void append_u64(std::vector<unsigned char>& out, const std::uint64_t value)
+    {
+        append_u32(out, static_cast<std::uint32_t>(value));
+        append_u32(out, static_cast<std::uint32_t>(value >> 32));
+    }
+
+    static void put_u32(unsigned char* out, const std::uint32_t value)
+    {
+        for(auto i = 0; i != 4; i++)
+        {
+            out[i] = static_cast<unsigned char>(value >> (8 * i));
+        }
+    }
+
+    static std::uint32_t read_u32(const unsigned char* bytes)
+    {
+        return static_cast<std::uint32_t>(bytes[0]) | static_cast<std::uint32_t>(bytes[1]) << 8 |
+               static_cast<std::uint32_t>(bytes[2]) << 16 | static_cast<std::uint32_t>(bytes[3]) << 24;
+    }
+
+    static std::uint64_t read_u64(const unsigned char* bytes)
+    {
+        return read_u32(bytes) | static_cast<std::uint64_t>(read_u32(bytes + 4)) << 32;
+    }
+
+    // Appends the header of a message whose payload is appended next and returns where it starts
+    static std::size_t begin_message(std::vector<unsigned char>& out, const message_type type)
+    {
+        const auto start = out.size();
+        append_u32(out, 0);
+        out.push_back(static_cast<unsigned char>(type));
+        return start;
+    }
+
+    static void end_message(std::vector<unsigned char>& out, const std::size_t start)
+    {
+        put_u32(&out[start], static_cast<std::uint32_t>(out.size() - start - 4));
+    }
+
+    void append_open_message(std::vector<unsigned char>& out, const open_request& request)
+    {
+        const auto start = begin_message(out, message_type::open);
+        out.push_back(static_cast<unsigned char>(request.quirks));
+        append_u32(out, request.cycles_per_frame);
+        append_u64(out, request.seed);
+        out.insert(out.end(), request.rom, request.rom + request.rom_size);
+        end_message(out, start);
+    }
+
+    void append_key_message(std::vector<unsigned char>& out, const int key, const bool down)
+    {
+        const auto start = begin_message(out, message_type::key);
+        out.push_back(static_cast<unsigned char>(key));
+        out.push_back(down ? 1 : 0);
+        end_message(out, start);
+    }
+
+    void append_frame_message(std::vector<unsigned char>& out, const frame_header& header, const recorded_frame& now,
+                              const recorded_frame& before)
+    {
+        const auto start = begin_message(out, message_type::frame);
+        append_u64(out, header.number);
+        append_u64(out, header.due);
+        out.push_back(header.keyframe ? FRAME_KEYFRAME : 0);
+
+        const auto delta = out.size();
+        out.resize(delta + max_xor_delta_size(RECORDED_FRAME_SIZE));
+        const auto size = encode_xor_delta(now.bytes, header.keyframe ? blank_frame.bytes : before.bytes,
+                                           RECORDED_FRAME_SIZE, &out[delta]);
+        out.resize(delta + size);
+        end_message(out, start);
+    }
+
+    void append_error_message(std::vector<unsigned char>& out, const std::string_view reason)
+    {
+        const auto start = begin_message(out, message_type::error);
+        out.insert(out.end(), reason.begin(), reason.end());
+        end_message(out, start);
+    }
+
+    std::size_t peek_message(const unsigned char* data, const std::size_t size, message& out)
+    {
+        if(size < 4)
+        {
+            return 0;
+        }
+
+        const auto length = read_u32(data);
+        if(length == 0 || length > MAX_MESSAGE_SIZE - 4)
+        {
+            throw std::runtime_error("Message of " + std::to_string(length) + " bytes");
+        }
+        if(size - 4 < length)
+        {
+            return 0;
+        }
+
+        out = {static_cast<message_type>(data[4]), data + MESSAGE_HEADER_SIZE, length - 1};
+        return 4 + length;
+    }
+
+    bool parse_open(const message& in, open_request& out)
+    {
+        if(in.type != message_type::open || in.size < OPEN_HEADER_SIZE ||
+           in.payload[0] > static_cast<unsigned char>(quirk_profile::xochip))
+        {
+            return false;
+        }
+
+        out.quirks           = static_cast<quirk_profile>(in.payload[0]);
+        out.cycles_per_frame = read_u32(&in.payload[1]);
+        out.seed             = read_u64(&in.payload[5]);
+        out.rom              = in.payload + OPEN_HEADER_SIZE;
+        out.rom_size         = in.size - OPEN_HEADER_SIZE;
+        return true;
+    }
+
+    bool parse_key(const message& in, int& key, bool& down)
+    {
+        if(in.type != message_type::key || in.size != 2 || in.payload[0] >= KEY_COUNT || in.payload[1] > 1)
+        {
+            return false;
+        }
+
+        key  = in.payload[0];
+        down = in.payload[1] != 0;
+        return true;
+    }
+
+    bool parse_frame(const message& in, frame_header& header, const unsigned char*& delta, std::size_t& delta_size)
+    {
+        if(in.type != message_type::frame || in.size < FRAME_HEADER_SIZE)
+        {
+            return false;
+        }
+
+        header     = {read_u64(&in.payload[0]), read_u64(&in.payload[8]), (in.payload[16] & FRAME_KEYFRAME) != 0};
+        delta      = in.payload + FRAME_HEADER_SIZE;
+        delta_size = in.size - FRAME_HEADER_SIZE;
+        return true;
+    }
+} // namespace chip8
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "chip8.h"
+#include "recording.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace chip8
+{
+    // What chip8-server and its clients send each other over a stream socket, little-endian throughout. Every
+    // message is a u32 size of what follows it, a u8 type and the payload:
+    //   open   client  u8 quirk profile, u32 cycles per frame or 0 for the default, u64 seed, the ROM
+    //   key    client  u8 keypad index, u8 1 for pressed or 0 for released
+    //   frame  server  u64 frame number, u64 steady clock nanoseconds the frame was due at, u8 flags, then the XOR
+    //                  delta (see xor_delta.h) of the recorded_frame against the one sent before or, with the
+    //                  keyframe flag, against a blank frame
+    //   error  server  the reason, after which the server closes the connection
+    // A connection starts with one open and then sends keys. The server sends a frame per frame the session runs,
+    // and skips frames while the client is too far behind reading, to send a keyframe once it has caught up.
+    enum class message_type : unsigned char
+    {
+        open  = 1,
+        key   = 2,
+        frame = 3,
+        error = 4
+    };
+
+    static constexpr std::size_t MESSAGE_HEADER_SIZE = 5;
+    static constexpr std::size_t OPEN_HEADER_SIZE    = 13;
+    static constexpr std::size_t FRAME_HEADER_SIZE   = 17;
+    static constexpr std::size_t MAX_MESSAGE_SIZE    = MESSAGE_HEADER_SIZE + OPEN_HEADER_SIZE + MAX_XO_ROM_SIZE;
+
+    static constexpr unsigned char FRAME_KEYFRAME = 1;
+
+    struct open_request
+    {
+        quirk_profile quirks      = DEFAULT_QUIRKS;
+        unsigned cycles_per_frame = 0;
+        std::uint64_t seed        = 0;
+        const unsigned char* rom  = nullptr;
+        std::size_t rom_size      = 0;
+    };
+
+    struct frame_header
+    {
+        std::uint64_t number;
+        std::uint64_t due;
+        bool keyframe;
+    };
+
+    // A message whole at the front of a receive buffer. payload points into the buffer.
+    struct message
+    {
+        message_type type;
+        const unsigned char* payload;
+        std::size_t size;
+    };
+
+    void append_open_message(std::vector<unsigned char>& out, const open_request& request);
+    void append_key_message(std::vector<unsigned char>& out, const int key, const bool down);
+    // Encodes now against before straight into out, or against a blank frame for a keyframe
+    void append_frame_message(std::vector<unsigned char>& out, const frame_header& header, const recorded_frame& now,
+                              const recorded_frame& before);
+    void append_error_message(std::vector<unsigned char>& out, const std::string_view reason);
+
+    // Returns how many bytes of data the message at its front takes, or 0 when data does not hold all of it yet.
+    // Throws std::runtime_error for a size no message has.
+    std::size_t peek_message(const unsigned char* data, const std::size_t size, message& out);
+
+    // Each returns false for a payload that does not fit its type
+    bool parse_open(const message& in, open_request& out);
+    bool parse_key(const message& in, int& key, bool& down);
+    // delta points into the message, for apply_xor_delta()
+    bool parse_frame(const message& in, frame_header& header, const unsigned char*& delta, std::size_t& delta_size);
+} // namespace chip8
@@ -0,0 +1,440 @@
+#include "session_server.h"
+
+#include "session_protocol.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace chip8
+{
+    static constexpr int MAX_EPOLL_EVENTS          = 256;
+    static constexpr std::size_t READ_SIZE         = 64 * 1024;
+    static constexpr unsigned MAX_CYCLES_PER_FRAME = 1'000'000; // Keeps one session from stalling every other
+
+    static std::runtime_error system_error(const char* what)
+    {
+        return std::runtime_error(std::string(what) + ": " + std::strerror(errno));
+    }
+
+    static std::uint64_t steady_nanoseconds(const std::chrono::steady_clock::time_point time)
+    {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count());
+    }
+
+    static void watch(const int epoll_fd, const int operation, const int fd, const std::uint32_t events)
+    {
+        epoll_event event = {};
+        event.events      = events;
+        event.data.fd     = fd;
+        if(epoll_ctl(epoll_fd, operation, fd, &event) != 0)
+        {
+            throw system_error("Could not watch a descriptor");
+        }
+    }
+
+    session_server::session_server(const server_options& options) : options(options), pool(options.threads)
+    {
+        if(options.batch_size == 0 || options.frames_per_second <= 1)
+        {
+            throw std::invalid_argument("A server needs a batch size and more than one frame per second");
+        }
+
+        sockaddr_un address = {};
+        address.sun_family  = AF_UNIX;
+        if(options.socket_path.empty() || options.socket_path.size() >= sizeof(address.sun_path))
+        {
+            throw std::runtime_error("Socket path " + options.socket_path + " is empty or too long");
+        }
+        options.socket_path.copy(address.sun_path, options.socket_path.size());
+
+        try
+        {
+            listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if(listen_fd < 0)
+            {
+                throw system_error("Could not create a socket");
+            }
+            unlink(address.sun_path);
+            if(bind(listen_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+               listen(listen_fd, SOMAXCONN) != 0)
+            {
+                throw system_error(("Could not listen on " + options.socket_path).c_str());
+            }
+
+            epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+            timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+            wake_fd  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if(epoll_fd < 0 || timer_fd < 0 || wake_fd < 0)
+            {
+                throw system_error("Could not set up the event loop");
+            }
+            watch(epoll_fd, EPOLL_CTL_ADD, listen_fd, EPOLLIN);
+            watch(epoll_fd, EPOLL_CTL_ADD, timer_fd, EPOLLIN);
+            watch(epoll_fd, EPOLL_CTL_ADD, wake_fd, EPOLLIN);
+        }
+        catch(...)
+        {
+            close_descriptors();
+            throw;
+        }
+    }
+
+    session_server::~session_server()
+    {
+        for(const auto& [fd, s] : sessions)
+        {
+            close(fd);
+        }
+        close_descriptors();
+    }
+
+    void session_server::close_descriptors()
+    {
+        for(const auto fd : {listen_fd, epoll_fd, timer_fd, wake_fd})
+        {
+            if(fd >= 0)
+            {
+                close(fd);
+            }
+        }
+        if(listen_fd >= 0)
+        {
+            unlink(options.socket_path.c_str());
+        }
+    }
+
+    void session_server::run()
+    {
+        const auto interval = std::chrono::nanoseconds(static_cast<long long>(1e9 / options.frames_per_second));
+
+        // The first tick is one interval in, and every tick is due a whole number of intervals after started, so
+        // ticks the loop runs late do not shift the ones after them
+        itimerspec timer  = {};
+        timer.it_interval = {0, static_cast<long>(interval.count())};
+        timer.it_value    = timer.it_interval;
+        started           = std::chrono::steady_clock::now();
+        if(timerfd_settime(timer_fd, 0, &timer, nullptr) != 0)
+        {
+            throw system_error("Could not start the frame timer");
+        }
+
+        epoll_event events[MAX_EPOLL_EVENTS];
+        while(stopping.load() == false)
+        {
+            const auto count = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+            if(count < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+                throw system_error("Could not wait for events");
+            }
+
+            for(auto i = 0; i != count; i++)
+            {
+                const auto fd = events[i].data.fd;
+                if(fd == listen_fd)
+                {
+                    accept_clients();
+                }
+                else if(fd == timer_fd)
+                {
+                    std::uint64_t expirations = 0;
+                    if(read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations) && expirations != 0)
+                    {
+                        totals.late_ticks += expirations - 1;
+                        ticks += expirations;
+                        tick(steady_nanoseconds(started + interval * ticks));
+                    }
+                }
+                else if(fd != wake_fd)
+                {
+                    // A session closed by an earlier event of this batch is gone from sessions
+                    const auto found = sessions.find(fd);
+                    if(found == sessions.end())
+                    {
+                        continue;
+                    }
+                    auto& s = *found->second;
+                    if((events[i].events & EPOLLOUT) != 0 && flush(s) == false)
+                    {
+                        close_session(fd);
+                        continue;
+                    }
+                    if((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0)
+                    {
+                        read_client(s);
+                    }
+                }
+            }
+        }
+
+        timer = {};
+        timerfd_settime(timer_fd, 0, &timer, nullptr);
+    }
+
+    void session_server::stop()
+    {
+        stopping.store(true);
+        const std::uint64_t one             = 1;
+        [[maybe_unused]] const auto written = write(wake_fd, &one, sizeof(one));
+    }
+
+    server_stats session_server::stats() const
+    {
+        auto result     = totals;
+        result.sessions = sessions.size();
+        return result;
+    }
+
+    void session_server::accept_clients()
+    {
+        for(;;)
+        {
+            const auto fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if(fd < 0)
+            {
+                // EAGAIN once the queue is empty. Anything else is the one client's problem.
+                return;
+            }
+            totals.accepted++;
+
+            auto s = std::make_unique<session>();
+            s->fd  = fd;
+            sessions.emplace(fd, std::move(s));
+            watch(epoll_fd, EPOLL_CTL_ADD, fd, EPOLLIN);
+
+            if(sessions.size() > options.max_sessions)
+            {
+                close_with_error(*sessions[fd], "The server is full");
+            }
+        }
+    }
+
+    void session_server::read_client(session& s)
+    {
+        unsigned char buffer[READ_SIZE];
+        for(;;)
+        {
+            const auto size = read(s.fd, buffer, sizeof(buffer));
+            if(size > 0)
+            {
+                s.input.insert(s.input.end(), buffer, buffer + size);
+                if(handle_messages(s) == false)
+                {
+                    return;
+                }
+            }
+            else if(size < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            else if(size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                return;
+            }
+            else
+            {
+                close_session(s.fd);
+                return;
+            }
+        }
+    }
+
+    bool session_server::handle_messages(session& s)
+    {
+        std::size_t consumed = 0;
+        try
+        {
+            message m;
+            while(const auto size = peek_message(s.input.data() + consumed, s.input.size() - consumed, m))
+            {
+                consumed += size;
+                if(s.vm == nullptr)
+                {
+                    open_request request;
+                    if(parse_open(m, request) == false)
+                    {
+                        close_with_error(s, "Expected an open message");
+                        return false;
+                    }
+                    if(request.cycles_per_frame > MAX_CYCLES_PER_FRAME)
+                    {
+                        close_with_error(s, "Too many cycles per frame");
+                        return false;
+                    }
+
+                    auto vm = std::make_unique<machine>();
+                    vm->set_quirks(request.quirks);
+                    if(request.cycles_per_frame != 0)
+                    {
+                        vm->set_cycles_per_frame(request.cycles_per_frame);
+                    }
+                    vm->seed(request.seed);
+                    vm->load(request.rom, request.rom_size);
+                    s.vm = std::move(vm);
+                    continue;
+                }
+
+                // The pool is idle whenever the loop handles input, so keys go straight to the machine
+                int key   = 0;
+                bool down = false;
+                if(parse_key(m, key, down) == false)
+                {
+                    close_with_error(s, "Expected a key message");
+                    return false;
+                }
+                down ? s.vm->on_key_down(key) : s.vm->on_key_up(key);
+            }
+        }
+        catch(const std::exception& e)
+        {
+            close_with_error(s, e.what());
+            return false;
+        }
+
+        s.input.erase(s.input.begin(), s.input.begin() + static_cast<std::ptrdiff_t>(consumed));
+        return true;
+    }
+
+    void session_server::tick(const std::uint64_t due)
+    {
+        active.clear();
+        for(const auto& [fd, s] : sessions)
+        {
+            if(s->vm != nullptr)
+            {
+                active.push_back(s.get());
+            }
+        }
+
+        for(std::size_t first = 0; first < active.size(); first += options.batch_size)
+        {
+            const auto last = std::min(first + options.batch_size, active.size());
+            pool.submit([this, first, last, due]() {
+                for(auto i = first; i != last; i++)
+                {
+                    step(*active[i], due);
+                }
+            });
+        }
+        pool.wait_idle();
+
+        for(const auto s : active)
+        {
+            totals.frames_sent += s->sent;
+            totals.frames_skipped += s->skipped;
+            s->sent    = 0;
+            s->skipped = 0;
+
+            if(s->fault.empty() == false)
+            {
+                totals.faults++;
+                close_with_error(*s, s->fault);
+            }
+            else if(flush(*s) == false)
+            {
+                close_session(s->fd);
+            }
+        }
+    }
+
+    void session_server::step(session& s, const std::uint64_t due) const
+    {
+        try
+        {
+            s.vm->run_frame();
+        }
+        catch(const std::exception& e)
+        {
+            s.fault = e.what();
+            return;
+        }
+
+        // A client this far behind would only fall further behind, so it gets a keyframe once it has caught up
+        if(s.output.size() - s.output_sent > options.max_backlog)
+        {
+            s.needs_keyframe = true;
+            s.skipped++;
+            return;
+        }
+
+        capture_frame(*s.vm, s.next);
+        append_frame_message(s.output, {s.vm->frame_count(), due, s.needs_keyframe}, s.next, s.shown);
+        s.shown          = s.next;
+        s.needs_keyframe = false;
+        s.sent++;
+    }
+
+    bool session_server::flush(session& s)
+    {
+        while(s.output_sent != s.output.size())
+        {
+            const auto size =
+                send(s.fd, s.output.data() + s.output_sent, s.output.size() - s.output_sent, MSG_NOSIGNAL);
+            if(size > 0)
+            {
+                s.output_sent += static_cast<std::size_t>(size);
+            }
+            else if(size < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            else if(size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                // Keeps the unsent bytes at the front once they are the larger part
+                if(s.output_sent > s.output.size() / 2)
+                {
+                    s.output.erase(s.output.begin(), s.output.begin() + static_cast<std::ptrdiff_t>(s.output_sent));
+                    s.output_sent = 0;
+                }
+                watch_writable(s, true);
+                return true;
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        s.output.clear();
+        s.output_sent = 0;
+        watch_writable(s, false);
+        return true;
+    }
+
+    void session_server::close_with_error(session& s, const std::string& reason)
+    {
+        append_error_message(s.output, reason);
+        flush(s);
+        close_session(s.fd);
+    }
+
+    void session_server::close_session(const int fd)
+    {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        sessions.erase(fd);
+    }
+
+    void session_server::watch_writable(session& s, const bool enabled)
+    {
+        if(s.waiting_for_writable != enabled)
+        {
+            watch(epoll_fd, EPOLL_CTL_MOD, s.fd, enabled ? EPOLLIN | EPOLLOUT : EPOLLIN);
+            s.waiting_for_writable = enabled;
+        }
+    }
+} // namespace chip8
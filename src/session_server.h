@@ -0,0 +1,110 @@
+#pragma once
+
+#include "chip8.h"
+#include "recording.h"
+#include "work_stealing_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace chip8
+{
+    struct server_options
+    {
+        std::string socket_path;
+        unsigned threads         = 0;         // 0 uses every core
+        unsigned batch_size      = 32;        // Sessions stepped by one pool task
+        unsigned max_sessions    = 1024;      // Clients past this many are turned away
+        std::size_t max_backlog  = 64 * 1024; // Unsent bytes past which a session's frames are skipped
+        double frames_per_second = FRAMES_PER_SECOND;
+    };
+
+    struct server_stats
+    {
+        std::uint64_t sessions       = 0; // Open right now
+        std::uint64_t accepted       = 0;
+        std::uint64_t frames_sent    = 0;
+        std::uint64_t frames_skipped = 0; // For clients too far behind
+        std::uint64_t late_ticks     = 0; // Frame ticks the loop missed, run late together with the next one
+        std::uint64_t faults         = 0; // Sessions closed by an instruction the machine could not run
+    };
+
+    // Hosts a machine per client of a Unix domain socket. One thread runs an epoll loop over the listening socket,
+    // every connection and a 60 Hz timer. On every tick the open sessions run a frame each, in batches of
+    // batch_size on a work stealing pool, and each one's frame is delta-encoded into the session's output right
+    // away. The loop then writes what the sockets take and keeps the rest for when they can take more. Nothing else
+    // runs while the pool does, so only the loop thread ever touches the sockets and only one thread at a time a
+    // session. See session_protocol.h for the messages.
+    class session_server
+    {
+    public:
+        // Throws std::runtime_error when the socket cannot be set up. A file left at the socket path by an earlier
+        // server is replaced.
+        explicit session_server(const server_options& options);
+        ~session_server();
+
+        session_server(const session_server&)            = delete;
+        session_server& operator=(const session_server&) = delete;
+
+        // Serves until stop()
+        void run();
+        // Safe to call from another thread or a signal handler
+        void stop();
+
+        // Only consistent when called from the loop's thread or after run() returned
+        server_stats stats() const;
+
+    private:
+        struct session
+        {
+            int fd = -1;
+            std::unique_ptr<machine> vm; // Null until the client sent open
+            std::vector<unsigned char> input;
+            std::vector<unsigned char> output;
+            std::size_t output_sent   = 0;
+            bool waiting_for_writable = false; // Output left over, watching for EPOLLOUT
+            bool needs_keyframe       = true;
+            recorded_frame shown      = {}; // What the client was last sent
+            recorded_frame next       = {};
+            std::string fault; // Set by a frame that could not run
+            // Counted into the totals after every tick
+            std::uint64_t sent    = 0;
+            std::uint64_t skipped = 0;
+        };
+
+        void accept_clients();
+        void read_client(session& s);
+        // Handles every whole message in the session's input. False when the session has to be closed.
+        bool handle_messages(session& s);
+        void tick(const std::uint64_t due);
+        void step(session& s, const std::uint64_t due) const;
+        // Writes what the socket takes. False when the connection is gone.
+        bool flush(session& s);
+        // Sends reason as an error, as far as the socket takes it, and closes
+        void close_with_error(session& s, const std::string& reason);
+        void close_session(const int fd);
+        void watch_writable(session& s, const bool enabled);
+        void close_descriptors();
+
+        server_options options;
+        int listen_fd = -1;
+        int epoll_fd  = -1;
+        int timer_fd  = -1;
+        int wake_fd   = -1;
+
+        std::unordered_map<int, std::unique_ptr<session>> sessions;
+        std::vector<session*> active;
+        work_stealing_pool pool;
+
+        std::chrono::steady_clock::time_point started;
+        std::uint64_t ticks = 0;
+        server_stats totals;
+        std::atomic<bool> stopping = false;
+    };
+} // namespace chip8
@@ -0,0 +1,132 @@
+#include "sha1.h"
+
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+
+namespace chip8
+{
+    static void sha1_block(std::uint32_t (&hash)[5], const unsigned char* block)
+    {
+        std::uint32_t w[80];
+        for(auto i = 0; i != 16; i++)
+        {
+            w[i] = static_cast<std::uint32_t>(block[i * 4]) << 24 | static_cast<std::uint32_t>(block[i * 4 + 1]) << 16 |
+                   static_cast<std::uint32_t>(block[i * 4 + 2]) << 8 | block[i * 4 + 3];
+        }
+        for(auto i = 16; i != 80; i++)
+        {
+            w[i] = std::rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+
+        auto a = hash[0];
+        auto b = hash[1];
+        auto c = hash[2];
+        auto d = hash[3];
+        auto e = hash[4];
+        for(auto i = 0; i != 80; i++)
+        {
+            std::uint32_t f;
+            std::uint32_t k;
+            if(i < 20)
+            {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            }
+            else if(i < 40)
+            {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            }
+            else if(i < 60)
+            {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            }
+            else
+            {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+
+            const auto next = std::rotl(a, 5) + f + e + k + w[i];
+            e               = d;
+            d               = c;
+            c               = std::rotl(b, 30);
+            b               = a;
+            a               = next;
+        }
+
+        hash[0] += a;
+        hash[1] += b;
+        hash[2] += c;
+        hash[3] += d;
+        hash[4] += e;
+    }
+
+    sha1_digest sha1(const unsigned char* data, const std::size_t size)
+    {
+        std::uint32_t hash[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+        std::size_t offset = 0;
+        for(; size - offset >= 64; offset += 64)
+        {
+            sha1_block(hash, data + offset);
+        }
+
+        // The tail, a one bit, zeros and the length in bits fill one or two more blocks
+        unsigned char tail[128] = {};
+        const auto remaining    = size - offset;
+        std::memcpy(tail, data + offset, remaining);
+        tail[remaining] = 0x80;
+
+        const auto tail_size = remaining < 56 ? 64 : 128;
+        const auto bits      = static_cast<std::uint64_t>(size) * 8;
+        for(auto i = 0; i != 8; i++)
+        {
+            tail[tail_size - 1 - i] = static_cast<unsigned char>(bits >> (i * 8));
+        }
+        for(auto block = 0; block != tail_size; block += 64)
+        {
+            sha1_block(hash, tail + block);
+        }
+
+        sha1_digest digest;
+        for(auto i = 0; i != 20; i++)
+        {
+            digest[i] = static_cast<unsigned char>(hash[i / 4] >> (24 - i % 4 * 8));
+        }
+        return digest;
+    }
+
+    std::string to_hex(const sha1_digest& digest)
+    {
+        static constexpr char DIGITS[] = "0123456789abcdef";
+
+        std::string text;
+        for(const auto byte : digest)
+        {
+            text.push_back(DIGITS[byte >> 4]);
+            text.push_back(DIGITS[byte & 0xF]);
+        }
+        return text;
+    }
+
+    bool parse_sha1(const std::string_view text, sha1_digest& out)
+    {
+        if(text.size() != out.size() * 2)
+        {
+            return false;
+        }
+        for(std::size_t i = 0; i != out.size(); i++)
+        {
+            const auto digits = text.data() + i * 2;
+            if(std::from_chars(digits, digits + 2, out[i], 16).ptr != digits + 2)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+} // namespace chip8
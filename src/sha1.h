@@ -0,0 +1,18 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace chip8
+{
+    using sha1_digest = std::array<unsigned char, 20>;
+
+    sha1_digest sha1(const unsigned char* data, const std::size_t size);
+
+    // Lowercase hex, 40 characters
+    std::string to_hex(const sha1_digest& digest);
+    // Accepts either case. Returns false unless text is exactly 40 hex digits.
+    bool parse_sha1(const std::string_view text, sha1_digest& out);
+} // namespace chip8
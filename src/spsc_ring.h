@@ -0,0 +1,84 @@
+#pragma once
+
+#include "chip8.h"
+
+#include <atomic>
+#include <cstddef>
+
+namespace chip8
+{
+    // Bounded single-producer/single-consumer ring. Neither side ever blocks or allocates: a push into a full
+    // ring and a pop from an empty ring simply fail.
+    template<typename T, std::size_t Capacity>
+    class spsc_ring
+    {
+        static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+    public:
+        bool try_push(const T& item)
+        {
+            const auto tail = write_index.load(std::memory_order_relaxed);
+            if(tail - cached_read_index == Capacity)
+            {
+                cached_read_index = read_index.load(std::memory_order_acquire);
+                if(tail - cached_read_index == Capacity)
+                {
+                    return false;
+                }
+            }
+
+            items[tail & (Capacity - 1)] = item;
+            write_index.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool try_pop(T& item)
+        {
+            return pop_bulk(&item, 1) == 1;
+        }
+
+        // Pops up to max_count items into out and returns how many were popped
+        std::size_t pop_bulk(T* out, const std::size_t max_count)
+        {
+            const auto head = read_index.load(std::memory_order_relaxed);
+            if(cached_write_index == head)
+            {
+                cached_write_index = write_index.load(std::memory_order_acquire);
+            }
+
+            std::size_t count = cached_write_index - head;
+            if(count > max_count)
+            {
+                count = max_count;
+            }
+
+            for(std::size_t i = 0; i != count; i++)
+            {
+                out[i] = items[(head + i) & (Capacity - 1)];
+            }
+
+            read_index.store(head + count, std::memory_order_release);
+            return count;
+        }
+
+        bool empty() const
+        {
+            return read_index.load(std::memory_order_acquire) == write_index.load(std::memory_order_acquire);
+        }
+
+        static constexpr std::size_t capacity()
+        {
+            return Capacity;
+        }
+
+    private:
+        // Producer and consumer indices live on separate cache lines so the two sides never false-share
+        alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> write_index = 0;
+        std::size_t cached_read_index                                 = 0;
+
+        alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> read_index = 0;
+        std::size_t cached_write_index                               = 0;
+
+        alignas(CACHE_LINE_SIZE) T items[Capacity];
+    };
+} // namespace chip8
@@ -0,0 +1,135 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace chip8
+{
+    static constexpr auto DRAIN_BATCH_SIZE = 256;
+
+    trace_drain::trace_drain(std::FILE* output, const format output_format)
+        : output(output)
+        , output_format(output_format)
+    {
+        worker = std::thread(&trace_drain::drain_loop, this);
+    }
+
+    trace_drain::~trace_drain()
+    {
+        stopping.store(true, std::memory_order_release);
+        worker.join();
+
+        std::lock_guard lock(sources_mutex);
+        for(const auto& s : sources)
+        {
+            while(drain_source(s))
+            {
+            }
+        }
+        std::fflush(output);
+    }
+
+    void trace_drain::attach(trace_ring& ring)
+    {
+        std::lock_guard lock(sources_mutex);
+        sources.push_back({&ring, next_id++});
+    }
+
+    void trace_drain::detach(trace_ring& ring)
+    {
+        std::lock_guard lock(sources_mutex);
+
+        const auto it = std::ranges::find_if(sources, [&ring](const source& s) {
+            return s.ring == &ring;
+        });
+        if(it == sources.end())
+        {
+            return;
+        }
+
+        while(drain_source(*it))
+        {
+        }
+
+        if(const auto dropped = ring.dropped.load(std::memory_order_relaxed); dropped != 0)
+        {
+            std::fprintf(output, "[%u] %llu trace records dropped\n", it->id, static_cast<unsigned long long>(dropped));
+        }
+        std::fflush(output);
+
+        sources.erase(it);
+    }
+
+    void trace_drain::drain_loop()
+    {
+        while(stopping.load(std::memory_order_acquire) == false)
+        {
+            bool drained_any = false;
+            {
+                std::lock_guard lock(sources_mutex);
+                for(const auto& s : sources)
+                {
+                    drained_any |= drain_source(s);
+                }
+            }
+
+            if(drained_any == false)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+
+    bool trace_drain::drain_source(const source& s)
+    {
+        trace_record records[DRAIN_BATCH_SIZE];
+
+        const auto count = s.ring->pop_bulk(records, DRAIN_BATCH_SIZE);
+        if(count != 0)
+        {
+            write(s, records, count);
+        }
+        return count != 0;
+    }
+
+    void trace_drain::write(const source& s, const trace_record* records, const std::size_t count)
+    {
+        if(output_format == format::binary)
+        {
+            std::fwrite(records, sizeof(trace_record), count, output);
+            return;
+        }
+
+        for(std::size_t i = 0; i != count; i++)
+        {
+            const auto& r = records[i];
+            const auto n  = static_cast<unsigned long long>(r.instruction);
+
+            switch(r.event)
+            {
+                case trace_event::instruction:
+                    std::fprintf(output, "[%u] %llu pc: %03x opcode: %04x\n", s.id, n, r.pc, r.opcode);
+                    break;
+                case trace_event::register_read:
+                    std::fprintf(output, "[%u] %llu   register %x value %02x\n", s.id, n, r.a, r.b);
+                    break;
+                case trace_event::state:
+                    std::fprintf(output, "[%u] %llu   pc: %03x I: %03x flag_register: %02x\n", s.id, n, r.pc, r.b,
+                                 r.a);
+                    break;
+                case trace_event::draw:
+                    std::fprintf(output, "[%u] %llu   draw x: %u y: %u h: %u\n", s.id, n, r.a, r.b >> 8, r.b & 0xFF);
+                    break;
+                case trace_event::beep:
+                    std::fprintf(output, "[%u] %llu Beep\n", s.id, n);
+                    break;
+            }
+        }
+    }
+
+    trace_drain& default_trace_drain()
+    {
+        static trace_drain instance(stdout);
+        return instance;
+    }
+} // namespace chip8
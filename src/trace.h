@@ -0,0 +1,106 @@
+#pragma once
+
+#include "spsc_ring.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 0 compiles every trace point away, 1 records each executed instruction, 2 also records register reads,
+// draws and the machine state after every instruction. Debug builds default to 2 (see CMakeLists.txt).
+#ifndef CHIP8_TRACE_LEVEL
+#define CHIP8_TRACE_LEVEL 0
+#endif
+
+namespace chip8
+{
+    enum class trace_level : unsigned char
+    {
+        off          = 0,
+        instructions = 1,
+        verbose      = 2
+    };
+
+    static constexpr auto TRACE_LEVEL = static_cast<trace_level>(CHIP8_TRACE_LEVEL);
+
+    enum class trace_event : unsigned char
+    {
+        instruction,   // pc, opcode
+        register_read, // a = register index, b = value
+        state,         // pc and b = I after the instruction, a = VF
+        draw,          // a = x, b = y << 8 | height
+        beep
+    };
+
+    // Fixed-size binary record, formatted to text by the drain thread rather than on the VM thread
+    struct trace_record
+    {
+        std::uint64_t instruction;
+        unsigned short pc;
+        opcode_t opcode;
+        trace_event event;
+        unsigned char a;
+        unsigned short b;
+    };
+
+    static_assert(sizeof(trace_record) == 16);
+
+    static constexpr auto TRACE_RING_CAPACITY = 4096;
+
+    // Per-machine ring. The VM never blocks on it: records that do not fit are counted and dropped.
+    class trace_ring : public spsc_ring<trace_record, TRACE_RING_CAPACITY>
+    {
+    public:
+        std::atomic<std::uint64_t> dropped = 0;
+    };
+
+    // Background thread that empties every attached trace ring into a file
+    class trace_drain
+    {
+    public:
+        enum class format
+        {
+            text,
+            binary
+        };
+
+        // Does not take ownership of output
+        explicit trace_drain(std::FILE* output, const format output_format = format::text);
+        ~trace_drain();
+
+        trace_drain(const trace_drain&)            = delete;
+        trace_drain& operator=(const trace_drain&) = delete;
+
+        void attach(trace_ring& ring);
+
+        // Drains whatever is left in the ring before forgetting about it
+        void detach(trace_ring& ring);
+
+    private:
+        struct source
+        {
+            trace_ring* ring;
+            unsigned id;
+        };
+
+        void drain_loop();
+        bool drain_source(const source& s);
+        void write(const source& s, const trace_record* records, const std::size_t count);
+
+        std::FILE* output;
+        format output_format;
+
+        std::mutex sources_mutex;
+        std::vector<source> sources;
+        unsigned next_id = 0;
+
+        std::atomic<bool> stopping = false;
+        std::thread worker;
+    };
+
+    // Process-wide drain writing text to stdout, used by the default machine in tracing builds
+    trace_drain& default_trace_drain();
+} // namespace chip8
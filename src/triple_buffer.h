@@ -0,0 +1,64 @@
+#pragma once
+
+#include "chip8.h"
+
+#include <atomic>
+
+namespace chip8
+{
+    // Hands the newest of a stream of values from one producer thread to one consumer thread. The producer fills
+    // the back buffer and publishes it by swapping it with the middle one, the consumer takes the middle one by
+    // swapping it with its front buffer. Each swap is one atomic exchange, so neither side ever waits for the other.
+    // A consumer that falls behind skips straight to the newest value.
+    template<typename T>
+    class triple_buffer
+    {
+    public:
+        // Producer side: the value to fill before publish()
+        T& back()
+        {
+            return slots[back_index].value;
+        }
+
+        // True when the value published before was never acquired and is dropped for this one
+        bool publish()
+        {
+            const auto previous = middle.exchange(back_index | FRESH, std::memory_order_acq_rel);
+            back_index          = previous & INDEX_MASK;
+            return (previous & FRESH) != 0;
+        }
+
+        // Consumer side: makes the newest published value the front one. False, leaving front() as it was, when
+        // nothing was published since the previous call.
+        bool acquire()
+        {
+            if((middle.load(std::memory_order_relaxed) & FRESH) == 0)
+            {
+                return false;
+            }
+            front_index = middle.exchange(front_index, std::memory_order_acq_rel) & INDEX_MASK;
+            return true;
+        }
+
+        const T& front() const
+        {
+            return slots[front_index].value;
+        }
+
+    private:
+        static constexpr unsigned char INDEX_MASK = 3;
+        static constexpr unsigned char FRESH      = 4; // Set in middle while it holds a value not acquired yet
+
+        // Slots are written by both threads, one at a time, and kept on lines of their own
+        struct alignas(CACHE_LINE_SIZE) slot
+        {
+            T value{};
+        };
+
+        slot slots[3];
+
+        alignas(CACHE_LINE_SIZE) unsigned char back_index          = 0;
+        alignas(CACHE_LINE_SIZE) std::atomic<unsigned char> middle = 1;
+        alignas(CACHE_LINE_SIZE) unsigned char front_index         = 2;
+    };
+} // namespace chip8
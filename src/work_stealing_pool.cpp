@@ -0,0 +1,134 @@
+#include "work_stealing_pool.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace chip8
+{
+    work_stealing_pool::work_stealing_pool(unsigned thread_count)
+    {
+        if(thread_count == 0)
+        {
+            thread_count = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        for(unsigned i = 0; i != thread_count; i++)
+        {
+            queues.push_back(std::make_unique<worker_queue>());
+        }
+
+        for(unsigned i = 0; i != thread_count; i++)
+        {
+            workers.emplace_back(&work_stealing_pool::worker_loop, this, i);
+        }
+    }
+
+    work_stealing_pool::~work_stealing_pool()
+    {
+        {
+            std::lock_guard lock(wake_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+
+        for(auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    void work_stealing_pool::submit(task t)
+    {
+        const auto index = next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+
+        pending.fetch_add(1, std::memory_order_relaxed);
+
+        // Counting under the wake lock orders the submission against a worker that is about to go to sleep
+        {
+            std::lock_guard lock(wake_mutex);
+            queued++;
+        }
+        {
+            std::lock_guard lock(queues[index]->mutex);
+            queues[index]->tasks.push_back(std::move(t));
+        }
+        wake.notify_one();
+    }
+
+    void work_stealing_pool::wait_idle()
+    {
+        std::unique_lock lock(wake_mutex);
+        idle.wait(lock, [this]() {
+            return pending.load(std::memory_order_acquire) == 0;
+        });
+    }
+
+    unsigned work_stealing_pool::thread_count() const
+    {
+        return static_cast<unsigned>(workers.size());
+    }
+
+    bool work_stealing_pool::pop_local(const std::size_t index, task& out)
+    {
+        auto& queue = *queues[index];
+
+        std::lock_guard lock(queue.mutex);
+        if(queue.tasks.empty())
+        {
+            return false;
+        }
+        out = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        queued--;
+        return true;
+    }
+
+    bool work_stealing_pool::steal(const std::size_t thief, task& out)
+    {
+        for(std::size_t i = 1; i != queues.size(); i++)
+        {
+            auto& victim = *queues[(thief + i) % queues.size()];
+
+            std::lock_guard lock(victim.mutex);
+            if(victim.tasks.empty())
+            {
+                continue;
+            }
+            out = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            queued--;
+            return true;
+        }
+        return false;
+    }
+
+    void work_stealing_pool::worker_loop(const std::size_t index)
+    {
+        task current;
+
+        while(true)
+        {
+            if(pop_local(index, current) || steal(index, current))
+            {
+                current();
+                current = nullptr;
+
+                if(pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                {
+                    std::lock_guard lock(wake_mutex);
+                    idle.notify_all();
+                }
+                continue;
+            }
+
+            std::unique_lock lock(wake_mutex);
+            wake.wait(lock, [this]() {
+                return stopping || queued.load(std::memory_order_relaxed) != 0;
+            });
+            if(stopping && queued.load(std::memory_order_relaxed) == 0)
+            {
+                return;
+            }
+        }
+    }
+} // namespace chip8
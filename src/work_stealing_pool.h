@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace chip8
+{
+    // Fixed-size thread pool where every worker owns a task deque. Workers pop their own tasks from the back
+    // and steal from the front of the other workers' deques once they run dry.
+    class work_stealing_pool
+    {
+    public:
+        using task = std::function<void()>;
+
+        // thread_count of 0 uses every hardware thread
+        explicit work_stealing_pool(unsigned thread_count = 0);
+        ~work_stealing_pool();
+
+        work_stealing_pool(const work_stealing_pool&)            = delete;
+        work_stealing_pool& operator=(const work_stealing_pool&) = delete;
+
+        void submit(task t);
+
+        // Blocks until every submitted task has finished
+        void wait_idle();
+
+        unsigned thread_count() const;
+
+    private:
+        struct worker_queue
+        {
+            std::mutex mutex;
+            std::deque<task> tasks;
+        };
+
+        void worker_loop(const std::size_t index);
+        bool pop_local(const std::size_t index, task& out);
+        bool steal(const std::size_t thief, task& out);
+
+        std::vector<std::unique_ptr<worker_queue>> queues;
+        std::vector<std::thread> workers;
+
+        std::mutex wake_mutex;
+        std::condition_variable wake;
+        std::condition_variable idle;
+
+        std::atomic<std::size_t> pending    = 0; // Submitted but not yet finished
+        std::atomic<std::size_t> queued     = 0; // Submitted but not yet picked up by a worker
+        std::atomic<std::size_t> next_queue = 0;
+        bool stopping                       = false;
+    };
+} // namespace chip8
@@ -0,0 +1,102 @@
+#include "xor_delta.h"
+
+#include <cstdint>
+#include <cstring>
+
+namespace chip8
+{
+    // Encoded deltas are a sequence of runs. A control byte below 0x80 is followed by that many plus one bytes to
+    // XOR in. From 0x80 its low bits and the next byte hold the length minus one of a run of unchanged bytes.
+    static constexpr std::size_t MAX_LITERAL_RUN   = 0x80;
+    static constexpr std::size_t MAX_UNCHANGED_RUN = 0x8000;
+    // Shorter unchanged runs are cheaper to carry along as literal bytes
+    static constexpr unsigned MIN_UNCHANGED_RUN = 3;
+
+    std::size_t encode_xor_delta(const unsigned char* now, const unsigned char* before, const std::size_t size,
+                                 unsigned char* out)
+    {
+        std::size_t written = 0;
+        std::size_t i       = 0;
+        while(i != size)
+        {
+            // Unchanged bytes are skipped a word at a time first
+            auto run = i;
+            while(size - run >= sizeof(std::uint64_t) && MAX_UNCHANGED_RUN - (run - i) >= sizeof(std::uint64_t) &&
+                  std::memcmp(&now[run], &before[run], sizeof(std::uint64_t)) == 0)
+            {
+                run += sizeof(std::uint64_t);
+            }
+            while(run != size && now[run] == before[run] && run - i != MAX_UNCHANGED_RUN)
+            {
+                run++;
+            }
+
+            // Trailing unchanged bytes need no run
+            if(run == size)
+            {
+                break;
+            }
+
+            if(run - i >= MIN_UNCHANGED_RUN)
+            {
+                const auto length = run - i - 1;
+                out[written++]    = static_cast<unsigned char>(0x80 | length >> 8);
+                out[written++]    = static_cast<unsigned char>(length & 0xFF);
+                i                 = run;
+                continue;
+            }
+
+            // Changed bytes up to the next unchanged run worth skipping
+            auto literal_end = i;
+            unsigned same    = 0;
+            while(literal_end != size && literal_end - i != MAX_LITERAL_RUN)
+            {
+                same = now[literal_end] == before[literal_end] ? same + 1 : 0;
+                literal_end++;
+                if(same == MIN_UNCHANGED_RUN)
+                {
+                    literal_end -= same;
+                    break;
+                }
+            }
+
+            out[written++] = static_cast<unsigned char>(literal_end - i - 1);
+            for(; i != literal_end; i++)
+            {
+                out[written++] = now[i] ^ before[i];
+            }
+        }
+        return written;
+    }
+
+    bool apply_xor_delta(const unsigned char* in, const std::size_t size, unsigned char* state,
+                         const std::size_t state_size)
+    {
+        std::size_t read     = 0;
+        std::size_t position = 0;
+        while(read != size)
+        {
+            const auto control = in[read++];
+            if((control & 0x80) != 0)
+            {
+                if(read == size)
+                {
+                    return false;
+                }
+                position += ((control & 0x7Fu) << 8 | in[read++]) + 1;
+                continue;
+            }
+
+            const std::size_t length = control + 1u;
+            if(size - read < length || position > state_size || state_size - position < length)
+            {
+                return false;
+            }
+            for(std::size_t i = 0; i != length; i++)
+            {
+                state[position++] ^= in[read++];
+            }
+        }
+        return true;
+    }
+} // namespace chip8
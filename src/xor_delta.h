@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+
+namespace chip8
+{
+    // Upper bound of what encode_xor_delta() writes for size bytes: literal runs cost a control byte per 128 bytes,
+    // runs of unchanged bytes never cost more than they save
+    constexpr std::size_t max_xor_delta_size(const std::size_t size)
+    {
+        return size + size / 128 + 2;
+    }
+
+    // Encodes the XOR of now against before, size bytes each, into out and returns how many bytes that took.
+    // Unchanged bytes are run-length encoded, so that they cost next to nothing, and trailing ones are left out. out
+    // has to hold max_xor_delta_size(size) bytes.
+    std::size_t encode_xor_delta(const unsigned char* now, const unsigned char* before, const std::size_t size,
+                                 unsigned char* out);
+
+    // XORs the size bytes of encoded delta in onto the state_size bytes of state, which turns before into now and
+    // now back into before. False, with state partly changed, when in is not a delta that fits state.
+    bool apply_xor_delta(const unsigned char* in, const std::size_t size, unsigned char* state,
+                         const std::size_t state_size);
+} // namespace chip8